@@ -8,6 +8,7 @@
 #ifndef CALIBRATION_ROUTINES_H
 #define CALIBRATION_ROUTINES_H
 
+#include <cmath>
 #include <map>
 #include <string>
 #include <tuple>
@@ -54,22 +55,27 @@ struct vfat3DACAndSize{
     }
 };
 
-/*! \fn std::unordered_map<std::string, uint32_t> setSingleChanMask(unsigned int ohN, int vfatN, unsigned int ch, localArgs *la)
+/*! \typedef ChanMaskBackup
+ *  \brief Original channel masks, as pairs <node of the channel MASK register, mask>
+ */
+typedef std::vector<std::pair<RegNode, uint32_t> > ChanMaskBackup;
+
+/*! \fn ChanMaskBackup setSingleChanMask(unsigned int ohN, unsigned int vfatN, unsigned int ch, localArgs *la)
  *  \brief Unmask the channel of interest and masks all the other
  *  \param ohN Optical link number
  *  \param vfatN VFAT position
  *  \param ch Channel of interest
  *  \param la Local arguments structure
- *  \return Original channel mask in a form of an unordered map <chanMaskRegName, mask>
+ *  \return Original channel mask, to be restored with applyChanMask
  */
-std::unordered_map<std::string, uint32_t> setSingleChanMask(unsigned int ohN, int vfatN, unsigned int ch, localArgs *la);
+ChanMaskBackup setSingleChanMask(unsigned int ohN, unsigned int vfatN, unsigned int ch, localArgs *la);
 
-/*! \fn void applyChanMask(std::unordered_map<std::string, uint32_t> map_chanOrigMask, localArgs *la)
+/*! \fn void applyChanMask(const ChanMaskBackup & map_chanOrigMask, localArgs *la)
  *  \brief Applies channel mask
  *  \param map_chanOrigMask Original channel mask as obtained from setSingleChanMask mehod
  *  \param la Local arguments structure
  */
-void applyChanMask(std::unordered_map<std::string, uint32_t> map_chanOrigMask, localArgs *la);
+void applyChanMask(const ChanMaskBackup & map_chanOrigMask, localArgs *la);
 
 /*! \fn void confCalPulseLocal(localArgs *la, uint32_t ohN, uint32_t mask, uint32_t ch, bool toggleOn, bool currentPulse, uint32_t calScaleFactor)
  *  \brief Configures the calibration pulse for channel ch on all VFATs of ohN that are not in mask to either be on (toggleOn==true) or off (toggleOn==false).  If ch == 128 and toggleOn == False will write the CALPULSE_ENABLE bit for all channels of all vfats that are not masked on ohN to 0x0.
@@ -178,6 +184,8 @@ void ttcGenConf(const RPCMsg *request, RPCMsg *response);
 
 /*! \fn void genScanLocal(localArgs *la, uint32_t *outData, uint32_t ohN, uint32_t mask, uint32_t ch, bool useCalPulse, bool currentPulse, uint32_t calScaleFactor, uint32_t nevts, uint32_t dacMin, uint32_t dacMax, uint32_t dacStep, std::string scanReg, bool useUltra, bool useExtTrig)
  *  \brief Generic calibration routine. Local callable version of genScan
+ *  \details In V3 electronics, the scan stops with the error of the response set if the triggers of a DAC step
+ *           do not complete in time, see GenScanPlan::measure.
  *  \param la Local arguments structure
  *  \param outData pointer to the results of the scan
  *  \param ohN Optical link
@@ -196,13 +204,209 @@ void ttcGenConf(const RPCMsg *request, RPCMsg *response);
  */
 void genScanLocal(localArgs *la, uint32_t *outData, uint32_t ohN, uint32_t mask, uint32_t ch, bool useCalPulse, bool currentPulse, uint32_t calScaleFactor, uint32_t nevts, uint32_t dacMin, uint32_t dacMax, uint32_t dacStep, std::string scanReg, bool useUltra, bool useExtTrig);
 
+/*! \class GenScanPlan
+ *  \brief DAC step of genScanLocal with all its registers resolved before the scan
+ *  \details The constructor looks up the scan register of each unmasked VFAT, the DAQ monitor counters and the
+ *            TTC registers once; each step then accesses the decoded nodes, in the same order as the register
+ *            names were accessed before, and groups the accesses surrounding the trigger wait in memhub sessions.
+ *
+ *            Each step is also given an estimated duration, from the number of accesses of the step at the default
+ *            latencies of memsvc_sim (PLAN_SIM_LOCAL_ACCESS_NS, PLAN_SIM_SLOW_ACCESS_NS for the VFAT slow control)
+ *            and from the duration of the cyclic generator triggers. The duration of the external triggers is unknown
+ *            and not estimated. These latencies are simulator defaults, not measurements of the card: the estimate
+ *            is only meaningful under memsvc_sim, where it checks the step against the simulated bus. On the card,
+ *            only the measured durations are. Both are reported by report().
+ */
+class GenScanPlan {
+  public:
+    static constexpr uint64_t PLAN_SIM_LOCAL_ACCESS_NS = 1000;  ///< MEMSVC_SIM_LATENCY_NS default, not a hardware figure
+    static constexpr uint64_t PLAN_SIM_SLOW_ACCESS_NS  = 50000; ///< MEMSVC_SIM_SLOW_NS default, not a hardware figure
+    static constexpr uint32_t PLAN_TRIG_TIMEOUT_MARGIN_MS = 1000; ///< Wait for the generator triggers beyond twice their duration
+    static constexpr uint32_t PLAN_EXT_TRIG_TIMEOUT_S     = 300;  ///< Wait for the nevts external triggers of a step
+
+    /*! \brief Resolves the registers of the scan
+     *  \param la Local arguments structure, used by all the steps
+     *  \param ohN Optical link number
+     *  \param notmask VFATs to scan, one bit per VFAT
+     *  \param scanReg DAC register to scan, without the CFG_ prefix
+     *  \param nevts Number of events per step
+     *  \param useExtTrig Whether the triggers come from the backplane rather than from the TTC generator
+     */
+    GenScanPlan(localArgs *la, uint32_t ohN, uint32_t notmask, const std::string & scanReg, uint32_t nevts, bool useExtTrig);
+
+    GenScanPlan(const GenScanPlan&) = delete;
+    GenScanPlan& operator=(const GenScanPlan&) = delete;
+
+    /*! \brief Returns whether all the registers were found; if not, the error of the response is set
+     */
+    bool valid() const { return m_valid; }
+
+    /*! \brief Runs the step of a DAC value, i.e. setDac followed by measure
+     *  \param dacVal Value of the scan register
+     *  \param goodEvents Raw GOOD_EVENTS_COUNT word of the DAQ monitor, set for each unmasked VFAT, indexed by VFAT position
+     *  \returns false if the triggers did not complete, see measure
+     */
+    bool step(uint32_t dacVal, uint32_t *goodEvents);
+
+    /*! \brief First part of a step: writes the DAC value to the unmasked VFATs
+     */
+    void setDac(uint32_t dacVal);
+
+    /*! \brief Second part of a step: sends the triggers and reads the DAQ monitor, which must be pointed at the link of the plan
+     *  \details The generator is waited for up to twice the duration of its triggers plus PLAN_TRIG_TIMEOUT_MARGIN_MS,
+     *            the external triggers up to PLAN_EXT_TRIG_TIMEOUT_S. If the triggers do not complete in time, the DAQ
+     *            monitor is disabled, the error of the response is set and the counters are not read: the scan must stop.
+     *  \param dacVal Value of the scan register, for the debug messages
+     *  \param goodEvents See step
+     *  \param events If not null, set to the decoded GOOD_EVENTS_COUNT of each unmasked VFAT
+     *  \param hits If not null, set to the decoded CHANNEL_FIRE_COUNT of each unmasked VFAT
+     *  \returns false if the triggers did not complete
+     */
+    bool measure(uint32_t dacVal, uint32_t *goodEvents, uint32_t *events = nullptr, uint32_t *hits = nullptr);
+
+    /*! \brief Builds a raw GOOD_EVENTS_COUNT word, as set by step, from decoded counts
+     *  \details Each count saturates at the maximum of its field.
+     */
+    uint32_t packCounts(uint32_t events, uint32_t hits) const;
+
+    /*! \brief Logs the estimated and measured totals
+     *  \param toResponse Whether to also set the per-step plan_estimated_us and plan_measured_us arrays of the response;
+     *                    ignored when the scan is repeated by genChannelScan, which reports the total of each scan instead
+     */
+    void report(bool toResponse = true) const;
+
+    const std::vector<uint32_t> & estimatedUs() const { return m_estimatedUs; } ///< Estimated duration of each step
+    const std::vector<uint32_t> & measuredUs() const { return m_measuredUs; }   ///< Measured duration of each step
+
+  private:
+    /*! \struct VFATRegs
+     *  \brief Registers of an unmasked VFAT
+     */
+    struct VFATRegs {
+      uint32_t vfatN;
+      RegNode scan;        ///< CFG_<scanReg>
+      RegNode thrArm;      ///< CFG_THR_ARM_DAC, read back in the debug messages
+      RegNode goodEvents;  ///< VFAT_DAQ_MONITOR.VFATn.GOOD_EVENTS_COUNT, unmasked
+      uint32_t goodEventsMask; ///< Mask of GOOD_EVENTS_COUNT in the address table
+      uint32_t goodEventsShift; ///< Shift of GOOD_EVENTS_COUNT in the address table
+      RegNode fireCount;   ///< VFAT_DAQ_MONITOR.VFATn.CHANNEL_FIRE_COUNT
+    };
+
+    bool resolve(const std::string & regName, RegNode & node);
+
+    localArgs * m_la;
+    std::string m_scanReg;
+    uint32_t m_nevts;
+    bool m_useExtTrig;
+    bool m_valid;
+    std::vector<VFATRegs> m_vfats;
+    RegNode m_monReset, m_monEnable, m_cntReset, m_l1aCount, m_cyclicStart, m_genEnable, m_cyclicRunning;
+    std::vector<const RegNode *> m_readout; ///< Nodes read after the triggers, see step()
+    std::chrono::microseconds m_triggerTime; ///< Duration of the generator triggers
+    std::vector<uint32_t> m_estimatedUs, m_measuredUs;
+    uint64_t m_stepLocal, m_stepSlow;        ///< Accesses of the current step so far
+    std::chrono::nanoseconds m_stepTime;     ///< Time spent in the current step so far
+};
+
+static constexpr double   ADAPTIVE_SCAN_Z         = 1.96; ///< Confidence of the adaptive scan tolerance, in standard deviations
+static constexpr uint32_t ADAPTIVE_SCAN_TOLERANCE = 20;   ///< Smallest default half width of the efficiency intervals of the adaptive scan, per mille
+
+/*! \fn uint32_t adaptiveScanTolerance(uint32_t nevts)
+ *  \brief Default tolerance of the adaptive scan for nevts events per point, per mille
+ *  \details The half width of the interval of a 50% efficiency measured with half of nevts events, so that the
+ *           points in the middle of a transition stop after about nevts/2 triggers: a fixed tolerance would either
+ *           never be reached before nevts (20 per mille needs about 2400 events at 50%) or be too loose for large
+ *           nevts. It is never below ADAPTIVE_SCAN_TOLERANCE.
+ */
+inline uint32_t adaptiveScanTolerance(uint32_t nevts)
+{
+    const double halfWidth = ADAPTIVE_SCAN_Z*0.5*std::sqrt(2./std::max<uint32_t>(nevts, 1));
+    return std::max<uint32_t>(ADAPTIVE_SCAN_TOLERANCE, uint32_t(std::ceil(1000*halfWidth)));
+}
+
+/*! \fn void genScanAdaptiveLocal(localArgs *la, uint32_t *outData, uint32_t *outEvents, uint32_t ohN, uint32_t mask, uint32_t ch, bool useCalPulse, bool currentPulse, uint32_t calScaleFactor, uint32_t nevts, uint32_t batch, uint32_t coarseStep, uint32_t tolerance, uint32_t dacMin, uint32_t dacMax, uint32_t dacStep, std::string scanReg, bool useExtTrig)
+ *  \brief Adaptive version of genScanLocal, which spends the triggers on the transitions of the S-curves
+ *  \details The triggers are sent in batches of batch events. A coarse pass first sends a batch every coarseStep
+ *           DAC units and at dacMax. Between two coarse points a VFAT is on a plateau if both have no hit or both
+ *           have a hit for every event; otherwise all the points in between are in its transition. The fine pass then
+ *           sends batches at each point of a transition until the efficiency of every VFAT in transition there is
+ *           known within tolerance, the half width of its Wilson score interval at ADAPTIVE_SCAN_Z, or until nevts
+ *           triggers were sent. A point thus receives at most nevts triggers rounded up to a multiple of batch.
+ *
+ *           outData has the layout of genScanLocal, the counts of the batches being summed into each word; the
+ *           points which received no trigger are left untouched. outEvents holds the number of triggers sent at each
+ *           point, (dacMax-dacMin)/dacStep+1 words, 0 for the skipped points.
+ *  \param la Local arguments structure
+ *  \param outData pointer to the results of the scan, see genScanLocal
+ *  \param outEvents pointer to the number of triggers of each DAC value
+ *  \param ohN Optical link
+ *  \param mask VFAT mask
+ *  \param ch Channel of interest
+ *  \param useCalPulse Use  calibration pulse if true
+ *  \param currentPulse Selects whether to use current or volage pulse
+ *  \param calScaleFactor
+ *  \param nevts Maximum number of events per calibration point
+ *  \param batch Number of events per batch, nevts if 0 or larger
+ *  \param coarseStep Distance between the points of the coarse pass, in DAC units
+ *  \param tolerance Half width of the efficiency intervals at which a point stops, per mille
+ *  \param dacMin Minimal value of scan variable
+ *  \param dacMax Maximal value of scan variable
+ *  \param dacStep Scan variable change step
+ *  \param scanReg DAC register to scan over name
+ *  \param useExtTrig Set to 1 in order to use the backplane triggers
+ */
+void genScanAdaptiveLocal(localArgs *la, uint32_t *outData, uint32_t *outEvents, uint32_t ohN, uint32_t mask, uint32_t ch, bool useCalPulse, bool currentPulse, uint32_t calScaleFactor, uint32_t nevts, uint32_t batch, uint32_t coarseStep, uint32_t tolerance, uint32_t dacMin, uint32_t dacMax, uint32_t dacStep, std::string scanReg, bool useExtTrig);
+
 /*! \fn void genScan(const RPCMsg *request, RPCMsg *response)
  *  \brief Generic calibration routine
+ *  \details If the request has an "adaptive" word, the scan is run by genScanAdaptiveLocal with the optional
+ *           "batch" (default nevts/10), "coarseStep" (default 4*dacStep) and "tolerance" (default
+ *           adaptiveScanTolerance(nevts)) words, and the response also holds the "events" array.
+ *           With a tolerance below the half width reached with nevts events, about 980/sqrt(nevts) per mille in
+ *           the middle of a transition, the points of the transitions always receive nevts triggers and all the
+ *           savings come from the plateaus.
+ *           The request is rejected if dacStep is 0 or dacMax is below dacMin.
  *  \param request RPC request message
  *  \param response RPC response message
  */
 void genScan(const RPCMsg *request, RPCMsg *response);
 
+/*! \fn void genScanMultiLinkLocal(localArgs *la, uint32_t *outData, uint32_t ohMask, uint32_t NOH, uint32_t ch, bool useCalPulse, bool currentPulse, uint32_t calScaleFactor, uint32_t nevts, uint32_t dacMin, uint32_t dacMax, uint32_t dacStep, std::string scanReg, bool useExtTrig)
+ *  \brief As genScanLocal(...) but for all the optohybrids of ohMask at once. Local callable version of genScanMultiLink
+ *  \details At each DAC step the value is first written to the unmasked VFATs of all the optohybrids, then the
+ *           VFAT_DAQ_MONITOR, which counts the hits of a single link, is pointed at each optohybrid in turn and the
+ *           nevts triggers are sent for it. The VFAT slow-control writes of the links are thus grouped, while the
+ *           triggers are sent once per link.
+ *
+ *           The results are ordered by optohybrid, then VFAT, then DAC value: the count of VFAT vfatN of ohN at
+ *           dacVal is at (ohN*oh::VFATS_PER_OH + vfatN)*nDac + (dacVal-dacMin)/dacStep, with nDac = (dacMax-dacMin)/dacStep + 1.
+ *           The words of the masked optohybrids are set to 0xdeaddead, those of the masked VFATs are left untouched.
+ *  \param la Local arguments structure
+ *  \param outData pointer to the results of the scan, NOH*oh::VFATS_PER_OH*nDac words
+ *  \param ohMask Optohybrids to scan, one bit per optohybrid; the VFAT mask of each is taken from getOHVFATMaskLocal
+ *  \param NOH Number of optohybrids of outData
+ *  \param ch Channel of interest, see genScanLocal
+ *  \param useCalPulse See genScanLocal
+ *  \param currentPulse See genScanLocal
+ *  \param calScaleFactor See genScanLocal
+ *  \param nevts Number of events per calibration point and optohybrid
+ *  \param dacMin Minimal value of scan variable
+ *  \param dacMax Maximal value of scan variable
+ *  \param dacStep Scan variable change step
+ *  \param scanReg DAC register to scan over name
+ *  \param useExtTrig Set to 1 in order to use the backplane triggers
+ */
+void genScanMultiLinkLocal(localArgs *la, uint32_t *outData, uint32_t ohMask, uint32_t NOH, uint32_t ch, bool useCalPulse, bool currentPulse, uint32_t calScaleFactor, uint32_t nevts, uint32_t dacMin, uint32_t dacMax, uint32_t dacStep, std::string scanReg, bool useExtTrig);
+
+/*! \fn void genScanMultiLink(const RPCMsg *request, RPCMsg *response)
+ *  \brief As genScan(...) but for all the optohybrids of the "ohMask" word, see genScanMultiLinkLocal
+ *  \details The optional "NOH" word limits the number of optohybrids, as for dacScanMultiLink. The response holds
+ *           the "data" array and the per-step "plan_estimated_us" and "plan_measured_us" arrays, optohybrid after optohybrid.
+ *  \param request RPC request message
+ *  \param response RPC response message
+ */
+void genScanMultiLink(const RPCMsg *request, RPCMsg *response);
+
 /*! \fn void sbitRateScanLocal(localArgs *la, uint32_t *outDataDacVal, uint32_t *outDataTrigRate, uint32_t ohN, uint32_t maskOh, bool invertVFATPos, uint32_t ch, uint32_t dacMin, uint32_t dacMax, uint32_t dacStep, std::string scanReg, uint32_t waitTime)
  *  \brief SBIT rate scan. Local version of sbitRateScan
  *
@@ -341,8 +545,30 @@ void dacScan(const RPCMsg *request, RPCMsg *response);
  */
 void dacScanMultiLink(const RPCMsg *request, RPCMsg *response);
 
+static constexpr uint32_t SCURVE_FIT_FIXED_POINT = 1000; ///< Scale of the fit_mean, fit_sigma and fit_chi2 words, i.e. in units of 1/1000
+
+/*! \fn void fitScanLocal(localArgs *la, const uint32_t *data, uint32_t nCurves, uint32_t nPoints, uint32_t dacMin, uint32_t dacStep)
+ *  \brief Fits the S-curves of scan data with fitSCurves, see scurve_fit.h, and sets the results in the response
+ *  \details The response gets the arrays "fit_mean" and "fit_sigma", in DAC units times SCURVE_FIT_FIXED_POINT,
+ *           "fit_chi2", times SCURVE_FIT_FIXED_POINT, "fit_ndf" and "fit_flags", the SCurveFitFlag bits, with an
+ *           entry per curve. A mean below 0 is set to 0, it is flagged SCURVE_FIT_OUT_OF_RANGE.
+ *  \param la Local arguments structure
+ *  \param data Raw GOOD_EVENTS_COUNT words of the scan, the nPoints words of each curve following each other
+ *  \param nCurves Number of curves
+ *  \param nPoints Number of points of each curve
+ *  \param dacMin DAC value of the first point
+ *  \param dacStep DAC difference between two points
+ */
+void fitScanLocal(localArgs *la, const uint32_t *data, uint32_t nCurves, uint32_t nPoints, uint32_t dacMin, uint32_t dacStep);
+
 /*! \fn void genChannelScan(const RPCMsg *request, RPCMsg *response)
  *  \brief Generic per channel scan. See the local callable methods documentation for details
+ *  \details If the request has a "fit" word, the S-curves of the channels are fitted on the card by fitScanLocal,
+ *           in the order of the data array, ch*oh::VFATS_PER_OH+vfatN, and the raw "data" array is only returned if
+ *           the request also has a "raw" word. The curves of the masked VFATs are flagged SCURVE_FIT_FEW_POINTS.
+ *           A fit is rejected before the scan unless dacMax-dacMin+1 is a multiple of dacStep: the curves are
+ *           otherwise not evenly spaced in the data array.
+ *           The "plan_estimated_us" and "plan_measured_us" arrays hold the total of each channel, see GenScanPlan.
  *  \param request RPC response message
  *  \param response RPC response message
  */
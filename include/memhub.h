@@ -21,10 +21,111 @@ int memhub_close(memsvc_handle_t *handle);
  */
 int memhub_read(memsvc_handle_t handle, uint32_t addr, uint32_t words, uint32_t *data);
 int memhub_write(memsvc_handle_t handle, uint32_t addr, uint32_t words, const uint32_t *data);
+/*
+ * Non-incrementing bursts: words are read from, or written to, the same address, e.g. a FIFO or a port.
+ * The semaphore is taken once for the whole burst, but released and taken again every MEMHUB_SESSION_MAX_HOLD_US
+ * (or the max_hold_us of the open session) so that long bursts do not starve the other processes.
+ * On error, the burst stops at the failing word: the words before it have been transferred.
+ */
+int memhub_fifo_read(memsvc_handle_t handle, uint32_t addr, uint32_t words, uint32_t *data);
+int memhub_fifo_write(memsvc_handle_t handle, uint32_t addr, uint32_t words, const uint32_t *data);
 void die(int signo);
 
+/*
+ * Counters of the memhub accesses made by this process since it started, see memhub_get_stats().
+ */
+struct memhub_stats {
+    uint64_t reads;         /* memhub_read and memhub_fifo_read calls */
+    uint64_t writes;        /* memhub_write and memhub_fifo_write calls */
+    uint64_t words_read;    /* words transferred by memhub_read and memhub_fifo_read */
+    uint64_t words_written; /* words transferred by memhub_write and memhub_fifo_write */
+    uint64_t lock_wait_ns;  /* time spent waiting for the semaphore */
+    uint64_t bus_ns;        /* time spent in memsvc_read and memsvc_write */
+};
+
+void memhub_get_stats(struct memhub_stats *stats);
+
+/*
+ * Trace of the register accesses.
+ *
+ * Every memhub_read/memhub_write and burst, from any process, is recorded in a ring buffer of MEMHUB_TRACE_ENTRIES entries
+ * shared through /dev/shm/memhub_trace, which survives the processes so that it can be read after the fact.
+ * Recording is lock-free: it does not take the semaphore and only costs a clock read and an atomic increment.
+ * Each entry holds the first word of the transaction, the number of words and the RPC method being executed,
+ * as set by memhub_trace_set_rpc with an id from memhub_trace_rpc_id (0 outside of RPC methods).
+ */
+#define MEMHUB_TRACE_ENTRIES   16384 /* must be a power of 2 */
+#define MEMHUB_TRACE_RPC_NAMES 256
+#define MEMHUB_TRACE_NAME_SIZE 60
+
+#define MEMHUB_TRACE_WRITE 0x1 /* the transaction is a write */
+#define MEMHUB_TRACE_ERROR 0x2 /* the memory service returned an error */
+#define MEMHUB_TRACE_FIFO  0x4 /* non-incrementing burst, all the words at addr */
+
+struct memhub_trace_entry {
+    uint64_t seq;         /* sequence number of the entry, starting at 1; 0 while the entry is being written */
+    uint64_t time_ns;     /* CLOCK_REALTIME, in ns */
+    uint32_t addr;        /* address of the first word */
+    uint32_t value;       /* first word read or written */
+    uint32_t pid;         /* process which made the access */
+    uint16_t words;       /* number of words of the transaction, saturated at 0xffff */
+    uint16_t rpc_id;      /* see memhub_trace_rpc_name */
+    uint8_t  flags;       /* MEMHUB_TRACE_WRITE, MEMHUB_TRACE_ERROR, MEMHUB_TRACE_FIFO */
+    uint8_t  reserved[7];
+};
+
+/*
+ * Returns the id of an RPC method name, registering it in the shared name table if needed; 0 if the table is full.
+ */
+uint16_t memhub_trace_rpc_id(const char *name);
+/*
+ * Returns the name of an RPC method id, NULL if unknown.
+ */
+const char *memhub_trace_rpc_name(uint16_t id);
+/*
+ * Sets the RPC method id recorded with the following accesses of this process.
+ */
+void memhub_trace_set_rpc(uint16_t id);
+/*
+ * Copies at most max_entries of the most recent consistent entries with a sequence number larger than since,
+ * oldest first, to entries. Entries overwritten while being copied are skipped.
+ * Returns the number of entries copied, -1 if the trace is not mapped.
+ */
+int memhub_trace_snapshot(uint64_t since, struct memhub_trace_entry *entries, uint32_t max_entries);
+
+/*
+ * Sessions take the semaphore once for a sequence of memhub_read/memhub_write calls, instead of once per call.
+ *
+ * While a session is open, the semaphore is released and taken again by the first access made after more than
+ * max_hold_us microseconds (MEMHUB_SESSION_MAX_HOLD_US if 0), so that other processes are not starved.
+ * The hold time is only checked on accesses: do not sleep for long inside a session.
+ * Sessions can be nested, only the outermost one takes and releases the semaphore.
+ * If the process is killed while a session is open, die() releases the semaphore.
+ *
+ * A session begun with max_hold_us = MEMHUB_SESSION_ATOMIC never releases the semaphore before it ends, even when
+ * nested in a session which has exceeded its hold time: use it around a read-modify-write, and nothing longer.
+ */
+#define MEMHUB_SESSION_MAX_HOLD_US 1000
+#define MEMHUB_SESSION_ATOMIC      0xffffffffU
+
+void memhub_session_begin(uint32_t max_hold_us);
+void memhub_session_end(void);
+
 #ifdef __cplusplus
 }
+
+/*! \class MemhubSession
+ *  \brief Scoped memhub session, see memhub_session_begin
+ */
+class MemhubSession
+{
+  public:
+    explicit MemhubSession(uint32_t max_hold_us = MEMHUB_SESSION_MAX_HOLD_US) { memhub_session_begin(max_hold_us); }
+    ~MemhubSession() { memhub_session_end(); }
+
+    MemhubSession(const MemhubSession&) = delete;
+    MemhubSession& operator=(const MemhubSession&) = delete;
+};
 #endif
 
 #endif
@@ -13,6 +13,7 @@
 
 /*! \fn void biasAllVFATsLocal(localArgs * la, uint32_t ohN, uint32_t mask = 0xFF000000)
  *  \brief Local callable. Sets default values to VFAT parameters. VFATs will remain in sleep mode
+ *  \details Registers already holding their value are not rewritten, see RegShadowScope
  *  \param la Local arguments structure
  *  \param ohN Optohybrid optical link number (string)
  *  \param mask VFAT mask. Default: no chips will be masked
@@ -21,6 +22,7 @@ void biasAllVFATsLocal(localArgs * la, uint32_t ohN, uint32_t mask = 0xFF000000)
 
 /*! \fn void broadcastWriteLocal(localArgs * la, uint32_t ohN, std::string regName, uint32_t value, uint32_t mask = 0xFF000000)
  *  \brief Local callable version of broadcastWrite
+ *  \details On v2 firmware, sets the "error" of the response if the broadcast is still running after 1 s
  *  \param la Local arguments structure
  *  \param ohN Optohybrid optical link number
  *  \param regName Register name
@@ -96,6 +98,8 @@ void configureVFATs(const RPCMsg *request, RPCMsg *response);
 
 /*! \fn void getUltraScanResultsLocal(localArgs *la, uint32_t *outData, uint32_t ohN, uint32_t nevts, uint32_t dacMin, uint32_t dacMax, uint32_t dacStep)
  *  \brief Local callable version of getUltraScanResults
+ *  \details Waits for the scan to finish, for as long as its triggers take at 1 kHz plus one second. If it is still
+ *           running then, the error of the response is set and outData is left untouched.
  *  \param la Local arguments structure
  *  \param outData Pointer to output data array
  *  \param nevts Number of events per scan point
@@ -161,6 +165,7 @@ void printScanConfiguration(const RPCMsg *request, RPCMsg *response);
 
 /*! \fn void setAllVFATsToRunModeLocal(localArgs * la, uint32_t ohN, uint32_t mask = 0xFF000000)
  *  \brief Local callable. Sets VFATs to run mode
+ *  \details Registers already holding their value are not rewritten, see RegShadowScope
  *  \param la Local arguments structure
  *  \param ohN Optohybrid optical link number (string)
  *  \param mask VFAT mask. Default: no chips will be masked
@@ -0,0 +1,294 @@
+/*! \file reg_node.h
+ *  \brief Compact, pre-decoded representation of an address table node.
+ *
+ *  The LMDB address table stores every node either as a legacy text record
+ *  "addr|perm|mask|mode|size" (see serialize() in utils.cpp) or, since format
+ *  version 1, as a fixed-layout little-endian binary record. The format version
+ *  is stored in the table itself under REG_FORMAT_KEY; tables without that key
+ *  use the legacy text format. Records are decoded once into a RegNode and kept
+ *  in a per-process cache.
+ *
+ *  This header has no dependency on the RPC service so that it can be used by
+ *  standalone tools and benchmarks.
+ */
+
+#ifndef REG_NODE_H
+#define REG_NODE_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+/*! \brief Access mode of an address table node
+ */
+enum RegMode : uint8_t {
+    REG_MODE_SINGLE          = 0, ///< Single register
+    REG_MODE_BLOCK           = 1, ///< Contiguous block of registers
+    REG_MODE_FIFO            = 2, ///< FIFO
+    REG_MODE_INCREMENTAL     = 3, ///< Incremental block
+    REG_MODE_NON_INCREMENTAL = 4, ///< Non-incremental block (port)
+    REG_MODE_PORT            = 5, ///< Port
+    REG_MODE_UNKNOWN         = 0xff
+};
+
+/*! \brief Permission bits of an address table node
+ */
+enum RegPerm : uint8_t {
+    REG_PERM_READ  = 0x1, ///< Node is readable
+    REG_PERM_WRITE = 0x2  ///< Node is writable
+};
+
+/*! \struct RegNode
+ *  \brief Decoded address table node
+ */
+struct RegNode {
+    uint32_t address; ///< Real address of the node
+    uint32_t mask;    ///< Mask of the node
+    uint32_t size;    ///< Size of the node, in 32-bit words
+    uint8_t  shift;   ///< Position of the lowest set bit of the mask
+    uint8_t  mode;    ///< Access mode, one of RegMode
+    uint8_t  perm;    ///< Permission bits, combination of RegPerm
+
+    bool readable() const { return perm & REG_PERM_READ; }
+    bool writable() const { return perm & REG_PERM_WRITE; }
+    bool masked()   const { return mask != 0xFFFFFFFF; }
+};
+
+constexpr uint32_t REG_WORD_BYTES = 4; ///< Address increment between two consecutive 32-bit registers
+
+/*! \brief Returns the shift corresponding to a register mask, i.e. the number of trailing zeros
+ */
+inline uint8_t maskShift(uint32_t mask)
+{
+    return mask ? __builtin_ctz(mask) : 0;
+}
+
+/*! \brief Returns the string representation of a node mode, as found in the address table
+ */
+inline const char* regModeName(uint8_t mode)
+{
+    switch (mode) {
+    case REG_MODE_SINGLE:          return "single";
+    case REG_MODE_BLOCK:           return "block";
+    case REG_MODE_FIFO:            return "fifo";
+    case REG_MODE_INCREMENTAL:     return "incremental";
+    case REG_MODE_NON_INCREMENTAL: return "non-incremental";
+    case REG_MODE_PORT:            return "port";
+    default:                       return "unknown";
+    }
+}
+
+/*! \brief Returns the RegMode corresponding to the mode string \c str of length \c len
+ */
+inline uint8_t regModeFromString(const char* str, size_t len)
+{
+    for (uint8_t mode = REG_MODE_SINGLE; mode <= REG_MODE_PORT; ++mode) {
+        const char* name = regModeName(mode);
+        if (std::strlen(name) == len && std::strncmp(name, str, len) == 0)
+            return mode;
+    }
+    return REG_MODE_UNKNOWN;
+}
+
+/*! \brief Returns the string representation of the permission bits, as found in the address table
+ */
+inline const char* regPermName(uint8_t perm)
+{
+    switch (perm & (REG_PERM_READ | REG_PERM_WRITE)) {
+    case REG_PERM_READ:                  return "r";
+    case REG_PERM_WRITE:                 return "w";
+    case REG_PERM_READ | REG_PERM_WRITE: return "rw";
+    default:                             return "";
+    }
+}
+
+namespace reg_node_detail {
+    /*! \brief Parses a hexadecimal field ending at the next '|' or at \c end
+     */
+    inline bool parseHex(const char*& p, const char* end, uint32_t& out)
+    {
+        uint32_t value = 0;
+        const char* start = p;
+        for (; p < end && *p != '|'; ++p) {
+            const char c = *p;
+            uint32_t digit;
+            if (c >= '0' && c <= '9')
+                digit = c - '0';
+            else if (c >= 'a' && c <= 'f')
+                digit = c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F')
+                digit = c - 'A' + 10;
+            else
+                return false;
+            value = (value << 4) | digit;
+        }
+        out = value;
+        return p != start;
+    }
+
+    /*! \brief Returns the end of the field starting at \c p
+     */
+    inline const char* fieldEnd(const char* p, const char* end)
+    {
+        while (p < end && *p != '|')
+            ++p;
+        return p;
+    }
+}
+
+/*! \brief Decodes a legacy text record "addr|perm|mask|mode|size" into a RegNode
+ *
+ *  The record does not need to be NUL terminated, which allows to decode the
+ *  LMDB value in place without any copy or allocation.
+ *
+ *  \param data Pointer to the record
+ *  \param len Length of the record
+ *  \param node Decoded node
+ *  \returns \c true if the record is well formed
+ */
+inline bool parseRegNode(const char* data, size_t len, RegNode& node)
+{
+    const char* p   = data;
+    const char* end = data + len;
+
+    if (!reg_node_detail::parseHex(p, end, node.address) || p == end)
+        return false;
+    ++p;
+
+    const char* fend = reg_node_detail::fieldEnd(p, end);
+    node.perm = 0;
+    for (; p < fend; ++p) {
+        if (*p == 'r')
+            node.perm |= REG_PERM_READ;
+        else if (*p == 'w')
+            node.perm |= REG_PERM_WRITE;
+    }
+    if (p == end)
+        return false;
+    ++p;
+
+    if (!reg_node_detail::parseHex(p, end, node.mask) || p == end)
+        return false;
+    ++p;
+
+    fend = reg_node_detail::fieldEnd(p, end);
+    node.mode = regModeFromString(p, fend - p);
+    p = fend;
+    if (p == end)
+        return false;
+    ++p;
+
+    if (!reg_node_detail::parseHex(p, end, node.size))
+        return false;
+
+    node.shift = maskShift(node.mask);
+    return true;
+}
+
+/*! \struct RegBlockRun
+ *  \brief Range of contiguous 32-bit words accessed in a single bus transaction
+ */
+struct RegBlockRun {
+    uint32_t address; ///< Address of the first word
+    uint32_t words;   ///< Number of words
+};
+
+constexpr uint32_t BATCH_MAX_WORDS = 256; ///< Maximum number of words read in a single transaction by readRegs
+
+/*! \brief Merges sorted, unique word addresses into runs of contiguous words
+ *
+ *  \param addresses Word addresses, sorted in increasing order without duplicates
+ *  \param maxWords Maximum number of words in a single run
+ *  \returns the runs, in increasing address order; together they cover exactly \c addresses
+ */
+inline std::vector<RegBlockRun> coalesceAddresses(const std::vector<uint32_t>& addresses, uint32_t maxWords)
+{
+    std::vector<RegBlockRun> runs;
+    for (auto const& address : addresses) {
+        if (!runs.empty()
+            && runs.back().words < maxWords
+            && address == runs.back().address + runs.back().words*REG_WORD_BYTES) {
+            ++runs.back().words;
+        } else {
+            runs.push_back({address, 1});
+        }
+    }
+    return runs;
+}
+
+/*! \brief Key of the address table entry holding the record format version, as a little-endian 32-bit word
+ */
+constexpr const char* REG_FORMAT_KEY = "__FORMAT_VERSION__";
+
+constexpr uint32_t REG_FORMAT_TEXT   = 0;  ///< Legacy "addr|perm|mask|mode|size" text records
+constexpr uint32_t REG_FORMAT_BINARY = 1;  ///< Binary records, see encodeRegRecord
+constexpr size_t   REG_RECORD_SIZE   = 16; ///< Size of a binary record, in bytes
+
+/*! \brief Writes \c value as a little-endian 32-bit word
+ */
+inline void storeLE32(uint8_t* out, uint32_t value)
+{
+    out[0] = value;
+    out[1] = value >> 8;
+    out[2] = value >> 16;
+    out[3] = value >> 24;
+}
+
+/*! \brief Reads a little-endian 32-bit word
+ */
+inline uint32_t loadLE32(const uint8_t* in)
+{
+    return uint32_t(in[0]) | (uint32_t(in[1]) << 8) | (uint32_t(in[2]) << 16) | (uint32_t(in[3]) << 24);
+}
+
+/*! \brief Encodes a RegNode into a binary record of REG_RECORD_SIZE bytes
+ *
+ *  Layout, all words little-endian:
+ *  | offset | size | content          |
+ *  |--------|------|------------------|
+ *  | 0      | 4    | address          |
+ *  | 4      | 4    | mask             |
+ *  | 8      | 4    | size             |
+ *  | 12     | 1    | mode (RegMode)   |
+ *  | 13     | 1    | perm (RegPerm)   |
+ *  | 14     | 2    | reserved, zero   |
+ */
+inline void encodeRegRecord(const RegNode& node, uint8_t* out)
+{
+    storeLE32(out,     node.address);
+    storeLE32(out + 4, node.mask);
+    storeLE32(out + 8, node.size);
+    out[12] = node.mode;
+    out[13] = node.perm;
+    out[14] = 0;
+    out[15] = 0;
+}
+
+/*! \brief Decodes a binary record into a RegNode
+ *  \returns \c true if the record has the expected size
+ */
+inline bool decodeRegRecord(const void* data, size_t len, RegNode& node)
+{
+    if (len != REG_RECORD_SIZE)
+        return false;
+    const uint8_t* in = static_cast<const uint8_t*>(data);
+    node.address = loadLE32(in);
+    node.mask    = loadLE32(in + 4);
+    node.size    = loadLE32(in + 8);
+    node.mode    = in[12];
+    node.perm    = in[13];
+    node.shift   = maskShift(node.mask);
+    return true;
+}
+
+/*! \brief Decodes a record of the given format version into a RegNode
+ */
+inline bool decodeRegNode(uint32_t format, const char* data, size_t len, RegNode& node)
+{
+    if (format == REG_FORMAT_BINARY)
+        return decodeRegRecord(data, len, node);
+    return parseRegNode(data, len, node);
+}
+
+#endif
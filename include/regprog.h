@@ -0,0 +1,199 @@
+/*! \file regprog.h
+ *  \brief Register programs: sequences of register micro-operations executed on the card in a single RPC call
+ *
+ *  A program is an array of 32-bit words holding a sequence of operations. Each operation starts with a header word:
+ *  | bits  | content                                                       |
+ *  |-------|---------------------------------------------------------------|
+ *  | 7:0   | opcode, one of RegProgOp                                      |
+ *  | 15:8  | accumulator index, for REGPROG_ACCUMULATE and REGPROG_STORE   |
+ *  | 31:16 | count, for REGPROG_READ_BLOCK and REGPROG_REPEAT              |
+ *  followed by the argument words listed with each opcode. Addresses are raw AXI addresses, masks are applied in place:
+ *  the value of a masked write is already shifted to the position of the mask.
+ *
+ *  The words produced by the operations are appended to a single result array, in execution order.
+ *  A program is checked by validateRegProgram before it is executed: malformed operations, addresses outside of
+ *  the GEM_AMC address space, and programs exceeding the REGPROG_MAX_* limits are rejected.
+ *
+ *  This header has no dependency on the RPC service so that clients and tools can build and check programs.
+ */
+
+#ifndef REGPROG_H
+#define REGPROG_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+
+/*! \brief Opcodes of the register program operations
+ */
+enum RegProgOp : uint8_t {
+    REGPROG_READ         = 0x01, ///< [addr]: appends the word at addr
+    REGPROG_WRITE        = 0x02, ///< [addr, value]: writes value at addr
+    REGPROG_WRITE_MASKED = 0x03, ///< [addr, mask, value]: read-modify-write of the bits of mask
+    REGPROG_READ_BLOCK   = 0x04, ///< [addr]: appends the count words starting at addr
+    REGPROG_POLL         = 0x05, ///< [addr, mask, expected, timeout_us]: reads addr until (word & mask) == expected, appends the last word & mask; the program stops with an error on timeout
+    REGPROG_SLEEP        = 0x06, ///< [us]: sleeps, the memhub semaphore is released meanwhile
+    REGPROG_ACCUMULATE   = 0x07, ///< [addr, mask]: adds the field of mask, shifted down, to the accumulator
+    REGPROG_STORE        = 0x08, ///< []: appends the accumulator and clears it
+    REGPROG_REPEAT       = 0x09, ///< [body_words]: executes the body_words following words, a sequence of operations, count times
+};
+
+constexpr uint32_t REGPROG_ADDR_MIN        = 0x64000000; ///< Lowest address a program can access, start of GEM_AMC
+constexpr uint32_t REGPROG_ADDR_MAX        = 0x67fffffc; ///< Highest address a program can access
+constexpr uint32_t REGPROG_ACCUMULATORS    = 8;          ///< Number of accumulators
+constexpr uint32_t REGPROG_MAX_WORDS       = 4096;       ///< Maximum size of a program
+constexpr uint32_t REGPROG_MAX_DEPTH       = 4;          ///< Maximum nesting of REGPROG_REPEAT
+constexpr uint64_t REGPROG_MAX_OPS         = 1000000;    ///< Maximum number of operations executed
+constexpr uint64_t REGPROG_MAX_RESULTS     = 65536;      ///< Maximum number of result words
+constexpr uint64_t REGPROG_MAX_WAIT_US     = 10000000;   ///< Maximum total time of the sleeps and poll timeouts
+constexpr uint32_t REGPROG_POLL_INTERVAL_US = 100;       ///< First interval between two reads of REGPROG_POLL, doubled up to 10 ms
+
+/*! \brief Builds the header word of an operation
+ */
+constexpr uint32_t regProgHeader(RegProgOp op, uint32_t count = 0, uint32_t accumulator = 0)
+{
+    return uint32_t(op) | ((accumulator & 0xff) << 8) | ((count & 0xffff) << 16);
+}
+
+inline RegProgOp regProgOpcode(uint32_t header)      { return RegProgOp(header & 0xff); }
+inline uint32_t  regProgAccumulator(uint32_t header) { return (header >> 8) & 0xff; }
+inline uint32_t  regProgCount(uint32_t header)       { return header >> 16; }
+
+/*! \brief Returns the number of argument words of an opcode, -1 if the opcode is unknown
+ */
+inline int regProgArgs(uint8_t op)
+{
+    switch (op) {
+    case REGPROG_READ:         return 1;
+    case REGPROG_WRITE:        return 2;
+    case REGPROG_WRITE_MASKED: return 3;
+    case REGPROG_READ_BLOCK:   return 1;
+    case REGPROG_POLL:         return 4;
+    case REGPROG_SLEEP:        return 1;
+    case REGPROG_ACCUMULATE:   return 2;
+    case REGPROG_STORE:        return 0;
+    case REGPROG_REPEAT:       return 1;
+    default:                   return -1;
+    }
+}
+
+/*! \struct RegProgCost
+ *  \brief Worst case cost of a program, computed by validateRegProgram
+ */
+struct RegProgCost {
+    uint64_t ops;     ///< Operations executed
+    uint64_t results; ///< Result words produced
+    uint64_t waitUs;  ///< Total time of the sleeps and poll timeouts
+};
+
+namespace regprog_detail {
+    inline bool validAddress(uint32_t addr, uint32_t words = 1)
+    {
+        return (addr & 0x3) == 0 && addr >= REGPROG_ADDR_MIN && addr <= REGPROG_ADDR_MAX
+            && (words == 0 || uint64_t(addr) + uint64_t(words - 1)*4 <= REGPROG_ADDR_MAX);
+    }
+
+    inline bool fail(std::string& error, size_t& errorOffset, size_t offset, const std::string& message)
+    {
+        error       = message;
+        errorOffset = offset;
+        return false;
+    }
+
+    /*! \brief Checks the operations of prog[begin, end) and adds their cost, executed repeat times, to cost
+     */
+    inline bool validate(const uint32_t* prog, size_t begin, size_t end, uint32_t depth, uint64_t repeat,
+                         RegProgCost& cost, std::string& error, size_t& errorOffset)
+    {
+        size_t pc = begin;
+        while (pc < end) {
+            const uint32_t header = prog[pc];
+            const uint8_t  op     = regProgOpcode(header);
+            const int      nArgs  = regProgArgs(op);
+            if (nArgs < 0)
+                return fail(error, errorOffset, pc, "unknown opcode " + std::to_string(op));
+            if (pc + 1 + nArgs > end)
+                return fail(error, errorOffset, pc, "truncated operation");
+            const uint32_t* args  = prog + pc + 1;
+            const uint32_t  count = regProgCount(header);
+            cost.ops += repeat;
+            switch (op) {
+            case REGPROG_READ:
+            case REGPROG_WRITE:
+            case REGPROG_WRITE_MASKED:
+                if (!validAddress(args[0]))
+                    return fail(error, errorOffset, pc, "address out of range");
+                if (op == REGPROG_READ)
+                    cost.results += repeat;
+                break;
+            case REGPROG_READ_BLOCK:
+                if (count == 0 || !validAddress(args[0], count))
+                    return fail(error, errorOffset, pc, "block out of range");
+                cost.results += repeat*count;
+                break;
+            case REGPROG_POLL:
+                if (!validAddress(args[0]))
+                    return fail(error, errorOffset, pc, "address out of range");
+                if (args[2] & ~args[1])
+                    return fail(error, errorOffset, pc, "expected value outside of the mask");
+                cost.results += repeat;
+                cost.waitUs  += repeat*args[3];
+                break;
+            case REGPROG_SLEEP:
+                cost.waitUs += repeat*args[0];
+                break;
+            case REGPROG_ACCUMULATE:
+                if (!validAddress(args[0]))
+                    return fail(error, errorOffset, pc, "address out of range");
+                if (args[1] == 0)
+                    return fail(error, errorOffset, pc, "empty mask");
+                // fall through
+            case REGPROG_STORE:
+                if (regProgAccumulator(header) >= REGPROG_ACCUMULATORS)
+                    return fail(error, errorOffset, pc, "invalid accumulator");
+                if (op == REGPROG_STORE)
+                    cost.results += repeat;
+                break;
+            case REGPROG_REPEAT:
+                if (depth >= REGPROG_MAX_DEPTH)
+                    return fail(error, errorOffset, pc, "repeat nested too deeply");
+                if (args[0] == 0 || pc + 2 + uint64_t(args[0]) > end)
+                    return fail(error, errorOffset, pc, "repeat body out of range");
+                if (repeat*count > REGPROG_MAX_OPS) // the body holds at least one operation
+                    return fail(error, errorOffset, pc, "too many operations");
+                if (!validate(prog, pc + 2, pc + 2 + args[0], depth + 1, repeat*count, cost, error, errorOffset))
+                    return false;
+                pc += args[0];
+                break;
+            }
+            if (cost.ops > REGPROG_MAX_OPS)
+                return fail(error, errorOffset, pc, "too many operations");
+            if (cost.results > REGPROG_MAX_RESULTS)
+                return fail(error, errorOffset, pc, "too many result words");
+            if (cost.waitUs > REGPROG_MAX_WAIT_US)
+                return fail(error, errorOffset, pc, "sleeps and timeouts too long");
+            pc += 1 + nArgs;
+        }
+        return true;
+    }
+}
+
+/*! \brief Checks that a program is well formed and within the limits before it is executed
+ *  \param prog Program words
+ *  \param size Number of words
+ *  \param cost Worst case cost of the program, set if valid
+ *  \param error Reason of the rejection
+ *  \param errorOffset Offset of the offending operation
+ *  \returns \c true if the program can be executed
+ */
+inline bool validateRegProgram(const uint32_t* prog, size_t size, RegProgCost& cost, std::string& error, size_t& errorOffset)
+{
+    cost = RegProgCost{0, 0, 0};
+    if (size == 0)
+        return regprog_detail::fail(error, errorOffset, 0, "empty program");
+    if (size > REGPROG_MAX_WORDS)
+        return regprog_detail::fail(error, errorOffset, 0, "program too long");
+    return regprog_detail::validate(prog, 0, size, 0, 1, cost, error, errorOffset);
+}
+
+#endif
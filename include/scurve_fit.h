@@ -0,0 +1,236 @@
+/*! \file scurve_fit.h
+ *  \brief Error function fits of S-curves, the efficiency of a channel as a function of a DAC
+ *
+ *  An S-curve of hits k_i over events n_i at the DAC values x_i is fitted with the efficiency
+ *  \f$ \Phi((x-\mu)/s) \f$, \f$ \Phi \f$ being the standard normal cumulative distribution. A negative s describes a
+ *  falling curve, flagged SCURVE_FIT_FALLING; the reported sigma is |s|. The fit starts from the moments of the
+ *  differences of the measured efficiency, then runs SCURVE_FIT_ITERATIONS damped Gauss-Newton steps on the
+ *  binomially weighted residuals. The chi2 is the Pearson chi2 of the counts.
+ *
+ *  The curves are fitted SCURVE_FIT_LANES at a time, their counts transposed so that the kernel runs each operation
+ *  on the lanes of a GCC vector, SCurveFitVec: SSE on a PC, NEON on the Cortex-A9 of the card, scalar code generated
+ *  by the compiler elsewhere. GCC only maps float vector arithmetic to NEON with -mfpu=neon and
+ *  -funsafe-math-optimizations, NEON flushing denormals to zero, so the ARM build compiles the users of this header,
+ *  calibration_routines.o, with both; without NEON the lanes silently run as scalar VFP code, hence the warning
+ *  below. The kernel never relies on denormals. There are no data dependent branches, exp and erfc are polynomial
+ *  approximations.
+ *
+ *  This header has no dependency on the RPC service so that clients and tools can fit the raw counts as well.
+ */
+
+#ifndef SCURVE_FIT_H
+#define SCURVE_FIT_H
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__arm__) && !defined(__ARM_NEON)
+#warning "scurve_fit.h: NEON is not enabled, the S-curve fit kernel runs as scalar VFP code, build with -mfpu=neon"
+#endif
+
+constexpr uint32_t SCURVE_FIT_LANES     = 4;    ///< Curves fitted together
+constexpr uint32_t SCURVE_FIT_ITERATIONS = 8;    ///< Gauss-Newton steps of each fit
+constexpr float    SCURVE_FIT_MIN_RISE   = 0.5f; ///< Smallest change of efficiency across the scan for a transition
+constexpr float    SCURVE_FIT_MAX_CHI2   = 10.f; ///< Largest chi2/ndf of a good fit
+
+/*! \brief Quality flags of a fit, the fit is good if none of SCURVE_FIT_BAD is set
+ */
+enum SCurveFitFlag : uint32_t {
+    SCURVE_FIT_FALLING       = 0x01, ///< The efficiency decreases with the DAC, informational
+    SCURVE_FIT_FEW_POINTS    = 0x02, ///< Less than 3 points with events
+    SCURVE_FIT_NO_TRANSITION = 0x04, ///< The efficiency changes by less than SCURVE_FIT_MIN_RISE
+    SCURVE_FIT_OUT_OF_RANGE  = 0x08, ///< The mean is outside of the scanned range
+    SCURVE_FIT_BAD_SIGMA     = 0x10, ///< The sigma is at its lower limit, half a step, or above the scanned range
+    SCURVE_FIT_HIGH_CHI2     = 0x20, ///< chi2/ndf above SCURVE_FIT_MAX_CHI2
+};
+constexpr uint32_t SCURVE_FIT_BAD = SCURVE_FIT_FEW_POINTS | SCURVE_FIT_NO_TRANSITION | SCURVE_FIT_OUT_OF_RANGE
+                                  | SCURVE_FIT_BAD_SIGMA | SCURVE_FIT_HIGH_CHI2;
+
+/*! \struct SCurveFit
+ *  \brief Result of the fit of an S-curve
+ */
+struct SCurveFit {
+    float    mean;  ///< DAC value at 50% efficiency
+    float    sigma; ///< Width of the transition, in DAC units
+    float    chi2;  ///< Pearson chi2 of the counts
+    uint32_t ndf;   ///< Number of points with events minus 2
+    uint32_t flags; ///< SCurveFitFlag bits
+};
+
+/*! \brief Vector of SCURVE_FIT_LANES floats, mapped by the compiler to its SIMD registers, or to scalars without them
+ */
+typedef float   SCurveFitVec  __attribute__((vector_size(SCURVE_FIT_LANES*sizeof(float))));
+typedef int32_t SCurveFitMask __attribute__((vector_size(SCURVE_FIT_LANES*sizeof(int32_t))));
+
+namespace scurve_fit_detail {
+    typedef SCurveFitVec  V;
+    typedef SCurveFitMask M;
+
+    inline V splat(float a)            { const V zero = {}; return zero + a; }
+    inline V vmin(V a, V b)            { return a < b ? a : b; }
+    inline V vmax(V a, V b)            { return a > b ? a : b; }
+    inline V vabs(V a)                 { return (V)((M)a & 0x7fffffff); }
+    inline V select(M cond, V a, V b)  { return cond ? a : b; }
+    inline V load(const float * data)  { V v; std::memcpy(&v, data, sizeof(v)); return v; }
+
+    /*! \brief exp(x) for x <= 0, Cephes polynomial scaled by 2^n
+     */
+    inline V expNeg(V x)
+    {
+        x = vmax(x, splat(-87.f));
+        const V magic = splat(12582912.f);          // 1.5*2^23: the sum is rounded to an integer, held in the low mantissa bits
+        const V t = x*1.44269504f + magic;
+        const V n = t - magic;
+        const V r = x - n*0.693359375f + n*2.12194440e-4f;
+        const V p = ((((r*1.9875691500e-4f + 1.3981999507e-3f)*r + 8.3334519073e-3f)*r
+                      + 4.1665795894e-2f)*r + 1.6666665459e-1f)*r + 5.0000001201e-1f;
+        const V scale = (V)(((M)t - 0x4B400000 + 127) << 23);
+        return (p*r*r + r + 1.f)*scale;
+    }
+
+    /*! \brief Standard normal cumulative distribution of z, and density in pdf; erfc from Abramowitz and Stegun 7.1.26
+     */
+    inline V normalCdf(V z, V & pdf)
+    {
+        const V a    = vabs(z)*0.70710678f;
+        const V t    = 1.f/(a*0.3275911f + 1.f);
+        const V e    = expNeg(vmax(-a*a, splat(-20.f))); // |z| beyond 6.3 would only bring denormals
+        const V poly = t*(t*(t*(t*(t*1.061405429f - 1.453152027f) + 1.421413741f) - 0.284496736f) + 0.254829592f);
+        const V tail = poly*e*0.5f; // Phi(-|z|)
+        pdf = e*0.39894228f;
+        return select(z >= 0.f, 1.f - tail, tail);
+    }
+
+    /*! \brief Fits SCURVE_FIT_LANES curves whose counts are transposed in k and n, indexed by point*SCURVE_FIT_LANES+lane
+     */
+    inline void fitLanes(const float * x, uint32_t nPoints, const float * k, const float * n, SCurveFit * fits)
+    {
+        constexpr uint32_t L = SCURVE_FIT_LANES;
+        const float range = x[nPoints-1] - x[0];
+        const float sMinF = 0.5f*range/std::max<uint32_t>(1, nPoints-1);
+        const V zero = {};
+        const V sMin = splat(sMinF), sMax = splat(std::max(range, sMinF));
+        const V xLow = splat(x[0]), xHigh = splat(x[nPoints-1]);
+
+        // Efficiency of each point, 0 without events
+        std::vector<float> eff(nPoints*L);
+        V valid = zero;
+        for (uint32_t p = 0; p < nPoints; ++p) {
+            const V nn = load(n + p*L);
+            const V e  = load(k + p*L)/vmax(nn, splat(1.f));
+            std::memcpy(&eff[p*L], &e, sizeof(e));
+            valid += select(nn > 0.f, splat(1.f), zero);
+        }
+
+        // Moments of the differences of the efficiency, the derivative of the S-curve
+        V sumD = zero, sumXD = zero, sumVar = zero;
+        for (uint32_t p = 0; p+1 < nPoints; ++p) {
+            const V d = select((load(n + p*L) > 0.f) & (load(n + (p+1)*L) > 0.f), load(&eff[(p+1)*L]) - load(&eff[p*L]), zero);
+            sumD  += d;
+            sumXD += d*(0.5f*(x[p] + x[p+1]));
+        }
+        const M rise = vabs(sumD) >= SCURVE_FIT_MIN_RISE;
+        V mu = vmin(vmax(select(rise, sumXD/select(rise, sumD, splat(1.f)), splat(x[0] + 0.5f*range)), xLow), xHigh);
+        for (uint32_t p = 0; p+1 < nPoints; ++p) {
+            const V d  = select((load(n + p*L) > 0.f) & (load(n + (p+1)*L) > 0.f), load(&eff[(p+1)*L]) - load(&eff[p*L]), zero);
+            const V dx = splat(0.5f*(x[p] + x[p+1])) - mu;
+            sumVar += dx*dx*d;
+        }
+        const V sign = select(sumD < 0.f, splat(-1.f), splat(1.f));
+        const V var  = vmax(select(sumD != 0.f, sumVar/select(sumD != 0.f, sumD, splat(1.f)), zero), zero);
+        V width;
+        for (uint32_t l = 0; l < L; ++l)
+            width[l] = std::sqrt(var[l]);
+        V s = sign*vmin(vmax(width, sMin), sMax);
+
+        // Damped Gauss-Newton on the residuals of the efficiency, weighted by their binomial variance
+        for (uint32_t it = 0; it < SCURVE_FIT_ITERATIONS; ++it) {
+            V a00 = zero, a01 = zero, a11 = zero, g0 = zero, g1 = zero;
+            const V invS = 1.f/s;
+            for (uint32_t p = 0; p < nPoints; ++p) {
+                const V nn  = load(n + p*L);
+                const V z   = (splat(x[p]) - mu)*invS;
+                V pdf;
+                const V cdf = normalCdf(z, pdf);
+                const V w   = select(nn > 0.f, nn/(cdf*(1.f - cdf) + 1.f/vmax(nn, splat(1.f))), zero);
+                const V r   = load(&eff[p*L]) - cdf;
+                const V jm  = -pdf*invS;
+                const V js  = jm*z;
+                a00 += w*jm*jm;
+                a01 += w*jm*js;
+                a11 += w*js*js;
+                g0  += w*jm*r;
+                g1  += w*js*r;
+            }
+            const V d00 = a00*1.001f + 1e-12f, d11 = a11*1.001f + 1e-12f;
+            const V det = d00*d11 - a01*a01;
+            const V dm  = (d11*g0 - a01*g1)/det;
+            const V ds  = (d00*g1 - a01*g0)/det;
+            mu = vmin(vmax(mu + vmin(vmax(dm, splat(-0.5f*range)), splat(0.5f*range)), xLow - range), xHigh + range);
+            s  = sign*vmin(vmax(sign*(s + ds), sMin), sMax);
+        }
+
+        V chi2 = zero;
+        for (uint32_t p = 0; p < nPoints; ++p) {
+            const V nn  = load(n + p*L);
+            V pdf;
+            const V cdf = normalCdf((splat(x[p]) - mu)/s, pdf);
+            const V r   = load(k + p*L) - nn*cdf;
+            chi2 += select(nn > 0.f, r*r/vmax(nn*cdf*(1.f - cdf), splat(1.f)), zero);
+        }
+
+        const V sigma = vabs(s);
+        const V ndf   = valid - 2.f;
+        for (uint32_t l = 0; l < L; ++l) {
+            uint32_t flags = 0;
+            if (s[l] < 0.f)
+                flags |= SCURVE_FIT_FALLING;
+            if (valid[l] < 3.f)
+                flags |= SCURVE_FIT_FEW_POINTS;
+            if (!rise[l])
+                flags |= SCURVE_FIT_NO_TRANSITION;
+            if (!(mu[l] >= x[0] && mu[l] <= x[nPoints-1]))
+                flags |= SCURVE_FIT_OUT_OF_RANGE;
+            if (!(sigma[l] > sMin[l] && sigma[l] < sMax[l]))
+                flags |= SCURVE_FIT_BAD_SIGMA;
+            if (ndf[l] > 0.f && chi2[l] > SCURVE_FIT_MAX_CHI2*ndf[l])
+                flags |= SCURVE_FIT_HIGH_CHI2;
+            fits[l] = SCurveFit{mu[l], sigma[l], chi2[l], uint32_t(std::max(ndf[l], 0.f)), flags};
+        }
+    }
+}
+
+/*! \brief Fits nCurves S-curves measured at the same DAC values
+ *  \param x DAC values, in increasing order
+ *  \param nPoints Number of DAC values
+ *  \param hits Hits of each curve at each DAC value, indexed by curve*nPoints+point
+ *  \param events Events of each curve at each DAC value, same layout; the points without events are ignored
+ *  \param nCurves Number of curves
+ *  \param fits Results, nCurves entries
+ */
+inline void fitSCurves(const float * x, uint32_t nPoints, const uint32_t * hits, const uint32_t * events, uint32_t nCurves, SCurveFit * fits)
+{
+    constexpr uint32_t L = SCURVE_FIT_LANES;
+    if (nPoints == 0) {
+        std::fill(fits, fits + nCurves, SCurveFit{0.f, 0.f, 0.f, 0, SCURVE_FIT_FEW_POINTS | SCURVE_FIT_NO_TRANSITION});
+        return;
+    }
+    std::vector<float> k(nPoints*L), n(nPoints*L);
+    SCurveFit laneFits[L];
+    for (uint32_t first = 0; first < nCurves; first += L) {
+        const uint32_t lanes = std::min(L, nCurves - first);
+        for (uint32_t p = 0; p < nPoints; ++p) {
+            for (uint32_t l = 0; l < L; ++l) {
+                k[p*L+l] = (l < lanes) ? float(hits[(first+l)*nPoints+p]) : 0.f;
+                n[p*L+l] = (l < lanes) ? float(events[(first+l)*nPoints+p]) : 0.f;
+            }
+        }
+        scurve_fit_detail::fitLanes(x, nPoints, k.data(), n.data(), laneFits);
+        std::copy(laneFits, laneFits + lanes, fits + first);
+    }
+}
+
+#endif
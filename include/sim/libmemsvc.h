@@ -0,0 +1,34 @@
+/*! \file sim/libmemsvc.h
+ *  \brief libmemsvc API implemented by the simulated memory service, memsvc_sim
+ *
+ *  Off-card (Arch=x86_64) builds put include/sim in front of the include path, so that
+ *  <libmemsvc.h> resolves to this header and memhub links against memsvc_sim.so
+ *  instead of the CTP7 libmemsvc. See memsvc_sim.cpp for the simulation settings.
+ */
+
+#ifndef __LIBMEMSVC_SIM_H
+#define __LIBMEMSVC_SIM_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct memsvc_sim *memsvc_handle_t;
+
+/* These functions return -1 on error and 0 on success.
+ *
+ * On error, the error message will be available via memsvc_get_last_error()
+ */
+int memsvc_open(memsvc_handle_t *handle);
+int memsvc_close(memsvc_handle_t *handle);
+const char *memsvc_get_last_error(memsvc_handle_t handle);
+int memsvc_read(memsvc_handle_t handle, uint32_t addr, uint32_t words, uint32_t *data);
+int memsvc_write(memsvc_handle_t handle, uint32_t addr, uint32_t words, const uint32_t *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -11,10 +11,16 @@
 //#include <libmemsvc.h>
 #include "memhub.h"
 #include "lmdb_cpp_wrapper.h"
+#include "reg_node.h"
+#include "utils/compiled_regs.h"
+#include "utils/system_info.h"
+#include "utils/bulk.h"
+#include "utils/jobs.h"
 #include "xhal/utils/XHALXMLParser.h"
 
 #include <unistd.h>
 #include <iostream>
+#include <map>
 #include <string>
 #include <vector>
 #include <sstream>
@@ -36,28 +42,68 @@ typedef struct localArgs {
     RPCMsg *response; /*!< RPC response message */
 } LocalArgs;
 
+static constexpr uint32_t LMDB_SIZE = 1UL * 1024UL * 1024UL * 50UL; ///< Maximum size of the LMDB object, currently 50 MiB
+
+/*! \fn bool openAddressTable()
+ *  \brief Opens the LMDB environment of the address table shared by all the RPC calls of the process
+ *  \details The environment is opened once, read-only with MDB_NOTLS, by the module_init functions or on first use,
+ *           together with a read transaction which is reset between RPC calls and renewed by GETLOCALARGS.
+ *           The environment is reopened if the address table file has been replaced, if the address table generation
+ *           changed (see utils/regnode_cache.h) or if called from a forked process.
+ *           Since update_address_table never writes the live table in place, the environment is opened with MDB_NOLOCK.
+ *           Each time the table is opened, the compiled-in register descriptors are checked against it.
+ *  \returns \c true if the environment is usable
+ */
+bool openAddressTable();
+
+/*! \fn void closeAddressTable()
+ *  \brief Closes the shared LMDB environment of the address table and drops the decoded nodes cache
+ */
+void closeAddressTable();
+
+/*! \fn bool compiledRegsValid()
+ *  \brief Returns whether the compiled-in register descriptors match the opened address table, see utils/compiled_regs.h
+ */
+bool compiledRegsValid();
+
+/*! \fn lmdb::dbi & getAddressTableDbi()
+ *  \brief Returns the database handle of the shared address table environment
+ */
+lmdb::dbi & getAddressTableDbi();
+
+/*! \class LocalTxn
+ *  \brief Scoped access to the read transaction shared by the RPC calls of the process
+ *  \details The shared transaction is renewed on construction and reset when the last
+ *            LocalTxn goes out of scope, so no LMDB snapshot is held between RPC calls.
+ *            LocalTxn objects can be nested, only the outermost one renews and resets the transaction.
+ */
+class LocalTxn : public lmdb::txn {
+  public:
+    LocalTxn();
+    ~LocalTxn() noexcept;
+
+    /*! \brief Releases the shared transaction early
+     *  \details Hides lmdb::txn::abort so that RPC methods ending with rtxn.abort() reset the shared transaction instead of destroying it
+     */
+    void abort() noexcept;
+
+  private:
+    bool m_active;
+};
+
 /*!
  * \brief returns a set up LocalArgs structure
+ * \details The returned structure refers to the shared read transaction, which is left active until the next LocalTxn is released
  */
 LocalArgs getLocalArgs(RPCMsg *response);
 
-static constexpr uint32_t LMDB_SIZE = 1UL * 1024UL * 1024UL * 50UL; ///< Maximum size of the LMDB object, currently 50 MiB
-
-// FIXME: to be replaced with the above function when the struct is properly implemented
 #define GETLOCALARGS(response)                                  \
-    auto env = lmdb::env::create();                             \
-    env.set_mapsize(LMDB_SIZE);                                 \
-    std::string gem_path       = std::getenv("GEM_PATH");       \
-    std::string lmdb_data_file = gem_path+"/address_table.mdb"; \
-    env.open(lmdb_data_file.c_str(), 0, 0664);                  \
-    auto rtxn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);     \
-    auto dbi  = lmdb::dbi::open(rtxn, nullptr);                 \
+    LocalTxn rtxn;                                              \
+    lmdb::dbi & dbi = getAddressTableDbi();                     \
     LocalArgs la = {.rtxn     = rtxn,                           \
                     .dbi      = dbi,                            \
                     .response = response};
 
-struct localArgs getLocalArgs(RPCMsg *response);
-
 struct slowCtrlErrCntVFAT{
     uint32_t crc;           //GEM_AMC.SLOW_CONTROL.VFAT3.CRC_ERROR_CNT
     uint32_t packet;        //GEM_AMC.SLOW_CONTROL.VFAT3.PACKET_ERROR_CNT
@@ -152,6 +198,38 @@ uint32_t getNumNonzeroBits(uint32_t value);
  */
 bool regExists(LocalArgs * la, const std::string & regName, lmdb::val * db_res=nullptr);
 
+/*! \fn bool regExists(LocalArgs * la, const CompiledReg & reg)
+ *  \brief Returns whether or not a compiled-in register can be found in the address table
+ */
+bool regExists(LocalArgs * la, const CompiledReg & reg);
+
+/*! \fn const RegNode * getRegNode(LocalArgs * la, const std::string & regName)
+ *  \brief Returns the decoded address table node of a register
+ *  \details The nodes are served from the cache shared by all the processes, see utils/regnode_cache.h.
+ *           When it is not available, the LMDB record of a register is decoded only once per process and kept
+ *           in a per-process cache, subsequent calls are served from that cache without touching LMDB.
+ *           The returned pointer stays valid until clearRegNodeCache or closeAddressTable is called.
+ *  \param la Local arguments structure
+ *  \param regName Register name
+ *  \returns pointer to the decoded node, nullptr if the register is not found
+ */
+const RegNode * getRegNode(LocalArgs * la, const std::string & regName);
+
+/*! \fn const RegNode * getRegNode(LocalArgs * la, const CompiledReg & reg)
+ *  \brief Returns the node of a compiled-in register, see utils/compiled_regs.h
+ *  \details The compiled-in node is returned without lookup when the descriptors match the address table,
+ *           the register is looked up by name otherwise
+ *  \param la Local arguments structure
+ *  \param reg Compiled-in register descriptor, e.g. regs::GEM_AMC_TTC_CTRL_L1A_ENABLE
+ *  \returns pointer to the node, nullptr if the register is not found
+ */
+const RegNode * getRegNode(LocalArgs * la, const CompiledReg & reg);
+
+/*! \fn void clearRegNodeCache()
+ *  \brief Drops all the decoded nodes cached by getRegNode, e.g. after the address table is updated
+ */
+void clearRegNodeCache();
+
 /*! \fn uint32_t getMask(LocalArgs * la, const std::string & regName)
  *  \brief Returns the mask for a given register
  *  \param la Local arguments structure
@@ -225,6 +303,40 @@ uint32_t applyMask(uint32_t data, uint32_t mask);
  */
 uint32_t readReg(LocalArgs * la, const std::string & regName);
 
+/*! \fn uint32_t readReg(LocalArgs * la, const RegNode & node, const std::string & regName)
+ *  \brief Reads a value from a decoded node, see readReg above
+ *  \param la Local arguments structure, unused: kept for symmetry with writeReg
+ *  \param node Decoded node of the register
+ *  \param regName Register name, or pattern of a RegArray, only used in the error messages
+ */
+uint32_t readReg(LocalArgs * la, const RegNode & node, const std::string & regName);
+
+/*! \fn uint32_t readReg(LocalArgs * la, const CompiledReg & reg)
+ *  \brief Reads a compiled-in register, see readReg above and utils/compiled_regs.h
+ */
+uint32_t readReg(LocalArgs * la, const CompiledReg & reg);
+
+/*! \fn uint32_t readRegs(const std::vector<const RegNode *> & nodes, std::vector<uint32_t> & values)
+ *  \brief Reads a list of registers with as few bus transactions as possible
+ *  \details The registers are sorted by address, registers sharing the same word are read once and adjacent words
+ *           are merged into block memhub_read calls of at most BATCH_MAX_WORDS words. The mask and shift of each
+ *           register are then applied. If a block read fails, its words are read one by one.
+ *           Like readReg, the value of a register which is not found, not readable or cannot be read is 0xdeaddead.
+ *  \param nodes Decoded nodes of the registers, as returned by getRegNode; nullptr entries are allowed
+ *  \param values Register values, in the same order as nodes
+ *  \returns the number of memhub_read transactions issued
+ */
+uint32_t readRegs(const std::vector<const RegNode *> & nodes, std::vector<uint32_t> & values);
+
+/*! \fn uint32_t readRegs(LocalArgs * la, const std::vector<std::string> & regNames, std::vector<uint32_t> & values)
+ *  \brief Reads a list of named registers with as few bus transactions as possible, see readRegs above
+ *  \param la Local arguments structure
+ *  \param regNames Register names
+ *  \param values Register values, in the same order as regNames
+ *  \returns the number of memhub_read transactions issued
+ */
+uint32_t readRegs(LocalArgs * la, const std::vector<std::string> & regNames, std::vector<uint32_t> & values);
+
 /*!
  *  \brief Reads a block of values from a contiguous address space.
  *  \param la Local arguments structure
@@ -264,6 +376,182 @@ slowCtrlErrCntVFAT repeatedRegReadLocal(localArgs * la, const std::string & regN
  */
 void writeReg(LocalArgs * la, const std::string & regName, uint32_t value);
 
+/*! \fn void writeReg(LocalArgs * la, const RegNode & node, uint32_t value, const std::string & regName)
+ *  \brief Writes a value to a decoded node, see writeReg above
+ *  \param la Local arguments structure
+ *  \param node Decoded node of the register
+ *  \param value Value to write
+ *  \param regName Register name, or pattern of a RegArray, only used in the error messages
+ */
+void writeReg(LocalArgs * la, const RegNode & node, uint32_t value, const std::string & regName);
+
+/*! \fn void writeReg(LocalArgs * la, const CompiledReg & reg, uint32_t value)
+ *  \brief Writes a compiled-in register, see writeReg above and utils/compiled_regs.h
+ */
+void writeReg(LocalArgs * la, const CompiledReg & reg, uint32_t value);
+
+/*! \struct RegShadowStats
+ *  \brief Counters of the register shadow, since the process started
+ */
+struct RegShadowStats {
+  uint32_t hits;   ///< Writes skipped because the register already held the value
+  uint32_t misses; ///< Writes issued under a RegShadowScope
+};
+
+/*! \class RegShadowScope
+ *  \brief Enables the "write only if different" mode of writeReg for configuration sequences
+ *  \details While a RegShadowScope exists, the read-modify-write of a masked, readable register skips the bus write
+ *            when the word read back already holds the requested value. The word is read from the hardware on every
+ *            call, nothing is cached: the front-end may have been power cycled or reset since the last write.
+ *            Registers covering a whole word are written as usual, since checking them would cost a read.
+ *            The outermost scope adds its hits and misses to the shadow_hits and shadow_misses words of the response.
+ */
+class RegShadowScope {
+  public:
+    explicit RegShadowScope(LocalArgs * la);
+    ~RegShadowScope();
+
+    RegShadowScope(const RegShadowScope&) = delete;
+    RegShadowScope& operator=(const RegShadowScope&) = delete;
+
+  private:
+    LocalArgs * m_la;
+    RegShadowStats m_start;
+};
+
+/*! \fn RegShadowStats getRegShadowStats()
+ *  \brief Returns the register shadow counters of the process
+ */
+RegShadowStats getRegShadowStats();
+
+/*! \class RegWriteBatch
+ *  \brief Deferred register writes, merged into a single read-modify-write per 32-bit word
+ *  \details Writes are queued and grouped by address: the fields of a same word are merged,
+ *            a later write to a field overrides an earlier one. On flush, the words are written
+ *            in increasing address order within a single memhub session. A word is only read first
+ *            if the queued fields do not cover it entirely.
+ *            Use barrier() where the hardware requires the writes queued so far to reach the
+ *            registers before the following ones, e.g. before an execute or reset bit.
+ *            Pending writes are flushed when the batch goes out of scope.
+ */
+class RegWriteBatch {
+  public:
+    explicit RegWriteBatch(LocalArgs * la) : m_la(la), m_nTransactions(0) {}
+    ~RegWriteBatch() { flush(); }
+
+    RegWriteBatch(const RegWriteBatch&) = delete;
+    RegWriteBatch& operator=(const RegWriteBatch&) = delete;
+
+    /*! \brief Queues the write of value to the register regName; the register mask is applied
+     *  \returns false, and sets the response error, if the register is not found
+     */
+    bool write(const std::string & regName, uint32_t value);
+
+    /*! \brief Queues the write of value to a decoded node; the node mask is applied
+     */
+    void write(const RegNode & node, uint32_t value);
+
+    /*! \brief Queues the write of value to a compiled-in register, see utils/compiled_regs.h
+     *  \returns false if the register is not found
+     */
+    bool write(const CompiledReg & reg, uint32_t value);
+
+    /*! \brief Ordering barrier: flushes the queued writes before any write queued afterwards
+     */
+    void barrier() { flush(); }
+
+    /*! \brief Writes the queued words, in increasing address order
+     *  \returns the total number of memhub transactions issued by this batch so far
+     */
+    uint32_t flush();
+
+  private:
+    struct PendingWord {
+      uint32_t mask;  ///< Bits of the word set by the queued writes
+      uint32_t value; ///< Value of these bits
+    };
+
+    LocalArgs * m_la;
+    std::map<uint32_t, PendingWord> m_pending;
+    uint32_t m_nTransactions;
+};
+
+/*! \class RegArray
+ *  \brief Handle on a family of indexed registers, e.g. "GEM_AMC.OH.OH0.GEB.VFAT{}.VFAT_CHANNELS.CHANNEL{}.MASK"
+ *  \details The pattern holds one "{}" placeholder per index. On construction, the node with all the indices
+ *            at 0 and, for each index, the node with that index at 1 are looked up to find the address stride
+ *            of each dimension. The nodes of the family are then computed from the indices, without formatting
+ *            the register names nor looking them up. Every element of the family is looked up once to check that
+ *            the family is regular, i.e. that all its nodes share the same mask, mode and permissions and are evenly
+ *            spaced; otherwise the nodes are looked up by name. The result is kept for the lifetime of the process,
+ *            or until clearRegNodeCache, so that later handles on the same pattern and sizes are built at no cost.
+ */
+class RegArray {
+  public:
+    /*! \brief Resolves the family
+     *  \param la Local arguments structure, used by the accesses for the whole lifetime of the handle
+     *  \param pattern Register name with a "{}" placeholder per index
+     *  \param sizes Number of elements of each dimension, in the order of the placeholders
+     */
+    RegArray(LocalArgs * la, const std::string & pattern, const std::vector<uint32_t> & sizes);
+
+    /*! \brief Returns whether the first node of the family was found
+     */
+    bool valid() const { return m_valid; }
+
+    /*! \brief Returns the name of a register of the family
+     */
+    template<typename... Indices>
+    std::string name(Indices... indices) const
+    {
+      const uint32_t idx[] = {uint32_t(indices)...};
+      return format(idx, sizeof...(indices));
+    }
+
+    /*! \brief Returns the node of a register of the family in node
+     *  \returns false if the indices are out of range or the register is not found
+     */
+    template<typename... Indices>
+    bool node(RegNode & node, Indices... indices) const
+    {
+      const uint32_t idx[] = {uint32_t(indices)...};
+      return resolve(idx, sizeof...(indices), node);
+    }
+
+    /*! \brief Reads a register of the family, see readReg
+     */
+    template<typename... Indices>
+    uint32_t read(Indices... indices) const
+    {
+      const uint32_t idx[] = {uint32_t(indices)...};
+      return readAt(idx, sizeof...(indices));
+    }
+
+    /*! \brief Writes a register of the family, see writeReg
+     */
+    template<typename... Indices>
+    void write(uint32_t value, Indices... indices) const
+    {
+      const uint32_t idx[] = {uint32_t(indices)...};
+      writeAt(idx, sizeof...(indices), value);
+    }
+
+  private:
+    std::string format(const uint32_t * indices, size_t nIndices) const;
+    bool resolve(const uint32_t * indices, size_t nIndices, RegNode & node) const;
+    uint32_t readAt(const uint32_t * indices, size_t nIndices) const;
+    void writeAt(const uint32_t * indices, size_t nIndices, uint32_t value) const;
+
+    LocalArgs * m_la;
+    std::string m_pattern;
+    std::vector<std::string> m_parts; ///< Pattern split at the placeholders
+    std::vector<uint32_t> m_sizes;
+    std::vector<uint32_t> m_strides;  ///< Address stride of each dimension, in bytes
+    RegNode m_base;                   ///< Node with all the indices at 0
+    bool m_valid;
+    bool m_regular;
+};
+
 /*!
  *  \brief Writes a block of values to a contiguous address space.
  *  \detail Block writes are allowed on 'single' registers, provided:
@@ -294,4 +582,140 @@ void writeBlock(localArgs* la, const std::string& regName, const uint32_t* value
  */
 void writeBlock(const uint32_t& regAddr, const uint32_t* values, const uint32_t& size, const uint32_t& offset=0);
 
+
+/*! \fn void recordSleepTime(uint64_t ns)
+ *  \brief Adds ns to the sleep time accounted to the RPC method being executed, see RPCStatsScope
+ */
+void recordSleepTime(uint64_t ns);
+
+/*! \fn void sleepFor(const std::chrono::duration<Rep, Period> & duration)
+ *  \brief Same as std::this_thread::sleep_for, the time actually slept is accounted in the RPC method statistics
+ */
+template<typename Rep, typename Period>
+void sleepFor(const std::chrono::duration<Rep, Period> & duration)
+{
+  const auto start = std::chrono::steady_clock::now();
+  std::this_thread::sleep_for(duration);
+  recordSleepTime(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+/*! \brief Condition waited for by pollUntil, on the register value after mask and shift
+ */
+enum class PollCondition {
+  equal,          ///< value == target
+  notEqual,       ///< value != target
+  greaterOrEqual  ///< value >= target, e.g. a counter reaching a number of events
+};
+
+/*! \struct PollBackoff
+ *  \brief Intervals between the reads of pollUntil
+ *  \details The first read is made immediately, or after predicted if it is nonzero, e.g. the expected duration of the operation.
+ *            The interval between the following reads starts at initial and doubles up to max. With PollCondition::greaterOrEqual,
+ *            once the value progresses, the interval is instead the time needed to reach the target at the observed rate,
+ *            bounded by initial and max.
+ */
+struct PollBackoff {
+  std::chrono::microseconds initial;   ///< First interval between two reads
+  std::chrono::microseconds max;       ///< Longest interval between two reads
+  std::chrono::microseconds predicted; ///< Wait before the first read
+
+  explicit PollBackoff(std::chrono::microseconds initial = std::chrono::microseconds(10),
+                       std::chrono::microseconds max = std::chrono::milliseconds(10),
+                       std::chrono::microseconds predicted = std::chrono::microseconds(0)) :
+    initial(initial), max(max), predicted(predicted) {}
+};
+
+/*! \struct PollResult
+ *  \brief Outcome of pollUntil
+ */
+struct PollResult {
+  bool     success;                  ///< Whether the condition was met before the timeout
+  uint32_t value;                    ///< Last value read, after mask and shift; 0xdeaddead if the read failed
+  uint32_t polls;                    ///< Number of reads issued
+  std::chrono::microseconds elapsed; ///< Time spent waiting
+};
+
+static constexpr std::chrono::microseconds POLL_FOREVER = std::chrono::microseconds::max(); ///< pollUntil timeout waiting without limit
+
+/*! \fn PollResult pollUntil(uint32_t address, uint32_t mask, PollCondition condition, uint32_t target, std::chrono::microseconds timeout, const PollBackoff & backoff)
+ *  \brief Reads a resolved register until its value meets a condition, sleeping between the reads
+ *  \details Each read takes the memhub semaphore on its own: do not call within a memhub session, which would be held while sleeping.
+ *            The polling stops on the first failed read.
+ *  \param address Register address
+ *  \param mask Register mask, the value is shifted down to the lowest bit of the mask
+ *  \param condition Condition to wait for
+ *  \param target Value the condition compares to
+ *  \param timeout Maximum time to wait, POLL_FOREVER for no limit
+ *  \param backoff Intervals between the reads
+ */
+PollResult pollUntil(uint32_t address, uint32_t mask, PollCondition condition, uint32_t target,
+                     std::chrono::microseconds timeout, const PollBackoff & backoff = PollBackoff());
+
+/*! \fn PollResult pollUntil(const RegNode & node, PollCondition condition, uint32_t target, std::chrono::microseconds timeout, const PollBackoff & backoff)
+ *  \brief Reads a decoded node until its value meets a condition, see pollUntil above
+ */
+PollResult pollUntil(const RegNode & node, PollCondition condition, uint32_t target,
+                     std::chrono::microseconds timeout, const PollBackoff & backoff = PollBackoff());
+
+static constexpr uint32_t RPC_STATS_HIST_BINS = 24; ///< Bins of the wall time histograms: bin 0 is [0,1) us, bin i is [2^(i-1),2^i) us, the last bin also holds the overflow
+
+/*! \struct RPCMethodStats
+ *  \brief Accumulated statistics of the calls of an RPC method
+ */
+struct RPCMethodStats {
+  uint64_t calls;        ///< Number of calls
+  uint64_t reads;        ///< memhub_read transactions
+  uint64_t writes;       ///< memhub_write transactions
+  uint64_t wordsRead;    ///< Words read from the bus
+  uint64_t wordsWritten; ///< Words written to the bus
+  uint64_t lockWaitNs;   ///< Time spent waiting for the memhub semaphore
+  uint64_t busNs;        ///< Time spent in the memory service
+  uint64_t sleepNs;      ///< Time spent in sleepFor
+  uint64_t lmdbLookups;  ///< Address table lookups not served by the node cache
+  uint64_t lmdbNs;       ///< Time spent in these lookups
+  uint64_t wallNs;       ///< Total execution time
+  uint32_t wallHist[RPC_STATS_HIST_BINS]; ///< Execution time histogram, see RPC_STATS_HIST_BINS
+};
+
+/*! \class RPCStatsScope
+ *  \brief Accounts the memhub, LMDB, sleep and wall time of its lifetime to an RPC method
+ *  \details The statistics are kept per process, i.e. per client connection of the RPC service,
+ *            and returned by the utils.getRPCStats method.
+ *            The register accesses made during the lifetime of the scope are recorded in the memhub trace
+ *            with the id of the method, see memhub_trace_rpc_id.
+ */
+class RPCStatsScope {
+  public:
+    explicit RPCStatsScope(const std::string & method);
+    ~RPCStatsScope();
+
+    RPCStatsScope(const RPCStatsScope&) = delete;
+    RPCStatsScope& operator=(const RPCStatsScope&) = delete;
+
+  private:
+    std::string m_method;
+    struct memhub_stats m_memhub;
+    uint64_t m_sleepNs;
+    uint64_t m_lmdbLookups;
+    uint64_t m_lmdbNs;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+/*! \fn void profiledMethod(const RPCMsg *request, RPCMsg *response)
+ *  \brief Wraps an RPC method so that its calls are accounted in the RPC statistics
+ *  \details To be used when registering the method: modmgr->register_method("module", "method", profiledMethod<method>);
+ */
+template<ModuleManager::rpc_method_t method>
+void profiledMethod(const RPCMsg *request, RPCMsg *response)
+{
+  RPCStatsScope stats(request->get_method());
+  method(request, response);
+}
+
+/*! \fn std::map<std::string, RPCMethodStats> getRPCStatsLocal(bool reset)
+ *  \brief Returns the statistics of the RPC methods called in this process, by method name
+ *  \param reset Clears the statistics after copying them
+ */
+std::map<std::string, RPCMethodStats> getRPCStatsLocal(bool reset);
+
 #endif
@@ -0,0 +1,80 @@
+/*!
+ * \file utils/bulk.h
+ * \brief Scratch buffers and chunked memhub transfers for the bulk register accesses
+ * \details The RPC methods used to hold their data in variable length arrays sized by the request, on a stack
+ *          of a few MB: a large enough count crashed the process. They take instead a ScratchBuffer from a
+ *          pool kept by each process, so that repeated calls reuse the same memory rather than allocating it
+ *          anew. A single buffer is limited to SCRATCH_MAX_WORDS words, requests for more are rejected,
+ *          and the pool keeps at most SCRATCH_POOL_WORDS words between calls.
+ *
+ *          Large transfers are split by readChunked and writeChunked into memhub transactions of at most
+ *          TRANSFER_CHUNK_WORDS words, which release the memhub semaphore in between: a multi-MB block
+ *          read does not hold the other processes off for its whole duration.
+ */
+
+#ifndef UTILS_BULK_H
+#define UTILS_BULK_H
+
+#include <stdint.h>
+#include <cstddef>
+
+namespace wisc {
+  class RPCMsg;
+}
+
+constexpr uint32_t SCRATCH_MAX_WORDS    = 4*1024*1024; ///< Largest scratch buffer, 16 MiB
+constexpr uint32_t SCRATCH_POOL_WORDS   = 8*1024*1024; ///< Largest total size of the buffers kept in the pool between calls
+constexpr uint32_t TRANSFER_CHUNK_WORDS = 16384;       ///< Largest memhub transaction of readChunked and writeChunked
+
+/*! \class ScratchBuffer
+ *  \brief Array of 32-bit words taken from the per-process pool, returned to it on destruction
+ *  \details The pool is not thread safe, like the rest of the per-process state of the modules.
+ */
+class ScratchBuffer
+{
+  public:
+    /*! \brief Takes a buffer of at least words words from the pool
+     *  \param words Number of words, the buffer is invalid if larger than SCRATCH_MAX_WORDS
+     *  \param zero Whether to clear the words, otherwise they hold what the previous user left
+     */
+    explicit ScratchBuffer(size_t words, bool zero = false);
+    ~ScratchBuffer();
+
+    ScratchBuffer(const ScratchBuffer&) = delete;
+    ScratchBuffer& operator=(const ScratchBuffer&) = delete;
+
+    /*! \brief Whether the buffer could be provided; if not, check() sets the error of the response
+     */
+    bool valid() const { return m_data != nullptr || m_size == 0; }
+
+    /*! \brief Returns valid(), setting the "error" of response and logging if the buffer is invalid
+     *  \param response RPC response of the method
+     *  \param what Content of the buffer, for the error message
+     */
+    bool check(wisc::RPCMsg * response, const char * what) const;
+
+    uint32_t * data() { return m_data; }
+    const uint32_t * data() const { return m_data; }
+    size_t size() const { return m_size; }
+    uint32_t & operator[](size_t i) { return m_data[i]; }
+    const uint32_t & operator[](size_t i) const { return m_data[i]; }
+
+  private:
+    uint32_t * m_data;     ///< Words, nullptr if invalid
+    size_t     m_size;     ///< Number of words requested
+    size_t     m_capacity; ///< Number of words allocated
+};
+
+/*! \fn int readChunked(uint32_t address, uint32_t words, uint32_t * data, bool fifo)
+ *  \brief Reads words words at address in transactions of at most TRANSFER_CHUNK_WORDS
+ *  \param fifo Whether the address is a port or a FIFO, read with memhub_fifo_read, or the start of a block
+ *  \returns 0 on success, -1 on the first failing transaction, see memsvc_get_last_error
+ */
+int readChunked(uint32_t address, uint32_t words, uint32_t * data, bool fifo = false);
+
+/*! \fn int writeChunked(uint32_t address, uint32_t words, const uint32_t * data, bool fifo)
+ *  \brief Writes words words at address in transactions of at most TRANSFER_CHUNK_WORDS, see readChunked
+ */
+int writeChunked(uint32_t address, uint32_t words, const uint32_t * data, bool fifo = false);
+
+#endif
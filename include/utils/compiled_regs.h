@@ -0,0 +1,40 @@
+/*!
+ * \file utils/compiled_regs.h
+ * \brief Register descriptors compiled in from the XML address table
+ * \details The registers listed in conf/compiled_regs.txt are resolved at build time by
+ *          scripts/gen_compiled_regs.py, from the address table given by ADDRESS_TABLE_XML, into
+ *          constexpr descriptors of the namespace regs, e.g. regs::GEM_AMC_TTC_CTRL_L1A_ENABLE.
+ *          Passed to readReg, writeReg or getRegNode, they skip the lookup by name.
+ *
+ *          The LMDB table can come from another firmware version than the one the modules were built for:
+ *          openAddressTable, hence every module_init, compares all the descriptors with the table it opens.
+ *          On any mismatch, or when a register was not found in the XML, the registers are looked up by name.
+ */
+
+#ifndef UTILS_COMPILED_REGS_H
+#define UTILS_COMPILED_REGS_H
+
+#include "reg_node.h"
+
+/*! \struct CompiledReg
+ *  \brief Register descriptor resolved at build time
+ */
+struct CompiledReg {
+    const char * name; ///< Full register name
+    RegNode node;      ///< Node computed from the XML address table
+    bool inTable;      ///< Whether the register was found in the XML address table
+};
+
+#include "generated/compiled_regs_gen.h"
+
+struct localArgs;
+
+/*! \fn bool checkCompiledRegs(struct localArgs * la)
+ *  \brief Compares all the compiled-in descriptors with the LMDB address table
+ *  \details Called by openAddressTable each time the table is opened; the mismatching registers are logged
+ *  \param la Local arguments structure, on the table just opened
+ *  \returns \c true if the descriptors can be used
+ */
+bool checkCompiledRegs(struct localArgs * la);
+
+#endif
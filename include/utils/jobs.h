@@ -0,0 +1,91 @@
+/*!
+ * \file utils/jobs.h
+ * \brief Progress and partial results of the routines run as asynchronous jobs
+ * \details The jobs module runs an RPC method in a worker process forked from the client connection, so that the
+ *          client polls the job instead of waiting for a single call of several minutes. The worker shares a JobShared
+ *          block with the connection process: the routines report their progress into it with jobProgress and may
+ *          publish their partial results with jobPartialResult, and the worker serializes the final response into it.
+ *          Outside of a worker these functions do nothing.
+ *
+ *          A routine called in a loop by another one, e.g. genScanLocal for each channel by genChannelScan, reports
+ *          its progress within a JobProgressScope, which maps it to a part of the progress of the caller. Only the
+ *          outermost routine publishes partial results.
+ */
+
+#ifndef UTILS_JOBS_H
+#define UTILS_JOBS_H
+
+#include "utils/bulk.h"
+
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+
+constexpr uint32_t JOB_PROGRESS_SCALE    = 1000000;           ///< Progress of a complete job
+constexpr uint32_t JOB_PARTIAL_MAX_WORDS = SCRATCH_MAX_WORDS; ///< Largest partial result
+constexpr uint32_t JOB_RESULT_MAX_BYTES  = 24*1024*1024;      ///< Largest serialized response of a job
+
+/*! \brief State of a job
+ */
+enum JobStatus : uint32_t {
+    JOB_STARTING = 0, ///< The worker is taking the card-wide job lock
+    JOB_RUNNING  = 1, ///< The worker is running the method
+    JOB_DONE     = 2, ///< The response of the method is in JobShared::result
+    JOB_FAILED   = 3, ///< The worker could not complete, see JobShared::error
+};
+
+/*! \struct JobShared
+ *  \brief Block shared by a worker and its connection process, mapped before the fork
+ *  \details Only the first pages, the header and the published words, are ever touched.
+ */
+struct JobShared {
+    uint32_t status;       ///< JobStatus, set by the worker once the result is written
+    uint32_t progress;     ///< Fraction done, out of JOB_PROGRESS_SCALE
+    uint32_t partialSeq;   ///< Odd while the partial result is written
+    uint32_t partialWords; ///< Size of the partial result
+    uint32_t resultBytes;  ///< Size of the serialized response
+    char     error[256];   ///< Reason of a JOB_FAILED status, or "error" of the response
+    uint32_t partial[JOB_PARTIAL_MAX_WORDS];
+    char     result[JOB_RESULT_MAX_BYTES];
+};
+
+/*! \fn void setJobShared(JobShared * job)
+ *  \brief Sets the block the progress of this process is reported to, called by the worker after the fork
+ */
+void setJobShared(JobShared * job);
+
+/*! \fn void jobProgress(uint32_t done, uint32_t total)
+ *  \brief Reports that done steps out of total are completed
+ */
+void jobProgress(uint32_t done, uint32_t total);
+
+/*! \fn void jobPartialResult(const uint32_t * data, size_t words)
+ *  \brief Publishes the words of the result computed so far, truncated to JOB_PARTIAL_MAX_WORDS
+ *  \details Ignored within a JobProgressScope, the caller publishes its own result.
+ */
+void jobPartialResult(const uint32_t * data, size_t words);
+
+/*! \fn uint32_t readJobPartialResult(const JobShared * job, uint32_t offset, uint32_t maxWords, std::vector<uint32_t> & words, bool & consistent)
+ *  \brief Copies at most maxWords words of the partial result from offset, retrying if the worker updates them meanwhile
+ *  \param words Copied words, empty if offset is beyond the partial result
+ *  \param consistent Set to false if every attempt overlapped an update: words may then mix two publications
+ *  \returns the total size of the partial result
+ */
+uint32_t readJobPartialResult(const JobShared * job, uint32_t offset, uint32_t maxWords, std::vector<uint32_t> & words, bool & consistent);
+
+/*! \class JobProgressScope
+ *  \brief Maps the progress reported within its lifetime to the part part out of parts of the enclosing progress
+ */
+class JobProgressScope {
+  public:
+    JobProgressScope(uint32_t part, uint32_t parts);
+    ~JobProgressScope(); ///< Reports the part as completed
+
+    JobProgressScope(const JobProgressScope&) = delete;
+    JobProgressScope& operator=(const JobProgressScope&) = delete;
+
+  private:
+    double m_base, m_width; ///< Mapping of the enclosing scope
+};
+
+#endif
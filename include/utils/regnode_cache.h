@@ -0,0 +1,61 @@
+/*!
+ * \file utils/regnode_cache.h
+ * \brief Decoded address table nodes shared by all the processes through POSIX shared memory
+ * \details RPC clients are forked, so a per-process cache of the decoded nodes is rebuilt for every
+ *          new connection. The shared cache holds all the nodes of the address table, decoded once into
+ *          a hash table in /dev/shm/gem_regnode_cache, which every process maps read-only.
+ *
+ *          The cache is built by the first process opening the address table after the service start or
+ *          after an update, under a named lock, and atomically swapped in with rename(2).
+ *          It is tagged with the address table generation, a counter in /dev/shm/gem_address_table_generation
+ *          bumped by update_address_table, and with the identity of data.mdb: a cache built for another
+ *          generation or another file is rebuilt, and processes remap the cache when the generation changes.
+ */
+
+#ifndef UTILS_REGNODE_CACHE_H
+#define UTILS_REGNODE_CACHE_H
+
+#include "lmdb_cpp_wrapper.h"
+#include "reg_node.h"
+
+#include <string>
+#include <sys/stat.h>
+
+/*! \fn bool attachRegNodeCache(lmdb::env & env, lmdb::dbi & dbi, uint32_t format, const struct stat & tableStat)
+ *  \brief Maps the shared node cache of the address table, building it first if it is missing or stale
+ *  \param env Opened address table environment
+ *  \param dbi Database handle of the address table
+ *  \param format Record format version of the address table
+ *  \param tableStat Status of the data.mdb file of the address table
+ *  \returns \c true if the cache is mapped; lookups have to go to LMDB otherwise
+ */
+bool attachRegNodeCache(lmdb::env & env, lmdb::dbi & dbi, uint32_t format, const struct stat & tableStat);
+
+/*! \fn void detachRegNodeCache()
+ *  \brief Unmaps the shared node cache, the pointers returned by findSharedRegNode become invalid
+ */
+void detachRegNodeCache();
+
+/*! \fn bool regNodeCacheAttached()
+ *  \brief Returns whether the shared node cache is mapped
+ */
+bool regNodeCacheAttached();
+
+/*! \fn bool regNodeCacheStale()
+ *  \brief Returns whether the address table generation changed since the mapped cache was built
+ */
+bool regNodeCacheStale();
+
+/*! \fn const RegNode * findSharedRegNode(const std::string & regName)
+ *  \brief Looks a register up in the mapped shared node cache
+ *  \details Since the cache holds all the nodes of the address table, nullptr means that the register does not exist
+ *  \returns pointer to the node in the shared memory, valid until detachRegNodeCache is called
+ */
+const RegNode * findSharedRegNode(const std::string & regName);
+
+/*! \fn void bumpAddressTableGeneration()
+ *  \brief Marks the shared node caches built so far as stale, to be called once a new address table is in place
+ */
+void bumpAddressTableGeneration();
+
+#endif
@@ -0,0 +1,42 @@
+/*!
+ * \file utils/system_info.h
+ * \brief Firmware release and system configuration of the AMC, read once per client connection
+ * \details The release and the number of OptoHybrids are read from the card on the first call to getSystemInfo
+ *          and kept until the address table is reopened or invalidateSystemInfo is called, from any process,
+ *          e.g. after a firmware reload: the invalidation goes through a counter shared in
+ *          /dev/shm/gem_system_info_generation, checked on every call.
+ */
+
+#ifndef UTILS_SYSTEM_INFO_H
+#define UTILS_SYSTEM_INFO_H
+
+#include <stdint.h>
+
+struct localArgs;
+
+/*! \struct SystemInfo
+ *  \brief Cached system information
+ */
+struct SystemInfo {
+    uint32_t releaseMajor; ///< GEM_AMC.GEM_SYSTEM.RELEASE.MAJOR
+    uint32_t releaseMinor; ///< GEM_AMC.GEM_SYSTEM.RELEASE.MINOR
+    uint32_t releaseBuild; ///< GEM_AMC.GEM_SYSTEM.RELEASE.BUILD
+    uint32_t numOfOH;      ///< GEM_AMC.GEM_SYSTEM.CONFIG.NUM_OF_OH
+    const char * gemVariant; ///< GEM_VARIANT the modules were built for, e.g. "ge11"
+};
+
+/*! \fn const SystemInfo & getSystemInfo(struct localArgs * la)
+ *  \brief Returns the system information, reading it from the card if not cached
+ *  \details Registers which cannot be read are 0xdeaddead, like with readReg; the information is then read again on the next call
+ *  \param la Local arguments structure
+ */
+const SystemInfo & getSystemInfo(struct localArgs * la);
+
+/*! \fn void invalidateSystemInfo(bool allProcesses)
+ *  \brief Drops the cached system information
+ *  \param allProcesses Whether to invalidate the information cached by all the processes, e.g. after a firmware reload,
+ *                      or only by this one
+ */
+void invalidateSystemInfo(bool allProcesses);
+
+#endif
@@ -52,6 +52,7 @@ void configureVFAT3DacMonitorMultiLink(const RPCMsg *request, RPCMsg *response);
 
 /*! \fn void configureVFAT3sLocal(localArgs * la, uint32_t ohN, uint32_t vfatMask)
  *  \brief Local callable version of configureVFAT3s
+ *  \details Registers already holding their value are not rewritten, see RegShadowScope
  *  \param la Local arguments structure
  *  \param ohN Optohybrid optical link number
  *  \param vfatMask Bitmask of chip positions determining which chips to use
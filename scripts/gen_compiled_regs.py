@@ -0,0 +1,176 @@
+#!/usr/bin/env python3
+"""Generates the register descriptors compiled into the modules, see include/utils/compiled_regs.h
+
+Usage: gen_compiled_regs.py [--xml ADDRESS_TABLE.xml] [--fw-version VERSION] REGISTER_LIST OUTPUT
+
+The registers listed in REGISTER_LIST, one per line, are looked up in the XML address table and
+written to OUTPUT as constexpr CompiledReg descriptors in the namespace regs, named after the
+register with the dots replaced by underscores. The addresses are computed the same way as
+xhal::utils::XHALXMLParser does when update_address_table fills the LMDB address table.
+
+Without --xml, or for registers absent from the address table, the descriptors are generated
+with inTable = false and the modules look the registers up in LMDB at runtime.
+
+OUTPUT is only rewritten when its content changes, so that the build can run this script every time.
+"""
+
+import argparse
+import os
+import re
+import sys
+import xml.etree.ElementTree as ET
+
+BASE_ADDRESS = 0x64000000  # CTP7 AXI base address of the GEM_AMC address space
+WORD_SHIFT = 2             # The XML addresses are in 32-bit words
+
+MODES = {
+    "single": "REG_MODE_SINGLE",
+    "block": "REG_MODE_BLOCK",
+    "fifo": "REG_MODE_FIFO",
+    "incremental": "REG_MODE_INCREMENTAL",
+    "non-incremental": "REG_MODE_NON_INCREMENTAL",
+    "port": "REG_MODE_PORT",
+}
+
+
+def parse_int(value, default):
+    if value is None or value == "":
+        return default
+    return int(value, 0)
+
+
+def perm_expr(permission):
+    flags = []
+    if "r" in permission:
+        flags.append("REG_PERM_READ")
+    if "w" in permission:
+        flags.append("REG_PERM_WRITE")
+    return "|".join(flags) if flags else "0"
+
+
+def walk(element, path, prefix, address, nodes):
+    """Adds the nodes below element to nodes, keyed by full register name"""
+    for child in element.findall("node"):
+        generate = child.get("generate", "false").lower() == "true"
+        indices = range(parse_int(child.get("generate_size"), 1)) if generate else [None]
+        step = parse_int(child.get("generate_address_step"), 0)
+        var = child.get("generate_idx_var", "")
+        for n, idx in enumerate(indices):
+            node_id = child.get("id")
+            if idx is not None:
+                node_id = node_id.replace("${%s}" % var, str(idx))
+            name = prefix + "." + node_id if prefix else node_id
+            node_address = address + parse_int(child.get("address"), 0) + n*step
+            nodes[name] = {
+                "address": BASE_ADDRESS + (node_address << WORD_SHIFT),
+                "mask": parse_int(child.get("mask"), 0xFFFFFFFF),
+                "size": parse_int(child.get("size"), 1),
+                "mode": child.get("mode", "single"),
+                "perm": child.get("permission", ""),
+            }
+            subtree = child
+            module = child.get("module")
+            if module:
+                module_path = os.path.join(os.path.dirname(path), module.replace("file://", ""))
+                subtree = ET.parse(module_path).getroot()
+                path_below = module_path
+            else:
+                path_below = path
+            walk(subtree, path_below, name, node_address, nodes)
+
+
+def load_nodes(xml_path):
+    nodes = {}
+    root = ET.parse(xml_path).getroot()
+    # The top node is not part of the register names
+    walk(root, xml_path, "", parse_int(root.get("address"), 0), nodes)
+    return nodes
+
+
+def read_register_list(path):
+    names = []
+    with open(path) as f:
+        for line in f:
+            line = line.split("#", 1)[0].strip()
+            if line:
+                names.append(line)
+    return names
+
+
+def identifier(name):
+    return re.sub(r"[^A-Za-z0-9_]", "_", name)
+
+
+def generate(names, nodes, xml_path, fw_version):
+    lines = [
+        "/* Generated by scripts/gen_compiled_regs.py, do not edit */",
+        "",
+        "#ifndef COMPILED_REGS_GEN_H",
+        "#define COMPILED_REGS_GEN_H",
+        "",
+        "namespace regs {",
+        '    constexpr const char FW_VERSION[]    = "%s"; ///< Firmware version of the address table' % fw_version,
+        '    constexpr const char ADDRESS_TABLE[] = "%s"; ///< Address table the descriptors were generated from'
+        % (os.path.basename(xml_path) if xml_path else ""),
+        "",
+    ]
+    seen = {}
+    for name in names:
+        ident = identifier(name)
+        if ident in seen and seen[ident] != name:
+            sys.exit("%s and %s map to the same identifier %s" % (seen[ident], name, ident))
+        if ident in seen:
+            continue
+        seen[ident] = name
+        node = nodes.get(name)
+        if node is None:
+            if xml_path:
+                print("warning: %s not found in %s" % (name, xml_path), file=sys.stderr)
+            lines.append('    constexpr CompiledReg %s = {"%s", {0, 0, 0, 0, REG_MODE_UNKNOWN, 0}, false};' % (ident, name))
+            continue
+        if node["mode"] not in MODES:
+            sys.exit("%s has an unknown mode %s" % (name, node["mode"]))
+        mask = node["mask"]
+        shift = (mask & -mask).bit_length() - 1 if mask else 0
+        lines.append('    constexpr CompiledReg %s = {"%s", {0x%08x, 0x%08x, %d, %d, %s, %s}, true};'
+                     % (ident, name, node["address"], mask, node["size"], shift, MODES[node["mode"]], perm_expr(node["perm"])))
+    lines += [
+        "",
+        "    /*! \\brief All the compiled-in descriptors, checked against the LMDB address table by openAddressTable",
+        "     */",
+        "    constexpr const CompiledReg * ALL[] = {",
+    ]
+    lines += ["        &%s," % ident for ident in seen]
+    lines += [
+        "    };",
+        "}",
+        "",
+        "#endif",
+        "",
+    ]
+    return "\n".join(lines)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--xml", default="", help="XML address table, e.g. gem_amc_top.xml")
+    parser.add_argument("--fw-version", default="", help="Firmware version of the address table")
+    parser.add_argument("register_list")
+    parser.add_argument("output")
+    args = parser.parse_args()
+
+    names = read_register_list(args.register_list)
+    nodes = load_nodes(args.xml) if args.xml else {}
+    content = generate(names, nodes, args.xml, args.fw_version)
+
+    if os.path.exists(args.output):
+        with open(args.output) as f:
+            if f.read() == content:
+                return
+    os.makedirs(os.path.dirname(os.path.abspath(args.output)), exist_ok=True)
+    with open(args.output, "w") as f:
+        f.write(content)
+
+
+if __name__ == "__main__":
+    main()
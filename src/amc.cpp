@@ -20,26 +20,11 @@
 
 unsigned int fw_version_check(const char* caller_name, localArgs *la)
 {
-    int iFWVersion = readReg(la, "GEM_AMC.GEM_SYSTEM.RELEASE.MAJOR");
-    char regBuf[200];
-    switch (iFWVersion) {
-        case 1:
-        {
-            LOGGER->log_message(LogManager::INFO, "System release major is 1, v2B electronics behavior");
-            break;
-        }
-        case 3:
-        {
-            LOGGER->log_message(LogManager::INFO, "System release major is 3, v3 electronics behavior");
-            break;
-        }
-        default:
-        {
-            LOGGER->log_message(LogManager::ERROR, "Unexpected value for system release major!");
-            sprintf(regBuf,"Unexpected value for system release major!");
-            la->response->set_string("error",regBuf);
-            break;
-        }
+    // The release is read once per client connection, and logged at that time
+    const unsigned int iFWVersion = getSystemInfo(la).releaseMajor;
+    if (iFWVersion != 1 && iFWVersion != 3) {
+        LOGGER->log_message(LogManager::ERROR, stdsprintf("%s: unexpected value for system release major: %u", caller_name, iFWVersion));
+        la->response->set_string("error", "Unexpected value for system release major!");
     }
     return iFWVersion;
 }
@@ -80,7 +65,7 @@ void getOHVFATMaskMultiLink(const RPCMsg *request, RPCMsg *response)
         ohMask = request->get_word("ohMask");
     }
 
-    unsigned int NOH = readReg(&la, "GEM_AMC.GEM_SYSTEM.CONFIG.NUM_OF_OH");
+    unsigned int NOH = getSystemInfo(&la).numOfOH;
     if (request->get_key_exists("NOH")) {
         unsigned int NOH_requested = request->get_word("NOH");
         if (NOH_requested <= NOH)
@@ -151,7 +136,7 @@ std::vector<uint32_t> sbitReadOutLocal(localArgs *la, uint32_t ohN, uint32_t acq
     }
 
     //Take the VFATs out of slow control only mode
-    writeReg(la, "GEM_AMC.GEM_SYSTEM.VFAT3.SC_ONLY_MODE", 0x0);
+    writeReg(la, regs::GEM_AMC_GEM_SYSTEM_VFAT3_SC_ONLY_MODE, 0x0);
 
     //[0:10] address of sbit cluster
     //[11:13] cluster size
@@ -174,7 +159,7 @@ std::vector<uint32_t> sbitReadOutLocal(localArgs *la, uint32_t ohN, uint32_t acq
         writeRawAddress(addrSbitMonReset, 0x1, la->response);
 
         //wait for 4095 clock cycles then read L1A delay
-        std::this_thread::sleep_for (std::chrono::nanoseconds(4095*25));
+        sleepFor(std::chrono::nanoseconds(4095*25));
         l1ADelay = readRawAddress(addrSbitL1ADelay, la->response);
         if (l1ADelay > 4095) { //Anything larger than this consider as overflow
             l1ADelay = 4095; //(0xFFF in hex)
@@ -245,56 +230,59 @@ extern "C" {
             LOGGER->log_message(LogManager::ERROR, "Unable to load module");
             return; // Do not register our functions, we depend on memsvc.
         }
+        if (!openAddressTable()) {
+            LOGGER->log_message(LogManager::WARNING, "Address table not available yet, it will be opened on first use");
+        }
 
-        modmgr->register_method("amc", "getOHVFATMask",          getOHVFATMask);
-        modmgr->register_method("amc", "getOHVFATMaskMultiLink", getOHVFATMaskMultiLink);
-        modmgr->register_method("amc", "repeatedRegRead",        repeatedRegRead);
-        modmgr->register_method("amc", "sbitReadOut",            sbitReadOut);
+        modmgr->register_method("amc", "getOHVFATMask",          profiledMethod<getOHVFATMask>);
+        modmgr->register_method("amc", "getOHVFATMaskMultiLink", profiledMethod<getOHVFATMaskMultiLink>);
+        modmgr->register_method("amc", "repeatedRegRead",        profiledMethod<repeatedRegRead>);
+        modmgr->register_method("amc", "sbitReadOut",            profiledMethod<sbitReadOut>);
 
         // DAQ module methods (from amc/daq)
-        modmgr->register_method("amc", "enableDAQLink",           enableDAQLink);
-        modmgr->register_method("amc", "disableDAQLink",          disableDAQLink);
-        modmgr->register_method("amc", "setZS",                   setZS);
-        modmgr->register_method("amc", "resetDAQLink",            resetDAQLink);
-        modmgr->register_method("amc", "setDAQLinkInputTimeout",  setDAQLinkInputTimeout);
-        modmgr->register_method("amc", "setDAQLinkRunType",       setDAQLinkRunType);
-        modmgr->register_method("amc", "setDAQLinkRunParameter",  setDAQLinkRunParameter);
-        modmgr->register_method("amc", "setDAQLinkRunParameters", setDAQLinkRunParameters);
-
-        modmgr->register_method("amc", "configureDAQModule",   configureDAQModule);
-        modmgr->register_method("amc", "enableDAQModule",      enableDAQModule);
+        modmgr->register_method("amc", "enableDAQLink",           profiledMethod<enableDAQLink>);
+        modmgr->register_method("amc", "disableDAQLink",          profiledMethod<disableDAQLink>);
+        modmgr->register_method("amc", "setZS",                   profiledMethod<setZS>);
+        modmgr->register_method("amc", "resetDAQLink",            profiledMethod<resetDAQLink>);
+        modmgr->register_method("amc", "setDAQLinkInputTimeout",  profiledMethod<setDAQLinkInputTimeout>);
+        modmgr->register_method("amc", "setDAQLinkRunType",       profiledMethod<setDAQLinkRunType>);
+        modmgr->register_method("amc", "setDAQLinkRunParameter",  profiledMethod<setDAQLinkRunParameter>);
+        modmgr->register_method("amc", "setDAQLinkRunParameters", profiledMethod<setDAQLinkRunParameters>);
+
+        modmgr->register_method("amc", "configureDAQModule",   profiledMethod<configureDAQModule>);
+        modmgr->register_method("amc", "enableDAQModule",      profiledMethod<enableDAQModule>);
 
         // TTC module methods (from amc/ttc)
-        modmgr->register_method("amc", "ttcModuleReset",     ttcModuleReset);
-        modmgr->register_method("amc", "ttcMMCMReset",       ttcMMCMReset);
-        modmgr->register_method("amc", "ttcMMCMPhaseShift",  ttcMMCMPhaseShift);
-        modmgr->register_method("amc", "checkPLLLock",       checkPLLLock);
-        modmgr->register_method("amc", "getMMCMPhaseMean",   getMMCMPhaseMean);
-        modmgr->register_method("amc", "getMMCMPhaseMedian", getMMCMPhaseMedian);
-        modmgr->register_method("amc", "getGTHPhaseMean",    getGTHPhaseMean);
-        modmgr->register_method("amc", "getGTHPhaseMedian",  getGTHPhaseMedian);
-        modmgr->register_method("amc", "ttcCounterReset",    ttcCounterReset);
-        modmgr->register_method("amc", "getL1AEnable",       getL1AEnable);
-        modmgr->register_method("amc", "setL1AEnable",       setL1AEnable);
-        modmgr->register_method("amc", "getTTCConfig",       getTTCConfig);
-        modmgr->register_method("amc", "setTTCConfig",       setTTCConfig);
-        modmgr->register_method("amc", "getTTCStatus",       getTTCStatus);
-        modmgr->register_method("amc", "getTTCErrorCount",   getTTCErrorCount);
-        modmgr->register_method("amc", "getTTCCounter",      getTTCCounter);
-        modmgr->register_method("amc", "getL1AID",           getL1AID);
-        modmgr->register_method("amc", "getL1ARate",         getL1ARate);
-        modmgr->register_method("amc", "getTTCSpyBuffer",    getTTCSpyBuffer);
+        modmgr->register_method("amc", "ttcModuleReset",     profiledMethod<ttcModuleReset>);
+        modmgr->register_method("amc", "ttcMMCMReset",       profiledMethod<ttcMMCMReset>);
+        modmgr->register_method("amc", "ttcMMCMPhaseShift",  profiledMethod<ttcMMCMPhaseShift>);
+        modmgr->register_method("amc", "checkPLLLock",       profiledMethod<checkPLLLock>);
+        modmgr->register_method("amc", "getMMCMPhaseMean",   profiledMethod<getMMCMPhaseMean>);
+        modmgr->register_method("amc", "getMMCMPhaseMedian", profiledMethod<getMMCMPhaseMedian>);
+        modmgr->register_method("amc", "getGTHPhaseMean",    profiledMethod<getGTHPhaseMean>);
+        modmgr->register_method("amc", "getGTHPhaseMedian",  profiledMethod<getGTHPhaseMedian>);
+        modmgr->register_method("amc", "ttcCounterReset",    profiledMethod<ttcCounterReset>);
+        modmgr->register_method("amc", "getL1AEnable",       profiledMethod<getL1AEnable>);
+        modmgr->register_method("amc", "setL1AEnable",       profiledMethod<setL1AEnable>);
+        modmgr->register_method("amc", "getTTCConfig",       profiledMethod<getTTCConfig>);
+        modmgr->register_method("amc", "setTTCConfig",       profiledMethod<setTTCConfig>);
+        modmgr->register_method("amc", "getTTCStatus",       profiledMethod<getTTCStatus>);
+        modmgr->register_method("amc", "getTTCErrorCount",   profiledMethod<getTTCErrorCount>);
+        modmgr->register_method("amc", "getTTCCounter",      profiledMethod<getTTCCounter>);
+        modmgr->register_method("amc", "getL1AID",           profiledMethod<getL1AID>);
+        modmgr->register_method("amc", "getL1ARate",         profiledMethod<getL1ARate>);
+        modmgr->register_method("amc", "getTTCSpyBuffer",    profiledMethod<getTTCSpyBuffer>);
 
         // SCA module methods (from amc/sca)
-        // modmgr->register_method("amc", "scaHardResetEnable", scaHardResetEnable);
-        modmgr->register_method("amc", "readSCAADCSensor", readSCAADCSensor);
-        modmgr->register_method("amc", "readSCAADCTemperatureSensors", readSCAADCTemperatureSensors);
-        modmgr->register_method("amc", "readSCAADCVoltageSensors", readSCAADCVoltageSensors);
-        modmgr->register_method("amc", "readSCAADCSignalStrengthSensors", readSCAADCSignalStrengthSensors);
-        modmgr->register_method("amc", "readAllSCAADCSensors", readAllSCAADCSensors);
+        // modmgr->register_method("amc", "scaHardResetEnable", profiledMethod<scaHardResetEnable>);
+        modmgr->register_method("amc", "readSCAADCSensor", profiledMethod<readSCAADCSensor>);
+        modmgr->register_method("amc", "readSCAADCTemperatureSensors", profiledMethod<readSCAADCTemperatureSensors>);
+        modmgr->register_method("amc", "readSCAADCVoltageSensors", profiledMethod<readSCAADCVoltageSensors>);
+        modmgr->register_method("amc", "readSCAADCSignalStrengthSensors", profiledMethod<readSCAADCSignalStrengthSensors>);
+        modmgr->register_method("amc", "readAllSCAADCSensors", profiledMethod<readAllSCAADCSensors>);
 
         // BLASTER RAM module methods (from amc/blaster_ram)
-        modmgr->register_method("amc", "writeConfRAM", writeConfRAM);
-        modmgr->register_method("amc", "readConfRAM",  readConfRAM);
+        modmgr->register_method("amc", "writeConfRAM", profiledMethod<writeConfRAM>);
+        modmgr->register_method("amc", "readConfRAM",  profiledMethod<readConfRAM>);
     }
 }
@@ -434,11 +434,13 @@ void writeConfRAM(const RPCMsg *request, RPCMsg *response)
   LOGGER->log_message(LogManager::DEBUG, stdsprintf("BLASTERTypeT is 0x%x", type));
 
   uint32_t blob_sz = request->get_binarydata_size("confblob");
-  uint32_t confblob[blob_sz];
+  ScratchBuffer confblob(blob_sz);
+  if (!confblob.check(response, "Configuration blob"))
+    return;
   LOGGER->log_message(LogManager::DEBUG, stdsprintf("blob_sz is 0x%x", blob_sz));
-  request->get_binarydata("confblob", confblob, blob_sz);
+  request->get_binarydata("confblob", confblob.data(), blob_sz);
   try {
-    writeConfRAMLocal(&la, type, confblob, blob_sz);
+    writeConfRAMLocal(&la, type, confblob.data(), blob_sz);
   } catch (std::runtime_error& e) {
     std::stringstream errmsg;
     errmsg << "Error writing configuration RAM: " << e.what();
@@ -22,12 +22,15 @@ void sendSCACommand(localArgs* la, uint8_t const& ch, uint8_t const& cmd, uint8_
   // FIXME: DECIDE WHETHER TO HAVE HERE //   writeReg(la,"GEM_AMC.SLOW_CONTROL.SCA.ADC_MONITORING.MONITORING_OFF",         0xffffffff);
   // FIXME: DECIDE WHETHER TO HAVE HERE // }
 
-  writeReg(la,"GEM_AMC.SLOW_CONTROL.SCA.MANUAL_CONTROL.LINK_ENABLE_MASK",       ohMask);
-  writeReg(la,"GEM_AMC.SLOW_CONTROL.SCA.MANUAL_CONTROL.SCA_CMD.SCA_CMD_CHANNEL",ch);
-  writeReg(la,"GEM_AMC.SLOW_CONTROL.SCA.MANUAL_CONTROL.SCA_CMD.SCA_CMD_COMMAND",cmd);
-  writeReg(la,"GEM_AMC.SLOW_CONTROL.SCA.MANUAL_CONTROL.SCA_CMD.SCA_CMD_LENGTH", len);
-  writeReg(la,"GEM_AMC.SLOW_CONTROL.SCA.MANUAL_CONTROL.SCA_CMD.SCA_CMD_DATA",   formatSCAData(data));
-  writeReg(la,"GEM_AMC.SLOW_CONTROL.SCA.MANUAL_CONTROL.SCA_CMD.SCA_CMD_EXECUTE",0x1);
+  // The command fields are merged per word, the execute bit is only set once they are all written
+  RegWriteBatch scaWrites(la);
+  scaWrites.write(regs::GEM_AMC_SLOW_CONTROL_SCA_MANUAL_CONTROL_LINK_ENABLE_MASK,        ohMask);
+  scaWrites.write(regs::GEM_AMC_SLOW_CONTROL_SCA_MANUAL_CONTROL_SCA_CMD_SCA_CMD_CHANNEL, ch);
+  scaWrites.write(regs::GEM_AMC_SLOW_CONTROL_SCA_MANUAL_CONTROL_SCA_CMD_SCA_CMD_COMMAND, cmd);
+  scaWrites.write(regs::GEM_AMC_SLOW_CONTROL_SCA_MANUAL_CONTROL_SCA_CMD_SCA_CMD_LENGTH,  len);
+  scaWrites.write(regs::GEM_AMC_SLOW_CONTROL_SCA_MANUAL_CONTROL_SCA_CMD_SCA_CMD_DATA,    formatSCAData(data));
+  scaWrites.barrier();
+  scaWrites.write(regs::GEM_AMC_SLOW_CONTROL_SCA_MANUAL_CONTROL_SCA_CMD_SCA_CMD_EXECUTE, 0x1);
 }
 
 std::vector<uint32_t> sendSCACommandWithReply(localArgs* la, uint8_t const& ch, uint8_t const& cmd, uint8_t const& len, uint32_t data, uint16_t const& ohMask)
@@ -60,9 +63,9 @@ std::vector<uint32_t> sendSCACommandWithReply(localArgs* la, uint8_t const& ch,
 std::vector<uint32_t> scaCTRLCommand(localArgs* la, SCACTRLCommandT const& cmd, uint16_t const& ohMask, uint8_t const& len, uint32_t const& data)
 {
   uint32_t monMask = 0xffffffff;
-  if (regExists(la, "GEM_AMC.SLOW_CONTROL.SCA.ADC_MONITORING.MONITORING_OFF")) {
-    monMask = readReg(la,"GEM_AMC.SLOW_CONTROL.SCA.ADC_MONITORING.MONITORING_OFF");
-    writeReg(la,"GEM_AMC.SLOW_CONTROL.SCA.ADC_MONITORING.MONITORING_OFF",       0xffffffff);
+  if (regExists(la, regs::GEM_AMC_SLOW_CONTROL_SCA_ADC_MONITORING_MONITORING_OFF)) {
+    monMask = readReg(la,regs::GEM_AMC_SLOW_CONTROL_SCA_ADC_MONITORING_MONITORING_OFF);
+    writeReg(la,regs::GEM_AMC_SLOW_CONTROL_SCA_ADC_MONITORING_MONITORING_OFF,       0xffffffff);
   }
 
   std::vector<uint32_t> result;
@@ -92,8 +95,8 @@ std::vector<uint32_t> scaCTRLCommand(localArgs* la, SCACTRLCommandT const& cmd,
     result = sendSCACommandWithReply(la, SCAChannel::CTRL, SCACTRLCommand::GET_DATA, len, data, ohMask);
   }
 
-  if (regExists(la, "GEM_AMC.SLOW_CONTROL.SCA.ADC_MONITORING.MONITORING_OFF")) {
-    writeReg(la,"GEM_AMC.SLOW_CONTROL.SCA.ADC_MONITORING.MONITORING_OFF", monMask);
+  if (regExists(la, regs::GEM_AMC_SLOW_CONTROL_SCA_ADC_MONITORING_MONITORING_OFF)) {
+    writeReg(la,regs::GEM_AMC_SLOW_CONTROL_SCA_ADC_MONITORING_MONITORING_OFF, monMask);
   }
 
   return result;
@@ -111,15 +114,15 @@ std::vector<uint32_t> scaI2CCommand(localArgs* la, SCAI2CChannelT const& ch, SCA
   std::vector<uint32_t> result;
 
   uint32_t monMask = 0xffffffff;
-  if (regExists(la, "GEM_AMC.SLOW_CONTROL.SCA.ADC_MONITORING.MONITORING_OFF")) {
-    monMask = readReg(la,"GEM_AMC.SLOW_CONTROL.SCA.ADC_MONITORING.MONITORING_OFF");
-    writeReg(la,"GEM_AMC.SLOW_CONTROL.SCA.ADC_MONITORING.MONITORING_OFF",       0xffffffff);
+  if (regExists(la, regs::GEM_AMC_SLOW_CONTROL_SCA_ADC_MONITORING_MONITORING_OFF)) {
+    monMask = readReg(la,regs::GEM_AMC_SLOW_CONTROL_SCA_ADC_MONITORING_MONITORING_OFF);
+    writeReg(la,regs::GEM_AMC_SLOW_CONTROL_SCA_ADC_MONITORING_MONITORING_OFF,       0xffffffff);
   }
 
   sendSCACommand(la, ch, cmd, len, data, ohMask);
 
-  if (regExists(la, "GEM_AMC.SLOW_CONTROL.SCA.ADC_MONITORING.MONITORING_OFF")) {
-    writeReg(la,"GEM_AMC.SLOW_CONTROL.SCA.ADC_MONITORING.MONITORING_OFF", monMask);
+  if (regExists(la, regs::GEM_AMC_SLOW_CONTROL_SCA_ADC_MONITORING_MONITORING_OFF)) {
+    writeReg(la,regs::GEM_AMC_SLOW_CONTROL_SCA_ADC_MONITORING_MONITORING_OFF, monMask);
   }
 
   return result;
@@ -129,15 +132,15 @@ std::vector<uint32_t> scaGPIOCommandLocal(localArgs* la, SCAGPIOCommandT const&
 {
   // enable the GPIO bus through the CTRL CRB register, bit 2
   uint32_t monMask = 0xffffffff;
-  if (regExists(la, "GEM_AMC.SLOW_CONTROL.SCA.ADC_MONITORING.MONITORING_OFF")) {
-    monMask = readReg(la,"GEM_AMC.SLOW_CONTROL.SCA.ADC_MONITORING.MONITORING_OFF");
-    writeReg(la,"GEM_AMC.SLOW_CONTROL.SCA.ADC_MONITORING.MONITORING_OFF",       0xffffffff);
+  if (regExists(la, regs::GEM_AMC_SLOW_CONTROL_SCA_ADC_MONITORING_MONITORING_OFF)) {
+    monMask = readReg(la,regs::GEM_AMC_SLOW_CONTROL_SCA_ADC_MONITORING_MONITORING_OFF);
+    writeReg(la,regs::GEM_AMC_SLOW_CONTROL_SCA_ADC_MONITORING_MONITORING_OFF,       0xffffffff);
   }
 
   std::vector<uint32_t> reply = sendSCACommandWithReply(la, SCAChannel::GPIO, cmd, len, data, ohMask);
 
-  if (regExists(la, "GEM_AMC.SLOW_CONTROL.SCA.ADC_MONITORING.MONITORING_OFF")) {
-    writeReg(la,"GEM_AMC.SLOW_CONTROL.SCA.ADC_MONITORING.MONITORING_OFF", monMask);
+  if (regExists(la, regs::GEM_AMC_SLOW_CONTROL_SCA_ADC_MONITORING_MONITORING_OFF)) {
+    writeReg(la,regs::GEM_AMC_SLOW_CONTROL_SCA_ADC_MONITORING_MONITORING_OFF, monMask);
   }
 
   return reply;
@@ -146,9 +149,9 @@ std::vector<uint32_t> scaGPIOCommandLocal(localArgs* la, SCAGPIOCommandT const&
 std::vector<uint32_t> scaADCCommand(localArgs* la, SCAADCChannelT const& ch, uint16_t const& ohMask)
 {
   uint32_t monMask = 0xffffffff;
-  if (regExists(la, "GEM_AMC.SLOW_CONTROL.SCA.ADC_MONITORING.MONITORING_OFF")) {
-    monMask = readReg(la,"GEM_AMC.SLOW_CONTROL.SCA.ADC_MONITORING.MONITORING_OFF");
-    writeReg(la,"GEM_AMC.SLOW_CONTROL.SCA.ADC_MONITORING.MONITORING_OFF",       0xffffffff);
+  if (regExists(la, regs::GEM_AMC_SLOW_CONTROL_SCA_ADC_MONITORING_MONITORING_OFF)) {
+    monMask = readReg(la,regs::GEM_AMC_SLOW_CONTROL_SCA_ADC_MONITORING_MONITORING_OFF);
+    writeReg(la,regs::GEM_AMC_SLOW_CONTROL_SCA_ADC_MONITORING_MONITORING_OFF,       0xffffffff);
   }
 
   // enable the ADC bus through the CTRL CRD register, bit 4
@@ -172,8 +175,8 @@ std::vector<uint32_t> scaADCCommand(localArgs* la, SCAADCChannelT const& ch, uin
   // // get the offset
   // std::vector<uint32_t> raw  = sendSCACommandWithReply(la, SCAChannel::ADC, SCAADCCommand::ADC_R_OFS, 0x1, 0x0, ohMask);
 
-  if (regExists(la, "GEM_AMC.SLOW_CONTROL.SCA.ADC_MONITORING.MONITORING_OFF")) {
-    writeReg(la,"GEM_AMC.SLOW_CONTROL.SCA.ADC_MONITORING.MONITORING_OFF", monMask);
+  if (regExists(la, regs::GEM_AMC_SLOW_CONTROL_SCA_ADC_MONITORING_MONITORING_OFF)) {
+    writeReg(la,regs::GEM_AMC_SLOW_CONTROL_SCA_ADC_MONITORING_MONITORING_OFF, monMask);
   }
 
   return result;
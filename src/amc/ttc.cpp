@@ -47,17 +47,29 @@ void ttcMMCMPhaseShiftLocal(localArgs* la,
   vec_ttcCtrlRegs.push_back(std::make_pair("PA_MANUAL_PLL_RESET"           , 0x1));
   vec_ttcCtrlRegs.push_back(std::make_pair("CNT_RESET"                     , 0x1));
 
-  // write & readback of aforementioned registers
-  uint32_t readback;
-  for (auto ttcRegIter = vec_ttcCtrlRegs.begin(); ttcRegIter != vec_ttcCtrlRegs.end(); ++ttcRegIter) {
-    writeReg(la, strTTCCtrlBaseNode + (*ttcRegIter).first, (*ttcRegIter).second);
-    std::this_thread::sleep_for(std::chrono::microseconds(250));
-    readback = readReg(la, strTTCCtrlBaseNode + (*ttcRegIter).first);
-    if (readback != (*ttcRegIter).second) {
+  // write of aforementioned registers, merged per word; the PLL and counter resets go out after the configuration
+  {
+    RegWriteBatch ttcCtrlWrites(la);
+    for (auto const& ttcReg : vec_ttcCtrlRegs) {
+      if (ttcReg.first == "PA_MANUAL_PLL_RESET" || ttcReg.first == "CNT_RESET")
+        ttcCtrlWrites.barrier();
+      ttcCtrlWrites.write(strTTCCtrlBaseNode + ttcReg.first, ttcReg.second);
+    }
+  }
+  sleepFor(std::chrono::microseconds(250));
+
+  // readback of aforementioned registers
+  std::vector<std::string> ttcRegNames;
+  std::vector<uint32_t> readbacks;
+  for (auto const& ttcReg : vec_ttcCtrlRegs)
+    ttcRegNames.push_back(strTTCCtrlBaseNode + ttcReg.first);
+  readRegs(la, ttcRegNames, readbacks);
+  for (size_t i = 0; i < vec_ttcCtrlRegs.size(); ++i) {
+    if (readbacks[i] != vec_ttcCtrlRegs[i].second) {
       std::stringstream errmsg;
-      errmsg << "Readback of " << strTTCCtrlBaseNode + (ttcRegIter->first).c_str()
-             << " failed, value is " << readback
-             << ", expected " << ttcRegIter->second;
+      errmsg << "Readback of " << ttcRegNames[i]
+             << " failed, value is " << readbacks[i]
+             << ", expected " << vec_ttcCtrlRegs[i].second;
 
       LOGGER->log_message(LogManager::ERROR, "ttcMMCMPhaseShiftLocal: " + errmsg.str());
       la->response->set_string("error", errmsg.str());
@@ -556,7 +568,7 @@ int checkPLLLockLocal(localArgs* la, int readAttempts)
     writeReg(la,"GEM_AMC.TTC.CTRL.PA_MANUAL_PLL_RESET", 0x1);
 
     // wait 100us to allow the PLL to lock
-    std::this_thread::sleep_for(std::chrono::microseconds(100));
+    sleepFor(std::chrono::microseconds(100));
 
     // Check if it's locked
     if (readReg(la,"GEM_AMC.TTC.STATUS.CLK.PHASE_LOCKED") != 0) {
@@ -636,13 +648,13 @@ void ttcCounterResetLocal(localArgs* la)
 
 bool getL1AEnableLocal(localArgs* la)
 {
-  return readReg(la, "GEM_AMC.TTC.CTRL.L1A_ENABLE");
+  return readReg(la, regs::GEM_AMC_TTC_CTRL_L1A_ENABLE);
 }
 
 void setL1AEnableLocal(localArgs* la,
                        bool enable)
 {
-  writeReg(la, "GEM_AMC.TTC.CTRL.L1A_ENABLE", int(enable));
+  writeReg(la, regs::GEM_AMC_TTC_CTRL_L1A_ENABLE, int(enable));
 }
 
 /*** CONFIG submodule ***/
@@ -3,38 +3,44 @@
 #include "calibration_routines.h"
 #include <chrono>
 #include <math.h>
+#include <memory>
 #include <pthread.h>
 #include "optohybrid.h"
+#include "scurve_fit.h"
 #include <thread>
 #include "vfat3.h"
 #include "hw_constants.h"
 
 using namespace std::string_literals;
 
-std::unordered_map<std::string, uint32_t> setSingleChanMask(unsigned int ohN, unsigned int vfatN, unsigned int ch, localArgs *la)
+static const std::string CHAN_MASK_PATTERN = "GEM_AMC.OH.OH{}.GEB.VFAT{}.VFAT_CHANNELS.CHANNEL{}.MASK";
+
+ChanMaskBackup setSingleChanMask(unsigned int ohN, unsigned int vfatN, unsigned int ch, localArgs *la)
 {
-    std::unordered_map<std::string, uint32_t> map_chanOrigMask;
+    ChanMaskBackup map_chanOrigMask;
 
+    const RegArray chanMasks(la, stdsprintf("GEM_AMC.OH.OH%i.GEB.VFAT%i.VFAT_CHANNELS.CHANNEL{}.MASK", ohN, vfatN), {128});
+    RegNode node;
     for (unsigned int chan=0; chan<128; ++chan) { //Loop Over All Channels
         uint32_t chMask = 1;
         if ( ch == chan) //Do not mask the channel of interest
             chMask = 0;
 
         //store the original channel mask
-        const std::string reg = "GEM_AMC.OH.OH"s + std::to_string(ohN) + ".GEB.VFAT" + std::to_string(vfatN) + ".VFAT_CHANNELS.CHANNEL" + std::to_string(chan) + ".MASK";
-        map_chanOrigMask[reg] = readReg(la, reg);
+        if (chanMasks.node(node, chan))
+            map_chanOrigMask.emplace_back(node, chanMasks.read(chan));
 
         //write the new channel mask
-        writeReg(la, reg, chMask);
+        chanMasks.write(chMask, chan);
     }
 
     return map_chanOrigMask;
 }
 
-void applyChanMask(std::unordered_map<std::string, uint32_t> map_chanOrigMask, localArgs *la)
+void applyChanMask(const ChanMaskBackup & map_chanOrigMask, localArgs *la)
 {
-    for (auto chanPtr = map_chanOrigMask.begin(); chanPtr != map_chanOrigMask.end(); ++chanPtr) {
-        writeReg(la, (*chanPtr).first, (*chanPtr).second);
+    for (auto const& chanMask : map_chanOrigMask) {
+        writeReg(la, chanMask.first, chanMask.second, CHAN_MASK_PATTERN);
     }
 }
 
@@ -43,19 +49,22 @@ bool confCalPulseLocal(localArgs *la, uint32_t ohN, uint32_t mask, uint32_t ch,
     //Determine the inverse of the vfatmask
     uint32_t notmask = ~mask & 0xFFFFFF;
 
-    char regBuf[200];
     if (ch >= 128 && toggleOn == true) { //Case: Bad Config, asked for OR of all channels
         la->response->set_string("error","confCalPulseLocal(): I was told to calpulse all channels which doesn't make sense");
         return false;
     } //End Case: Bad Config, asked for OR of all channels
-    else if (ch == 128 && toggleOn == false) { //Case: Turn cal pusle off for all channels
+
+    MemhubSession session;
+    const std::string vfatBase = stdsprintf("GEM_AMC.OH.OH%i.GEB.VFAT{}.", ohN);
+    const RegArray calPulseEnable(la, vfatBase + "VFAT_CHANNELS.CHANNEL{}.CALPULSE_ENABLE", {oh::VFATS_PER_OH, 128});
+    const RegArray calMode(la, vfatBase + "CFG_CAL_MODE", {oh::VFATS_PER_OH});
+    if (ch == 128 && toggleOn == false) { //Case: Turn cal pusle off for all channels
         for (unsigned int vfatN = 0; vfatN < oh::VFATS_PER_OH; vfatN++) { //Loop over all VFATs
             if ((notmask >> vfatN) & 0x1) { //End VFAT is not masked
                 for (unsigned int chan=0; chan < 128; ++chan) { //Loop Over all Channels
-                    sprintf(regBuf,"GEM_AMC.OH.OH%i.GEB.VFAT%i.VFAT_CHANNELS.CHANNEL%i.CALPULSE_ENABLE", ohN, vfatN, chan);
-                    writeReg(la, regBuf, 0x0);
+                    calPulseEnable.write(0x0, vfatN, chan);
                 } //End Loop Over all Channels
-                writeReg(la, stdsprintf("GEM_AMC.OH.OH%i.GEB.VFAT%i.CFG_CAL_MODE", ohN, vfatN), 0x0);
+                calMode.write(0x0, vfatN);
             } //End VFAT is not masked
         } //End Loop over all VFATs
     } //End Case: Turn cal pulse off for all channels
@@ -64,25 +73,26 @@ bool confCalPulseLocal(localArgs *la, uint32_t ohN, uint32_t mask, uint32_t ch,
         return false;
     } //End Case: Bad Config, asked for OR of all channels
     else{ //Case: Pulse a specific channel
+        const RegArray calFS(la, vfatBase + "CFG_CAL_FS", {oh::VFATS_PER_OH});
+        const RegArray calDur(la, vfatBase + "CFG_CAL_DUR", {oh::VFATS_PER_OH});
         for (unsigned int vfatN = 0; vfatN < oh::VFATS_PER_OH; vfatN++) { //Loop over all VFATs
             if ((notmask >> vfatN) & 0x1) { //End VFAT is not masked
-                sprintf(regBuf,"GEM_AMC.OH.OH%i.GEB.VFAT%i.VFAT_CHANNELS.CHANNEL%i.CALPULSE_ENABLE", ohN, vfatN, ch);
                 if (toggleOn == true) { //Case: turn calpulse on
-                    writeReg(la, regBuf, 0x1);
+                    calPulseEnable.write(0x1, vfatN, ch);
                     if (currentPulse) { //Case: cal mode current injection
-                        writeReg(la, stdsprintf("GEM_AMC.OH.OH%i.GEB.VFAT%i.CFG_CAL_MODE", ohN, vfatN), 0x2);
+                        calMode.write(0x2, vfatN);
 
                         //Set cal current pulse scale factor. Q = CAL DUR[s] * CAL DAC * 10nA * CAL FS[%] (00 = 25%, 01 = 50%, 10 = 75%, 11 = 100%)
-                        writeReg(la, stdsprintf("GEM_AMC.OH.OH%i.GEB.VFAT%i.CFG_CAL_FS", ohN, vfatN), calScaleFactor);
-                        writeReg(la, stdsprintf("GEM_AMC.OH.OH%i.GEB.VFAT%i.CFG_CAL_DUR", ohN, vfatN), 0x0);
+                        calFS.write(calScaleFactor, vfatN);
+                        calDur.write(0x0, vfatN);
                     } //End Case: cal mode current injection
                     else { //Case: cal mode voltage injection
-                        writeReg(la, stdsprintf("GEM_AMC.OH.OH%i.GEB.VFAT%i.CFG_CAL_MODE", ohN, vfatN), 0x1);
+                        calMode.write(0x1, vfatN);
                     } //Case: cal mode voltage injection
                 } //End Case: Turn calpulse on
                 else{ //Case: Turn calpulse off
-                    writeReg(la, regBuf, 0x0);
-                    writeReg(la, stdsprintf("GEM_AMC.OH.OH%i.GEB.VFAT%i.CFG_CAL_MODE", ohN, vfatN), 0x0);
+                    calPulseEnable.write(0x0, vfatN, ch);
+                    calMode.write(0x0, vfatN);
                 } //End Case: Turn calpulse off
             } //End VFAT is not masked
         } //End Loop over all VFATs
@@ -271,6 +281,256 @@ void ttcGenConf(const RPCMsg *request, RPCMsg *response)
     rtxn.abort();
 }
 
+GenScanPlan::GenScanPlan(localArgs *la, uint32_t ohN, uint32_t notmask, const std::string & scanReg, uint32_t nevts, bool useExtTrig) :
+    m_la(la),
+    m_scanReg(scanReg),
+    m_nevts(nevts),
+    m_useExtTrig(useExtTrig),
+    m_valid(true),
+    m_triggerTime(0),
+    m_stepLocal(0),
+    m_stepSlow(0),
+    m_stepTime(0)
+{
+    for (uint32_t vfatN = 0; vfatN < oh::VFATS_PER_OH; ++vfatN) {
+        if (!((notmask >> vfatN) & 0x1))
+            continue;
+        VFATRegs vfat;
+        vfat.vfatN = vfatN;
+        m_valid &= resolve(stdsprintf("GEM_AMC.OH.OH%i.GEB.VFAT%i.CFG_%s", ohN, vfatN, scanReg.c_str()), vfat.scan);
+        m_valid &= resolve(stdsprintf("GEM_AMC.OH.OH%i.GEB.VFAT%i.CFG_THR_ARM_DAC", ohN, vfatN), vfat.thrArm);
+        m_valid &= resolve(stdsprintf("GEM_AMC.GEM_TESTS.VFAT_DAQ_MONITOR.VFAT%i.GOOD_EVENTS_COUNT", vfatN), vfat.goodEvents);
+        m_valid &= resolve(stdsprintf("GEM_AMC.GEM_TESTS.VFAT_DAQ_MONITOR.VFAT%i.CHANNEL_FIRE_COUNT", vfatN), vfat.fireCount);
+        m_vfats.push_back(vfat);
+    }
+    m_valid &= resolve("GEM_AMC.GEM_TESTS.VFAT_DAQ_MONITOR.CTRL.RESET", m_monReset);
+    m_valid &= resolve("GEM_AMC.GEM_TESTS.VFAT_DAQ_MONITOR.CTRL.ENABLE", m_monEnable);
+    if (useExtTrig) {
+        m_valid &= resolve("GEM_AMC.TTC.CTRL.CNT_RESET", m_cntReset);
+        m_valid &= resolve("GEM_AMC.TTC.CMD_COUNTERS.L1A", m_l1aCount);
+    } else {
+        m_valid &= resolve("GEM_AMC.TTC.GENERATOR.CYCLIC_START", m_cyclicStart);
+        m_valid &= resolve("GEM_AMC.TTC.GENERATOR.ENABLE", m_genEnable);
+        m_valid &= resolve("GEM_AMC.TTC.GENERATOR.CYCLIC_RUNNING", m_cyclicRunning);
+    }
+    if (!m_valid)
+        return;
+
+    //The counters go to outData as raw words, the masked values are for the debug messages
+    for (auto & vfat : m_vfats) {
+        vfat.goodEventsMask   = vfat.goodEvents.mask;
+        vfat.goodEventsShift  = vfat.goodEvents.shift;
+        vfat.goodEvents.mask  = 0xFFFFFFFF;
+        vfat.goodEvents.shift = 0;
+    }
+    for (auto const& vfat : m_vfats) {
+        m_readout.push_back(&vfat.goodEvents);
+        m_readout.push_back(&vfat.fireCount);
+    }
+
+    //The generator sends nevts L1As, CYCLIC_L1A_GAP bunch crossings of 25 ns apart
+    if (!useExtTrig)
+        m_triggerTime = std::chrono::microseconds(uint64_t(nevts)*readReg(la, "GEM_AMC.TTC.GENERATOR.CYCLIC_L1A_GAP")/40);
+}
+
+bool GenScanPlan::resolve(const std::string & regName, RegNode & node)
+{
+    const RegNode * found = getRegNode(m_la, regName);
+    if (!found) {
+        LOGGER->log_message(LogManager::ERROR, stdsprintf("Key: %s is NOT found", regName.c_str()));
+        m_la->response->set_string("error", stdsprintf("Register %s key not found", regName.c_str()));
+        return false;
+    }
+    node = *found;
+    return true;
+}
+
+void GenScanPlan::setDac(uint32_t dacVal)
+{
+    const auto start = std::chrono::steady_clock::now();
+    {
+        MemhubSession session;
+        //Write the scan reg value
+        for (auto const& vfat : m_vfats) {
+            writeReg(m_la, vfat.scan, dacVal, m_scanReg);
+            m_stepSlow += vfat.scan.masked() ? 2 : 1; // masked writes are read-modify-write
+        }
+    }
+    m_stepTime += std::chrono::steady_clock::now() - start;
+}
+
+bool GenScanPlan::measure(uint32_t dacVal, uint32_t *goodEvents, uint32_t *events, uint32_t *hits)
+{
+    const auto start = std::chrono::steady_clock::now();
+    uint64_t & localAccesses = m_stepLocal;
+    uint64_t & slowAccesses  = m_stepSlow;
+    auto count = [&](const RegNode & node, bool slow) {
+        (slow ? slowAccesses : localAccesses) += (node.masked() ? 2 : 1); // masked writes are read-modify-write
+    };
+
+    {
+        MemhubSession session;
+        //Reset and enable the VFAT_DAQ_MONITOR
+        writeReg(m_la, m_monReset, 0x1, "GEM_AMC.GEM_TESTS.VFAT_DAQ_MONITOR.CTRL.RESET");
+        writeReg(m_la, m_monEnable, 0x1, "GEM_AMC.GEM_TESTS.VFAT_DAQ_MONITOR.CTRL.ENABLE");
+        count(m_monReset, false);
+        count(m_monEnable, false);
+
+        if (m_useExtTrig) {
+            writeReg(m_la, m_cntReset, 0x1, "GEM_AMC.TTC.CTRL.CNT_RESET");
+            writeReg(m_la, regs::GEM_AMC_TTC_CTRL_L1A_ENABLE, 0x1);
+            count(m_cntReset, false);
+            localAccesses += 2;
+        }
+    }
+
+    //Start the triggers, outside of a session since the waits sleep
+    PollResult done = {true, 0, 0, std::chrono::microseconds(0)};
+    std::string waitedFor;
+    if (m_useExtTrig) {
+        done = pollUntil(m_l1aCount.address, 0xffffffff, PollCondition::greaterOrEqual, m_nevts,
+                         std::chrono::seconds(PLAN_EXT_TRIG_TIMEOUT_S),
+                         PollBackoff(std::chrono::microseconds(200), std::chrono::milliseconds(100)));
+        waitedFor = stdsprintf("%i external L1As", m_nevts);
+        writeReg(m_la, regs::GEM_AMC_TTC_CTRL_L1A_ENABLE, 0x0);
+        localAccesses += 2;
+    } else {
+        writeReg(m_la, m_cyclicStart, 0x1, "GEM_AMC.TTC.GENERATOR.CYCLIC_START");
+        count(m_cyclicStart, false);
+        ++localAccesses;
+        if (readReg(m_la, m_genEnable, "GEM_AMC.TTC.GENERATOR.ENABLE")) { //TTC Commands from TTC.GENERATOR
+            done = pollUntil(m_cyclicRunning, PollCondition::equal, 0,
+                             2*m_triggerTime + std::chrono::milliseconds(PLAN_TRIG_TIMEOUT_MARGIN_MS),
+                             PollBackoff(std::chrono::microseconds(50), std::chrono::milliseconds(10), m_triggerTime));
+            waitedFor = stdsprintf("the end of the %i generator L1As", m_nevts);
+            ++localAccesses;
+        }
+    }
+
+    if (!done.success) {
+        writeReg(m_la, m_monEnable, 0x0, "GEM_AMC.GEM_TESTS.VFAT_DAQ_MONITOR.CTRL.ENABLE");
+        const std::string errmsg = (done.value == 0xdeaddead)
+            ? stdsprintf("%s scan at %i: memsvc error while waiting for %s", m_scanReg.c_str(), dacVal, waitedFor.c_str())
+            : stdsprintf("%s scan at %i: timed out after %lld us waiting for %s, last value read %u",
+                         m_scanReg.c_str(), dacVal, (long long)done.elapsed.count(), waitedFor.c_str(), done.value);
+        m_la->response->set_string("error", errmsg);
+        LOGGER->log_message(LogManager::ERROR, errmsg);
+        m_stepLocal = 0;
+        m_stepSlow  = 0;
+        m_stepTime  = std::chrono::nanoseconds(0);
+        return false;
+    }
+
+    //Stop the DAQ monitor counters from incrementing and read them
+    std::vector<uint32_t> values;
+    {
+        MemhubSession session;
+        writeReg(m_la, m_monEnable, 0x0, "GEM_AMC.GEM_TESTS.VFAT_DAQ_MONITOR.CTRL.ENABLE");
+        count(m_monEnable, false);
+        localAccesses += readRegs(m_readout, values);
+    }
+
+    for (size_t i = 0; i < m_vfats.size(); ++i) {
+        const VFATRegs & vfat = m_vfats[i];
+        goodEvents[vfat.vfatN] = values[2*i];
+        if (events)
+            events[vfat.vfatN] = applyMask(values[2*i], vfat.goodEventsMask);
+        if (hits)
+            hits[vfat.vfatN] = values[2*i+1];
+        if (values[2*i] == 0xdeaddead)
+            m_la->response->set_string("error", "memsvc error: unable to read the DAQ monitor counters");
+
+        LOGGER->log_message(LogManager::DEBUG, stdsprintf("%s Value: %i; Readback Val: %i; Nhits: %i; Nev: %i; CFG_THR_ARM: %i",
+                     m_scanReg.c_str(),
+                     dacVal,
+                     readReg(m_la, vfat.scan, m_scanReg),
+                     values[2*i+1],
+                     applyMask(values[2*i], vfat.goodEventsMask),
+                     readReg(m_la, vfat.thrArm, "CFG_THR_ARM_DAC")
+            )
+        );
+        slowAccesses += 2;
+    }
+
+    m_stepTime += std::chrono::steady_clock::now() - start;
+    const std::chrono::nanoseconds estimated(localAccesses*PLAN_SIM_LOCAL_ACCESS_NS + slowAccesses*PLAN_SIM_SLOW_ACCESS_NS);
+    m_estimatedUs.push_back(std::chrono::duration_cast<std::chrono::microseconds>(estimated + m_triggerTime).count());
+    m_measuredUs.push_back(std::chrono::duration_cast<std::chrono::microseconds>(m_stepTime).count());
+    m_stepLocal = 0;
+    m_stepSlow  = 0;
+    m_stepTime  = std::chrono::nanoseconds(0);
+    return true;
+}
+
+uint32_t GenScanPlan::packCounts(uint32_t events, uint32_t hits) const
+{
+    if (m_vfats.empty())
+        return 0;
+    const VFATRegs & vfat = m_vfats.front();
+    const uint32_t maxEvents = vfat.goodEventsMask >> vfat.goodEventsShift;
+    const uint32_t maxHits   = vfat.fireCount.mask >> vfat.fireCount.shift;
+    return ((std::min(events, maxEvents) << vfat.goodEventsShift) & vfat.goodEventsMask)
+        | ((std::min(hits, maxHits) << vfat.fireCount.shift) & vfat.fireCount.mask);
+}
+
+bool GenScanPlan::step(uint32_t dacVal, uint32_t *goodEvents)
+{
+    setDac(dacVal);
+    return measure(dacVal, goodEvents);
+}
+
+namespace {
+    unsigned nestedScanDepth = 0;
+    std::vector<uint32_t> nestedEstimatedUs; ///< Estimated total of each plan reported within a NestedGenScans
+    std::vector<uint32_t> nestedMeasuredUs;  ///< Measured total of each plan reported within a NestedGenScans
+
+    /*! \class NestedGenScans
+     *  \brief While it exists, GenScanPlan::report leaves the response to the caller running the scans in a loop
+     *  \details Otherwise each scan would overwrite the arrays of the previous one, leaving only those of the last.
+     */
+    class NestedGenScans {
+      public:
+        NestedGenScans()
+        {
+            if (nestedScanDepth++ == 0) {
+                nestedEstimatedUs.clear();
+                nestedMeasuredUs.clear();
+            }
+        }
+        ~NestedGenScans() { --nestedScanDepth; }
+
+        NestedGenScans(const NestedGenScans&) = delete;
+        NestedGenScans& operator=(const NestedGenScans&) = delete;
+
+        /*! \brief Sets the totals of the plans run so far as the plan_estimated_us and plan_measured_us arrays of the response
+         */
+        void report(localArgs *la) const
+        {
+            la->response->set_word_array("plan_estimated_us", nestedEstimatedUs);
+            la->response->set_word_array("plan_measured_us", nestedMeasuredUs);
+        }
+    };
+}
+
+void GenScanPlan::report(bool toResponse) const
+{
+    uint64_t estimated = 0, measured = 0;
+    for (auto const& us : m_estimatedUs)
+        estimated += us;
+    for (auto const& us : m_measuredUs)
+        measured += us;
+    if (nestedScanDepth > 0) {
+        nestedEstimatedUs.push_back(uint32_t(std::min<uint64_t>(estimated, UINT32_MAX)));
+        nestedMeasuredUs.push_back(uint32_t(std::min<uint64_t>(measured, UINT32_MAX)));
+    } else if (toResponse) {
+        m_la->response->set_word_array("plan_estimated_us", m_estimatedUs);
+        m_la->response->set_word_array("plan_measured_us", m_measuredUs);
+    }
+    LOGGER->log_message(LogManager::INFO, stdsprintf("genScan of %s on %zu VFATs: %zu steps, estimated %llu us, measured %llu us",
+                                                     m_scanReg.c_str(), m_vfats.size(), m_measuredUs.size(),
+                                                     (unsigned long long)estimated, (unsigned long long)measured));
+}
+
 void genScanLocal(localArgs *la, uint32_t *outData, uint32_t ohN, uint32_t mask, uint32_t ch, bool useCalPulse, bool currentPulse, uint32_t calScaleFactor, uint32_t nevts, uint32_t dacMin, uint32_t dacMax, uint32_t dacStep, std::string scanReg, bool useUltra, bool useExtTrig)
 {
     //Determine the inverse of the vfatmask
@@ -295,6 +555,11 @@ void genScanLocal(localArgs *la, uint32_t *outData, uint32_t ohN, uint32_t mask,
                 return;
             }
 
+            //Resolve the registers of the DAC loop
+            GenScanPlan plan(la, ohN, notmask, scanReg, nevts, useExtTrig);
+            if (!plan.valid())
+                return;
+
             //Do we turn on the calpulse for the channel = ch?
             if (useCalPulse) {
                 if (confCalPulseLocal(la, ohN, mask, ch, true, currentPulse, calScaleFactor) == false) {
@@ -303,18 +568,9 @@ void genScanLocal(localArgs *la, uint32_t *outData, uint32_t ohN, uint32_t mask,
                 }
             } //End use calibration pulse
 
-            //Get addresses
-            uint32_t daqMonAddr[oh::VFATS_PER_OH];
-            uint32_t l1CntAddr = getAddress(la, "GEM_AMC.TTC.CMD_COUNTERS.L1A");
-            for (unsigned int vfatN = 0; vfatN < oh::VFATS_PER_OH; vfatN++)
-            {
-                sprintf(regBuf,"GEM_AMC.GEM_TESTS.VFAT_DAQ_MONITOR.VFAT%i.GOOD_EVENTS_COUNT",vfatN);
-                daqMonAddr[vfatN] = getAddress(la, regBuf);
-            }
-
             //TTC Config
             if (useExtTrig) {
-                writeReg(la, "GEM_AMC.TTC.CTRL.L1A_ENABLE", 0x0);
+                writeReg(la, regs::GEM_AMC_TTC_CTRL_L1A_ENABLE, 0x0);
                 writeReg(la, "GEM_AMC.TTC.CTRL.CNT_RESET", 0x1);
             }
             else{
@@ -326,62 +582,22 @@ void genScanLocal(localArgs *la, uint32_t *outData, uint32_t ohN, uint32_t mask,
             dacMonConfLocal(la, ohN, ch);
 
             //Scan over DAC values
+            uint32_t goodEvents[oh::VFATS_PER_OH];
             for (uint32_t dacVal = dacMin; dacVal <= dacMax; dacVal += dacStep)
             {
-                //Write the scan reg value
-                for (unsigned int vfatN = 0; vfatN < oh::VFATS_PER_OH; vfatN++) if ((notmask >> vfatN) & 0x1)
-                {
-                    writeReg(la, stdsprintf("GEM_AMC.OH.OH%i.GEB.VFAT%i.CFG_%s",ohN,vfatN,scanReg.c_str()), dacVal);
-                }
-
-                //Reset and enable the VFAT_DAQ_MONITOR
-                writeReg(la, "GEM_AMC.GEM_TESTS.VFAT_DAQ_MONITOR.CTRL.RESET", 0x1);
-                writeReg(la, "GEM_AMC.GEM_TESTS.VFAT_DAQ_MONITOR.CTRL.ENABLE", 0x1);
-
-                //Start the triggers
-                if (useExtTrig) {
-                    writeReg(la, "GEM_AMC.TTC.CTRL.CNT_RESET", 0x1);
-                    writeReg(la, "GEM_AMC.TTC.CTRL.L1A_ENABLE", 0x1);
+                if (!plan.step(dacVal, goodEvents))
+                    break; //The triggers did not complete, the error is set
 
-                    uint32_t l1aCnt = 0;
-                    while(l1aCnt < nevts) {
-                        l1aCnt = readRawAddress(l1CntAddr, la->response);
-                        std::this_thread::sleep_for(std::chrono::microseconds(200));
-                    }
-
-                    writeReg(la, "GEM_AMC.TTC.CTRL.L1A_ENABLE", 0x0);
-                    l1aCnt = readRawAddress(l1CntAddr, la->response);
-                }
-                else{
-                    writeReg(la, "GEM_AMC.TTC.GENERATOR.CYCLIC_START", 0x1);
-                    if (readReg(la, "GEM_AMC.TTC.GENERATOR.ENABLE")) { //TTC Commands from TTC.GENERATOR
-                        while(readReg(la, "GEM_AMC.TTC.GENERATOR.CYCLIC_RUNNING")) {
-                            std::this_thread::sleep_for(std::chrono::microseconds(50));
-                        }
-                    } //End TTC Commands from TTC.GENERATOR
-                }
-
-                //Stop the DAQ monitor counters from incrementing
-                writeReg(la, "GEM_AMC.GEM_TESTS.VFAT_DAQ_MONITOR.CTRL.ENABLE", 0x0);
-
-                //Read the DAQ Monitor counters
                 for (unsigned int vfatN = 0; vfatN < oh::VFATS_PER_OH; vfatN++) {
                     if ( !( (notmask >> vfatN) & 0x1)) continue;
 
                     unsigned int idx = vfatN*(dacMax-dacMin+1)/dacStep+(dacVal-dacMin)/dacStep;
-                    outData[idx] = readRawAddress(daqMonAddr[vfatN], la->response);
-
-                    LOGGER->log_message(LogManager::DEBUG, stdsprintf("%s Value: %i; Readback Val: %i; Nhits: %i; Nev: %i; CFG_THR_ARM: %i",
-                                 scanReg.c_str(),
-                                 dacVal,
-                                 readReg(la, stdsprintf("GEM_AMC.OH.OH%i.GEB.VFAT%i.CFG_%s",ohN,vfatN,scanReg.c_str())),
-                                 readReg(la, stdsprintf("GEM_AMC.GEM_TESTS.VFAT_DAQ_MONITOR.VFAT%i.CHANNEL_FIRE_COUNT",vfatN)),
-                                 readReg(la, stdsprintf("GEM_AMC.GEM_TESTS.VFAT_DAQ_MONITOR.VFAT%i.GOOD_EVENTS_COUNT",vfatN)),
-                                 readReg(la, stdsprintf("GEM_AMC.OH.OH%i.GEB.VFAT%i.CFG_THR_ARM_DAC",ohN,vfatN,scanReg.c_str()))
-                        )
-                    );
-                } //End Loop over vfats
+                    outData[idx] = goodEvents[vfatN];
+                }
+                jobProgress((dacVal-dacMin)/dacStep+1, (dacMax-dacMin)/dacStep+1);
+                jobPartialResult(outData, oh::VFATS_PER_OH*(dacMax-dacMin+1)/dacStep);
             } //End Loop from dacMin to dacMax
+            plan.report();
 
             //If the calpulse for channel ch was turned on, turn it off
             if (useCalPulse) {
@@ -482,6 +698,161 @@ void genScanLocal(localArgs *la, uint32_t *outData, uint32_t ohN, uint32_t mask,
     return;
 } //End genScanLocal(...)
 
+namespace {
+    /*! \brief Half width of the Wilson score interval of an efficiency of hits over events
+     */
+    double efficiencyHalfWidth(uint32_t hits, uint32_t events)
+    {
+        const double z  = ADAPTIVE_SCAN_Z;
+        const double n  = events;
+        const double p  = std::min(1., hits/n);
+        const double z2 = z*z;
+        return z*std::sqrt(p*(1-p)/n + z2/(4*n*n))/(1 + z2/n);
+    }
+}
+
+void genScanAdaptiveLocal(localArgs *la, uint32_t *outData, uint32_t *outEvents, uint32_t ohN, uint32_t mask, uint32_t ch, bool useCalPulse, bool currentPulse, uint32_t calScaleFactor, uint32_t nevts, uint32_t batch, uint32_t coarseStep, uint32_t tolerance, uint32_t dacMin, uint32_t dacMax, uint32_t dacStep, std::string scanReg, bool useExtTrig)
+{
+    //Determine the inverse of the vfatmask
+    uint32_t notmask = ~mask & 0xFFFFFF;
+
+    if (fw_version_check("genScanAdaptiveLocal", la) != 3) {
+        LOGGER->log_message(LogManager::ERROR, "The adaptive genScan is only supported in V3 electronics");
+        la->response->set_string("error", "The adaptive genScan is only supported in V3 electronics");
+        return;
+    }
+
+    uint32_t goodVFATs = vfatSyncCheckLocal(la, ohN);
+    if ( (notmask & goodVFATs) != notmask) {
+        la->response->set_string("error",stdsprintf("One of the unmasked VFATs is not Synced. goodVFATs: %x\tnotmask: %x",goodVFATs,notmask));
+        return;
+    }
+
+    if (currentPulse && calScaleFactor > 3) {
+        la->response->set_string("error",stdsprintf("Bad value for CFG_CAL_FS: %x, Possible values are {0b00, 0b01, 0b10, 0b11}. Exiting.",calScaleFactor));
+        return;
+    }
+
+    if (batch == 0 || batch > nevts)
+        batch = nevts;
+    const uint32_t nDac   = (dacMax-dacMin)/dacStep+1;
+    const uint32_t stride = std::max<uint32_t>(1, coarseStep/dacStep); //Points between two points of the coarse pass
+
+    //Resolve the registers of the DAC loop, each measurement sends a batch of triggers
+    GenScanPlan plan(la, ohN, notmask, scanReg, batch, useExtTrig);
+    if (!plan.valid())
+        return;
+
+    //Do we turn on the calpulse for the channel = ch?
+    if (useCalPulse) {
+        if (confCalPulseLocal(la, ohN, mask, ch, true, currentPulse, calScaleFactor) == false) {
+            la->response->set_string("error",stdsprintf("Unable to configure calpulse ON for ohN %i mask %x chan %i", ohN, mask, ch));
+            return; //Calibration pulse is not configured correctly
+        }
+    } //End use calibration pulse
+
+    //TTC Config
+    if (useExtTrig) {
+        writeReg(la, regs::GEM_AMC_TTC_CTRL_L1A_ENABLE, 0x0);
+        writeReg(la, "GEM_AMC.TTC.CTRL.CNT_RESET", 0x1);
+    }
+    else{
+        writeReg(la, "GEM_AMC.TTC.GENERATOR.CYCLIC_L1A_COUNT", batch);
+        writeReg(la, "GEM_AMC.TTC.GENERATOR.SINGLE_RESYNC", 0x1);
+    }
+
+    //Configure VFAT_DAQ_MONITOR
+    dacMonConfLocal(la, ohN, ch);
+
+    //Counts accumulated over the batches, indexed by vfatN*nDac+point
+    std::vector<uint32_t> events(oh::VFATS_PER_OH*nDac, 0), hits(oh::VFATS_PER_OH*nDac, 0);
+    std::fill(outEvents, outEvents+nDac, 0);
+    uint32_t goodEvents[oh::VFATS_PER_OH], batchEvents[oh::VFATS_PER_OH], batchHits[oh::VFATS_PER_OH];
+    bool triggered = true; //Cleared when the triggers of a batch do not complete, which ends the scan
+    auto measureBatch = [&](uint32_t point) {
+        triggered = plan.measure(dacMin+point*dacStep, goodEvents, batchEvents, batchHits);
+        if (!triggered)
+            return;
+        outEvents[point] += batch;
+        for (unsigned int vfatN = 0; vfatN < oh::VFATS_PER_OH; vfatN++) {
+            if ( !( (notmask >> vfatN) & 0x1)) continue;
+            events[vfatN*nDac+point] += batchEvents[vfatN];
+            hits[vfatN*nDac+point]   += batchHits[vfatN];
+        }
+    };
+
+    //Coarse pass: a batch every stride points, and at dacMax
+    std::vector<uint32_t> coarse;
+    for (uint32_t point = 0; point < nDac; point += stride)
+        coarse.push_back(point);
+    if (coarse.back() != nDac-1)
+        coarse.push_back(nDac-1);
+    for (size_t i = 0; i < coarse.size() && triggered; ++i) {
+        plan.setDac(dacMin+coarse[i]*dacStep);
+        measureBatch(coarse[i]);
+    }
+
+    //A VFAT is in transition between two coarse points unless both sit on the same plateau, 0% or 100%
+    std::vector<uint32_t> active(nDac, 0); //VFATs whose efficiency is refined, one bit per VFAT
+    for (unsigned int vfatN = 0; vfatN < oh::VFATS_PER_OH; vfatN++) {
+        if ( !( (notmask >> vfatN) & 0x1)) continue;
+        auto plateau = [&](uint32_t point) {
+            const uint32_t n = events[vfatN*nDac+point], k = hits[vfatN*nDac+point];
+            return (n == 0) ? -1 : (k == 0) ? 0 : (k >= n) ? 1 : -1;
+        };
+        for (size_t i = 0; i+1 < coarse.size(); ++i) {
+            const int low = plateau(coarse[i]), high = plateau(coarse[i+1]);
+            if (low >= 0 && low == high)
+                continue;
+            for (uint32_t point = coarse[i]; point <= coarse[i+1]; ++point)
+                active[point] |= (0x1 << vfatN);
+        }
+    }
+
+    //Fine pass: batches at each point of a transition until the efficiencies are known within tolerance, or nevts are sent
+    auto converged = [&](uint32_t point) {
+        for (unsigned int vfatN = 0; vfatN < oh::VFATS_PER_OH; vfatN++) {
+            if ( !( (active[point] >> vfatN) & 0x1)) continue;
+            const uint32_t n = events[vfatN*nDac+point];
+            if (n == 0 || efficiencyHalfWidth(hits[vfatN*nDac+point], n)*1000 > tolerance)
+                return false;
+        }
+        return true;
+    };
+    uint64_t sent = 0;
+    for (uint32_t point = 0; point < nDac; ++point) {
+        if (triggered && active[point] && outEvents[point] < nevts && !converged(point)) {
+            plan.setDac(dacMin+point*dacStep);
+            do {
+                measureBatch(point);
+            } while (triggered && outEvents[point] < nevts && !converged(point));
+        }
+        sent += outEvents[point];
+        jobProgress(point+1, nDac);
+    }
+
+    //Results in the layout of genScanLocal; the points without triggers are left untouched
+    for (unsigned int vfatN = 0; vfatN < oh::VFATS_PER_OH; vfatN++) {
+        if ( !( (notmask >> vfatN) & 0x1)) continue;
+        for (uint32_t point = 0; point < nDac; ++point) {
+            if (outEvents[point] == 0) continue;
+            unsigned int idx = vfatN*(dacMax-dacMin+1)/dacStep+point;
+            outData[idx] = plan.packCounts(events[vfatN*nDac+point], hits[vfatN*nDac+point]);
+        }
+    }
+    plan.report();
+    LOGGER->log_message(LogManager::INFO, stdsprintf("Adaptive %s scan of OH%i: %llu triggers sent, %llu for the full scan",
+                                                     scanReg.c_str(), ohN, (unsigned long long)sent, (unsigned long long)nevts*nDac));
+
+    //If the calpulse for channel ch was turned on, turn it off
+    if (useCalPulse) {
+        if (confCalPulseLocal(la, ohN, mask, ch, false, currentPulse, calScaleFactor) == false) {
+            la->response->set_string("error",stdsprintf("Unable to configure calpulse OFF for ohN %i mask %x chan %i", ohN, mask, ch));
+            return; //Calibration pulse is not configured correctly
+        }
+    }
+} //End genScanAdaptiveLocal(...)
+
 void genScan(const RPCMsg *request, RPCMsg *response)
 {
     GETLOCALARGS(response);
@@ -504,9 +875,184 @@ void genScan(const RPCMsg *request, RPCMsg *response)
     }
     bool useExtTrig = request->get_word("useExtTrig");
 
-    uint32_t outData[oh::VFATS_PER_OH*(dacMax-dacMin+1)/dacStep];
-    genScanLocal(&la, outData, ohN, mask, ch, useCalPulse, currentPulse, calScaleFactor, nevts, dacMin, dacMax, dacStep, scanReg, useUltra, useExtTrig);
-    response->set_word_array("data",outData,oh::VFATS_PER_OH*(dacMax-dacMin+1)/dacStep);
+    if (dacStep == 0 || dacMax < dacMin) {
+        response->set_string("error", stdsprintf("Invalid DAC range: dacMin %i, dacMax %i, dacStep %i", dacMin, dacMax, dacStep));
+        return;
+    }
+    ScratchBuffer outData(oh::VFATS_PER_OH*(dacMax-dacMin+1)/dacStep, true);
+    if (!outData.check(response, "Scan data"))
+        return;
+    if (request->get_key_exists("adaptive")) {
+        uint32_t batch = request->get_key_exists("batch") ? request->get_word("batch") : nevts/10;
+        uint32_t coarseStep = request->get_key_exists("coarseStep") ? request->get_word("coarseStep") : 4*dacStep;
+        uint32_t tolerance = request->get_key_exists("tolerance") ? request->get_word("tolerance") : adaptiveScanTolerance(nevts);
+        std::vector<uint32_t> outEvents((dacMax-dacMin)/dacStep+1, 0);
+        genScanAdaptiveLocal(&la, outData.data(), outEvents.data(), ohN, mask, ch, useCalPulse, currentPulse, calScaleFactor, nevts, batch, coarseStep, tolerance, dacMin, dacMax, dacStep, scanReg, useExtTrig);
+        response->set_word_array("events",outEvents);
+    } else {
+        genScanLocal(&la, outData.data(), ohN, mask, ch, useCalPulse, currentPulse, calScaleFactor, nevts, dacMin, dacMax, dacStep, scanReg, useUltra, useExtTrig);
+    }
+    response->set_word_array("data",outData.data(),outData.size());
+
+    rtxn.abort();
+}
+
+void genScanMultiLinkLocal(localArgs *la, uint32_t *outData, uint32_t ohMask, uint32_t NOH, uint32_t ch, bool useCalPulse, bool currentPulse, uint32_t calScaleFactor, uint32_t nevts, uint32_t dacMin, uint32_t dacMax, uint32_t dacStep, std::string scanReg, bool useExtTrig)
+{
+    if (fw_version_check("genScanMultiLinkLocal", la) != 3) {
+        LOGGER->log_message(LogManager::ERROR, "genScanMultiLink is only supported in V3 electronics");
+        la->response->set_string("error", "genScanMultiLink is only supported in V3 electronics");
+        return;
+    }
+
+    if (currentPulse && calScaleFactor > 3) {
+        la->response->set_string("error",stdsprintf("Bad value for CFG_CAL_FS: %x, Possible values are {0b00, 0b01, 0b10, 0b11}. Exiting.",calScaleFactor));
+        return;
+    }
+
+    const uint32_t nDac = (dacMax-dacMin)/dacStep+1;
+    std::vector<uint32_t> vfatMasks(NOH, 0xFFFFFF);
+    std::vector<std::unique_ptr<GenScanPlan> > plans(NOH);
+    for (unsigned int ohN = 0; ohN < NOH; ++ohN) {
+        // If this Optohybrid is masked skip it
+        if (!((ohMask >> ohN) & 0x1)) {
+            std::fill(outData + ohN*oh::VFATS_PER_OH*nDac, outData + (ohN+1)*oh::VFATS_PER_OH*nDac, 0xdeaddead);
+            continue;
+        }
+
+        vfatMasks[ohN] = getOHVFATMaskLocal(la, ohN);
+        uint32_t notmask = ~vfatMasks[ohN] & 0xFFFFFF;
+        uint32_t goodVFATs = vfatSyncCheckLocal(la, ohN);
+        if ( (notmask & goodVFATs) != notmask) {
+            la->response->set_string("error",stdsprintf("One of the unmasked VFATs of OH%i is not Synced. goodVFATs: %x\tnotmask: %x",ohN,goodVFATs,notmask));
+            return;
+        }
+
+        //Resolve the registers of the DAC loop
+        plans[ohN].reset(new GenScanPlan(la, ohN, notmask, scanReg, nevts, useExtTrig));
+        if (!plans[ohN]->valid())
+            return;
+    }
+
+    const RegNode * ohSelect = getRegNode(la, "GEM_AMC.GEM_TESTS.VFAT_DAQ_MONITOR.CTRL.OH_SELECT");
+    if (!ohSelect) {
+        la->response->set_string("error", "Register GEM_AMC.GEM_TESTS.VFAT_DAQ_MONITOR.CTRL.OH_SELECT key not found");
+        return;
+    }
+
+    //Do we turn on the calpulse for the channel = ch?
+    if (useCalPulse) {
+        for (unsigned int ohN = 0; ohN < NOH; ++ohN) {
+            if (!plans[ohN])
+                continue;
+            if (confCalPulseLocal(la, ohN, vfatMasks[ohN], ch, true, currentPulse, calScaleFactor) == false) {
+                la->response->set_string("error",stdsprintf("Unable to configure calpulse ON for ohN %i mask %x chan %i", ohN, vfatMasks[ohN], ch));
+                return; //Calibration pulse is not configured correctly
+            }
+        }
+    } //End use calibration pulse
+
+    //TTC Config
+    if (useExtTrig) {
+        writeReg(la, regs::GEM_AMC_TTC_CTRL_L1A_ENABLE, 0x0);
+        writeReg(la, "GEM_AMC.TTC.CTRL.CNT_RESET", 0x1);
+    }
+    else{
+        writeReg(la, "GEM_AMC.TTC.GENERATOR.CYCLIC_L1A_COUNT", nevts);
+        writeReg(la, "GEM_AMC.TTC.GENERATOR.SINGLE_RESYNC", 0x1);
+    }
+
+    //Configure VFAT_DAQ_MONITOR, the link is selected at each step
+    dacMonConfLocal(la, 0, ch);
+
+    //Scan over DAC values
+    uint32_t goodEvents[oh::VFATS_PER_OH];
+    bool triggered = true; //Cleared when the triggers of a step do not complete, which ends the scan
+    for (uint32_t dacVal = dacMin; dacVal <= dacMax && triggered; dacVal += dacStep)
+    {
+        for (auto & plan : plans) {
+            if (plan)
+                plan->setDac(dacVal);
+        }
+
+        for (unsigned int ohN = 0; ohN < NOH; ++ohN) {
+            if (!plans[ohN])
+                continue;
+            writeReg(la, *ohSelect, ohN, "GEM_AMC.GEM_TESTS.VFAT_DAQ_MONITOR.CTRL.OH_SELECT");
+            triggered = plans[ohN]->measure(dacVal, goodEvents);
+            if (!triggered)
+                break;
+
+            uint32_t notmask = ~vfatMasks[ohN] & 0xFFFFFF;
+            for (unsigned int vfatN = 0; vfatN < oh::VFATS_PER_OH; vfatN++) {
+                if ( !( (notmask >> vfatN) & 0x1)) continue;
+                outData[(ohN*oh::VFATS_PER_OH+vfatN)*nDac+(dacVal-dacMin)/dacStep] = goodEvents[vfatN];
+            }
+        }
+        jobProgress((dacVal-dacMin)/dacStep+1, nDac);
+        jobPartialResult(outData, NOH*oh::VFATS_PER_OH*nDac);
+    } //End Loop from dacMin to dacMax
+
+    std::vector<uint32_t> estimatedUs, measuredUs;
+    for (auto const& plan : plans) {
+        if (!plan)
+            continue;
+        plan->report(false);
+        estimatedUs.insert(estimatedUs.end(), plan->estimatedUs().begin(), plan->estimatedUs().end());
+        measuredUs.insert(measuredUs.end(), plan->measuredUs().begin(), plan->measuredUs().end());
+    }
+    la->response->set_word_array("plan_estimated_us", estimatedUs);
+    la->response->set_word_array("plan_measured_us", measuredUs);
+
+    //If the calpulse for channel ch was turned on, turn it off
+    if (useCalPulse) {
+        for (unsigned int ohN = 0; ohN < NOH; ++ohN) {
+            if (!plans[ohN])
+                continue;
+            if (confCalPulseLocal(la, ohN, vfatMasks[ohN], ch, false, currentPulse, calScaleFactor) == false) {
+                la->response->set_string("error",stdsprintf("Unable to configure calpulse OFF for ohN %i mask %x chan %i", ohN, vfatMasks[ohN], ch));
+                return; //Calibration pulse is not configured correctly
+            }
+        }
+    }
+} //End genScanMultiLinkLocal(...)
+
+void genScanMultiLink(const RPCMsg *request, RPCMsg *response)
+{
+    GETLOCALARGS(response);
+
+    uint32_t ohMask = request->get_word("ohMask");
+    uint32_t nevts = request->get_word("nevts");
+    uint32_t ch = request->get_word("ch");
+    uint32_t dacMin = request->get_word("dacMin");
+    uint32_t dacMax = request->get_word("dacMax");
+    uint32_t dacStep = request->get_word("dacStep");
+    bool useCalPulse = request->get_word("useCalPulse");
+    bool currentPulse = request->get_word("currentPulse");
+    uint32_t calScaleFactor = request->get_word("calScaleFactor");
+    bool useExtTrig = request->get_word("useExtTrig");
+    std::string scanReg = request->get_string("scanReg");
+
+    if (dacStep == 0 || dacMax < dacMin) {
+        response->set_string("error", stdsprintf("Invalid DAC range: dacMin %i, dacMax %i, dacStep %i", dacMin, dacMax, dacStep));
+        return;
+    }
+
+    unsigned int NOH = getSystemInfo(&la).numOfOH;
+    if (request->get_key_exists("NOH")) {
+        unsigned int NOH_requested = request->get_word("NOH");
+        if (NOH_requested <= NOH)
+            NOH = NOH_requested;
+        else
+            LOGGER->log_message(LogManager::WARNING, stdsprintf("NOH requested (%i) > NUM_OF_OH AMC register value (%i), NOH request will be disregarded",NOH_requested,NOH));
+    }
+
+    ScratchBuffer outData(size_t(NOH)*oh::VFATS_PER_OH*((dacMax-dacMin)/dacStep+1), true);
+    if (!outData.check(response, "Scan data"))
+        return;
+    genScanMultiLinkLocal(&la, outData.data(), ohMask, NOH, ch, useCalPulse, currentPulse, calScaleFactor, nevts, dacMin, dacMax, dacStep, scanReg, useExtTrig);
+    response->set_word_array("data",outData.data(),outData.size());
+    LOGGER->log_message(LogManager::INFO, stdsprintf("Finished generic scans for OH Mask 0x%x", ohMask));
 
     rtxn.abort();
 }
@@ -562,7 +1108,7 @@ void sbitRateScanLocal(localArgs *la, uint32_t *outDataDacVal, uint32_t *outData
 
             //If ch!=128 store the original channel mask settings
             //Then mask all other channels except for channel ch
-            std::unordered_map<std::string, uint32_t> map_chanOrigMask; //key -> reg addr; val -> reg value
+            ChanMaskBackup map_chanOrigMask;
             if ( ch != 128) map_chanOrigMask = setSingleChanMask(ohN,vfatN,ch,la);
 
             //Get the OH Rate Monitor Address
@@ -576,17 +1122,19 @@ void sbitRateScanLocal(localArgs *la, uint32_t *outDataDacVal, uint32_t *outData
             writeRawAddress(ohVFATMaskAddr, maskOh, la->response);
 
             //Take the VFATs out of slow control only mode
-            writeReg(la, "GEM_AMC.GEM_SYSTEM.VFAT3.SC_ONLY_MODE", 0x0);
+            writeReg(la, regs::GEM_AMC_GEM_SYSTEM_VFAT3_SC_ONLY_MODE, 0x0);
 
             //Loop from dacMin to dacMax in steps of dacStep
             for (uint32_t dacVal = dacMin; dacVal <= dacMax; dacVal += dacStep) {
                 sprintf(regBuf,"GEM_AMC.OH.OH%i.GEB.VFAT%i.CFG_%s",ohN,vfatN,scanReg.c_str());
                 writeReg(la, regBuf, dacVal);
-                std::this_thread::sleep_for(std::chrono::milliseconds(waitTime));
+                sleepFor(std::chrono::milliseconds(waitTime));
 
                 unsigned int idx = (dacVal-dacMin)/dacStep;
                 outDataDacVal[idx] = dacVal;
                 outDataTrigRate[idx] = readRawAddress(ohTrigRateAddr, la->response);
+                jobProgress(idx+1, (dacMax-dacMin)/dacStep+1);
+                jobPartialResult(outDataTrigRate, (dacMax-dacMin)/dacStep+1);
             } //End Loop from dacMin to dacMax
 
             //Restore the original channel masks if specific channel was requested
@@ -619,7 +1167,7 @@ void sbitRateScanParallelLocal(localArgs *la, uint32_t *outDataDacVal, uint32_t
          return;
     }
     uint32_t vfatmask[amc::OH_PER_AMC] = {0};
-    std::unordered_map<std::string, uint32_t> origVFATmasks[amc::OH_PER_AMC][oh::VFATS_PER_OH];
+    ChanMaskBackup origVFATmasks[amc::OH_PER_AMC][oh::VFATS_PER_OH];
     switch (fw_version_check("SBIT Rate Scan", la)){
         case 3:
         {
@@ -660,7 +1208,7 @@ void sbitRateScanParallelLocal(localArgs *la, uint32_t *outDataDacVal, uint32_t
             } //End loop over optohybrids
 
             //Take the VFATs out of slow control only mode
-            writeReg(la, "GEM_AMC.GEM_SYSTEM.VFAT3.SC_ONLY_MODE", 0x0);
+            writeReg(la, regs::GEM_AMC_GEM_SYSTEM_VFAT3_SC_ONLY_MODE, 0x0);
 
             //Prep the SBIT counters
             std::unordered_map<uint32_t,uint32_t> map_origSBITPersist;
@@ -697,7 +1245,7 @@ void sbitRateScanParallelLocal(localArgs *la, uint32_t *outDataDacVal, uint32_t
                     } // End checking whether the OH is masked
                 } // End loop over optohybrids
 
-                std::this_thread::sleep_for(std::chrono::seconds(waitTime));
+                sleepFor(std::chrono::seconds(waitTime));
 
                 //Read the counters
                 for (unsigned int ohN = 0; ohN < amc::OH_PER_AMC; ++ohN) {
@@ -714,6 +1262,8 @@ void sbitRateScanParallelLocal(localArgs *la, uint32_t *outDataDacVal, uint32_t
                         } //End Loop Over all VFATs
                     } // End checking whether the OH is masked
                 } // End loop over optohybrids
+                jobProgress((dacVal-dacMin)/dacStep+1, (dacMax-dacMin)/dacStep+1);
+                jobPartialResult(outDataTrigRatePerVFAT, amc::OH_PER_AMC*oh::VFATS_PER_OH*(dacMax-dacMin+1)/dacStep);
             } //End Loop from dacMin to dacMax
 
             //Restore the original SBIT counter persist setting
@@ -761,14 +1311,17 @@ void sbitRateScan(const RPCMsg *request, RPCMsg *response)
     uint32_t waitTime = request->get_word("waitTime");    
     std::string scanReg = request->get_string("scanReg");
 
-    uint32_t outDataTrigRatePerVFAT[amc::OH_PER_AMC*oh::VFATS_PER_OH*(dacMax-dacMin+1)/dacStep];
-    uint32_t outDataDacValPerOH[amc::OH_PER_AMC*(dacMax-dacMin+1)/dacStep];
-    uint32_t outDataTrigRatePerOH[amc::OH_PER_AMC*(dacMax-dacMin+1)/dacStep];
-    sbitRateScanParallelLocal(&la, outDataDacValPerOH, outDataTrigRatePerVFAT, outDataTrigRatePerOH, ch, dacMin, dacMax, dacStep, scanReg, ohMask, waitTime);
+    ScratchBuffer outDataTrigRatePerVFAT(amc::OH_PER_AMC*oh::VFATS_PER_OH*(dacMax-dacMin+1)/dacStep, true);
+    ScratchBuffer outDataDacValPerOH(amc::OH_PER_AMC*(dacMax-dacMin+1)/dacStep, true);
+    ScratchBuffer outDataTrigRatePerOH(amc::OH_PER_AMC*(dacMax-dacMin+1)/dacStep, true);
+    if (!outDataTrigRatePerVFAT.check(response, "Scan data") || !outDataDacValPerOH.check(response, "Scan data")
+        || !outDataTrigRatePerOH.check(response, "Scan data"))
+        return;
+    sbitRateScanParallelLocal(&la, outDataDacValPerOH.data(), outDataTrigRatePerVFAT.data(), outDataTrigRatePerOH.data(), ch, dacMin, dacMax, dacStep, scanReg, ohMask, waitTime);
 
-    response->set_word_array("outDataVFATRate", outDataTrigRatePerVFAT, amc::OH_PER_AMC*oh::VFATS_PER_OH*(dacMax-dacMin+1)/dacStep);
-    response->set_word_array("outDataDacValue", outDataDacValPerOH, amc::OH_PER_AMC*(dacMax-dacMin+1)/dacStep);
-    response->set_word_array("outDataCTP7Rate", outDataTrigRatePerOH, amc::OH_PER_AMC*(dacMax-dacMin+1)/dacStep);
+    response->set_word_array("outDataVFATRate", outDataTrigRatePerVFAT.data(), outDataTrigRatePerVFAT.size());
+    response->set_word_array("outDataDacValue", outDataDacValPerOH.data(), outDataDacValPerOH.size());
+    response->set_word_array("outDataCTP7Rate", outDataTrigRatePerOH.data(), outDataTrigRatePerOH.size());
 
     return;
 } //End sbitRateScan(...)
@@ -819,7 +1372,7 @@ void checkSbitMappingWithCalPulseLocal(localArgs *la, uint32_t *outData, uint32_
     broadcastWriteLocal(la, ohN, "CFG_RUN", 0x0, mask);
 
     //Take the VFATs out of slow control only mode
-    writeReg(la, "GEM_AMC.GEM_SYSTEM.VFAT3.SC_ONLY_MODE", 0x0);
+    writeReg(la, regs::GEM_AMC_GEM_SYSTEM_VFAT3_SC_ONLY_MODE, 0x0);
 
     //Setup the sbit monitor
     const unsigned int nclusters = 8;
@@ -863,7 +1416,7 @@ void checkSbitMappingWithCalPulseLocal(localArgs *la, uint32_t *outData, uint32_
             }
 
             //Sleep for 200 us + pulseDelay * 25 ns * (0.001 us / ns)
-            std::this_thread::sleep_for(std::chrono::microseconds(200+int(ceil(pulseDelay*25*0.001))));
+            sleepFor(std::chrono::microseconds(200+int(ceil(pulseDelay*25*0.001))));
 
             //Check clusers
             for (unsigned int cluster=0; cluster<nclusters; ++cluster) {
@@ -900,6 +1453,8 @@ void checkSbitMappingWithCalPulseLocal(localArgs *la, uint32_t *outData, uint32_
 
         //mask this channel
         writeReg(la, stdsprintf("GEM_AMC.OH.OH%i.GEB.VFAT%i.VFAT_CHANNELS.CHANNEL%i.MASK",ohN,vfatN,chan), 0x1);
+        jobProgress(chan+1, 128);
+        jobPartialResult(outData, (chan+1)*nevts*nclusters);
     } //End Loop over all channels
 
     //Place this vfat out of run mode
@@ -932,10 +1487,12 @@ void checkSbitMappingWithCalPulse(const RPCMsg *request, RPCMsg *response)
     uint32_t L1Ainterval = request->get_word("L1Ainterval");
     uint32_t pulseDelay = request->get_word("pulseDelay");
 
-    uint32_t outData[128*8*nevts];
-    checkSbitMappingWithCalPulseLocal(&la, outData, ohN, vfatN, mask, useCalPulse, currentPulse, calScaleFactor, nevts, L1Ainterval, pulseDelay);
+    ScratchBuffer outData(128*8*nevts, true);
+    if (!outData.check(response, "Sbit data"))
+        return;
+    checkSbitMappingWithCalPulseLocal(&la, outData.data(), ohN, vfatN, mask, useCalPulse, currentPulse, calScaleFactor, nevts, L1Ainterval, pulseDelay);
 
-    response->set_word_array("data",outData,128*8*nevts);
+    response->set_word_array("data",outData.data(),outData.size());
 
     rtxn.abort();
 } //End checkSbitMappingWithCalPulse()
@@ -1005,7 +1562,7 @@ void checkSbitRateWithCalPulseLocal(localArgs *la, uint32_t *outDataCTP7Rate, ui
 
     //Take the VFATs out of slow control only mode
     LOGGER->log_message(LogManager::INFO, "Taking VFAT3s out of slow control only mode");
-    writeReg(la, "GEM_AMC.GEM_SYSTEM.VFAT3.SC_ONLY_MODE", 0x0);
+    writeReg(la, regs::GEM_AMC_GEM_SYSTEM_VFAT3_SC_ONLY_MODE, 0x0);
 
     //Prep the SBIT counters
     LOGGER->log_message(LogManager::INFO, stdsprintf("Preping SBIT Counters for ohN %i", ohN));
@@ -1053,7 +1610,7 @@ void checkSbitRateWithCalPulseLocal(localArgs *la, uint32_t *outDataCTP7Rate, ui
         writeRawAddress(addrTtcStart, 0x1, la->response);
 
         //Sleep for waitTime of milliseconds
-        std::this_thread::sleep_for(std::chrono::milliseconds(waitTime));
+        sleepFor(std::chrono::milliseconds(waitTime));
 
         //Read All Trigger Registers
         LOGGER->log_message(LogManager::INFO, "Reading trigger counters");
@@ -1075,6 +1632,7 @@ void checkSbitRateWithCalPulseLocal(localArgs *la, uint32_t *outDataCTP7Rate, ui
         //mask this channel
         LOGGER->log_message(LogManager::INFO, stdsprintf("Masking channel %i on vfat %i of OH %i", chan, vfatN, ohN));
         writeReg(la, stdsprintf("GEM_AMC.OH.OH%i.GEB.VFAT%i.VFAT_CHANNELS.CHANNEL%i.MASK",ohN,vfatN,chan), 0x1);
+        jobProgress(chan+1, 128);
     } //End Loop over all channels
 
     //Place this vfat out of run mode
@@ -1197,21 +1755,21 @@ std::vector<uint32_t> dacScanLocal(localArgs *la, uint32_t ohN, uint32_t dacSele
     std::vector<uint32_t> vec_dacScanData(oh::VFATS_PER_OH*nDacValues); //Each element has bits [0:7] as the current dacValue, and bits [8:17] as the ADC read back value
 
     //Block L1A's then take VFATs out of run mode
-    writeReg(la, "GEM_AMC.TTC.CTRL.L1A_ENABLE", 0x0);
+    writeReg(la, regs::GEM_AMC_TTC_CTRL_L1A_ENABLE, 0x0);
     broadcastWriteLocal(la, ohN, "CFG_RUN", 0x0, mask);
 
     //Block L1A's then take VFATs out of run mode
-    writeReg(la, "GEM_AMC.TTC.CTRL.L1A_ENABLE", 0x0);
+    writeReg(la, regs::GEM_AMC_TTC_CTRL_L1A_ENABLE, 0x0);
     broadcastWriteLocal(la, ohN, "CFG_RUN", 0x0, mask);
 
     //Configure the DAC Monitoring on all the VFATs
     configureVFAT3DacMonitorLocal(la, ohN, mask, dacSelect);
 
     //Set the VFATs into Run Mode
-    writeReg(la, "GEM_AMC.GEM_SYSTEM.VFAT3.SC_ONLY_MODE", 0x0);
+    writeReg(la, regs::GEM_AMC_GEM_SYSTEM_VFAT3_SC_ONLY_MODE, 0x0);
     broadcastWriteLocal(la, ohN, "CFG_RUN", 0x1, mask);
     LOGGER->log_message(LogManager::INFO, stdsprintf("VFATs not in 0x%x were set to run mode", mask));
-    std::this_thread::sleep_for(std::chrono::seconds(1)); //I noticed that DAC values behave weirdly immediately after VFAT is placed in run mode (probably voltage/current takes a moment to stabalize)
+    sleepFor(std::chrono::seconds(1)); //I noticed that DAC values behave weirdly immediately after VFAT is placed in run mode (probably voltage/current takes a moment to stabalize)
 
     //Scan the DAC
 
@@ -1239,7 +1797,7 @@ std::vector<uint32_t> dacScanLocal(localArgs *la, uint32_t ohN, uint32_t dacSele
                         //either reading or writing this register will trigger a cache update
                         readRawAddress(adcCacheUpdateAddr[vfatN], la->response);
                         //updating the cache takes 20 us, including a 50% safety factor
-                        std::this_thread::sleep_for(std::chrono::microseconds(20));
+                        sleepFor(std::chrono::microseconds(20));
                     }
                     adcVal += readRawAddress(adcAddr[vfatN], la->response);
                 }
@@ -1249,6 +1807,7 @@ std::vector<uint32_t> dacScanLocal(localArgs *la, uint32_t ohN, uint32_t dacSele
                 vec_dacScanData[idx] = ((ohN & 0xf) << 23) + ((vfatN & 0x1f) << 18) + ((adcVal & 0x3ff) << 8) + (dacVal & 0xff);
             } //End Case: VFAT is not masked
         } //End Loop over VFATs
+        jobProgress((dacVal-dacMin)/dacStep+1, (dacMax-dacMin)/dacStep+1);
     } //End Loop over DAC values
 
 
@@ -1283,7 +1842,7 @@ void dacScanMultiLink(const RPCMsg *request, RPCMsg *response)
     uint32_t dacStep = request->get_word("dacStep");
     bool useExtRefADC = request->get_word("useExtRefADC");
 
-    unsigned int NOH = readReg(&la, "GEM_AMC.GEM_SYSTEM.CONFIG.NUM_OF_OH");
+    unsigned int NOH = getSystemInfo(&la).numOfOH;
     if (request->get_key_exists("NOH")) {
         unsigned int NOH_requested = request->get_word("NOH");
         if (NOH_requested <= NOH)
@@ -1311,11 +1870,15 @@ void dacScanMultiLink(const RPCMsg *request, RPCMsg *response)
 
         //Get dac scan results for this optohybrid
         LOGGER->log_message(LogManager::INFO, stdsprintf("Performing DAC Scan for OH%i", ohN));
-        dacScanResults = dacScanLocal(&la, ohN, dacSelect, dacStep, vfatMask, useExtRefADC);
+        {
+            JobProgressScope progress(ohN, NOH);
+            dacScanResults = dacScanLocal(&la, ohN, dacSelect, dacStep, vfatMask, useExtRefADC);
+        }
 
         //Copy the results into the final container
         LOGGER->log_message(LogManager::INFO, stdsprintf("Storing results of DAC scan for OH%i", ohN));
         std::copy(dacScanResults.begin(), dacScanResults.end(), std::back_inserter(dacScanResultsAll));
+        jobPartialResult(dacScanResultsAll.data(), dacScanResultsAll.size());
 
         LOGGER->log_message(LogManager::INFO, stdsprintf("Finished DAC scan for OH%i", ohN));
     } //End Loop over all Optohybrids
@@ -1326,6 +1889,55 @@ void dacScanMultiLink(const RPCMsg *request, RPCMsg *response)
     rtxn.abort();
 } //End dacScanMultiLink(...)
 
+void fitScanLocal(localArgs *la, const uint32_t *data, uint32_t nCurves, uint32_t nPoints, uint32_t dacMin, uint32_t dacStep)
+{
+    const RegNode * goodEvents = getRegNode(la, "GEM_AMC.GEM_TESTS.VFAT_DAQ_MONITOR.VFAT0.GOOD_EVENTS_COUNT");
+    const RegNode * fireCount = getRegNode(la, "GEM_AMC.GEM_TESTS.VFAT_DAQ_MONITOR.VFAT0.CHANNEL_FIRE_COUNT");
+    if (!goodEvents || !fireCount) {
+        LOGGER->log_message(LogManager::ERROR, "Unable to find the VFAT_DAQ_MONITOR counters, the scan is not fitted");
+        la->response->set_string("error", "Unable to find the VFAT_DAQ_MONITOR counters, the scan is not fitted");
+        return;
+    }
+
+    ScratchBuffer hits(size_t(nCurves)*nPoints), events(size_t(nCurves)*nPoints);
+    if (!hits.check(la->response, "Fit hits") || !events.check(la->response, "Fit events"))
+        return;
+    for (size_t i = 0; i < hits.size(); ++i) {
+        events[i] = applyMask(data[i], goodEvents->mask);
+        hits[i]   = applyMask(data[i], fireCount->mask);
+    }
+    std::vector<float> x(nPoints);
+    for (uint32_t point = 0; point < nPoints; ++point)
+        x[point] = dacMin + point*dacStep;
+
+    std::vector<SCurveFit> fits(nCurves);
+    const auto start = std::chrono::steady_clock::now();
+    fitSCurves(x.data(), nPoints, hits.data(), events.data(), nCurves, fits.data());
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+    auto fixedPoint = [](float value) {
+        const float scaled = value*SCURVE_FIT_FIXED_POINT;
+        return (scaled > 0.f) ? uint32_t(std::min(scaled, 4294967040.f)) : 0; // also maps NaN to 0
+    };
+    std::vector<uint32_t> mean, sigma, chi2, ndf, flags;
+    uint32_t good = 0;
+    for (auto const& fit : fits) {
+        mean.push_back(fixedPoint(fit.mean));
+        sigma.push_back(fixedPoint(fit.sigma));
+        chi2.push_back(fixedPoint(fit.chi2));
+        ndf.push_back(fit.ndf);
+        flags.push_back(fit.flags);
+        good += !(fit.flags & SCURVE_FIT_BAD);
+    }
+    la->response->set_word_array("fit_mean", mean);
+    la->response->set_word_array("fit_sigma", sigma);
+    la->response->set_word_array("fit_chi2", chi2);
+    la->response->set_word_array("fit_ndf", ndf);
+    la->response->set_word_array("fit_flags", flags);
+    LOGGER->log_message(LogManager::INFO, stdsprintf("Fitted %u S-curves of %u points in %lld ms, %u good fits",
+                                                     nCurves, nPoints, (long long)elapsed.count(), good));
+}
+
 void genChannelScan(const RPCMsg *request, RPCMsg *response)
 {
     GETLOCALARGS(response);
@@ -1347,11 +1959,35 @@ void genChannelScan(const RPCMsg *request, RPCMsg *response)
         useUltra = true;
     }
 
-    uint32_t outData[128*oh::VFATS_PER_OH*(dacMax-dacMin+1)/dacStep];
+    if (dacStep == 0 || dacMax < dacMin) {
+        response->set_string("error", stdsprintf("Invalid DAC range: dacMin %i, dacMax %i, dacStep %i", dacMin, dacMax, dacStep));
+        return;
+    }
+    bool fit = request->get_key_exists("fit");
+    if (fit && (dacMax-dacMin+1) % dacStep != 0) {
+        // Otherwise the curves of the VFATs are not stored every (dacMax-dacMin+1)/dacStep words, see genScanLocal
+        response->set_string("error", stdsprintf("Cannot fit the S-curves: dacMax-dacMin+1 (%i) is not a multiple of dacStep (%i)",
+                                                 dacMax-dacMin+1, dacStep));
+        return;
+    }
+    ScratchBuffer outData(128*oh::VFATS_PER_OH*(dacMax-dacMin+1)/dacStep, true);
+    if (!outData.check(response, "Scan data"))
+        return;
+    NestedGenScans nested;
     for (uint32_t ch = 0; ch < 128; ch++) {
-        genScanLocal(&la, &(outData[ch*oh::VFATS_PER_OH*(dacMax-dacMin+1)/dacStep]), ohN, mask, ch, useCalPulse, currentPulse, calScaleFactor, nevts, dacMin, dacMax, dacStep, scanReg, useUltra, useExtTrig);
+        {
+            JobProgressScope progress(ch, 128);
+            genScanLocal(&la, &(outData[ch*oh::VFATS_PER_OH*(dacMax-dacMin+1)/dacStep]), ohN, mask, ch, useCalPulse, currentPulse, calScaleFactor, nevts, dacMin, dacMax, dacStep, scanReg, useUltra, useExtTrig);
+        }
+        jobPartialResult(outData.data(), outData.size());
+        if (response->get_key_exists("error"))
+            break;
     }
-    response->set_word_array("data",outData,oh::VFATS_PER_OH*128*(dacMax-dacMin+1)/dacStep);
+    nested.report(&la);
+    if (fit)
+        fitScanLocal(&la, outData.data(), 128*oh::VFATS_PER_OH, (dacMax-dacMin+1)/dacStep, dacMin, dacStep);
+    if (!fit || request->get_key_exists("raw"))
+        response->set_word_array("data",outData.data(),outData.size());
 
     rtxn.abort();
 }
@@ -1382,15 +2018,19 @@ extern "C" {
             LOGGER->log_message(LogManager::ERROR, "Unable to load module");
             return; // Do not register our functions, we depend on memsvc.
         }
-        modmgr->register_method("calibration_routines", "checkSbitMappingWithCalPulse", checkSbitMappingWithCalPulse);
-        modmgr->register_method("calibration_routines", "checkSbitRateWithCalPulse", checkSbitRateWithCalPulse);
-        modmgr->register_method("calibration_routines", "dacScan", dacScan);
-        modmgr->register_method("calibration_routines", "dacScanMultiLink", dacScanMultiLink);
-        modmgr->register_method("calibration_routines", "genScan", genScan);
-        modmgr->register_method("calibration_routines", "genChannelScan", genChannelScan);
-        modmgr->register_method("calibration_routines", "sbitRateScan", sbitRateScan);
-        modmgr->register_method("calibration_routines", "ttcGenConf", ttcGenConf);
-        modmgr->register_method("calibration_routines", "ttcGenToggle", ttcGenToggle);
-        modmgr->register_method("calibration_routines", "confCalPulse", confCalPulse);
+        if (!openAddressTable()) {
+            LOGGER->log_message(LogManager::WARNING, "Address table not available yet, it will be opened on first use");
+        }
+        modmgr->register_method("calibration_routines", "checkSbitMappingWithCalPulse", profiledMethod<checkSbitMappingWithCalPulse>);
+        modmgr->register_method("calibration_routines", "checkSbitRateWithCalPulse", profiledMethod<checkSbitRateWithCalPulse>);
+        modmgr->register_method("calibration_routines", "dacScan", profiledMethod<dacScan>);
+        modmgr->register_method("calibration_routines", "dacScanMultiLink", profiledMethod<dacScanMultiLink>);
+        modmgr->register_method("calibration_routines", "genScan", profiledMethod<genScan>);
+        modmgr->register_method("calibration_routines", "genScanMultiLink", profiledMethod<genScanMultiLink>);
+        modmgr->register_method("calibration_routines", "genChannelScan", profiledMethod<genChannelScan>);
+        modmgr->register_method("calibration_routines", "sbitRateScan", profiledMethod<sbitRateScan>);
+        modmgr->register_method("calibration_routines", "ttcGenConf", profiledMethod<ttcGenConf>);
+        modmgr->register_method("calibration_routines", "ttcGenToggle", profiledMethod<ttcGenToggle>);
+        modmgr->register_method("calibration_routines", "confCalPulse", profiledMethod<confCalPulse>);
     }
 }
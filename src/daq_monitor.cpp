@@ -34,7 +34,7 @@ void getmonTRIGGERmainLocal(localArgs * la, int NOH, int ohMask)
 {
   std::string t1,t2;
   la->response->set_word("OR_TRIGGER_RATE",readReg(la,"GEM_AMC.TRIGGER.STATUS.OR_TRIGGER_RATE"));
-  int NOH_local = readReg(la,"GEM_AMC.GEM_SYSTEM.CONFIG.NUM_OF_OH");
+  int NOH_local = getSystemInfo(la).numOfOH;
   if (NOH_local < NOH) NOH = NOH_local;
   for (int ohN = 0; ohN < NOH; ohN++){
     // If this Optohybrid is masked skip it
@@ -51,7 +51,7 @@ void getmonTRIGGERmain(const RPCMsg *request, RPCMsg *response)
 {
   GETLOCALARGS(response);
 
-  unsigned int NOH = readReg(&la, "GEM_AMC.GEM_SYSTEM.CONFIG.NUM_OF_OH");
+  unsigned int NOH = getSystemInfo(&la).numOfOH;
   int ohMask = 0xfff;
   if (request->get_key_exists("ohMask")) {
     ohMask = request->get_word("ohMask");
@@ -73,7 +73,7 @@ void getmonTRIGGERmain(const RPCMsg *request, RPCMsg *response)
 void getmonTRIGGEROHmainLocal(localArgs * la, int NOH, int ohMask)
 {
   std::string t1,t2;
-  int NOH_local = readReg(la,"GEM_AMC.GEM_SYSTEM.CONFIG.NUM_OF_OH");
+  int NOH_local = getSystemInfo(la).numOfOH;
   if (NOH_local < NOH) NOH = NOH_local;
   for (int ohN = 0; ohN < NOH; ohN++){
     // If this Optohybrid is masked skip it
@@ -127,7 +127,7 @@ void getmonTRIGGEROHmain(const RPCMsg *request, RPCMsg *response)
 {
   GETLOCALARGS(response);
 
-  unsigned int NOH = readReg(&la, "GEM_AMC.GEM_SYSTEM.CONFIG.NUM_OF_OH");
+  unsigned int NOH = getSystemInfo(&la).numOfOH;
   int ohMask = 0xfff;
   if (request->get_key_exists("ohMask")) {
     ohMask = request->get_word("ohMask");
@@ -171,7 +171,7 @@ void getmonDAQmain(const RPCMsg *request, RPCMsg *response)
 void getmonDAQOHmainLocal(localArgs * la, int NOH, int ohMask)
 {
   std::string t1,t2;
-  int NOH_local = readReg(la,"GEM_AMC.GEM_SYSTEM.CONFIG.NUM_OF_OH");
+  int NOH_local = getSystemInfo(la).numOfOH;
   if (NOH_local < NOH) NOH = NOH_local;
   for (int ohN = 0; ohN < NOH; ohN++){
     // If this Optohybrid is masked skip it
@@ -215,7 +215,7 @@ void getmonDAQOHmain(const RPCMsg *request, RPCMsg *response)
 {
   GETLOCALARGS(response);
 
-  unsigned int NOH = readReg(&la, "GEM_AMC.GEM_SYSTEM.CONFIG.NUM_OF_OH");
+  unsigned int NOH = getSystemInfo(&la).numOfOH;
   int ohMask = 0xfff;
   if (request->get_key_exists("ohMask")) {
     ohMask = request->get_word("ohMask");
@@ -273,7 +273,7 @@ void getmonGBTLink(const RPCMsg *request, RPCMsg *response)
 {
   GETLOCALARGS(response);
 
-  unsigned int NOH = readReg(&la, "GEM_AMC.GEM_SYSTEM.CONFIG.NUM_OF_OH");
+  unsigned int NOH = getSystemInfo(&la).numOfOH;
 
   if (request->get_key_exists("NOH")) {
     unsigned int NOH_requested = request->get_word("NOH");
@@ -296,7 +296,7 @@ void getmonOHLink(const RPCMsg *request, RPCMsg *response)
 {
   GETLOCALARGS(response);
 
-  unsigned int NOH = readReg(&la, "GEM_AMC.GEM_SYSTEM.CONFIG.NUM_OF_OH");
+  unsigned int NOH = getSystemInfo(&la).numOfOH;
 
   if (request->get_key_exists("NOH")) {
     unsigned int NOH_requested = request->get_word("NOH");
@@ -319,84 +319,77 @@ void getmonOHLink(const RPCMsg *request, RPCMsg *response)
 
 void getmonOHmainLocal(localArgs * la, int NOH, int ohMask)
 {
-  int NOH_local = readReg(la,"GEM_AMC.GEM_SYSTEM.CONFIG.NUM_OF_OH");
+  int NOH_local = getSystemInfo(la).numOfOH;
   if (NOH_local < NOH) NOH = NOH_local;
-  std::string t1,t2;
+
+  // Response key suffix and register of the monitored counters
+  static const struct { const char * key; const char * reg; } counters[] = {
+    {"EVENT_COUNTER",     "GEM_AMC.DAQ.OH%d.COUNTERS.EVN"},
+    {"EVENT_RATE",        "GEM_AMC.DAQ.OH%d.COUNTERS.EVT_RATE"},
+    {"GTX.TRK_ERR",       "GEM_AMC.OH.OH%d.COUNTERS.GTX_LINK.TRK_ERR"},
+    {"GTX.TRG_ERR",       "GEM_AMC.OH.OH%d.COUNTERS.GTX_LINK.TRG_ERR"},
+    {"GBT.TRK_ERR",       "GEM_AMC.OH.OH%d.COUNTERS.GBT_LINK.TRK_ERR"},
+    {"CORR_VFAT_BLK_CNT", "GEM_AMC.DAQ.OH%d.COUNTERS.CORRUPT_VFAT_BLK_CNT"},
+    {"COUNTERS.SEU",      "GEM_AMC.OH.OH%d.COUNTERS.SEU"},
+    {"STATUS.SEU",        "GEM_AMC.OH.OH%d.STATUS.SEU"},
+  };
+  static const char * const fwVersionFields[] = {"MAJOR", "MINOR", "BUILD", "GENERATION"};
+
+  // The registers of all the unmasked OptoHybrids are read in a single batch
+  int fwMajor = -1;
+  std::vector<std::string> regNames;
+  for (int ohN = 0; ohN < NOH; ohN++) {
+    if (!((ohMask >> ohN) & 0x1))
+      continue;
+    if (fwMajor < 0)
+      fwMajor = fw_version_check("getmonOHmain",la);
+    if (fwMajor == 3) {
+      for (auto const& field : fwVersionFields)
+        regNames.push_back(stdsprintf("GEM_AMC.OH.OH%d.FPGA.CONTROL.RELEASE.VERSION.%s",ohN,field));
+    } else {
+      regNames.push_back(stdsprintf("GEM_AMC.OH.OH%d.STATUS.FW.VERSION",ohN));
+    }
+    for (auto const& counter : counters)
+      regNames.push_back(stdsprintf(counter.reg,ohN));
+  }
+  std::vector<uint32_t> values;
+  uint32_t nTransactions = readRegs(la, regNames, values);
+
+  auto value = values.cbegin();
   for (int ohN = 0; ohN < NOH; ohN++) {
     // If this Optohybrid is masked skip it
     if (!((ohMask >> ohN) & 0x1)) {
-      t1 = stdsprintf("OH%s.FW_VERSION",std::to_string(ohN).c_str());
-      la->response->set_word(t1,0xdeaddead);
-      t1 = stdsprintf("OH%s.EVENT_COUNTER",std::to_string(ohN).c_str());
-      la->response->set_word(t1,0xdeaddead);
-      t1 = stdsprintf("OH%s.EVENT_RATE",std::to_string(ohN).c_str());
-      la->response->set_word(t1,0xdeaddead);
-      t1 = stdsprintf("OH%s.GTX.TRK_ERR",std::to_string(ohN).c_str());
-      la->response->set_word(t1,0xdeaddead);
-      t1 = stdsprintf("OH%s.GTX.TRG_ERR",std::to_string(ohN).c_str());
-      la->response->set_word(t1,0xdeaddead);
-      t1 = stdsprintf("OH%s.GBT.TRK_ERR",std::to_string(ohN).c_str());
-      la->response->set_word(t1,0xdeaddead);
-      t1 = stdsprintf("OH%s.CORR_VFAT_BLK_CNT",std::to_string(ohN).c_str());
-      la->response->set_word(t1,0xdeaddead);
-      t1 = stdsprintf("OH%s.COUNTERS.SEU",std::to_string(ohN).c_str());
-      la->response->set_word(t1,0xdeaddead);
-      t1 = stdsprintf("OH%s.STATUS.SEU",std::to_string(ohN).c_str());
-      la->response->set_word(t1,0xdeaddead);
+      la->response->set_word(stdsprintf("OH%d.FW_VERSION",ohN),0xdeaddead);
+      for (auto const& counter : counters)
+        la->response->set_word(stdsprintf("OH%d.%s",ohN,counter.key),0xdeaddead);
       continue;
     }
-    t1 = stdsprintf("OH%s.FW_VERSION",std::to_string(ohN).c_str());
-    if (fw_version_check("getmonOHmain",la) == 3) {
+    if (fwMajor == 3) {
       uint32_t t_fwver=0xffffffff;
-      t2 = stdsprintf("GEM_AMC.OH.OH%s.FPGA.CONTROL.RELEASE.VERSION.MAJOR",std::to_string(ohN).c_str());
-      t_fwver = t_fwver & (0x00ffffff|(readReg(la,t2) << 24));
-      LOGGER->log_message(LogManager::INFO, stdsprintf("FW version MAJOR for OH%i is %08x, t_fwver is %08x ",ohN, readReg(la,t2), t_fwver));
-      t2 = stdsprintf("GEM_AMC.OH.OH%s.FPGA.CONTROL.RELEASE.VERSION.MINOR",std::to_string(ohN).c_str());
-      t_fwver = t_fwver & (0xff00ffff|(readReg(la,t2) << 16));
-      LOGGER->log_message(LogManager::INFO, stdsprintf("FW version MINOR for OH%i is %08x, t_fwver is %08x ",ohN, readReg(la,t2), t_fwver));
-      t2 = stdsprintf("GEM_AMC.OH.OH%s.FPGA.CONTROL.RELEASE.VERSION.BUILD",std::to_string(ohN).c_str());
-      t_fwver = t_fwver & (0xffff00ff|(readReg(la,t2) << 8));
-      LOGGER->log_message(LogManager::INFO, stdsprintf("FW version BUILD for OH%i is %08x, t_fwver is %08x ",ohN, readReg(la,t2), t_fwver));
-      t2 = stdsprintf("GEM_AMC.OH.OH%s.FPGA.CONTROL.RELEASE.VERSION.GENERATION",std::to_string(ohN).c_str());
-      t_fwver = t_fwver & (0xffffff00|(readReg(la,t2)));
-      LOGGER->log_message(LogManager::INFO, stdsprintf("FW version GENERATION for OH%i is %08x, t_fwver is %08x ",ohN, readReg(la,t2), t_fwver));
-      la->response->set_word(t1,t_fwver);
+      const uint32_t major = *value++, minor = *value++, build = *value++, generation = *value++;
+      t_fwver = t_fwver & (0x00ffffff|(major << 24));
+      LOGGER->log_message(LogManager::INFO, stdsprintf("FW version MAJOR for OH%i is %08x, t_fwver is %08x ",ohN, major, t_fwver));
+      t_fwver = t_fwver & (0xff00ffff|(minor << 16));
+      LOGGER->log_message(LogManager::INFO, stdsprintf("FW version MINOR for OH%i is %08x, t_fwver is %08x ",ohN, minor, t_fwver));
+      t_fwver = t_fwver & (0xffff00ff|(build << 8));
+      LOGGER->log_message(LogManager::INFO, stdsprintf("FW version BUILD for OH%i is %08x, t_fwver is %08x ",ohN, build, t_fwver));
+      t_fwver = t_fwver & (0xffffff00|(generation));
+      LOGGER->log_message(LogManager::INFO, stdsprintf("FW version GENERATION for OH%i is %08x, t_fwver is %08x ",ohN, generation, t_fwver));
+      la->response->set_word(stdsprintf("OH%d.FW_VERSION",ohN),t_fwver);
     } else {
-      t2 = stdsprintf("GEM_AMC.OH.OH%s.STATUS.FW.VERSION",std::to_string(ohN).c_str());
-      la->response->set_word(t1,readReg(la,t2));
+      la->response->set_word(stdsprintf("OH%d.FW_VERSION",ohN),*value++);
     }
-    t1 = stdsprintf("OH%s.EVENT_COUNTER",std::to_string(ohN).c_str());
-    t2 = stdsprintf("GEM_AMC.DAQ.OH%s.COUNTERS.EVN",std::to_string(ohN).c_str());
-    la->response->set_word(t1,readReg(la,t2));
-    t1 = stdsprintf("OH%s.EVENT_RATE",std::to_string(ohN).c_str());
-    t2 = stdsprintf("GEM_AMC.DAQ.OH%s.COUNTERS.EVT_RATE",std::to_string(ohN).c_str());
-    la->response->set_word(t1,readReg(la,t2));
-    t1 = stdsprintf("OH%s.GTX.TRK_ERR",std::to_string(ohN).c_str());
-    t2 = stdsprintf("GEM_AMC.OH.OH%s.COUNTERS.GTX_LINK.TRK_ERR",std::to_string(ohN).c_str());
-    la->response->set_word(t1,readReg(la,t2));
-    t1 = stdsprintf("OH%s.GTX.TRG_ERR",std::to_string(ohN).c_str());
-    t2 = stdsprintf("GEM_AMC.OH.OH%s.COUNTERS.GTX_LINK.TRG_ERR",std::to_string(ohN).c_str());
-    la->response->set_word(t1,readReg(la,t2));
-    t1 = stdsprintf("OH%s.GBT.TRK_ERR",std::to_string(ohN).c_str());
-    t2 = stdsprintf("GEM_AMC.OH.OH%s.COUNTERS.GBT_LINK.TRK_ERR",std::to_string(ohN).c_str());
-    la->response->set_word(t1,readReg(la,t2));
-    t1 = stdsprintf("OH%s.CORR_VFAT_BLK_CNT",std::to_string(ohN).c_str());
-    t2 = stdsprintf("GEM_AMC.DAQ.OH%s.COUNTERS.CORRUPT_VFAT_BLK_CNT",std::to_string(ohN).c_str());
-    la->response->set_word(t1,readReg(la,t2));
-    t1 = stdsprintf("OH%s.COUNTERS.SEU",std::to_string(ohN).c_str());
-    t2 = stdsprintf("GEM_AMC.OH.OH%s.COUNTERS.SEU",std::to_string(ohN).c_str());
-    la->response->set_word(t1,readReg(la,t2));
-    t1 = stdsprintf("OH%s.STATUS.SEU",std::to_string(ohN).c_str());
-    t2 = stdsprintf("GEM_AMC.OH.OH%s.STATUS.SEU",std::to_string(ohN).c_str());
-    la->response->set_word(t1,readReg(la,t2));
+    for (auto const& counter : counters)
+      la->response->set_word(stdsprintf("OH%d.%s",ohN,counter.key),*value++);
   }
+  LOGGER->log_message(LogManager::DEBUG, stdsprintf("getmonOHmain: %zu registers read in %u transactions", regNames.size(), nTransactions));
 }
 
 void getmonOHmain(const RPCMsg *request, RPCMsg *response)
 {
   GETLOCALARGS(response);
 
-  unsigned int NOH = readReg(&la, "GEM_AMC.GEM_SYSTEM.CONFIG.NUM_OF_OH");
+  unsigned int NOH = getSystemInfo(&la).numOfOH;
   int ohMask = 0xfff;
   if (request->get_key_exists("ohMask")) {
     ohMask = request->get_word("ohMask");
@@ -420,11 +413,11 @@ void getmonOHSCAmainLocal(localArgs *la, int NOH, int ohMask)
     std::string strRegName, strKeyName;
 
     //Get original monitoring mask
-    uint32_t initSCAMonOffMask = readReg(la, "GEM_AMC.SLOW_CONTROL.SCA.ADC_MONITORING.MONITORING_OFF");
+    uint32_t initSCAMonOffMask = readReg(la, regs::GEM_AMC_SLOW_CONTROL_SCA_ADC_MONITORING_MONITORING_OFF);
 
     //Turn on monitoring for requested links
-    writeReg(la, "GEM_AMC.SLOW_CONTROL.SCA.ADC_MONITORING.MONITORING_OFF", (~ohMask) & 0x3fc);
-    int NOH_local = readReg(la,"GEM_AMC.GEM_SYSTEM.CONFIG.NUM_OF_OH");
+    writeReg(la, regs::GEM_AMC_SLOW_CONTROL_SCA_ADC_MONITORING_MONITORING_OFF, (~ohMask) & 0x3fc);
+    int NOH_local = getSystemInfo(la).numOfOH;
     if (NOH_local < NOH) NOH = NOH_local;
 
     for (int ohN = 0; ohN < NOH; ++ohN) { //Loop over all optohybrids
@@ -538,7 +531,7 @@ void getmonOHSCAmainLocal(localArgs *la, int NOH, int ohMask)
     } //End Loop over all optohybrids
 
     //Return monitoring to original value
-    writeReg(la, "GEM_AMC.SLOW_CONTROL.SCA.ADC_MONITORING.MONITORING_OFF", initSCAMonOffMask);
+    writeReg(la, regs::GEM_AMC_SLOW_CONTROL_SCA_ADC_MONITORING_MONITORING_OFF, initSCAMonOffMask);
 
     return;
 } //End getmonOHSCAmainLocal(...)
@@ -547,7 +540,7 @@ void getmonOHSCAmain(const RPCMsg *request, RPCMsg *response)
 {
   GETLOCALARGS(response);
 
-  unsigned int NOH = readReg(&la, "GEM_AMC.GEM_SYSTEM.CONFIG.NUM_OF_OH");
+  unsigned int NOH = getSystemInfo(&la).numOfOH;
   int ohMask = 0xfff;
   if (request->get_key_exists("ohMask")) {
     ohMask = request->get_word("ohMask");
@@ -570,7 +563,7 @@ void getmonOHSysmonLocal(localArgs *la, int NOH, int ohMask, bool doReset)
 {
     std::string strKeyName;
     std::string strRegBase;
-    int NOH_local = readReg(la,"GEM_AMC.GEM_SYSTEM.CONFIG.NUM_OF_OH");
+    int NOH_local = getSystemInfo(la).numOfOH;
     if (NOH_local < NOH) NOH = NOH_local;
 
     if (fw_version_check("getmonOHSysmon", la) == 3) {
@@ -702,7 +695,7 @@ void getmonOHSysmon(const RPCMsg *request, RPCMsg *response)
 {
   GETLOCALARGS(response);
 
-  unsigned int NOH = readReg(&la, "GEM_AMC.GEM_SYSTEM.CONFIG.NUM_OF_OH");
+  unsigned int NOH = getSystemInfo(&la).numOfOH;
   int ohMask = 0xfff;
   if (request->get_key_exists("ohMask")) {
     ohMask = request->get_word("ohMask");
@@ -725,7 +718,7 @@ void getmonOHSysmon(const RPCMsg *request, RPCMsg *response)
 
 void getmonSCALocal(localArgs * la, int NOH)
 {
-  int NOH_local = readReg(la,"GEM_AMC.GEM_SYSTEM.CONFIG.NUM_OF_OH");
+  int NOH_local = getSystemInfo(la).numOfOH;
   if (NOH_local < NOH) NOH = NOH_local;
   std::string t1,t2;
   la->response->set_word("SCA.STATUS.READY", readReg(la, "GEM_AMC.SLOW_CONTROL.SCA.STATUS.READY"));
@@ -752,7 +745,7 @@ void getmonVFATLinkLocal(localArgs * la, int NOH, bool doReset)
     //Reset Requested?
     if (doReset) {
          writeReg(la, "GEM_AMC.GEM_SYSTEM.CTRL.LINK_RESET", 0x1);
-         std::this_thread::sleep_for(std::chrono::microseconds(92)); // FIXME sleep for N orbits
+         sleepFor(std::chrono::microseconds(92)); // FIXME sleep for N orbits
     }
 
     std::string regName, respName; //regName used for read/write, respName sets word in RPC response
@@ -792,7 +785,7 @@ void getmonVFATLink(const RPCMsg *request, RPCMsg *response)
 {
   GETLOCALARGS(response);
 
-  unsigned int NOH = readReg(&la, "GEM_AMC.GEM_SYSTEM.CONFIG.NUM_OF_OH");
+  unsigned int NOH = getSystemInfo(&la).numOfOH;
 
   if (request->get_key_exists("NOH")) {
     unsigned int NOH_requested = request->get_word("NOH");
@@ -862,9 +855,12 @@ void getmonCTP7dump(const RPCMsg *request, RPCMsg *response)
   std::vector<uint32_t>    keyvalues;
   for (auto const& regName : regNames) {
     keynames.push_back(regName.second);
-    // keyvalues.push_back(regName.second, readReg(&la, regName.second));
-    response->set_word(regName.second, readReg(&la, regName.second));
   }
+  uint32_t nTransactions = readRegs(&la, keynames, keyvalues);
+  for (size_t i = 0; i < keynames.size(); ++i) {
+    response->set_word(keynames[i], keyvalues[i]);
+  }
+  LOGGER->log_message(LogManager::DEBUG, stdsprintf("getmonCTP7dump: %zu registers read in %u transactions", keynames.size(), nTransactions));
   response->set_string_array("keynames",keynames);
   // response->set_word_array("keyvalues", keyvalues);
   rtxn.abort();
@@ -879,18 +875,21 @@ extern "C" {
             LOGGER->log_message(LogManager::ERROR, "Unable to load module");
             return; // Do not register our functions, we depend on memsvc.
         }
-        modmgr->register_method("daq_monitor", "getmonTTCmain", getmonTTCmain);
-        modmgr->register_method("daq_monitor", "getmonTRIGGERmain", getmonTRIGGERmain);
-        modmgr->register_method("daq_monitor", "getmonTRIGGEROHmain", getmonTRIGGEROHmain);
-        modmgr->register_method("daq_monitor", "getmonDAQmain", getmonDAQmain);
-        modmgr->register_method("daq_monitor", "getmonDAQOHmain", getmonDAQOHmain);
-        modmgr->register_method("daq_monitor", "getmonGBTLink", getmonGBTLink);
-        modmgr->register_method("daq_monitor", "getmonOHLink", getmonOHLink);
-        modmgr->register_method("daq_monitor", "getmonOHmain", getmonOHmain);
-        modmgr->register_method("daq_monitor", "getmonOHSCAmain", getmonOHSCAmain);
-        modmgr->register_method("daq_monitor", "getmonOHSysmon", getmonOHSysmon);
-        modmgr->register_method("daq_monitor", "getmonSCA", getmonSCA);
-        modmgr->register_method("daq_monitor", "getmonVFATLink", getmonVFATLink);
-        modmgr->register_method("daq_monitor", "getmonCTP7dump", getmonCTP7dump);
+        if (!openAddressTable()) {
+            LOGGER->log_message(LogManager::WARNING, "Address table not available yet, it will be opened on first use");
+        }
+        modmgr->register_method("daq_monitor", "getmonTTCmain", profiledMethod<getmonTTCmain>);
+        modmgr->register_method("daq_monitor", "getmonTRIGGERmain", profiledMethod<getmonTRIGGERmain>);
+        modmgr->register_method("daq_monitor", "getmonTRIGGEROHmain", profiledMethod<getmonTRIGGEROHmain>);
+        modmgr->register_method("daq_monitor", "getmonDAQmain", profiledMethod<getmonDAQmain>);
+        modmgr->register_method("daq_monitor", "getmonDAQOHmain", profiledMethod<getmonDAQOHmain>);
+        modmgr->register_method("daq_monitor", "getmonGBTLink", profiledMethod<getmonGBTLink>);
+        modmgr->register_method("daq_monitor", "getmonOHLink", profiledMethod<getmonOHLink>);
+        modmgr->register_method("daq_monitor", "getmonOHmain", profiledMethod<getmonOHmain>);
+        modmgr->register_method("daq_monitor", "getmonOHSCAmain", profiledMethod<getmonOHSCAmain>);
+        modmgr->register_method("daq_monitor", "getmonOHSysmon", profiledMethod<getmonOHSysmon>);
+        modmgr->register_method("daq_monitor", "getmonSCA", profiledMethod<getmonSCA>);
+        modmgr->register_method("daq_monitor", "getmonVFATLink", profiledMethod<getmonVFATLink>);
+        modmgr->register_method("daq_monitor", "getmonCTP7dump", profiledMethod<getmonCTP7dump>);
     }
 }
@@ -6,6 +6,8 @@
 #include "moduleapi.h"
 //#include <libmemsvc.h>
 #include "memhub.h"
+#include "utils.h"
+#include "regprog.h"
 
 memsvc_handle_t memsvc; /// \var global memory service handle required for registers read/write operations
 
@@ -18,15 +20,17 @@ memsvc_handle_t memsvc; /// \var global memory service handle required for regis
 void mblockread(const RPCMsg *request, RPCMsg *response) {
   uint32_t count = request->get_word("count");
   uint32_t addr  = request->get_word("address");
-  uint32_t data[count];
+  ScratchBuffer data(count);
+  if (!data.check(response, "Block read"))
+    return;
 
-  if (memhub_read(memsvc, addr, count, data) != 0) {
+  if (readChunked(addr, count, data.data()) != 0) {
     response->set_string("error", memsvc_get_last_error(memsvc));
     LOGGER->log_message(LogManager::INFO, stdsprintf("read memsvc error: %s",
                                                      memsvc_get_last_error(memsvc)));
     return;
   }
-  response->set_word_array("data", data, count);
+  response->set_word_array("data", data.data(), count);
 }
 
 /*! \fn void mfiforead(const RPCMsg *request, RPCMsg *response)
@@ -39,17 +43,17 @@ void mblockread(const RPCMsg *request, RPCMsg *response) {
 void mfiforead(const RPCMsg *request, RPCMsg *response) {
   uint32_t count = request->get_word("count");
   uint32_t addr  = request->get_word("address");
-  uint32_t data[count];
+  ScratchBuffer data(count);
+  if (!data.check(response, "FIFO read"))
+    return;
 
-  for (unsigned int i=0; i<count; i++){
-    if (memhub_read(memsvc, addr, 1, &data[i]) != 0) {
-      response->set_string("error", memsvc_get_last_error(memsvc));
-      LOGGER->log_message(LogManager::INFO, stdsprintf("read memsvc error: %s",
-                                                       memsvc_get_last_error(memsvc)));
-      return;
-    }
+  if (readChunked(addr, count, data.data(), true) != 0) {
+    response->set_string("error", memsvc_get_last_error(memsvc));
+    LOGGER->log_message(LogManager::INFO, stdsprintf("read memsvc error: %s",
+                                                     memsvc_get_last_error(memsvc)));
+    return;
   }
-  response->set_word_array("data", data, count);
+  response->set_word_array("data", data.data(), count);
 }
 
 /*! \fn void mlistread(const RPCMsg *request, RPCMsg *response)
@@ -59,9 +63,16 @@ void mfiforead(const RPCMsg *request, RPCMsg *response) {
  */
 void mlistread(const RPCMsg *request, RPCMsg *response) {
   uint32_t count = request->get_word("count");
-  uint32_t addr[count];
-  request->get_word_array("addresses", addr);
-  uint32_t data[count];
+  if (request->get_word_array_size("addresses") != count) {
+    response->set_string("error", "The number of addresses differs from count");
+    LOGGER->log_message(LogManager::ERROR, "listread: the number of addresses differs from count");
+    return;
+  }
+  ScratchBuffer addr(count);
+  ScratchBuffer data(count);
+  if (!addr.check(response, "List read") || !data.check(response, "List read"))
+    return;
+  request->get_word_array("addresses", addr.data());
 
   for (unsigned int i=0; i<count; i++){
     if (memhub_read(memsvc, addr[i], 1, &data[i]) != 0) {
@@ -71,7 +82,7 @@ void mlistread(const RPCMsg *request, RPCMsg *response) {
       return;
     }
   }
-  response->set_word_array("data", data, count);
+  response->set_word_array("data", data.data(), count);
 }
 
 /*! \fn void mblockwrite(const RPCMsg *request, RPCMsg *response)
@@ -82,10 +93,12 @@ void mlistread(const RPCMsg *request, RPCMsg *response) {
 void mblockwrite(const RPCMsg *request, RPCMsg *response) {
   uint32_t count = request->get_word_array_size("data");
   uint32_t addr  = request->get_word("address");
-  uint32_t data[count];
-  request->get_word_array("data", data);
+  ScratchBuffer data(count);
+  if (!data.check(response, "Block write"))
+    return;
+  request->get_word_array("data", data.data());
 
-  if (memhub_write(memsvc, addr, count, data) != 0) {
+  if (writeChunked(addr, count, data.data()) != 0) {
     response->set_string("error", memsvc_get_last_error(memsvc));
     LOGGER->log_message(LogManager::ERROR, stdsprintf("blockwrite memsvc error: %s",
                                                       memsvc_get_last_error(memsvc)));
@@ -93,7 +106,7 @@ void mblockwrite(const RPCMsg *request, RPCMsg *response) {
     return;
   }
   // return type?
-  response->set_word_array("data", data, count);
+  response->set_word_array("data", data.data(), count);
 }
 
 
@@ -105,20 +118,20 @@ void mblockwrite(const RPCMsg *request, RPCMsg *response) {
 void mfifowrite(const RPCMsg *request, RPCMsg *response) {
   uint32_t count = request->get_word_array_size("data");
   uint32_t addr  = request->get_word("address");
-  uint32_t data[count];
-  request->get_word_array("data", data);
+  ScratchBuffer data(count);
+  if (!data.check(response, "FIFO write"))
+    return;
+  request->get_word_array("data", data.data());
 
-  for (unsigned int i=0; i<count; i++){
-    if (memhub_write(memsvc, addr, 1, &data[i]) != 0) {
-      response->set_string("error", memsvc_get_last_error(memsvc));
-      LOGGER->log_message(LogManager::ERROR, stdsprintf("fifowrite memsvc error: %s",
-                                                        memsvc_get_last_error(memsvc)));
-      // needs better error handling
-      return;
-    }
+  if (writeChunked(addr, count, data.data(), true) != 0) {
+    response->set_string("error", memsvc_get_last_error(memsvc));
+    LOGGER->log_message(LogManager::ERROR, stdsprintf("fifowrite memsvc error: %s",
+                                                      memsvc_get_last_error(memsvc)));
+    // needs better error handling
+    return;
   }
   // return type?
-  response->set_word_array("data", data, count);
+  response->set_word_array("data", data.data(), count);
 }
 
 /*! \fn void mlistwrite(const RPCMsg *request, RPCMsg *response)
@@ -129,10 +142,17 @@ void mfifowrite(const RPCMsg *request, RPCMsg *response) {
 void mlistwrite(const RPCMsg *request, RPCMsg *response) {
   // implicit expectation that data and addresses will be the same size
   uint32_t count = request->get_word_array_size("data");
-  uint32_t addr[count];
-  request->get_word_array("addresses", addr);
-  uint32_t data[count];
-  request->get_word_array("data", data);
+  if (request->get_word_array_size("addresses") != count) {
+    response->set_string("error", "The numbers of addresses and of values differ");
+    LOGGER->log_message(LogManager::ERROR, "listwrite: the numbers of addresses and of values differ");
+    return;
+  }
+  ScratchBuffer addr(count);
+  ScratchBuffer data(count);
+  if (!addr.check(response, "List write") || !data.check(response, "List write"))
+    return;
+  request->get_word_array("addresses", addr.data());
+  request->get_word_array("data", data.data());
 
   for (unsigned int i=0; i<count; i++){
     if (memhub_write(memsvc, addr[i], 1, &data[i]) != 0) {
@@ -144,9 +164,133 @@ void mlistwrite(const RPCMsg *request, RPCMsg *response) {
     }
   }
   // return type?
-  response->set_word_array("data", data, count);
+  response->set_word_array("data", data.data(), count);
+}
+
+
+/*! \brief Executes the validated register program prog[begin, end), see regprog.h
+ *  \details Runs inside a memhub session, which is released while sleeping and between the reads of a poll
+ *  \returns \c false if an access failed or a poll timed out, error and errorOffset are then set
+ */
+static bool executeRegProgram(const uint32_t * prog, size_t begin, size_t end, uint32_t accumulators[],
+                              std::vector<uint32_t> & results, std::string & error, size_t & errorOffset)
+{
+  auto fail = [&](size_t pc, const std::string & message) {
+    error       = message;
+    errorOffset = pc;
+    return false;
+  };
+
+  size_t pc = begin;
+  while (pc < end) {
+    const uint32_t   header = prog[pc];
+    const RegProgOp  op     = regProgOpcode(header);
+    const uint32_t * args   = prog + pc + 1;
+    const uint32_t   count  = regProgCount(header);
+    uint32_t data;
+    switch (op) {
+    case REGPROG_READ:
+      if (memhub_read(memsvc, args[0], 1, &data) != 0)
+        return fail(pc, std::string("read memsvc error: ")+memsvc_get_last_error(memsvc));
+      results.push_back(data);
+      break;
+    case REGPROG_WRITE:
+      if (memhub_write(memsvc, args[0], 1, &args[1]) != 0)
+        return fail(pc, std::string("write memsvc error: ")+memsvc_get_last_error(memsvc));
+      break;
+    case REGPROG_WRITE_MASKED:
+    {
+      MemhubSession rmw(MEMHUB_SESSION_ATOMIC);
+      if (memhub_read(memsvc, args[0], 1, &data) != 0)
+        return fail(pc, std::string("read memsvc error: ")+memsvc_get_last_error(memsvc));
+      data = (data & ~args[1]) | (args[2] & args[1]);
+      if (memhub_write(memsvc, args[0], 1, &data) != 0)
+        return fail(pc, std::string("write memsvc error: ")+memsvc_get_last_error(memsvc));
+      break;
+    }
+    case REGPROG_READ_BLOCK:
+      results.resize(results.size()+count);
+      if (memhub_read(memsvc, args[0], count, results.data()+results.size()-count) != 0)
+        return fail(pc, std::string("read memsvc error: ")+memsvc_get_last_error(memsvc));
+      break;
+    case REGPROG_POLL:
+    {
+      const uint32_t shift = maskShift(args[1]);
+      memhub_session_end();
+      const PollResult done = pollUntil(args[0], args[1], PollCondition::equal, args[2] >> shift, std::chrono::microseconds(args[3]),
+                                        PollBackoff(std::chrono::microseconds(REGPROG_POLL_INTERVAL_US)));
+      memhub_session_begin(0);
+      results.push_back(done.value << shift);
+      if (!done.success)
+        return fail(pc, stdsprintf("poll of 0x%08x failed after %u reads, last value 0x%08x", args[0], done.polls, done.value << shift));
+      break;
+    }
+    case REGPROG_SLEEP:
+      memhub_session_end();
+      sleepFor(std::chrono::microseconds(args[0]));
+      memhub_session_begin(0);
+      break;
+    case REGPROG_ACCUMULATE:
+      if (memhub_read(memsvc, args[0], 1, &data) != 0)
+        return fail(pc, std::string("read memsvc error: ")+memsvc_get_last_error(memsvc));
+      accumulators[regProgAccumulator(header)] += (data & args[1]) >> maskShift(args[1]);
+      break;
+    case REGPROG_STORE:
+      results.push_back(accumulators[regProgAccumulator(header)]);
+      accumulators[regProgAccumulator(header)] = 0;
+      break;
+    case REGPROG_REPEAT:
+      for (uint32_t i = 0; i < count; ++i) {
+        if (!executeRegProgram(prog, pc+2, pc+2+args[0], accumulators, results, error, errorOffset))
+          return false;
+      }
+      pc += args[0];
+      break;
+    }
+    pc += 1 + regProgArgs(op);
+  }
+  return true;
 }
 
+/*! \fn void mexecute(const RPCMsg *request, RPCMsg *response)
+ *  \brief Executes a register program, a sequence of register micro-operations, under a single memhub session
+ *  \details The "program" word array is encoded as described in regprog.h and checked by validateRegProgram:
+ *           a rejected program is not executed at all. The words produced by the operations are returned in
+ *           the "data" word array. If an operation fails, the program stops: "error" is set, "error_offset"
+ *           holds the offset of the operation in the program, and "data" the words produced so far.
+ *  \param request RPC request message
+ *  \param response RPC response message
+ */
+void mexecute(const RPCMsg *request, RPCMsg *response) {
+  std::vector<uint32_t> prog = request->get_word_array("program");
+
+  RegProgCost cost;
+  std::string error;
+  size_t errorOffset = 0;
+  if (!validateRegProgram(prog.data(), prog.size(), cost, error, errorOffset)) {
+    response->set_string("error", stdsprintf("Program rejected at word %zu: %s", errorOffset, error.c_str()));
+    response->set_word("error_offset", errorOffset);
+    LOGGER->log_message(LogManager::ERROR, stdsprintf("Register program rejected at word %zu: %s", errorOffset, error.c_str()));
+    return;
+  }
+  LOGGER->log_message(LogManager::DEBUG, stdsprintf("Executing register program of %zu words: up to %llu operations, %llu result words, %llu us of waits",
+                                                    prog.size(), (unsigned long long)cost.ops, (unsigned long long)cost.results, (unsigned long long)cost.waitUs));
+
+  std::vector<uint32_t> results;
+  results.reserve(cost.results);
+  uint32_t accumulators[REGPROG_ACCUMULATORS] = {0};
+  bool success;
+  {
+    MemhubSession session;
+    success = executeRegProgram(prog.data(), 0, prog.size(), accumulators, results, error, errorOffset);
+  }
+  if (!success) {
+    response->set_string("error", stdsprintf("Program failed at word %zu: %s", errorOffset, error.c_str()));
+    response->set_word("error_offset", errorOffset);
+    LOGGER->log_message(LogManager::ERROR, stdsprintf("Register program failed at word %zu: %s", errorOffset, error.c_str()));
+  }
+  response->set_word_array("data", results);
+}
 
 extern "C" {
   const char *module_version_key = "extras v1.0.1";
@@ -158,11 +302,12 @@ extern "C" {
       LOGGER->log_message(LogManager::ERROR, "Unable to load module");
       return; // Do not register our functions, we depend on memsvc.
     }
-    modmgr->register_method("extras", "fiforead",  mfiforead);
-    modmgr->register_method("extras", "blockread", mblockread);
-    modmgr->register_method("extras", "listread",  mlistread);
-    modmgr->register_method("extras", "fifowrite",  mfifowrite);
-    modmgr->register_method("extras", "blockwrite", mblockwrite);
-    modmgr->register_method("extras", "listwrite",  mlistwrite);
+    modmgr->register_method("extras", "fiforead",  profiledMethod<mfiforead>);
+    modmgr->register_method("extras", "blockread", profiledMethod<mblockread>);
+    modmgr->register_method("extras", "listread",  profiledMethod<mlistread>);
+    modmgr->register_method("extras", "fifowrite",  profiledMethod<mfifowrite>);
+    modmgr->register_method("extras", "blockwrite", profiledMethod<mblockwrite>);
+    modmgr->register_method("extras", "listwrite",  profiledMethod<mlistwrite>);
+    modmgr->register_method("extras", "execute",    profiledMethod<mexecute>);
   }
 }
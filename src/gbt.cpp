@@ -42,7 +42,7 @@ bool scanGBTPhasesLocal(localArgs *la, const uint32_t ohN, const uint32_t nReset
     LOGGER->log_message(LogManager::INFO, stdsprintf("Scanning the phases for OH #%u.", ohN));
 
     // ohN check
-    const uint32_t ohMax = readReg(la, "GEM_AMC.GEM_SYSTEM.CONFIG.NUM_OF_OH");
+    const uint32_t ohMax = getSystemInfo(la).numOfOH;
     if (ohN >= ohMax)
         EMIT_RPC_ERROR(la->response, stdsprintf("The ohN parameter supplied (%u) exceeds the number of OH's supported by the CTP7 (%u).", ohN, ohMax), true);
 
@@ -66,12 +66,12 @@ bool scanGBTPhasesLocal(localArgs *la, const uint32_t ohN, const uint32_t nReset
         }
 
         // Wait for the phases to be set
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        sleepFor(std::chrono::milliseconds(10));
 
         for (uint32_t repN = 0; repN < nResets; repN++) {
             // Try to synchronize the VFAT's
             writeReg(la, "GEM_AMC.GEM_SYSTEM.CTRL.LINK_RESET", 1);
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            sleepFor(std::chrono::milliseconds(10));
 
             // Check the VFAT status
             slowCtrlErrCntVFAT vfatErrs;
@@ -141,7 +141,7 @@ bool writeGBTConfigLocal(localArgs *la, const uint32_t ohN, const uint32_t gbtN,
     LOGGER->log_message(LogManager::INFO, stdsprintf("Writing the configuration of OH #%u - GBTX #%u.", ohN, gbtN));
 
     // ohN check
-    const uint32_t ohMax = readReg(la, "GEM_AMC.GEM_SYSTEM.CONFIG.NUM_OF_OH");
+    const uint32_t ohMax = getSystemInfo(la).numOfOH;
     if (ohN >= ohMax)
         EMIT_RPC_ERROR(la->response, stdsprintf("The ohN parameter supplied (%u) exceeds the number of OH's supported by the CTP7 (%u).", ohN, ohMax), true);
 
@@ -178,7 +178,7 @@ bool writeGBTPhaseLocal(localArgs *la, const uint32_t ohN, const uint32_t vfatN,
     LOGGER->log_message(LogManager::INFO, stdsprintf("Writing %u to the VFAT #%u phase of OH #%u.", phase, vfatN, ohN));
 
     // ohN check
-    const uint32_t ohMax = readReg(la, "GEM_AMC.GEM_SYSTEM.CONFIG.NUM_OF_OH");
+    const uint32_t ohMax = getSystemInfo(la).numOfOH;
     if (ohN >= ohMax)
         EMIT_RPC_ERROR(la->response, stdsprintf("The ohN parameter supplied (%u) exceeds the number of OH's supported by the CTP7 (%u).", ohN, ohMax), true);
 
@@ -238,8 +238,11 @@ extern "C" {
             LOGGER->log_message(LogManager::ERROR, "Unable to load module");
             return; // Do not register our functions, we depend on memsvc.
         }
-        modmgr->register_method("gbt", "writeGBTConfig", writeGBTConfig);
-        modmgr->register_method("gbt", "writeGBTPhase", writeGBTPhase);
-        modmgr->register_method("gbt", "scanGBTPhases", scanGBTPhases);
+        if (!openAddressTable()) {
+            LOGGER->log_message(LogManager::WARNING, "Address table not available yet, it will be opened on first use");
+        }
+        modmgr->register_method("gbt", "writeGBTConfig", profiledMethod<writeGBTConfig>);
+        modmgr->register_method("gbt", "writeGBTPhase", profiledMethod<writeGBTPhase>);
+        modmgr->register_method("gbt", "scanGBTPhases", profiledMethod<scanGBTPhases>);
     }
 }
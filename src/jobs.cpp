@@ -0,0 +1,323 @@
+/*! \file jobs.cpp
+ *  \brief Asynchronous jobs: RPC methods run in a worker process and polled by the client
+ *
+ *  A long routine, e.g. calibration_routines.genScan, blocks its RPC call for minutes and runs into the RPC
+ *  timeouts of the client. jobs.start runs instead any registered method in a worker process forked from the
+ *  client connection and returns at once with a job id: the client then polls the progress of the job with
+ *  jobs.poll, fetches its response in chunks with jobs.fetch once done, and frees it with jobs.release.
+ *  A client can thus drive several cards concurrently.
+ *
+ *  The worker shares a JobShared block with the connection process, see utils/jobs.h. It runs the method as
+ *  a normal call, with its own address table environment and memhub sessions, and exits once the response
+ *  is serialized into the block. The jobs belong to their client connection: the workers are terminated when
+ *  the connection process exits.
+ *
+ *  Only one job runs at a time on a card, whichever connection started it: the routines share the TTC generator,
+ *  the VFAT_DAQ_MONITOR, OH_SELECT and the calibration pulse settings, and two of them would corrupt each other's
+ *  data without any error. The worker holds the card-wide "jobs"/"hardware" named lock while it runs, and
+ *  jobs.start fails if another worker holds it. Blocking calls are not covered by the lock: a client must not
+ *  send routines using the same resources, from any connection, while one of its jobs runs.
+ */
+
+#include "moduleapi.h"
+#include "utils.h"
+#include "LockTools.h"
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <map>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+constexpr uint32_t JOB_MAX_JOBS         = 4;               ///< Jobs kept at once by a client connection
+constexpr uint32_t JOB_FETCH_MAX_BYTES  = 4*1024*1024;     ///< Largest chunk returned by jobs.fetch
+constexpr uint32_t JOB_POLL_MAX_WORDS   = 1024*1024;       ///< Largest partial result returned by jobs.poll
+constexpr uint32_t JOB_START_TIMEOUT_MS = 5000;            ///< Longest wait of jobs.start for the worker to take the job lock
+
+namespace {
+  /*! \brief Job started by this client connection
+   */
+  struct Job {
+    pid_t       pid;     ///< Worker process
+    std::string method;  ///< Method run by the worker
+    JobShared * shared;  ///< Block shared with the worker
+    std::chrono::steady_clock::time_point start;
+    bool        reaped;  ///< Whether the worker has exited
+  };
+
+  std::map<uint32_t, Job> jobs;
+  uint32_t nextJobId = 1;
+  ModuleManager * manager = nullptr; ///< Invokes the methods in the workers
+
+  void setJobError(JobShared * shared, const std::string & error)
+  {
+    std::strncpy(shared->error, error.c_str(), sizeof(shared->error) - 1);
+  }
+
+  /*! \brief Runs the method in the worker process, never returns
+   */
+  void runWorker(const std::string & method, const RPCMsg & request, JobShared * shared, pid_t parent)
+  {
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() != parent)
+      _exit(1);
+    setJobShared(shared);
+
+    // Held until the worker exits, when the lock is released by the system
+    const int lock = namedlock_init("jobs", "hardware");
+    if (lock < 0 || namedlock_trylock(lock) != 0) {
+      setJobError(shared, (lock >= 0 && errno == EWOULDBLOCK) ? "Another job is running on this card"
+                                                              : "Unable to take the job lock");
+      __atomic_store_n(&shared->status, JOB_FAILED, __ATOMIC_RELEASE);
+      _exit(1);
+    }
+    __atomic_store_n(&shared->status, JOB_RUNNING, __ATOMIC_RELEASE);
+
+    RPCMsg response(method);
+    try {
+      manager->invoke_method(method, const_cast<RPCMsg *>(&request), &response);
+    } catch (...) {
+      setJobError(shared, "Exception raised by " + method);
+      __atomic_store_n(&shared->status, JOB_FAILED, __ATOMIC_RELEASE);
+      _exit(1);
+    }
+
+    const std::string serial = response.serialize();
+    if (serial.size() > JOB_RESULT_MAX_BYTES) {
+      setJobError(shared, stdsprintf("Response of %zu bytes exceeds the maximum of %u bytes", serial.size(), JOB_RESULT_MAX_BYTES));
+      __atomic_store_n(&shared->status, JOB_FAILED, __ATOMIC_RELEASE);
+      _exit(1);
+    }
+    if (response.get_key_exists("error"))
+      setJobError(shared, response.get_string("error"));
+    std::memcpy(shared->result, serial.data(), serial.size());
+    shared->resultBytes = serial.size();
+    __atomic_store_n(&shared->progress, JOB_PROGRESS_SCALE, __ATOMIC_RELEASE);
+    __atomic_store_n(&shared->status, JOB_DONE, __ATOMIC_RELEASE);
+    _exit(0);
+  }
+
+  /*! \brief Reaps the worker if it has exited, failing the job if it did not complete
+   */
+  void updateJob(Job & job)
+  {
+    if (job.reaped)
+      return;
+    int status = 0;
+    const pid_t ret = waitpid(job.pid, &status, WNOHANG);
+    if (ret == 0)
+      return;
+    if (ret < 0 && !(errno == ECHILD && kill(job.pid, 0) != 0)) // ECHILD if SIGCHLD is ignored, the worker is then reaped by the kernel
+      return;
+    job.reaped = true;
+    if (__atomic_load_n(&job.shared->status, __ATOMIC_ACQUIRE) != JOB_RUNNING)
+      return;
+    if (ret > 0 && WIFSIGNALED(status))
+      setJobError(job.shared, stdsprintf("Worker of %s killed by signal %d", job.method.c_str(), WTERMSIG(status)));
+    else
+      setJobError(job.shared, stdsprintf("Worker of %s exited without a result", job.method.c_str()));
+    __atomic_store_n(&job.shared->status, JOB_FAILED, __ATOMIC_RELEASE);
+  }
+
+  /*! \brief Returns the job of the "job_id" word of the request, setting the error of the response if unknown
+   */
+  Job * findJob(const RPCMsg *request, RPCMsg *response)
+  {
+    const uint32_t id = request->get_word("job_id");
+    auto it = jobs.find(id);
+    if (it == jobs.end()) {
+      response->set_string("error", stdsprintf("Unknown job %u", id));
+      return nullptr;
+    }
+    updateJob(it->second);
+    return &it->second;
+  }
+}
+
+/*! \fn void startJob(const RPCMsg *request, RPCMsg *response)
+ *  \brief Starts a job running the method of the "job_method" string, e.g. "calibration_routines.genScan"
+ *  \details The request also holds the parameters of the method, it is passed as is to the method.
+ *           The response holds the "job_id" word. The call fails if a job is already running on the card.
+ *  \param request RPC request message
+ *  \param response RPC response message
+ */
+void startJob(const RPCMsg *request, RPCMsg *response)
+{
+  const std::string method = request->get_string("job_method");
+  if (method.compare(0, 5, "jobs.") == 0) {
+    response->set_string("error", "Jobs cannot run the jobs methods");
+    return;
+  }
+  for (auto & job : jobs)
+    updateJob(job.second);
+  if (jobs.size() >= JOB_MAX_JOBS) {
+    response->set_string("error", stdsprintf("Too many jobs, at most %u can be kept, release the completed ones", JOB_MAX_JOBS));
+    return;
+  }
+
+  void * addr = mmap(nullptr, sizeof(JobShared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (addr == MAP_FAILED) {
+    const std::string error = stdsprintf("Unable to map the job block: %s", strerror(errno));
+    response->set_string("error", error);
+    LOGGER->log_message(LogManager::ERROR, error);
+    return;
+  }
+  JobShared * shared = static_cast<JobShared *>(addr);
+  shared->status = JOB_STARTING;
+
+  RPCMsg methodRequest(*request);
+  methodRequest.set_method(method);
+  const pid_t parent = getpid();
+  const pid_t pid = fork();
+  if (pid == 0)
+    runWorker(method, methodRequest, shared, parent);
+  if (pid < 0) {
+    const std::string error = stdsprintf("Unable to start the worker of %s: %s", method.c_str(), strerror(errno));
+    response->set_string("error", error);
+    LOGGER->log_message(LogManager::ERROR, error);
+    munmap(shared, sizeof(JobShared));
+    return;
+  }
+
+  // Wait for the worker to take the job lock, so that a busy card is reported by this call
+  Job job{pid, method, shared, std::chrono::steady_clock::now(), false};
+  const auto deadline = job.start + std::chrono::milliseconds(JOB_START_TIMEOUT_MS);
+  while (__atomic_load_n(&shared->status, __ATOMIC_ACQUIRE) == JOB_STARTING && !job.reaped
+         && std::chrono::steady_clock::now() < deadline) {
+    sleepFor(std::chrono::milliseconds(1));
+    updateJob(job);
+  }
+  if (__atomic_load_n(&shared->status, __ATOMIC_ACQUIRE) != JOB_RUNNING) {
+    if (!job.reaped) {
+      kill(pid, SIGTERM);
+      waitpid(pid, nullptr, 0);
+    }
+    const std::string error = stdsprintf("Unable to start %s: %s", method.c_str(),
+                                         shared->error[0] ? shared->error : "the worker exited or did not start in time");
+    response->set_string("error", error);
+    LOGGER->log_message(LogManager::ERROR, error);
+    munmap(shared, sizeof(JobShared));
+    return;
+  }
+
+  const uint32_t id = nextJobId++;
+  jobs[id] = job;
+  LOGGER->log_message(LogManager::INFO, stdsprintf("Started job %u running %s in process %d", id, method.c_str(), pid));
+  response->set_word("job_id", id);
+}
+
+/*! \fn void pollJob(const RPCMsg *request, RPCMsg *response)
+ *  \brief Returns the state of the job of the "job_id" word
+ *  \details The response holds the "status" word, a JobStatus, "progress", out of JOB_PROGRESS_SCALE,
+ *           "elapsed_ms", "eta_ms", 0xffffffff until some progress is reported, and "job_method". Once done it also holds
+ *           "result_bytes", the size of the response to fetch, and the "job_error" string if the job failed
+ *           or if the response of the method has an error.
+ *
+ *           If the request has a "partial" word, the response also holds "partial_words", the size of the partial
+ *           result published by the method so far, "partial", at most JOB_POLL_MAX_WORDS of its words from the
+ *           optional "offset" word, and "partial_consistent", 0 if the copy overlapped an update of the worker
+ *           and may mix two publications, in which case the client polls again.
+ *  \param request RPC request message
+ *  \param response RPC response message
+ */
+void pollJob(const RPCMsg *request, RPCMsg *response)
+{
+  Job * job = findJob(request, response);
+  if (!job)
+    return;
+
+  const uint32_t status   = __atomic_load_n(&job->shared->status, __ATOMIC_ACQUIRE);
+  const uint32_t progress = __atomic_load_n(&job->shared->progress, __ATOMIC_ACQUIRE);
+  const uint64_t elapsed  = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - job->start).count();
+  uint64_t eta = 0xffffffff;
+  if (status != JOB_RUNNING)
+    eta = 0;
+  else if (progress > 0)
+    eta = std::min<uint64_t>(0xfffffffe, elapsed*(JOB_PROGRESS_SCALE - progress)/progress);
+
+  response->set_word("status", status);
+  response->set_string("job_method", job->method);
+  response->set_word("progress", progress);
+  response->set_word("elapsed_ms", std::min<uint64_t>(elapsed, 0xffffffff));
+  response->set_word("eta_ms", eta);
+  if (status == JOB_DONE)
+    response->set_word("result_bytes", job->shared->resultBytes);
+  if (status != JOB_RUNNING && job->shared->error[0])
+    response->set_string("job_error", job->shared->error);
+
+  if (request->get_key_exists("partial")) {
+    const uint32_t offset = request->get_key_exists("offset") ? request->get_word("offset") : 0;
+    std::vector<uint32_t> partial;
+    bool consistent;
+    response->set_word("partial_words", readJobPartialResult(job->shared, offset, JOB_POLL_MAX_WORDS, partial, consistent));
+    response->set_word("partial_consistent", consistent);
+    response->set_word_array("partial", partial);
+  }
+}
+
+/*! \fn void fetchJob(const RPCMsg *request, RPCMsg *response)
+ *  \brief Returns a chunk of the serialized response of the completed job of the "job_id" word
+ *  \details The chunk starts at the "offset" word, in bytes, and holds at most JOB_FETCH_MAX_BYTES, or the optional
+ *           "size" word; it is returned as the "chunk" binary data with the "result_bytes" word. The client
+ *           concatenates the chunks and builds the response of the method from them, e.g. RPCMsg(data, size).
+ *  \param request RPC request message
+ *  \param response RPC response message
+ */
+void fetchJob(const RPCMsg *request, RPCMsg *response)
+{
+  Job * job = findJob(request, response);
+  if (!job)
+    return;
+  if (__atomic_load_n(&job->shared->status, __ATOMIC_ACQUIRE) != JOB_DONE) {
+    response->set_string("error", stdsprintf("Job %u has no result", request->get_word("job_id")));
+    return;
+  }
+
+  const uint32_t total  = job->shared->resultBytes;
+  const uint32_t offset = std::min(request->get_word("offset"), total);
+  uint32_t size = std::min(JOB_FETCH_MAX_BYTES, total - offset);
+  if (request->get_key_exists("size"))
+    size = std::min(size, request->get_word("size"));
+  response->set_word("result_bytes", total);
+  response->set_binarydata("chunk", job->shared->result + offset, size);
+}
+
+/*! \fn void releaseJob(const RPCMsg *request, RPCMsg *response)
+ *  \brief Frees the job of the "job_id" word, terminating its worker if it is still running
+ *  \details A job stopped in the middle of a routine leaves the hardware as it was at that point,
+ *           e.g. with the calibration pulses enabled.
+ *  \param request RPC request message
+ *  \param response RPC response message
+ */
+void releaseJob(const RPCMsg *request, RPCMsg *response)
+{
+  Job * job = findJob(request, response);
+  if (!job)
+    return;
+  const uint32_t id = request->get_word("job_id");
+  if (!job->reaped) {
+    LOGGER->log_message(LogManager::WARNING, stdsprintf("Terminating job %u running %s", id, job->method.c_str()));
+    kill(job->pid, SIGTERM);
+    waitpid(job->pid, nullptr, 0);
+  }
+  response->set_word("status", __atomic_load_n(&job->shared->status, __ATOMIC_ACQUIRE));
+  munmap(job->shared, sizeof(JobShared));
+  jobs.erase(id);
+}
+
+extern "C" {
+  const char *module_version_key = "jobs v1.0.0";
+  int module_activity_color = 4;
+  void module_init(ModuleManager *modmgr)
+  {
+    manager = modmgr;
+    modmgr->register_method("jobs", "start",   profiledMethod<startJob>);
+    modmgr->register_method("jobs", "poll",    profiledMethod<pollJob>);
+    modmgr->register_method("jobs", "fetch",   profiledMethod<fetchJob>);
+    modmgr->register_method("jobs", "release", profiledMethod<releaseJob>);
+  }
+}
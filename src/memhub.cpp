@@ -2,19 +2,133 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <semaphore.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #define SEM_NAME "/memhub"
 #define SEM_PERMS (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP)
 #define SEM_INIT 1
+#define TRACE_SHM_NAME "/memhub_trace"
 
 static sem_t *semaphore = NULL;
 static bool busy = false;
 
+static unsigned session_depth = 0;
+// Depth of the outermost atomic session, 0 if none is open: no yield until it ends
+static unsigned session_atomic_depth = 0;
+static uint32_t session_max_hold_us = MEMHUB_SESSION_MAX_HOLD_US;
+static struct timespec session_start;
+
+static struct memhub_stats stats;
+
+struct memhub_trace_name {
+    uint32_t ready; /* set once name is written */
+    char name[MEMHUB_TRACE_NAME_SIZE];
+};
+
+// Layout of /dev/shm/memhub_trace
+struct memhub_trace {
+    uint64_t head;    /* number of entries recorded so far, i.e. sequence number of the last one */
+    uint32_t n_names; /* number of slots of names claimed, may exceed MEMHUB_TRACE_RPC_NAMES */
+    uint32_t reserved;
+    struct memhub_trace_name names[MEMHUB_TRACE_RPC_NAMES];
+    struct memhub_trace_entry entries[MEMHUB_TRACE_ENTRIES];
+};
+
+static struct memhub_trace *trace = NULL;
+static uint32_t trace_pid = 0;
+static uint16_t trace_rpc = 0;
+
+static uint64_t now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec*1000000000ULL + now.tv_nsec;
+}
+
+static uint64_t elapsed_us(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec)*1000000ULL + (now.tv_nsec - since->tv_nsec)/1000;
+}
+
+static void timed_sem_wait() {
+    uint64_t start = now_ns();
+    sem_wait(semaphore);
+    stats.lock_wait_ns += now_ns() - start;
+}
+
+/*
+ * Claims the next entry of the ring and fills it. Concurrent writers get different entries;
+ * the sequence number is zeroed while the entry is written so that readers can detect torn entries.
+ */
+static void trace_record(uint32_t addr, uint32_t words, uint32_t value, uint8_t flags) {
+    if (trace == NULL)
+        return;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t seq = __atomic_add_fetch(&trace->head, 1, __ATOMIC_RELAXED);
+    struct memhub_trace_entry *entry = &trace->entries[(seq - 1) & (MEMHUB_TRACE_ENTRIES - 1)];
+    __atomic_store_n(&entry->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    entry->time_ns = now.tv_sec*1000000000ULL + now.tv_nsec;
+    entry->addr    = addr;
+    entry->value   = value;
+    entry->pid     = trace_pid;
+    entry->words   = (words > 0xffff) ? 0xffff : words;
+    entry->rpc_id  = trace_rpc;
+    entry->flags   = flags;
+    __atomic_store_n(&entry->seq, seq, __ATOMIC_RELEASE);
+}
+
+static void trace_refresh_pid() {
+    trace_pid = getpid();
+}
+
+static void *map_shm(const char *name, size_t size) {
+    void *addr = NULL;
+    int fd = shm_open(name, O_CREAT | O_RDWR, SEM_PERMS);
+    if (fd >= 0 && ftruncate(fd, size) == 0) {
+        addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED)
+            addr = NULL;
+    }
+    if (fd >= 0)
+        close(fd);
+    return addr;
+}
+
+static void memhub_lock() {
+    if (session_depth > 0) {
+        if (session_atomic_depth == 0 && elapsed_us(&session_start) > session_max_hold_us) {
+            // let the other processes in before going on with the session
+            sem_post(semaphore);
+            busy = false;
+            sched_yield();
+            timed_sem_wait();
+            busy = true;
+            clock_gettime(CLOCK_MONOTONIC, &session_start);
+        }
+        return;
+    }
+    timed_sem_wait();
+    busy = true;
+}
+
+static void memhub_unlock() {
+    if (session_depth > 0)
+        return;
+    sem_post(semaphore);
+    busy = false;
+}
+
 int memhub_open(memsvc_handle_t *handle) {
     if (semaphore == NULL) {
         semaphore = sem_open(SEM_NAME, O_CREAT, SEM_PERMS, SEM_INIT);
@@ -30,6 +144,13 @@ int memhub_open(memsvc_handle_t *handle) {
         perror("sem_open(3) error");
         exit(1);
     }
+    if (trace == NULL) {
+        trace = (struct memhub_trace *)map_shm(TRACE_SHM_NAME, sizeof(struct memhub_trace));
+        if (trace == NULL)
+            LOGGER->log_message(LogManager::WARNING, "Memhub could not map the access trace, accesses are not traced");
+        trace_refresh_pid();
+        pthread_atfork(NULL, NULL, trace_refresh_pid);
+    }
 
     // handle all signals in attempt to undo an active semaphore if the process is killed in the middle of a transaction..
     signal(SIGABRT, die);
@@ -48,21 +169,184 @@ int memhub_close(memsvc_handle_t *handle) {
 }
 
 int memhub_read(memsvc_handle_t handle, uint32_t addr, uint32_t words, uint32_t *data) {
-    sem_wait(semaphore);
-    busy = true;
+    memhub_lock();
+    uint64_t start = now_ns();
     int ret = memsvc_read(handle, addr, words, data);
-    sem_post(semaphore);
-    busy = false;
+    stats.bus_ns += now_ns() - start;
+    trace_record(addr, words, (ret == 0 && words > 0) ? data[0] : 0, (ret == 0) ? 0 : MEMHUB_TRACE_ERROR);
+    memhub_unlock();
+    ++stats.reads;
+    stats.words_read += words;
     return ret;
 }
 
 int memhub_write(memsvc_handle_t handle, uint32_t addr, uint32_t words, const uint32_t *data) {
-    sem_wait(semaphore);
-    busy = true;
+    memhub_lock();
+    uint64_t start = now_ns();
     int ret = memsvc_write(handle, addr, words, data);
+    stats.bus_ns += now_ns() - start;
+    trace_record(addr, words, (words > 0) ? data[0] : 0, MEMHUB_TRACE_WRITE | ((ret == 0) ? 0 : MEMHUB_TRACE_ERROR));
+    memhub_unlock();
+    ++stats.writes;
+    stats.words_written += words;
+    return ret;
+}
+
+/*
+ * Called between the words of a burst: releases and takes the semaphore again once it has been held
+ * for longer than allowed, see memhub_lock. start is the time the semaphore was taken outside of a session.
+ */
+static void memhub_burst_yield(struct timespec *start) {
+    if (session_depth > 0) {
+        memhub_lock();
+        return;
+    }
+    if (elapsed_us(start) > MEMHUB_SESSION_MAX_HOLD_US) {
+        sem_post(semaphore);
+        busy = false;
+        sched_yield();
+        timed_sem_wait();
+        busy = true;
+        clock_gettime(CLOCK_MONOTONIC, start);
+    }
+}
+
+/* Number of words transferred between two checks of the hold time of a burst */
+#define BURST_YIELD_WORDS 64
+
+int memhub_fifo_read(memsvc_handle_t handle, uint32_t addr, uint32_t words, uint32_t *data) {
+    memhub_lock();
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t bus_start = now_ns();
+    int ret = 0;
+    uint32_t done = 0;
+    for (; done < words; ++done) {
+        if (done > 0 && done % BURST_YIELD_WORDS == 0) {
+            stats.bus_ns += now_ns() - bus_start;
+            memhub_burst_yield(&start);
+            bus_start = now_ns();
+        }
+        if ((ret = memsvc_read(handle, addr, 1, &data[done])) != 0)
+            break;
+    }
+    stats.bus_ns += now_ns() - bus_start;
+    trace_record(addr, words, (done > 0) ? data[0] : 0, MEMHUB_TRACE_FIFO | ((ret == 0) ? 0 : MEMHUB_TRACE_ERROR));
+    memhub_unlock();
+    ++stats.reads;
+    stats.words_read += done;
+    return ret;
+}
+
+int memhub_fifo_write(memsvc_handle_t handle, uint32_t addr, uint32_t words, const uint32_t *data) {
+    memhub_lock();
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t bus_start = now_ns();
+    int ret = 0;
+    uint32_t done = 0;
+    for (; done < words; ++done) {
+        if (done > 0 && done % BURST_YIELD_WORDS == 0) {
+            stats.bus_ns += now_ns() - bus_start;
+            memhub_burst_yield(&start);
+            bus_start = now_ns();
+        }
+        if ((ret = memsvc_write(handle, addr, 1, &data[done])) != 0)
+            break;
+    }
+    stats.bus_ns += now_ns() - bus_start;
+    trace_record(addr, words, (words > 0) ? data[0] : 0,
+                 MEMHUB_TRACE_WRITE | MEMHUB_TRACE_FIFO | ((ret == 0) ? 0 : MEMHUB_TRACE_ERROR));
+    memhub_unlock();
+    ++stats.writes;
+    stats.words_written += done;
+    return ret;
+}
+
+void memhub_get_stats(struct memhub_stats *out) {
+    *out = stats;
+}
+
+uint16_t memhub_trace_rpc_id(const char *name) {
+    if (trace == NULL)
+        return 0;
+    uint32_t n_names = __atomic_load_n(&trace->n_names, __ATOMIC_ACQUIRE);
+    if (n_names > MEMHUB_TRACE_RPC_NAMES)
+        n_names = MEMHUB_TRACE_RPC_NAMES;
+    for (uint32_t i = 0; i < n_names; ++i) {
+        if (__atomic_load_n(&trace->names[i].ready, __ATOMIC_ACQUIRE)
+            && strncmp(trace->names[i].name, name, MEMHUB_TRACE_NAME_SIZE - 1) == 0)
+            return i + 1;
+    }
+    // Two processes registering the same name at the same time get different ids, which is harmless
+    uint32_t i = __atomic_fetch_add(&trace->n_names, 1, __ATOMIC_RELAXED);
+    if (i >= MEMHUB_TRACE_RPC_NAMES)
+        return 0;
+    strncpy(trace->names[i].name, name, MEMHUB_TRACE_NAME_SIZE - 1);
+    __atomic_store_n(&trace->names[i].ready, 1, __ATOMIC_RELEASE);
+    return i + 1;
+}
+
+const char *memhub_trace_rpc_name(uint16_t id) {
+    if (trace == NULL || id == 0 || id > MEMHUB_TRACE_RPC_NAMES)
+        return NULL;
+    if (!__atomic_load_n(&trace->names[id - 1].ready, __ATOMIC_ACQUIRE))
+        return NULL;
+    return trace->names[id - 1].name;
+}
+
+void memhub_trace_set_rpc(uint16_t id) {
+    trace_rpc = id;
+}
+
+int memhub_trace_snapshot(uint64_t since, struct memhub_trace_entry *entries, uint32_t max_entries) {
+    if (trace == NULL)
+        return -1;
+    uint64_t head = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+    uint64_t first = (head > MEMHUB_TRACE_ENTRIES) ? head - MEMHUB_TRACE_ENTRIES + 1 : 1;
+    if (first <= since)
+        first = since + 1;
+    if (first <= head && head - first >= max_entries)
+        first = head - max_entries + 1;
+    uint32_t n = 0;
+    for (uint64_t seq = first; seq <= head && n < max_entries; ++seq) {
+        const struct memhub_trace_entry *entry = &trace->entries[(seq - 1) & (MEMHUB_TRACE_ENTRIES - 1)];
+        if (__atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE) != seq)
+            continue; // being written, or already overwritten
+        entries[n] = *entry;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&entry->seq, __ATOMIC_RELAXED) != seq)
+            continue; // overwritten while copied
+        entries[n++].seq = seq;
+    }
+    return n;
+}
+
+void memhub_session_begin(uint32_t max_hold_us) {
+    if (session_depth++ > 0) {
+        if (max_hold_us == MEMHUB_SESSION_ATOMIC && session_atomic_depth == 0) {
+            memhub_lock(); // last chance to yield before the atomic sequence
+            session_atomic_depth = session_depth;
+        }
+        return;
+    }
+    if (max_hold_us == MEMHUB_SESSION_ATOMIC)
+        session_atomic_depth = session_depth;
+    session_max_hold_us = (max_hold_us && max_hold_us != MEMHUB_SESSION_ATOMIC) ? max_hold_us : MEMHUB_SESSION_MAX_HOLD_US;
+    timed_sem_wait();
+    busy = true;
+    clock_gettime(CLOCK_MONOTONIC, &session_start);
+}
+
+void memhub_session_end(void) {
+    if (session_depth == 0)
+        return;
+    if (session_depth == session_atomic_depth)
+        session_atomic_depth = 0;
+    if (--session_depth > 0)
+        return;
     sem_post(semaphore);
     busy = false;
-    return ret;
 }
 
 void die(int signo) {
@@ -1,16 +1,19 @@
 #include "moduleapi.h"
 #include <libmemsvc.h>
 #include "memhub.h"
+#include "utils.h"
 
 memsvc_handle_t memsvc;
 
 void mread(const RPCMsg *request, RPCMsg *response) {
 	uint32_t count = request->get_word("count");
 	uint32_t addr = request->get_word("address");
-	uint32_t data[count];
+	ScratchBuffer data(count);
+	if (!data.check(response, "Read"))
+		return;
 
-	if (memhub_read(memsvc, addr, count, data) == 0) {
-		response->set_word_array("data", data, count);
+	if (readChunked(addr, count, data.data()) == 0) {
+		response->set_word_array("data", data.data(), count);
 	}
 	else {
 		response->set_string("error", memsvc_get_last_error(memsvc));
@@ -20,11 +23,13 @@ void mread(const RPCMsg *request, RPCMsg *response) {
 
 void mwrite(const RPCMsg *request, RPCMsg *response) {
 	uint32_t count = request->get_word_array_size("data");
-	uint32_t data[count];
-	request->get_word_array("data", data);
+	ScratchBuffer data(count);
+	if (!data.check(response, "Write"))
+		return;
+	request->get_word_array("data", data.data());
 	uint32_t addr = request->get_word("address");
 
-	if (memhub_write(memsvc, addr, count, data) != 0) {
+	if (writeChunked(addr, count, data.data()) != 0) {
 		response->set_string("error", std::string("memsvc error: ")+memsvc_get_last_error(memsvc));
 		LOGGER->log_message(LogManager::INFO, stdsprintf("write memsvc error: %s", memsvc_get_last_error(memsvc)));
 	}
@@ -39,7 +44,7 @@ extern "C" {
 			LOGGER->log_message(LogManager::ERROR, "Unable to load module");
 			return; // Do not register our functions, we depend on memsvc.
 		}
-		modmgr->register_method("memory", "read", mread);
-		modmgr->register_method("memory", "write", mwrite);
+		modmgr->register_method("memory", "read", profiledMethod<mread>);
+		modmgr->register_method("memory", "write", profiledMethod<mwrite>);
 	}
 }
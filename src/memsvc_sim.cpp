@@ -0,0 +1,462 @@
+/*! \file memsvc_sim.cpp
+ *  \brief In-memory simulation of the CTP7 memory service
+ *
+ *  Implements the libmemsvc API on a register file held in memory, so that the modules can be built,
+ *  run and profiled on a Linux PC (make Arch=x86_64). The register file is populated from the LMDB
+ *  address table: every word covered by a node is mapped, accesses to other addresses fail like bus
+ *  errors. The simulation follows the node properties:
+ *   * bits of nodes without write permission (status, counters) are not changed by writes
+ *   * bits of writable nodes whose name matches MEMSVC_SIM_AUTOCLEAR (pulsed RESET or EXECUTE bits) read back as 0
+ *   * each access waits for a configurable latency, larger for the VFAT slow-control registers
+ *
+ *  Counters follow the L1As, which come from two simulated sources:
+ *   * the TTC generator: writing GEM_AMC.TTC.GENERATOR.CYCLIC_START while GEM_AMC.TTC.GENERATOR.ENABLE is set sends
+ *     GEM_AMC.TTC.GENERATOR.CYCLIC_L1A_COUNT L1As at once (none in continuous mode, i.e. with a count of 0)
+ *   * the backplane: while GEM_AMC.TTC.CTRL.L1A_ENABLE is set and the generator is not enabled, L1As arrive at
+ *     MEMSVC_SIM_EXT_L1A_RATE_HZ; they are counted on the next access
+ *  Each L1A increments the counters, while their gate register is nonzero. Writing a nonzero value to a counter reset
+ *  register zeroes the counters it clears, unless the register was already set and the write changes other fields
+ *  of its word, i.e. is a read-modify-write of another register. The defaults are DEFAULT_COUNTERS and DEFAULT_COUNTER_RESETS; the
+ *  initial values file can add or replace them, see conf/memsvc_sim.txt.
+ *
+ *  The register file is private to each process: the forked RPC connections and job workers each start from
+ *  the initial values and do not see each other's writes. It is configured by environment variables:
+ *  | variable                  | default                         | content                                                       |
+ *  |---------------------------|---------------------------------|---------------------------------------------------------------|
+ *  | MEMSVC_SIM_ADDRESS_TABLE  | $GEM_PATH/address_table.mdb     | address table directory                                       |
+ *  | MEMSVC_SIM_INIT           | $GEM_PATH/memsvc_sim.txt        | initial values, "register value" per line, see conf/memsvc_sim.txt |
+ *  | MEMSVC_SIM_LATENCY_NS     | 1000                            | latency of each transaction                                   |
+ *  | MEMSVC_SIM_WORD_NS        | 20                              | additional latency of each word                               |
+ *  | MEMSVC_SIM_SLOW_NS        | 50000                           | additional latency of each slow-control word                  |
+ *  | MEMSVC_SIM_SLOW           | GEM_AMC.OH.OH*.GEB.VFAT*        | comma separated patterns of the slow-control registers        |
+ *  | MEMSVC_SIM_AUTOCLEAR      | see DEFAULT_AUTOCLEAR           | comma separated patterns of the auto-clearing registers       |
+ *  | MEMSVC_SIM_EXT_L1A_RATE_HZ| 100000                          | rate of the backplane L1As, 0 for none                        |
+ *  Patterns use the shell wildcards of fnmatch(3) and match the full register name.
+ */
+
+#include <libmemsvc.h>
+
+#include <fnmatch.h>
+#include <time.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "LogManager.h"
+#include "lmdb_cpp_wrapper.h"
+#include "reg_node.h"
+
+struct memsvc_sim {
+  std::string last_error;
+};
+
+namespace {
+  /*! \struct SimWord
+   *  \brief Simulated 32-bit register
+   */
+  struct SimWord {
+    uint32_t value;     ///< Current content
+    uint32_t roMask;    ///< Bits not changed by writes
+    uint32_t clearMask; ///< Bits cleared right after a write
+    bool     slow;      ///< Word accessed through the VFAT slow control
+  };
+
+  /*! \brief Registers pulsed by the firmware, which read back as 0 right after being written
+   *  \details Level registers such as GEM_AMC.TTC.CTRL.CNT_RESET or PA_MANUAL_PLL_RESET keep their value and are not listed.
+   */
+  const char DEFAULT_AUTOCLEAR[] = "GEM_AMC.TTC.CTRL.MODULE_RESET,GEM_AMC.TTC.CTRL.MMCM_RESET,"
+                                   "GEM_AMC.TTC.GENERATOR.RESET,GEM_AMC.TTC.GENERATOR.SINGLE_*,"
+                                   "GEM_AMC.GEM_SYSTEM.CTRL.LINK_RESET,GEM_AMC.GEM_TESTS.VFAT_DAQ_MONITOR.CTRL.RESET,"
+                                   "GEM_AMC.TRIGGER.SBIT_MONITOR.RESET,GEM_AMC.SLOW_CONTROL.SCA.CTRL.MODULE_RESET,"
+                                   "GEM_AMC.SLOW_CONTROL.SCA.MANUAL_CONTROL.SCA_CMD.SCA_CMD_EXECUTE,"
+                                   "GEM_AMC.SLOW_CONTROL.IC.EXECUTE_*";
+
+  /*! \brief Counters incremented by each L1A, by pattern, with the register gating them ("-" if always counting)
+   */
+  const std::map<std::string, std::string> DEFAULT_COUNTERS = {
+    {"GEM_AMC.TTC.CMD_COUNTERS.L1A", "-"},
+    {"GEM_AMC.GEM_TESTS.VFAT_DAQ_MONITOR.VFAT*.GOOD_EVENTS_COUNT", "GEM_AMC.GEM_TESTS.VFAT_DAQ_MONITOR.CTRL.ENABLE"},
+  };
+
+  /*! \brief Counter reset registers, with the pattern of the counters they zero
+   */
+  const std::map<std::string, std::string> DEFAULT_COUNTER_RESETS = {
+    {"GEM_AMC.TTC.CTRL.CNT_RESET", "GEM_AMC.TTC.CMD_COUNTERS.*"},
+    {"GEM_AMC.GEM_TESTS.VFAT_DAQ_MONITOR.CTRL.RESET", "GEM_AMC.GEM_TESTS.VFAT_DAQ_MONITOR.VFAT*_COUNT"},
+  };
+
+  const char GENERATOR_ENABLE[]   = "GEM_AMC.TTC.GENERATOR.ENABLE";
+  const char GENERATOR_START[]    = "GEM_AMC.TTC.GENERATOR.CYCLIC_START";
+  const char GENERATOR_L1A_COUNT[] = "GEM_AMC.TTC.GENERATOR.CYCLIC_L1A_COUNT";
+  const char EXT_L1A_ENABLE[]     = "GEM_AMC.TTC.CTRL.L1A_ENABLE";
+
+  /*! \struct SimCounter
+   *  \brief Register field incremented by the L1As
+   */
+  struct SimCounter {
+    RegNode node;
+    RegNode gate;  ///< Counts while this field is nonzero
+    bool    gated;
+  };
+
+  /*! \struct SimWriteAction
+   *  \brief Effect of writing a nonzero value to a register field
+   */
+  struct SimWriteAction {
+    uint32_t mask;                 ///< Field of the word which triggers the action
+    bool     cyclicStart;          ///< Starts the TTC generator
+    std::vector<RegNode> cleared;  ///< Counters zeroed
+  };
+
+  std::mutex simMutex;
+  bool simLoaded = false;
+  std::unordered_map<uint32_t, SimWord> simWords;
+  std::vector<SimCounter> simCounters;
+  std::unordered_map<uint32_t, std::vector<SimWriteAction> > simWriteActions; ///< By word address
+  RegNode genEnable, genL1ACount, extL1AEnable;
+  bool hasGenerator = false, hasExtTriggers = false;
+  uint64_t extRateHz;
+  uint64_t extCountedNs; ///< Time up to which the backplane L1As were counted
+  uint64_t latencyNs;
+  uint64_t wordNs;
+  uint64_t slowNs;
+
+  std::string envOr(const char * name, const std::string & fallback)
+  {
+    const char * value = std::getenv(name);
+    return value ? value : fallback;
+  }
+
+  uint64_t envNs(const char * name, uint64_t fallback)
+  {
+    const char * value = std::getenv(name);
+    return value ? std::strtoull(value, nullptr, 10) : fallback;
+  }
+
+  std::vector<std::string> splitPatterns(const std::string & list)
+  {
+    std::vector<std::string> patterns;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ','))
+      if (!item.empty())
+        patterns.push_back(item);
+    return patterns;
+  }
+
+  bool matchesAny(const std::vector<std::string> & patterns, const char * str)
+  {
+    for (auto const& pattern : patterns)
+      if (fnmatch(pattern.c_str(), str, 0) == 0)
+        return true;
+    return false;
+  }
+
+  /*! \brief Waits for the simulated duration of an access
+   */
+  void waitNs(uint64_t ns)
+  {
+    if (ns == 0)
+      return;
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec  += ns/1000000000ULL;
+    deadline.tv_nsec += ns%1000000000ULL;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_nsec -= 1000000000L;
+      ++deadline.tv_sec;
+    }
+    if (ns >= 100000) {
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) != 0) {}
+      return;
+    }
+    // Short latencies are below the scheduler resolution, spin instead
+    struct timespec now;
+    do {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+    } while (now.tv_sec < deadline.tv_sec || (now.tv_sec == deadline.tv_sec && now.tv_nsec < deadline.tv_nsec));
+  }
+
+  uint64_t accessNs(uint32_t addr, uint32_t words)
+  {
+    uint64_t ns = latencyNs;
+    for (uint32_t i = 0; i < words; ++i) {
+      auto word = simWords.find(addr + i*REG_WORD_BYTES);
+      ns += (word != simWords.end() && word->second.slow) ? slowNs : wordNs;
+    }
+    return ns;
+  }
+
+  uint64_t nowNs()
+  {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return uint64_t(now.tv_sec)*1000000000ULL + now.tv_nsec;
+  }
+
+  uint32_t getField(const RegNode & node)
+  {
+    auto word = simWords.find(node.address);
+    return (word == simWords.end()) ? 0 : (word->second.value & node.mask) >> node.shift;
+  }
+
+  void setField(const RegNode & node, uint32_t value)
+  {
+    auto word = simWords.find(node.address);
+    if (word != simWords.end())
+      word->second.value = (word->second.value & ~node.mask) | ((value << node.shift) & node.mask);
+  }
+
+  /*! \brief Increments the counters by a number of L1As, wrapping around at the width of their field
+   */
+  void sendL1As(uint64_t n)
+  {
+    for (auto const& counter : simCounters)
+      if (!counter.gated || getField(counter.gate))
+        setField(counter.node, uint32_t(getField(counter.node) + n));
+  }
+
+  /*! \brief Counts the backplane L1As arrived since the last access
+   */
+  void countExtTriggers()
+  {
+    const uint64_t now = nowNs();
+    if (!hasExtTriggers || extRateHz == 0 || !getField(extL1AEnable) || (hasGenerator && getField(genEnable))) {
+      extCountedNs = now;
+      return;
+    }
+    const uint64_t n = (now - extCountedNs)*extRateHz/1000000000ULL;
+    if (n > 0) {
+      sendL1As(n);
+      extCountedNs += n*1000000000ULL/extRateHz;
+    }
+  }
+
+  /*! \brief Builds the register file from the address table and the initial values file
+   */
+  bool loadRegisterFile(std::string & error)
+  {
+    const std::string gemPath = envOr("GEM_PATH", ".");
+    const std::string dbPath  = envOr("MEMSVC_SIM_ADDRESS_TABLE", gemPath + "/address_table.mdb");
+    const std::string initPath = envOr("MEMSVC_SIM_INIT", gemPath + "/memsvc_sim.txt");
+    const std::vector<std::string> slowPatterns      = splitPatterns(envOr("MEMSVC_SIM_SLOW", "GEM_AMC.OH.OH*.GEB.VFAT*"));
+    const std::vector<std::string> autoclearPatterns = splitPatterns(envOr("MEMSVC_SIM_AUTOCLEAR", DEFAULT_AUTOCLEAR));
+    latencyNs = envNs("MEMSVC_SIM_LATENCY_NS", 1000);
+    wordNs    = envNs("MEMSVC_SIM_WORD_NS", 20);
+    slowNs    = envNs("MEMSVC_SIM_SLOW_NS", 50000);
+    extRateHz = envNs("MEMSVC_SIM_EXT_L1A_RATE_HZ", 100000);
+
+    // Initial values, applied to the nodes matching each pattern, and counter rules replacing the defaults
+    std::vector<std::pair<std::string, uint32_t> > initValues;
+    std::map<std::string, std::string> counterRules = DEFAULT_COUNTERS;
+    std::map<std::string, std::string> resetRules   = DEFAULT_COUNTER_RESETS;
+    std::ifstream initFile(initPath);
+    std::string line;
+    for (unsigned lineN = 1; std::getline(initFile, line); ++lineN) {
+      std::stringstream ss(line);
+      std::string pattern, value;
+      if (!(ss >> pattern >> value) || pattern[0] == '#')
+        continue;
+      if (pattern == "counter" || pattern == "reset") {
+        std::string target;
+        if (!(ss >> target)) {
+          error = stdsprintf("memsvc_sim: \"%s %s\" without its second register at %s:%u", pattern.c_str(), value.c_str(), initPath.c_str(), lineN);
+          return false;
+        }
+        (pattern == "counter" ? counterRules : resetRules)[value] = target;
+        continue;
+      }
+      try {
+        initValues.push_back(std::make_pair(pattern, uint32_t(std::stoul(value, nullptr, 0))));
+      } catch (const std::exception &) {
+        error = stdsprintf("memsvc_sim: invalid value \"%s\" at %s:%u", value.c_str(), initPath.c_str(), lineN);
+        return false;
+      }
+    }
+
+    // Registers looked up by name: the generator, the backplane trigger enable, the gates and the reset registers
+    std::set<std::string> named = {GENERATOR_ENABLE, GENERATOR_START, GENERATOR_L1A_COUNT, EXT_L1A_ENABLE};
+    for (auto const& rule : counterRules)
+      named.insert(rule.second);
+    for (auto const& rule : resetRules)
+      named.insert(rule.first);
+    std::map<std::string, RegNode> namedNodes;
+    std::vector<std::pair<RegNode, std::string> > counterNodes;  // counter, gate
+    std::map<std::string, std::vector<RegNode> > clearedNodes;   // by reset register
+
+    try {
+      auto env = lmdb::env::create();
+      env.set_mapsize(1UL * 1024UL * 1024UL * 50UL);
+      env.open(dbPath.c_str(), MDB_RDONLY | MDB_NOLOCK, 0664);
+      auto rtxn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+      auto dbi  = lmdb::dbi::open(rtxn, nullptr);
+
+      uint32_t format = REG_FORMAT_TEXT;
+      lmdb::val key, value;
+      key.assign(REG_FORMAT_KEY);
+      if (dbi.get(rtxn, key, value) && value.size() == sizeof(uint32_t))
+        format = loadLE32(reinterpret_cast<const uint8_t*>(value.data()));
+
+      auto cursor = lmdb::cursor::open(rtxn, dbi);
+      while (cursor.get(key, value, MDB_NEXT)) {
+        const std::string name(key.data(), key.size());
+        RegNode node;
+        if (name == REG_FORMAT_KEY || !decodeRegNode(format, value.data(), value.size(), node))
+          continue;
+
+        const bool slow      = matchesAny(slowPatterns, name.c_str());
+        const bool autoclear = node.writable() && matchesAny(autoclearPatterns, name.c_str());
+        uint32_t initValue = 0;
+        bool hasInit = false;
+        for (auto const& init : initValues) {
+          if (fnmatch(init.first.c_str(), name.c_str(), 0) == 0) {
+            initValue = init.second;
+            hasInit = true;
+          }
+        }
+
+        if (named.count(name))
+          namedNodes[name] = node;
+        for (auto const& rule : counterRules)
+          if (rule.second != "off" && fnmatch(rule.first.c_str(), name.c_str(), 0) == 0)
+            counterNodes.push_back(std::make_pair(node, rule.second));
+        for (auto const& rule : resetRules)
+          if (rule.second != "-" && fnmatch(rule.second.c_str(), name.c_str(), 0) == 0)
+            clearedNodes[rule.first].push_back(node);
+
+        const uint32_t words = (node.size > 0) ? node.size : 1;
+        for (uint32_t i = 0; i < words; ++i) {
+          SimWord & word = simWords.emplace(node.address + i*REG_WORD_BYTES, SimWord{0, 0, 0, false}).first->second;
+          if (!node.writable())
+            word.roMask |= node.mask;
+          if (autoclear)
+            word.clearMask |= node.mask;
+          word.slow |= slow;
+          if (hasInit)
+            word.value = (word.value & ~node.mask) | ((initValue << node.shift) & node.mask);
+        }
+      }
+      cursor.close();
+      rtxn.abort();
+    } catch (const std::exception & e) {
+      error = "memsvc_sim: cannot load the address table " + dbPath + ": " + e.what();
+      return false;
+    }
+
+    // Counters and the write actions, skipping those whose registers are not in the address table
+    for (auto const& counter : counterNodes) {
+      SimCounter sim = {counter.first, RegNode(), counter.second != "-"};
+      if (sim.gated) {
+        auto gate = namedNodes.find(counter.second);
+        if (gate == namedNodes.end()) {
+          LOGGER->log_message(LogManager::WARNING, stdsprintf("memsvc_sim: counter gate %s not found", counter.second.c_str()));
+          continue;
+        }
+        sim.gate = gate->second;
+      }
+      simCounters.push_back(sim);
+    }
+    for (auto const& cleared : clearedNodes) {
+      auto reset = namedNodes.find(cleared.first);
+      if (reset == namedNodes.end()) {
+        LOGGER->log_message(LogManager::WARNING, stdsprintf("memsvc_sim: counter reset %s not found", cleared.first.c_str()));
+        continue;
+      }
+      simWriteActions[reset->second.address].push_back(SimWriteAction{reset->second.mask, false, cleared.second});
+    }
+    hasGenerator = namedNodes.count(GENERATOR_ENABLE) && namedNodes.count(GENERATOR_START) && namedNodes.count(GENERATOR_L1A_COUNT);
+    if (hasGenerator) {
+      genEnable   = namedNodes[GENERATOR_ENABLE];
+      genL1ACount = namedNodes[GENERATOR_L1A_COUNT];
+      const RegNode & start = namedNodes[GENERATOR_START];
+      simWriteActions[start.address].push_back(SimWriteAction{start.mask, true, {}});
+    }
+    hasExtTriggers = namedNodes.count(EXT_L1A_ENABLE);
+    if (hasExtTriggers)
+      extL1AEnable = namedNodes[EXT_L1A_ENABLE];
+    extCountedNs = nowNs();
+
+    LOGGER->log_message(LogManager::INFO, stdsprintf("memsvc_sim: %zu words mapped from %s, %zu initial values from %s, %zu counters",
+                                                     simWords.size(), dbPath.c_str(), initValues.size(), initPath.c_str(),
+                                                     simCounters.size()));
+    return true;
+  }
+}
+
+int memsvc_open(memsvc_handle_t *handle)
+{
+  *handle = new memsvc_sim();
+  std::lock_guard<std::mutex> guard(simMutex);
+  if (!simLoaded)
+    simLoaded = loadRegisterFile((*handle)->last_error);
+  return simLoaded ? 0 : -1;
+}
+
+int memsvc_close(memsvc_handle_t *handle)
+{
+  delete *handle;
+  *handle = nullptr;
+  return 0;
+}
+
+const char *memsvc_get_last_error(memsvc_handle_t handle)
+{
+  return handle ? handle->last_error.c_str() : "memsvc_sim: invalid handle";
+}
+
+int memsvc_read(memsvc_handle_t handle, uint32_t addr, uint32_t words, uint32_t *data)
+{
+  std::lock_guard<std::mutex> guard(simMutex);
+  waitNs(accessNs(addr, words));
+  countExtTriggers();
+  for (uint32_t i = 0; i < words; ++i) {
+    auto word = simWords.find(addr + i*REG_WORD_BYTES);
+    if (word == simWords.end()) {
+      handle->last_error = stdsprintf("memsvc_sim: read of unmapped address 0x%08x", addr + i*REG_WORD_BYTES);
+      return -1;
+    }
+    data[i] = word->second.value;
+  }
+  return 0;
+}
+
+int memsvc_write(memsvc_handle_t handle, uint32_t addr, uint32_t words, const uint32_t *data)
+{
+  std::lock_guard<std::mutex> guard(simMutex);
+  waitNs(accessNs(addr, words));
+  countExtTriggers();
+  for (uint32_t i = 0; i < words; ++i) {
+    auto word = simWords.find(addr + i*REG_WORD_BYTES);
+    if (word == simWords.end()) {
+      handle->last_error = stdsprintf("memsvc_sim: write to unmapped address 0x%08x", addr + i*REG_WORD_BYTES);
+      return -1;
+    }
+    SimWord & sim = word->second;
+    const uint32_t before = sim.value;
+    sim.value = (sim.value & sim.roMask) | (data[i] & ~sim.roMask);
+    const uint32_t written = sim.value;
+    sim.value &= ~sim.clearMask;
+
+    auto actions = simWriteActions.find(addr + i*REG_WORD_BYTES);
+    if (actions == simWriteActions.end())
+      continue;
+    for (auto const& action : actions->second) {
+      // A read-modify-write of another field of the word rewrites a level register without meaning to trigger it
+      const bool aimed = !(before & action.mask) || !((before ^ written) & ~action.mask);
+      if (!(data[i] & action.mask) || !aimed)
+        continue;
+      for (auto const& counter : action.cleared)
+        setField(counter, 0);
+      if (action.cyclicStart && getField(genEnable))
+        sendL1As(getField(genL1ACount));
+    }
+  }
+  return 0;
+}
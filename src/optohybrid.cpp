@@ -3,7 +3,7 @@
 #include "hw_constants.h"
 
 void broadcastWriteLocal(localArgs * la, uint32_t ohN, std::string regName, uint32_t value, uint32_t mask) {
-  uint32_t fw_maj = readReg(la, "GEM_AMC.GEM_SYSTEM.RELEASE.MAJOR");
+  uint32_t fw_maj = getSystemInfo(la).releaseMajor;
   if (fw_maj == 1) {
     char regBase [100];
     sprintf(regBase, "GEM_AMC.OH.OH%i.GEB.Broadcast",ohN);
@@ -21,10 +21,16 @@ void broadcastWriteLocal(localArgs * la, uint32_t ohN, std::string regName, uint
     writeRawReg(la, t_regName, value);
     //Wait until broadcast write finishes
     t_regName = std::string(regBase) + ".Running";
-    while (unsigned int t_res = readRawReg(la, t_regName))
-    {
-      if (t_res == 0xdeaddead) break;
-      usleep(1000);
+    const RegNode * running = getRegNode(la, t_regName);
+    if (running) {
+      const PollResult done = pollUntil(*running, PollCondition::equal, 0, std::chrono::seconds(1),
+                                        PollBackoff(std::chrono::microseconds(50), std::chrono::milliseconds(1)));
+      if (!done.success) {
+        const std::string errmsg = stdsprintf("Broadcast write to %s still running after %u polls in %lld us",
+                                              regName.c_str(), done.polls, (long long)done.elapsed.count());
+        la->response->set_string("error", errmsg);
+        LOGGER->log_message(LogManager::ERROR, errmsg);
+      }
     }
   } else if (fw_maj == 3) {
     std::string t_regName;
@@ -54,7 +60,7 @@ void broadcastWrite(const RPCMsg *request, RPCMsg *response) {
 }
 
 void broadcastReadLocal(localArgs * la, uint32_t * outData, uint32_t ohN, std::string regName, uint32_t mask) {
-  uint32_t fw_maj = readReg(la, "GEM_AMC.GEM_SYSTEM.RELEASE.MAJOR");
+  uint32_t fw_maj = getSystemInfo(la).releaseMajor;
   char regBase [100];
   if (fw_maj == 1) {
     sprintf(regBase,"GEM_AMC.OH.OH%i.GEB.VFATS.VFAT",ohN);
@@ -92,6 +98,7 @@ void broadcastRead(const RPCMsg *request, RPCMsg *response) {
 
 // Set default values to VFAT parameters. VFATs will remain in sleep mode
 void biasAllVFATsLocal(localArgs * la, uint32_t ohN, uint32_t mask) {
+  RegShadowScope shadow(la);
   for (auto & it:vfat_parameters)
   {
     broadcastWriteLocal(la, ohN, it.first, it.second, mask);
@@ -99,6 +106,7 @@ void biasAllVFATsLocal(localArgs * la, uint32_t ohN, uint32_t mask) {
 }
 
 void setAllVFATsToRunModeLocal(localArgs * la, uint32_t ohN, uint32_t mask) {
+    RegShadowScope shadow(la);
     switch(fw_version_check("setAllVFATsToRunMode", la)){
         case 3:
             broadcastWriteLocal(la, ohN, "CFG_RUN", 0x1, mask);
@@ -420,6 +428,9 @@ void startScanModule(const RPCMsg *request, RPCMsg *response){
     rtxn.abort();
 } //End startScanModule(...)
 
+static const uint32_t ULTRA_SCAN_MIN_L1A_RATE_HZ   = 1000; ///< Slowest trigger rate of an ultra scan before it is considered stuck
+static const uint32_t ULTRA_SCAN_TIMEOUT_MARGIN_MS = 1000; ///< Wait for the ultra scan beyond its triggers
+
 void getUltraScanResultsLocal(localArgs * la, uint32_t *outData, uint32_t ohN, uint32_t nevts, uint32_t dacMin, uint32_t dacMax, uint32_t dacStep){
     std::stringstream sstream;
     sstream<<ohN;
@@ -428,42 +439,25 @@ void getUltraScanResultsLocal(localArgs * la, uint32_t *outData, uint32_t ohN, u
     //Set Scan Base
     std::string scanBase = "GEM_AMC.OH.OH" + strOhN + ".ScanController.ULTRA";
 
-    //Get L1A Count & num events
-    uint32_t ohnL1A_0 =  readReg(la, "GEM_AMC.OH.OH" + strOhN + ".COUNTERS.T1.SENT.L1A");
-    uint32_t ohnL1A   =  readReg(la, "GEM_AMC.OH.OH" + strOhN + ".COUNTERS.T1.SENT.L1A");
-    uint32_t numtrigs = readReg(la, scanBase + ".CONF.NTRIGS");
-
-    //Print latency counts
-    bool bIsLatency = false;
-    if( readReg(la, scanBase + ".CONF.MODE") == 2){
-        bIsLatency = true;
-
-        stdsprintf(
-                "At Link %i: %d/%d L1As processed, %d%% done",
-                    ohN,
-                    readReg(la, "GEM_AMC.OH.OH" + strOhN + ".COUNTERS.T1.SENT.L1A") - ohnL1A_0,
-                    nevts*numtrigs,
-                    (readReg(la, "GEM_AMC.OH.OH" + strOhN + ".COUNTERS.T1.SENT.L1A") - ohnL1A_0)*100./(nevts*numtrigs)
-                );
-    }
-
-    //Check if the scan is still running
-    while(readReg(la, scanBase + ".MONITOR.STATUS") > 0){
-        stdsprintf("OH %i: Ultra scan still running (0x%x), not returning results",ohN,
-                    readReg(la, scanBase + ".MONITOR.STATUS"));
-        if (bIsLatency){
-            if( (readReg(la, "GEM_AMC.OH.OH" + strOhN + ".COUNTERS.T1.SENT.L1A") - ohnL1A ) > numtrigs){
-                stdsprintf(
-                        "At Link %i: %d/%d L1As processed, %d%% done",
-                            ohN,
-                            readReg(la, "GEM_AMC.OH.OH" + strOhN + ".COUNTERS.T1.SENT.L1A") - ohnL1A_0,
-                            nevts*numtrigs,
-                            (readReg(la, "GEM_AMC.OH.OH" + strOhN + ".COUNTERS.T1.SENT.L1A") - ohnL1A_0)*100./(nevts*numtrigs)
-                        );
-                ohnL1A   =  readReg(la, "GEM_AMC.OH.OH" + strOhN + ".COUNTERS.T1.SENT.L1A");
-            }
+    //Wait for the scan to finish, the nevts triggers of each step coming at ULTRA_SCAN_MIN_L1A_RATE_HZ at least
+    const RegNode * status = getRegNode(la, scanBase + ".MONITOR.STATUS");
+    if (status) {
+        const uint64_t expectedL1As = uint64_t(nevts)*((dacMax-dacMin)/dacStep+1);
+        const std::chrono::microseconds timeout = std::chrono::milliseconds(ULTRA_SCAN_TIMEOUT_MARGIN_MS)
+            + std::chrono::microseconds(expectedL1As*1000000/ULTRA_SCAN_MIN_L1A_RATE_HZ);
+        const PollResult done = pollUntil(*status, PollCondition::equal, 0, timeout,
+                                          PollBackoff(std::chrono::milliseconds(1), std::chrono::milliseconds(100)));
+        if (!done.success) {
+            const std::string errmsg = stdsprintf("OH %i: ultra scan still running after %lld us, %u L1As sent for %llu expected",
+                                                  ohN, (long long)done.elapsed.count(),
+                                                  readReg(la, "GEM_AMC.OH.OH" + strOhN + ".COUNTERS.T1.SENT.L1A"),
+                                                  (unsigned long long)expectedL1As);
+            la->response->set_string("error", errmsg);
+            LOGGER->log_message(LogManager::ERROR, errmsg);
+            return;
         }
-        sleep(0.1);
+        LOGGER->log_message(LogManager::DEBUG, stdsprintf("OH %i: ultra scan finished after %u polls in %lld us",
+                                                          ohN, done.polls, (long long)done.elapsed.count()));
     }
 
     LOGGER->log_message(LogManager::DEBUG, "OH " + strOhN + ": getUltraScanResults(...)");
@@ -490,16 +484,18 @@ void getUltraScanResults(const RPCMsg *request, RPCMsg *response){
     uint32_t dacMax = request->get_word("dacMax");
     uint32_t dacStep = request->get_word("dacStep");
 
-    uint32_t outData[oh::VFATS_PER_OH*(dacMax-dacMin+1)/dacStep];
-    getUltraScanResultsLocal(&la, outData, ohN, nevts, dacMin, dacMax, dacStep);
-    response->set_word_array("data",outData,oh::VFATS_PER_OH*(dacMax-dacMin+1)/dacStep);
+    ScratchBuffer outData(oh::VFATS_PER_OH*(dacMax-dacMin+1)/dacStep, true);
+    if (!outData.check(response, "Scan data"))
+        return;
+    getUltraScanResultsLocal(&la, outData.data(), ohN, nevts, dacMin, dacMax, dacStep);
+    response->set_word_array("data",outData.data(),outData.size());
 
     rtxn.abort();
 } //End getUltraScanResults(...)
 
 void stopCalPulse2AllChannelsLocal(localArgs *la, uint32_t ohN, uint32_t mask, uint32_t ch_min, uint32_t ch_max){
     //Get FW release
-    uint32_t fw_maj = readReg(la, "GEM_AMC.GEM_SYSTEM.RELEASE.MAJOR");
+    uint32_t fw_maj = getSystemInfo(la).releaseMajor;
 
     if (fw_maj == 1) {
         uint32_t trimVal=0;
@@ -566,7 +562,7 @@ void statusOHLocal(localArgs * la, uint32_t ohEnMask){
                            "CLOCKING.CLOCKING.LOGIC_MMCM_LOCKED",
                            "CLOCKING.CLOCKING.GBT_MMCM_UNLOCKED_CNT",
                            "CLOCKING.CLOCKING.LOGIC_MMCM_UNLOCKED_CNT"};
-    std::string regName;
+    std::vector<std::string> regNames;
 
     for(unsigned int ohN = 0; ohN < amc::OH_PER_AMC; ohN++) if((ohEnMask >> ohN) & 0x1)
 
@@ -574,10 +570,16 @@ void statusOHLocal(localArgs * la, uint32_t ohEnMask){
         char regBase [100];
         sprintf(regBase, "GEM_AMC.OH.OH%i.",ohN);
         for (auto &reg : regs) {
-            regName = std::string(regBase)+reg;
-            la->response->set_word(regName,readReg(la,regName));
+            regNames.push_back(std::string(regBase)+reg);
         }
     }
+
+    std::vector<uint32_t> values;
+    uint32_t nTransactions = readRegs(la, regNames, values);
+    for (size_t i = 0; i < regNames.size(); ++i) {
+        la->response->set_word(regNames[i], values[i]);
+    }
+    LOGGER->log_message(LogManager::DEBUG, stdsprintf("statusOH: %zu registers read in %u transactions", regNames.size(), nTransactions));
 }
 
 void statusOH(const RPCMsg *request, RPCMsg *response)
@@ -600,16 +602,19 @@ extern "C" {
             LOGGER->log_message(LogManager::ERROR, "Unable to load module");
             return; // Do not register our functions, we depend on memsvc.
         }
-        modmgr->register_method("optohybrid", "broadcastRead", broadcastRead);
-        modmgr->register_method("optohybrid", "broadcastWrite", broadcastWrite);
-        modmgr->register_method("optohybrid", "configureScanModule", configureScanModule);
-        modmgr->register_method("optohybrid", "configureVFATs", configureVFATs);
-        modmgr->register_method("optohybrid", "getUltraScanResults", getUltraScanResults);
-        modmgr->register_method("optohybrid", "loadTRIMDAC", loadTRIMDAC);
-        modmgr->register_method("optohybrid", "loadVT1", loadVT1);
-        modmgr->register_method("optohybrid", "printScanConfiguration", printScanConfiguration);
-        modmgr->register_method("optohybrid", "startScanModule", startScanModule);
-        modmgr->register_method("optohybrid", "stopCalPulse2AllChannels", stopCalPulse2AllChannels);
-        modmgr->register_method("optohybrid", "statusOH", statusOH);
+        if (!openAddressTable()) {
+            LOGGER->log_message(LogManager::WARNING, "Address table not available yet, it will be opened on first use");
+        }
+        modmgr->register_method("optohybrid", "broadcastRead", profiledMethod<broadcastRead>);
+        modmgr->register_method("optohybrid", "broadcastWrite", profiledMethod<broadcastWrite>);
+        modmgr->register_method("optohybrid", "configureScanModule", profiledMethod<configureScanModule>);
+        modmgr->register_method("optohybrid", "configureVFATs", profiledMethod<configureVFATs>);
+        modmgr->register_method("optohybrid", "getUltraScanResults", profiledMethod<getUltraScanResults>);
+        modmgr->register_method("optohybrid", "loadTRIMDAC", profiledMethod<loadTRIMDAC>);
+        modmgr->register_method("optohybrid", "loadVT1", profiledMethod<loadVT1>);
+        modmgr->register_method("optohybrid", "printScanConfiguration", profiledMethod<printScanConfiguration>);
+        modmgr->register_method("optohybrid", "startScanModule", profiledMethod<startScanModule>);
+        modmgr->register_method("optohybrid", "stopCalPulse2AllChannels", profiledMethod<stopCalPulse2AllChannels>);
+        modmgr->register_method("optohybrid", "statusOH", profiledMethod<statusOH>);
     }
 }
@@ -1,18 +1,195 @@
 #include "utils.h"
+#include "utils/regnode_cache.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <cerrno>
+#include <cstring>
+#include <sys/stat.h>
+#include <sys/types.h>
 
 memsvc_handle_t memsvc;
 
+/* Address table environment shared by all the RPC calls of the process.
+ * The transaction must be declared after the environment so that it is destroyed first.
+ */
+static lmdb::env atEnv(nullptr);         ///< Shared LMDB environment
+static lmdb::txn atTxn(nullptr);         ///< Shared read transaction, reset between the RPC calls
+static lmdb::dbi atDbi(0);               ///< Shared database handle
+static int       atTxnDepth = 0;         ///< Number of nested LocalTxn currently using atTxn
+static bool      atTxnActive = false;    ///< Whether atTxn is renewed
+static pid_t     atPid      = 0;         ///< Process which opened atEnv
+static struct stat atStat;               ///< Status of data.mdb when atEnv was opened
+static uint32_t  atFormat   = REG_FORMAT_TEXT; ///< Record format version of the opened address table
+static bool      atCompiledRegs = false; ///< Whether the compiled-in register descriptors match the opened address table
+
+/*! \brief Returns whether data.mdb was replaced since the shared environment was opened
+ */
+static bool addressTableChanged(const std::string & lmdb_data_file)
+{
+  struct stat st;
+  if (stat(lmdb_data_file.c_str(), &st) != 0)
+    return false; // Keep on using the current table if the live one cannot be checked
+  return st.st_ino != atStat.st_ino || st.st_dev != atStat.st_dev || st.st_mtime != atStat.st_mtime;
+}
+
+/*! \brief Returns the record format version of an address table, tables without version key use the legacy text format
+ */
+static uint32_t readAddressTableFormat(lmdb::txn & txn, lmdb::dbi & dbi)
+{
+  lmdb::val key;
+  lmdb::val value;
+  key.assign(REG_FORMAT_KEY);
+  if (dbi.get(txn, key, value) && value.size() == sizeof(uint32_t))
+    return loadLE32(reinterpret_cast<const uint8_t*>(value.data()));
+  return REG_FORMAT_TEXT;
+}
+
+bool openAddressTable()
+{
+  const char * gem_path = std::getenv("GEM_PATH");
+  if (gem_path == nullptr) {
+    LOGGER->log_message(LogManager::ERROR, "GEM_PATH is not set, unable to open the address table");
+    return false;
+  }
+  const std::string lmdb_area_file = std::string(gem_path)+"/address_table.mdb";
+  const std::string lmdb_data_file = lmdb_area_file+"/data.mdb";
+
+  if (atEnv.handle() && atPid == getpid() && !addressTableChanged(lmdb_data_file) && !regNodeCacheStale())
+    return true;
+
+  if (atEnv.handle() && atPid != getpid()) {
+    // An environment inherited through fork() must be neither used nor closed by the child,
+    // closing it would release the reader slots of the parent: the handles are intentionally leaked
+    new lmdb::txn(std::move(atTxn));
+    new lmdb::env(std::move(atEnv));
+    closeAddressTable();
+  } else if (atEnv.handle()) {
+    LOGGER->log_message(LogManager::INFO, "Address table changed, reopening the LMDB environment");
+    closeAddressTable();
+  }
+
+  try {
+    atEnv = lmdb::env::create();
+    atEnv.set_mapsize(LMDB_SIZE);
+    // The live table is never written in place (see update_address_table), so no lock file is needed
+    atEnv.open(lmdb_area_file.c_str(), MDB_RDONLY | MDB_NOLOCK | MDB_NOTLS, 0664);
+
+    auto txn = lmdb::txn::begin(atEnv, nullptr, MDB_RDONLY);
+    atDbi = lmdb::dbi::open(txn, nullptr);
+    atFormat = readAddressTableFormat(txn, atDbi);
+    txn.commit();
+    if (atFormat > REG_FORMAT_BINARY) {
+      LOGGER->log_message(LogManager::ERROR, stdsprintf("Unsupported address table format version %u in %s", atFormat, lmdb_area_file.c_str()));
+      closeAddressTable();
+      return false;
+    }
+
+    atTxn = lmdb::txn::begin(atEnv, nullptr, MDB_RDONLY);
+    atTxn.reset();
+  } catch (const lmdb::error & e) {
+    LOGGER->log_message(LogManager::ERROR, stdsprintf("Unable to open the address table %s: %s", lmdb_area_file.c_str(), e.what()));
+    closeAddressTable();
+    return false;
+  }
+
+  stat(lmdb_data_file.c_str(), &atStat);
+  atPid = getpid();
+  if (!attachRegNodeCache(atEnv, atDbi, atFormat, atStat))
+    LOGGER->log_message(LogManager::WARNING, "Shared node cache not available, the nodes are looked up in LMDB");
+
+  try {
+    // The table may come from another firmware version than the one the modules were built for
+    auto txn = lmdb::txn::begin(atEnv, nullptr, MDB_RDONLY);
+    RPCMsg response;
+    LocalArgs la = {.rtxn = txn, .dbi = atDbi, .response = &response};
+    atCompiledRegs = checkCompiledRegs(&la);
+  } catch (const lmdb::error & e) {
+    LOGGER->log_message(LogManager::ERROR, stdsprintf("Unable to check the compiled-in registers: %s", e.what()));
+  }
+  LOGGER->log_message(LogManager::DEBUG, stdsprintf("Address table %s opened", lmdb_area_file.c_str()));
+  return true;
+}
+
+void closeAddressTable()
+{
+  atTxn.abort();
+  atEnv.close();
+  atTxnDepth  = 0;
+  atTxnActive = false;
+  atPid       = 0;
+  atCompiledRegs = false;
+  invalidateSystemInfo(false);
+  detachRegNodeCache();
+  clearRegNodeCache();
+}
+
+bool compiledRegsValid()
+{
+  return atCompiledRegs;
+}
+
+lmdb::dbi & getAddressTableDbi()
+{
+  return atDbi;
+}
+
+/*! \brief Renews the shared read transaction if needed
+ */
+static void renewAddressTableTxn()
+{
+  if (!atTxnActive) {
+    if (!openAddressTable())
+      throw std::runtime_error("Unable to open the address table");
+    atTxn.renew();
+    atTxnActive = true;
+  }
+}
+
+/*! \brief Takes a reference on the shared read transaction, and returns its handle
+ */
+static MDB_txn * acquireAddressTableTxn()
+{
+  renewAddressTableTxn();
+  ++atTxnDepth;
+  return atTxn.handle();
+}
+
+/*! \brief Releases a reference on the shared read transaction, which is reset once it is not used anymore
+ */
+static void releaseAddressTableTxn() noexcept
+{
+  if (atTxnDepth > 0 && --atTxnDepth == 0 && atTxnActive) {
+    atTxn.reset();
+    atTxnActive = false;
+  }
+}
+
+LocalTxn::LocalTxn() :
+  lmdb::txn(acquireAddressTableTxn()),
+  m_active(true)
+{
+}
+
+LocalTxn::~LocalTxn() noexcept
+{
+  abort();
+}
+
+void LocalTxn::abort() noexcept
+{
+  if (m_active) {
+    releaseAddressTableTxn();
+    m_active = false;
+  }
+  _handle = nullptr; // The handle is owned by atTxn
+}
+
 struct localArgs getLocalArgs(RPCMsg *response)
 {
-  auto env = lmdb::env::create();
-  env.set_mapsize(LMDB_SIZE);
-  std::string gem_path       = std::getenv("GEM_PATH");
-  std::string lmdb_data_file = gem_path+"/address_table.mdb";
-  env.open(lmdb_data_file.c_str(), 0, 0664);
-  auto rtxn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
-  auto dbi  = lmdb::dbi::open(rtxn, nullptr);
-  struct localArgs la = {.rtxn     = rtxn,
-                         .dbi      = dbi,
+  renewAddressTableTxn(); // Left active until the next LocalTxn is released
+  struct localArgs la = {.rtxn     = atTxn,
+                         .dbi      = atDbi,
                          .response = response};
   return la;
 }
@@ -35,14 +212,82 @@ std::string serialize(xhal::utils::Node n)
   return node.str();
 }
 
+/*! \brief Converts a node parsed from the XML address table into a RegNode
+ */
+static RegNode toRegNode(const xhal::utils::Node & n)
+{
+  RegNode node;
+  node.address = n.real_address;
+  node.mask    = n.mask;
+  node.size    = n.size;
+  node.shift   = maskShift(n.mask);
+  node.mode    = regModeFromString(n.mode.data(), n.mode.size());
+  node.perm    = 0;
+  if (n.permission.find('r') != std::string::npos)
+    node.perm |= REG_PERM_READ;
+  if (n.permission.find('w') != std::string::npos)
+    node.perm |= REG_PERM_WRITE;
+  return node;
+}
+
+/*! \brief Returns the number of microseconds elapsed since \c start and restarts the measurement
+ */
+static uint32_t lapMicroseconds(std::chrono::steady_clock::time_point & start)
+{
+  const auto now = std::chrono::steady_clock::now();
+  const uint32_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now-start).count();
+  start = now;
+  return elapsed;
+}
+
+/*! \brief Records the duration of an update_address_table phase in the response and in the log
+ */
+static void reportPhase(RPCMsg *response, const std::string & phase, uint32_t elapsed)
+{
+  response->set_word(phase+"_time_us", elapsed);
+  LOGGER->log_message(LogManager::INFO, stdsprintf("update_address_table: %s phase took %u us", phase.c_str(), elapsed));
+}
+
 void update_address_table(const RPCMsg *request, RPCMsg *response)
 {
   LOGGER->log_message(LogManager::INFO, "START UPDATE ADDRESS TABLE");
   std::string at_xml = request->get_string("at_xml");
   std::string gem_path = std::getenv("GEM_PATH");
-  std::string lmdb_data_file = gem_path+"/address_table.mdb/data.mdb";
-  std::string lmdb_lock_file = gem_path+"/address_table.mdb/lock.mdb";
-  std::string lmdb_area_file = gem_path+"/address_table.mdb";
+  // The new table is built in a side directory and its data file is then renamed over the live one,
+  // so that concurrent clients always see either the complete old table or the complete new one
+  const std::string lmdb_area_file = gem_path+"/address_table.mdb";
+  const std::string lmdb_data_file = lmdb_area_file+"/data.mdb";
+  const std::string lmdb_lock_file = lmdb_area_file+"/lock.mdb";
+  const std::string lmdb_side_file = gem_path+"/address_table.mdb.new";
+  const std::string side_data_file = lmdb_side_file+"/data.mdb";
+  const std::string side_lock_file = lmdb_side_file+"/lock.mdb";
+  // The legacy text format can still be requested, e.g. for cards running older modules
+  uint32_t format = REG_FORMAT_BINARY;
+  if (request->get_key_exists("format_version")) {
+    format = request->get_word("format_version");
+    if (format > REG_FORMAT_BINARY) {
+      response->set_string("error", stdsprintf("Unsupported address table format version %u", format));
+      LOGGER->log_message(LogManager::ERROR, stdsprintf("Unsupported address table format version %u", format));
+      return;
+    }
+  }
+  // In incremental mode, only the records which differ from the live table are written
+  bool incremental = request->get_key_exists("incremental") && request->get_word("incremental");
+
+  static int updateLock = namedlock_init("utils", "update_address_table");
+  if (updateLock < 0 || namedlock_trylock(updateLock) != 0) {
+    response->set_string("error", "Another address table update is in progress");
+    LOGGER->log_message(LogManager::ERROR, "Another address table update is in progress");
+    return;
+  }
+  struct UnlockOnExit {
+    int lockid;
+    ~UnlockOnExit() { namedlock_unlock(lockid); }
+  } unlockOnExit = {updateLock};
+
+  auto t_phase = std::chrono::steady_clock::now();
+  auto t_start = t_phase;
+
   xhal::utils::XHALXMLParser * m_parser = new xhal::utils::XHALXMLParser(at_xml.c_str());
   try {
     m_parser->setLogLevel(0);
@@ -50,45 +295,156 @@ void update_address_table(const RPCMsg *request, RPCMsg *response)
   } catch (...) {
     response->set_string("error", "XML parser failed");
     LOGGER->log_message(LogManager::INFO, "XML parser failed");
+    delete m_parser;
     return;
   }
   LOGGER->log_message(LogManager::INFO, "XML PARSING DONE");
   std::unordered_map<std::string,xhal::utils::Node> m_parsed_at;
   m_parsed_at = m_parser->getAllNodes();
   m_parsed_at.erase("top");
-  xhal::utils::Node t_node;
+  delete m_parser;
+  reportPhase(response, "parse", lapMicroseconds(t_phase));
 
-  // Remove old DB
-  LOGGER->log_message(LogManager::INFO, "REMOVE OLD DB");
-  std::remove(lmdb_data_file.c_str());
-  std::remove(lmdb_lock_file.c_str());
+  // LMDB keeps its keys sorted, building the records in key order allows to append them without page splits
+  std::vector<std::pair<std::string, std::string> > records;
+  records.reserve(m_parsed_at.size()+1);
+  for (auto const& it : m_parsed_at) {
+    if (format == REG_FORMAT_BINARY) {
+      uint8_t record[REG_RECORD_SIZE];
+      encodeRegRecord(toRegNode(it.second), record);
+      records.emplace_back(it.first, std::string(reinterpret_cast<const char*>(record), sizeof(record)));
+    } else {
+      records.emplace_back(it.first, serialize(it.second));
+    }
+  }
+  if (format != REG_FORMAT_TEXT) {
+    uint8_t version[sizeof(uint32_t)];
+    storeLE32(version, format);
+    records.emplace_back(REG_FORMAT_KEY, std::string(reinterpret_cast<const char*>(version), sizeof(version)));
+  }
+  std::sort(records.begin(), records.end());
+  reportPhase(response, "encode", lapMicroseconds(t_phase));
 
-  auto env = lmdb::env::create();
-  env.set_mapsize(LMDB_SIZE);
-  env.open(lmdb_area_file.c_str(), 0, 0664);
+  // Start from a clean side directory, seeded with a copy of the live table in incremental mode
+  std::remove(side_data_file.c_str());
+  std::remove(side_lock_file.c_str());
+  if (mkdir(lmdb_side_file.c_str(), 0775) != 0 && errno != EEXIST) {
+    response->set_string("error", stdsprintf("Unable to create %s: %s", lmdb_side_file.c_str(), strerror(errno)));
+    LOGGER->log_message(LogManager::ERROR, stdsprintf("Unable to create %s: %s", lmdb_side_file.c_str(), strerror(errno)));
+    return;
+  }
+  if (incremental) {
+    try {
+      auto live = lmdb::env::create();
+      live.set_mapsize(LMDB_SIZE);
+      live.open(lmdb_area_file.c_str(), MDB_RDONLY | MDB_NOLOCK, 0664);
+      auto rtxn = lmdb::txn::begin(live, nullptr, MDB_RDONLY);
+      auto dbi  = lmdb::dbi::open(rtxn, nullptr);
+      const uint32_t live_format = readAddressTableFormat(rtxn, dbi);
+      rtxn.abort();
+      if (live_format != format) {
+        LOGGER->log_message(LogManager::INFO, stdsprintf("Live address table has format version %u, doing a full rebuild", live_format));
+        incremental = false;
+      } else {
+        lmdb::env_copy(live, lmdb_side_file.c_str());
+      }
+    } catch (const lmdb::error & e) {
+      LOGGER->log_message(LogManager::INFO, stdsprintf("Live address table not usable (%s), doing a full rebuild", e.what()));
+      std::remove(side_data_file.c_str());
+      incremental = false;
+    }
+  }
+  reportPhase(response, "prepare", lapMicroseconds(t_phase));
 
-  LOGGER->log_message(LogManager::INFO, "LMDB ENV OPEN");
+  uint32_t n_written = 0;
+  uint32_t n_deleted = 0;
+  try {
+    auto env = lmdb::env::create();
+    env.set_mapsize(LMDB_SIZE);
+    env.open(lmdb_side_file.c_str(), 0, 0664);
 
-  lmdb::val key;
-  lmdb::val value;
-  auto wtxn = lmdb::txn::begin(env);
-  auto dbi  = lmdb::dbi::open(wtxn, nullptr);
+    LOGGER->log_message(LogManager::INFO, "LMDB ENV OPEN");
+
+    lmdb::val key;
+    lmdb::val value;
+    auto wtxn = lmdb::txn::begin(env);
+    auto dbi  = lmdb::dbi::open(wtxn, nullptr);
+
+    if (incremental) {
+      LOGGER->log_message(LogManager::INFO, stdsprintf("START DIFFING %zu RECORDS", records.size()));
+      std::vector<std::string> stale;
+      {
+        auto cursor = lmdb::cursor::open(wtxn, dbi);
+        std::string t_key, t_value;
+        while (cursor.get(t_key, t_value, MDB_NEXT)) {
+          auto it = std::lower_bound(records.begin(), records.end(), std::make_pair(t_key, std::string()));
+          if (it == records.end() || it->first != t_key)
+            stale.push_back(t_key);
+        }
+      }
+      for (auto const& t_key : stale) {
+        key.assign(t_key);
+        dbi.del(wtxn, key);
+        ++n_deleted;
+      }
+      for (auto const& record : records) {
+        key.assign(record.first);
+        if (dbi.get(wtxn, key, value) && value.size() == record.second.size()
+            && std::memcmp(value.data(), record.second.data(), value.size()) == 0)
+          continue;
+        value.assign(record.second);
+        dbi.put(wtxn, key, value);
+        ++n_written;
+      }
+    } else {
+      LOGGER->log_message(LogManager::INFO, stdsprintf("START WRITING %zu RECORDS, FORMAT VERSION %u", records.size(), format));
+      for (auto const& record : records) {
+        key.assign(record.first);
+        value.assign(record.second);
+        dbi.put(wtxn, key, value, MDB_APPEND);
+        ++n_written;
+      }
+    }
+    reportPhase(response, "write", lapMicroseconds(t_phase));
 
-  LOGGER->log_message(LogManager::INFO, "START ITERATING OVER MAP");
+    wtxn.commit();
+    LOGGER->log_message(LogManager::INFO, "COMMIT DB");
+    reportPhase(response, "commit", lapMicroseconds(t_phase));
+  } catch (const lmdb::error & e) {
+    response->set_string("error", stdsprintf("Unable to build the address table: %s", e.what()));
+    LOGGER->log_message(LogManager::ERROR, stdsprintf("Unable to build the address table: %s", e.what()));
+    return;
+  }
 
-  std::string t_key;
-  std::string t_value;
-  for (auto it:m_parsed_at) {
-    t_key = it.first;
-    t_node = it.second;
-    t_value = serialize(t_node);
-    key.assign(t_key);
-    value.assign(t_value);
-    dbi.put(wtxn, key, value);
+  // rename(2) atomically replaces the live data file, readers notice the new inode and reopen the table
+  if (mkdir(lmdb_area_file.c_str(), 0775) != 0 && errno != EEXIST) {
+    response->set_string("error", stdsprintf("Unable to create %s: %s", lmdb_area_file.c_str(), strerror(errno)));
+    LOGGER->log_message(LogManager::ERROR, stdsprintf("Unable to create %s: %s", lmdb_area_file.c_str(), strerror(errno)));
+    return;
+  }
+  if (rename(side_data_file.c_str(), lmdb_data_file.c_str()) != 0) {
+    response->set_string("error", stdsprintf("Unable to swap in the new address table: %s", strerror(errno)));
+    LOGGER->log_message(LogManager::ERROR, stdsprintf("Unable to swap in the new address table: %s", strerror(errno)));
+    return;
   }
-  wtxn.commit();
-  LOGGER->log_message(LogManager::INFO, "COMMIT DB");
-  wtxn.abort();
+  // The lock file of the old table must not be reused with the new data file
+  std::remove(lmdb_lock_file.c_str());
+  std::remove(side_lock_file.c_str());
+  rmdir(lmdb_side_file.c_str());
+  closeAddressTable();
+  bumpAddressTableGeneration();
+  reportPhase(response, "swap", lapMicroseconds(t_phase));
+
+  // Build the shared node cache of the new table now rather than in the next client
+  openAddressTable();
+  reportPhase(response, "cache", lapMicroseconds(t_phase));
+
+  response->set_word("n_nodes",   m_parsed_at.size());
+  response->set_word("n_written", n_written);
+  response->set_word("n_deleted", n_deleted);
+  response->set_word("total_time_us", lapMicroseconds(t_start));
+  LOGGER->log_message(LogManager::INFO, stdsprintf("ADDRESS TABLE UPDATED (%s): %zu nodes, %u written, %u deleted",
+                                                   incremental ? "incremental" : "full", m_parsed_at.size(), n_written, n_deleted));
 }
 
 void readRegFromDB(const RPCMsg *request, RPCMsg *response)
@@ -98,29 +454,19 @@ void readRegFromDB(const RPCMsg *request, RPCMsg *response)
   GETLOCALARGS(response);
 
   LOGGER->log_message(LogManager::INFO, "LMDB ENV OPEN");
-  lmdb::val key;
-  lmdb::val value;
 
-  key.assign(regName.c_str());
-  bool found = dbi.get(rtxn,key,value);
-  if (found) {
+  const RegNode * node = getRegNode(&la, regName);
+  if (node) {
     LOGGER->log_message(LogManager::INFO, stdsprintf("Key: %s is found", regName.c_str()));
-    std::string t_value = std::string(value.data());
-    t_value = t_value.substr(0,value.size());
-    std::vector<std::string> tmp = split(t_value,'|');
-    uint32_t raddr = stoull(tmp[0], nullptr, 16);
-    uint32_t rmask = stoull(tmp[2], nullptr, 16);
-    uint32_t rsize = stoull(tmp[4], nullptr, 16);
-    std::string rperm = tmp[1];
-    std::string rmode = tmp[3];
     LOGGER->log_message(LogManager::DEBUG, stdsprintf("node %s properties: 0x%x  0x%x  0x%x  %s  %s",
-                                                      regName.c_str(), raddr, rmask, rsize, rmode.c_str(), rperm.c_str()));
+                                                      regName.c_str(), node->address, node->mask, node->size,
+                                                      regModeName(node->mode), regPermName(node->perm)));
 
-    response->set_string("permissions", rperm);
-    response->set_string("mode",        rmode);
-    response->set_word("address",       raddr);
-    response->set_word("mask",          rmask);
-    response->set_word("size",          rsize);
+    response->set_string("permissions", regPermName(node->perm));
+    response->set_string("mode",        regModeName(node->mode));
+    response->set_word("address",       node->address);
+    response->set_word("mask",          node->mask);
+    response->set_word("size",          node->size);
   } else {
     LOGGER->log_message(LogManager::ERROR, stdsprintf("Key: %s is NOT found", regName.c_str()));
     response->set_string("error", "Register not found");
@@ -148,32 +494,85 @@ uint32_t getNumNonzeroBits(uint32_t value)
   return numNonzeroBits;
 }
 
-bool regExists(localArgs * la, const std::string & regName, lmdb::val * db_res)
+static std::unordered_map<std::string, RegNode> regNodeCache; ///< Per-process cache of the decoded address table nodes
+/*! \brief Strides and regularity of a RegArray family, shared by all the handles on it
+ */
+struct RegArrayLayout {
+  RegNode base;
+  std::vector<uint32_t> strides;
+  bool regular;
+};
+static std::unordered_map<std::string, RegArrayLayout> regArrayLayouts; ///< Per-process cache of the RegArray layouts, by pattern and sizes
+static uint64_t lmdbLookups = 0; ///< Lookups not served by regNodeCache, for the RPC statistics
+static uint64_t lmdbNs      = 0; ///< Time spent in these lookups
+
+const RegNode * getRegNode(localArgs * la, const std::string & regName)
 {
+  if (regNodeCacheAttached())
+    return findSharedRegNode(regName);
+
+  auto it = regNodeCache.find(regName);
+  if (it != regNodeCache.end())
+    return &it->second;
+
+  const auto start = std::chrono::steady_clock::now();
   lmdb::val key;
+  lmdb::val db_res;
   key.assign(regName.c_str());
+  const bool found = la->dbi.get(la->rtxn, key, db_res);
+  ++lmdbLookups;
+  lmdbNs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  if (!found)
+    return nullptr;
+
+  RegNode node;
+  if (!decodeRegNode(atFormat, db_res.data(), db_res.size(), node)) {
+    LOGGER->log_message(LogManager::ERROR, stdsprintf("Malformed address table record for %s (format version %u)",
+                                                      regName.c_str(), atFormat));
+    return nullptr;
+  }
+  return &regNodeCache.emplace(regName, node).first->second;
+}
+
+const RegNode * getRegNode(localArgs * la, const CompiledReg & reg)
+{
+  if (compiledRegsValid())
+    return reg.inTable ? &reg.node : nullptr;
+  return getRegNode(la, std::string(reg.name));
+}
+
+void clearRegNodeCache()
+{
+  regNodeCache.clear();
+  regArrayLayouts.clear();
+}
+
+bool regExists(localArgs * la, const std::string & regName, lmdb::val * db_res)
+{
   if (db_res != nullptr) {
+    lmdb::val key;
+    key.assign(regName.c_str());
     return la->dbi.get(la->rtxn,key, *db_res);
   } else {
-    lmdb::val db_res_loc;
-    return la->dbi.get(la->rtxn,key,db_res_loc);
+    return getRegNode(la, regName) != nullptr;
   }
 }
 
+bool regExists(localArgs * la, const CompiledReg & reg)
+{
+  return getRegNode(la, reg) != nullptr;
+}
+
 uint32_t getMask(localArgs * la, const std::string & regName)
 {
-  lmdb::val db_res;
-  uint32_t rmask = 0x0;
-  if (regExists(la, regName, &db_res)) {
-    std::string t_db_res = std::string(db_res.data());
-    t_db_res = t_db_res.substr(0,db_res.size());
-    std::vector<std::string> tmp = split(t_db_res,'|');
-    rmask = stoull(tmp[2], nullptr, 16);
+  const RegNode * node = getRegNode(la, regName);
+  if (node) {
+    return node->mask;
   } else {
     LOGGER->log_message(LogManager::ERROR, stdsprintf("Key: %s is NOT found", regName.c_str()));
     la->response->set_string("error", "Register not found");
+    return 0x0;
   }
-  return rmask;
 }
 
 void writeRawAddress(uint32_t address, uint32_t value, RPCMsg *response)
@@ -198,42 +597,21 @@ uint32_t readRawAddress(uint32_t address, RPCMsg* response)
 
 uint32_t getAddress(localArgs * la, const std::string & regName)
 {
-  uint32_t raddr;
-  lmdb::val db_res;
-  if (regExists(la, regName, &db_res)) {
-    std::string t_db_res = std::string(db_res.data());
-    t_db_res = t_db_res.substr(0,db_res.size());
-    std::vector<std::string> tmp = split(t_db_res,'|');
-    raddr = stoull(tmp[0], nullptr, 16);
+  const RegNode * node = getRegNode(la, regName);
+  if (node) {
+    return node->address;
   } else {
     LOGGER->log_message(LogManager::ERROR, stdsprintf("Key: %s is NOT found", regName.c_str()));
     la->response->set_string("error", "Register not found");
     return 0xdeaddead;
   }
-  return raddr;
 }
 
-void writeAddress(lmdb::val & db_res, uint32_t value, RPCMsg *response)
+/*! \brief Reads a single word, retrying up to 10 times on memsvc errors
+ */
+static uint32_t readAddressRetry(uint32_t raddr, RPCMsg *response)
 {
-  std::string t_db_res = std::string(db_res.data());
-  t_db_res = t_db_res.substr(0,db_res.size());
-  std::vector<std::string> tmp = split(t_db_res,'|');
   uint32_t data[1];
-  uint32_t raddr = stoull(tmp[0], nullptr, 16);
-  data[0] = value;
-  if (memhub_write(memsvc, raddr, 1, data) != 0) {
-    response->set_string("error", std::string("memsvc error: ")+memsvc_get_last_error(memsvc));
-    LOGGER->log_message(LogManager::INFO, stdsprintf("write memsvc error: %s", memsvc_get_last_error(memsvc)));
-  }
-}
-
-uint32_t readAddress(lmdb::val & db_res, RPCMsg *response)
-{
-  std::string t_db_res = std::string(db_res.data());
-  t_db_res = t_db_res.substr(0,db_res.size());
-  std::vector<std::string> tmp = split(t_db_res,'|');
-  uint32_t data[1];
-  uint32_t raddr = stoull(tmp[0], nullptr, 16);
   int n_current_tries = 0;
   while (true) {
     if (memhub_read(memsvc, raddr, 1, data) != 0) {
@@ -252,11 +630,33 @@ uint32_t readAddress(lmdb::val & db_res, RPCMsg *response)
   return data[0];
 }
 
+void writeAddress(lmdb::val & db_res, uint32_t value, RPCMsg *response)
+{
+  RegNode node;
+  if (!decodeRegNode(atFormat, db_res.data(), db_res.size(), node)) {
+    response->set_string("error", "Malformed address table record");
+    LOGGER->log_message(LogManager::ERROR, "writeAddress: malformed address table record");
+    return;
+  }
+  writeRawAddress(node.address, value, response);
+}
+
+uint32_t readAddress(lmdb::val & db_res, RPCMsg *response)
+{
+  RegNode node;
+  if (!decodeRegNode(atFormat, db_res.data(), db_res.size(), node)) {
+    response->set_string("error", "Malformed address table record");
+    LOGGER->log_message(LogManager::ERROR, "readAddress: malformed address table record");
+    return 0xdeaddead;
+  }
+  return readAddressRetry(node.address, response);
+}
+
 void writeRawReg(localArgs * la, const std::string & regName, uint32_t value)
 {
-  lmdb::val db_res;
-  if (regExists(la, regName, &db_res)) {
-    writeAddress(db_res, value, la->response);
+  const RegNode * node = getRegNode(la, regName);
+  if (node) {
+    writeRawAddress(node->address, value, la->response);
   } else {
     LOGGER->log_message(LogManager::ERROR, stdsprintf("Key: %s is NOT found", regName.c_str()));
     la->response->set_string("error", "Register not found");
@@ -265,9 +665,9 @@ void writeRawReg(localArgs * la, const std::string & regName, uint32_t value)
 
 uint32_t readRawReg(localArgs * la, const std::string & regName)
 {
-  lmdb::val db_res;
-  if (regExists(la, regName, &db_res)) {
-    return readAddress(db_res, la->response);
+  const RegNode * node = getRegNode(la, regName);
+  if (node) {
+    return readAddressRetry(node->address, la->response);
   } else {
     LOGGER->log_message(LogManager::ERROR, stdsprintf("Key: %s is NOT found", regName.c_str()));
     la->response->set_string("error", "Register not found");
@@ -277,44 +677,14 @@ uint32_t readRawReg(localArgs * la, const std::string & regName)
 
 uint32_t applyMask(uint32_t data, uint32_t mask)
 {
-  uint32_t result = data & mask;
-  for (int i = 0; i < 32; i++) {
-    if (mask & 1) {
-      break;
-    } else {
-      mask = mask >> 1;
-      result = result >> 1;
-    }
-  }
-  return result;
+  return (data & mask) >> maskShift(mask);
 }
 
 uint32_t readReg(localArgs * la, const std::string & regName)
 {
-  lmdb::val db_res;
-  if (regExists(la, regName, &db_res)) {
-    std::string t_db_res = std::string(db_res.data());
-    t_db_res = t_db_res.substr(0,db_res.size());
-    std::vector<std::string> tmp = split(t_db_res,'|');
-    std::size_t found = tmp[1].find_first_of("r");
-    if (found==std::string::npos) {
-      // response->set_string("error", std::string("No read permissions"));
-      LOGGER->log_message(LogManager::ERROR, stdsprintf("No read permissions for %s: %s", regName.c_str(), tmp[1].c_str()));
-      return 0xdeaddead;
-    }
-    uint32_t data[1];
-    uint32_t raddr = stoull(tmp[0], nullptr, 16);
-    uint32_t rmask = stoull(tmp[2], nullptr, 16);
-    if (memhub_read(memsvc, raddr, 1, data) != 0) {
-      // response->set_string("error", std::string("memsvc error: ")+memsvc_get_last_error(memsvc));
-      LOGGER->log_message(LogManager::ERROR, stdsprintf("read memsvc error: %s", memsvc_get_last_error(memsvc)));
-      return 0xdeaddead;
-    }
-    if (rmask!=0xFFFFFFFF) {
-      return applyMask(data[0],rmask);
-    } else {
-      return data[0];
-    }
+  const RegNode * node = getRegNode(la, regName);
+  if (node) {
+    return readReg(la, *node, regName);
   } else {
     // response->set_string("error", "Register not found");
     LOGGER->log_message(LogManager::ERROR, stdsprintf("Key: %s is NOT found", regName.c_str()));
@@ -322,29 +692,116 @@ uint32_t readReg(localArgs * la, const std::string & regName)
   }
 }
 
+uint32_t readReg(localArgs * /* la */, const RegNode & node, const std::string & regName)
+{
+  if (!node.readable()) {
+    // response->set_string("error", std::string("No read permissions"));
+    LOGGER->log_message(LogManager::ERROR, stdsprintf("No read permissions for %s: %s", regName.c_str(), regPermName(node.perm)));
+    return 0xdeaddead;
+  }
+  uint32_t data[1];
+  if (memhub_read(memsvc, node.address, 1, data) != 0) {
+    // response->set_string("error", std::string("memsvc error: ")+memsvc_get_last_error(memsvc));
+    LOGGER->log_message(LogManager::ERROR, stdsprintf("read memsvc error: %s", memsvc_get_last_error(memsvc)));
+    return 0xdeaddead;
+  }
+  if (node.masked()) {
+    return (data[0] & node.mask) >> node.shift;
+  } else {
+    return data[0];
+  }
+}
+
+uint32_t readReg(localArgs * la, const CompiledReg & reg)
+{
+  const RegNode * node = getRegNode(la, reg);
+  if (node) {
+    return readReg(la, *node, reg.name);
+  } else {
+    LOGGER->log_message(LogManager::ERROR, stdsprintf("Key: %s is NOT found", reg.name));
+    return 0xdeaddead;
+  }
+}
+
+uint32_t readRegs(const std::vector<const RegNode *> & nodes, std::vector<uint32_t> & values)
+{
+  values.assign(nodes.size(), 0xdeaddead);
+
+  std::vector<uint32_t> addresses;
+  addresses.reserve(nodes.size());
+  for (auto const& node : nodes)
+    if (node && node->readable())
+      addresses.push_back(node->address);
+  std::sort(addresses.begin(), addresses.end());
+  addresses.erase(std::unique(addresses.begin(), addresses.end()), addresses.end());
+
+  // words[i] holds the content of addresses[i], since the runs cover the sorted addresses in order
+  std::vector<uint32_t> words(addresses.size(), 0xdeaddead);
+  std::vector<bool>     valid(addresses.size(), true);
+  uint32_t nTransactions = 0;
+  size_t   idx = 0;
+  MemhubSession session;
+  for (auto const& run : coalesceAddresses(addresses, BATCH_MAX_WORDS)) {
+    ++nTransactions;
+    if (memhub_read(memsvc, run.address, run.words, &words[idx]) != 0) {
+      LOGGER->log_message(LogManager::WARNING, stdsprintf("Block read of %u words at 0x%08x failed, reading them one by one: %s",
+                                                          run.words, run.address, memsvc_get_last_error(memsvc)));
+      for (uint32_t i = 0; i < run.words; ++i) {
+        ++nTransactions;
+        if (memhub_read(memsvc, run.address+i*REG_WORD_BYTES, 1, &words[idx+i]) != 0) {
+          LOGGER->log_message(LogManager::ERROR, stdsprintf("read memsvc error: %s", memsvc_get_last_error(memsvc)));
+          valid[idx+i] = false;
+        }
+      }
+    }
+    idx += run.words;
+  }
+
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    const RegNode * node = nodes[i];
+    if (!node || !node->readable())
+      continue;
+    const size_t pos = std::lower_bound(addresses.begin(), addresses.end(), node->address) - addresses.begin();
+    if (valid[pos])
+      values[i] = node->masked() ? (words[pos] & node->mask) >> node->shift : words[pos];
+  }
+  return nTransactions;
+}
+
+uint32_t readRegs(localArgs * la, const std::vector<std::string> & regNames, std::vector<uint32_t> & values)
+{
+  std::vector<const RegNode *> nodes;
+  nodes.reserve(regNames.size());
+  for (auto const& regName : regNames) {
+    const RegNode * node = getRegNode(la, regName);
+    if (!node) {
+      LOGGER->log_message(LogManager::ERROR, stdsprintf("Key: %s is NOT found", regName.c_str()));
+    } else if (!node->readable()) {
+      LOGGER->log_message(LogManager::ERROR, stdsprintf("No read permissions for %s: %s", regName.c_str(), regPermName(node->perm)));
+    }
+    nodes.push_back(node);
+  }
+  return readRegs(nodes, values);
+}
+
 uint32_t readBlock(localArgs* la, const std::string& regName, uint32_t* result, const uint32_t& size, const uint32_t& offset)
 {
-  lmdb::val db_res;
-  if (regExists(la, regName, &db_res)) {
-    std::string t_db_res = std::string(db_res.data());
-    t_db_res = t_db_res.substr(0,db_res.size());
-    std::vector<std::string> tmp = split(t_db_res,'|');
-    uint32_t raddr = stoull(tmp[0], nullptr, 16);
-    uint32_t rmask = stoull(tmp[2], nullptr, 16);
-    uint32_t rsize = stoull(tmp[4], nullptr, 16);
-    std::string rperm = tmp[1];
-    std::string rmode = tmp[3];
+  const RegNode * node = getRegNode(la, regName);
+  if (node) {
+    const uint32_t raddr = node->address;
+    const uint32_t rsize = node->size;
     LOGGER->log_message(LogManager::DEBUG, stdsprintf("node %s properties: 0x%x  0x%x  0x%x  %s  %s",
-                                                      regName.c_str(), raddr, rmask, rsize, rmode.c_str(), rperm.c_str()));
+                                                      regName.c_str(), raddr, node->mask, rsize,
+                                                      regModeName(node->mode), regPermName(node->perm)));
 
-    if (rmask != 0xFFFFFFFF) {
+    if (node->masked()) {
       // deny block read on masked register, but what if mask is None?
       std::stringstream errmsg;
       errmsg << "Block read attempted on masked register";
       la->response->set_string("error", errmsg.str());
       LOGGER->log_message(LogManager::ERROR, stdsprintf("block read error: %s", errmsg.str().c_str()));
       // throw std::range_error(errmsg.str());
-    } else if (rmode.rfind("single") != std::string::npos && size > 1) {
+    } else if (node->mode == REG_MODE_SINGLE && size > 1) {
       // only allow block read of size 1 on single registers?
       std::stringstream errmsg;
       errmsg << "Block read attempted on single register with size greater than 1";
@@ -394,12 +851,12 @@ slowCtrlErrCntVFAT repeatedRegReadLocal(localArgs * la, const std::string & regN
 
     //Issue a link reset to reset counters under GEM_AMC.SLOW_CONTROL.VFAT3
     writeReg(la,"GEM_AMC.GEM_SYSTEM.CTRL.LINK_RESET", 0x1);
-    std::this_thread::sleep_for(std::chrono::microseconds(90));
+    sleepFor(std::chrono::microseconds(90));
 
     for (uint32_t i=0; i<nReads; i++){
         //Any time a bus error occurs for VFAT slow control the TIMEOUT_ERROR_CNT will increment
         bool goodRead = (readReg(la, regName) != 0xdeaddead);
-        std::this_thread::sleep_for(std::chrono::microseconds(20));
+        sleepFor(std::chrono::microseconds(20));
 
         if(!goodRead && breakOnFailure){
             break;
@@ -418,69 +875,315 @@ slowCtrlErrCntVFAT repeatedRegReadLocal(localArgs * la, const std::string & regN
     return vfatErrs;
 } //End repeatedRegReadLocal
 
+static unsigned       regShadowDepth = 0;
+static RegShadowStats regShadowStats = {0, 0};
+
+RegShadowStats getRegShadowStats()
+{
+  return regShadowStats;
+}
+
+RegShadowScope::RegShadowScope(LocalArgs * la) :
+  m_la(la),
+  m_start(regShadowStats)
+{
+  ++regShadowDepth;
+}
+
+RegShadowScope::~RegShadowScope()
+{
+  if (--regShadowDepth > 0)
+    return;
+  const uint32_t hits   = regShadowStats.hits - m_start.hits;
+  const uint32_t misses = regShadowStats.misses - m_start.misses;
+  LOGGER->log_message(LogManager::INFO, stdsprintf("Register shadow: %u writes skipped, %u writes issued", hits, misses));
+  m_la->response->set_word("shadow_hits",   hits   + (m_la->response->get_key_exists("shadow_hits")   ? m_la->response->get_word("shadow_hits")   : 0));
+  m_la->response->set_word("shadow_misses", misses + (m_la->response->get_key_exists("shadow_misses") ? m_la->response->get_word("shadow_misses") : 0));
+}
+
+/*! \brief Masked writeReg under a RegShadowScope: the word is only written if the value read back differs from the requested one
+ */
+static void writeShadowedReg(localArgs * la, const std::string & regName, const RegNode & node, uint32_t value)
+{
+  MemhubSession session(MEMHUB_SESSION_ATOMIC);
+  const uint32_t current_value = readAddressRetry(node.address, la->response);
+  if (current_value == 0xdeaddead) {
+    std::stringstream errmsg;
+    errmsg << "Writing masked register failed due to problem reading: " << regName;
+    la->response->set_string("error", errmsg.str());
+    LOGGER->log_message(LogManager::ERROR, errmsg.str().c_str());
+    return;
+  }
+
+  const uint32_t val_to_write = ((value << node.shift) & node.mask) | (current_value & ~node.mask);
+  if (val_to_write == current_value) {
+    ++regShadowStats.hits;
+    return;
+  }
+  ++regShadowStats.misses;
+  writeRawAddress(node.address, val_to_write, la->response);
+}
+
 void writeReg(localArgs * la, const std::string & regName, uint32_t value)
 {
-  lmdb::val db_res;
-  if (regExists(la, regName, &db_res)) {
-    std::string t_db_res = std::string(db_res.data());
-    t_db_res = t_db_res.substr(0,db_res.size());
-    std::vector<std::string> tmp = split(t_db_res,'|');
-    uint32_t rmask = stoull(tmp[2], nullptr, 16);
-    if (rmask==0xFFFFFFFF) {
-      writeAddress(db_res, value, la->response);
-    } else {
-      uint32_t current_value = readAddress(db_res, la->response);
+  const RegNode * node = getRegNode(la, regName);
+  if (node) {
+    writeReg(la, *node, value, regName);
+  } else {
+    std::stringstream errmsg;
+    errmsg << "Register " << regName << " key not found";
+    la->response->set_string("error", errmsg.str());
+    LOGGER->log_message(LogManager::ERROR, errmsg.str().c_str());
+  }
+}
+
+void writeReg(localArgs * la, const RegNode & node, uint32_t value, const std::string & regName)
+{
+  if (regShadowDepth > 0 && node.masked() && node.readable()) {
+    writeShadowedReg(la, regName, node, value);
+  } else if (!node.masked()) {
+    writeRawAddress(node.address, value, la->response);
+  } else {
+    // Keep the read-modify-write under a single hold of the memhub semaphore, even within a longer session
+    MemhubSession session(MEMHUB_SESSION_ATOMIC);
+    uint32_t current_value = readAddressRetry(node.address, la->response);
+    if (current_value == 0xdeaddead) {
+      std::stringstream errmsg;
+      errmsg << "Writing masked register failed due to problem reading: " << regName;
+      la->response->set_string("error", errmsg.str());
+      LOGGER->log_message(LogManager::ERROR, errmsg.str().c_str());
+      return;
+    }
+    uint32_t val_to_write = value << node.shift;
+    val_to_write = (val_to_write & node.mask) | (current_value & ~node.mask);
+    writeRawAddress(node.address, val_to_write, la->response);
+  }
+}
+
+void writeReg(localArgs * la, const CompiledReg & reg, uint32_t value)
+{
+  const RegNode * node = getRegNode(la, reg);
+  if (node) {
+    writeReg(la, *node, value, reg.name);
+  } else {
+    std::stringstream errmsg;
+    errmsg << "Register " << reg.name << " key not found";
+    la->response->set_string("error", errmsg.str());
+    LOGGER->log_message(LogManager::ERROR, errmsg.str().c_str());
+  }
+}
+
+bool RegWriteBatch::write(const std::string & regName, uint32_t value)
+{
+  const RegNode * node = getRegNode(m_la, regName);
+  if (!node) {
+    std::stringstream errmsg;
+    errmsg << "Register " << regName << " key not found";
+    m_la->response->set_string("error", errmsg.str());
+    LOGGER->log_message(LogManager::ERROR, errmsg.str().c_str());
+    return false;
+  }
+  write(*node, value);
+  return true;
+}
+
+void RegWriteBatch::write(const RegNode & node, uint32_t value)
+{
+  PendingWord & word = m_pending.emplace(node.address, PendingWord{0, 0}).first->second;
+  word.value = (word.value & ~node.mask) | ((value << node.shift) & node.mask);
+  word.mask |= node.mask;
+}
+
+bool RegWriteBatch::write(const CompiledReg & reg, uint32_t value)
+{
+  const RegNode * node = getRegNode(m_la, reg);
+  if (!node) {
+    std::stringstream errmsg;
+    errmsg << "Register " << reg.name << " key not found";
+    m_la->response->set_string("error", errmsg.str());
+    LOGGER->log_message(LogManager::ERROR, errmsg.str().c_str());
+    return false;
+  }
+  write(*node, value);
+  return true;
+}
+
+uint32_t RegWriteBatch::flush()
+{
+  if (m_pending.empty())
+    return m_nTransactions;
+
+  MemhubSession session;
+  for (auto const& pending : m_pending) {
+    const uint32_t address = pending.first;
+    uint32_t value = pending.second.value;
+    MemhubSession rmw(MEMHUB_SESSION_ATOMIC);
+    if (pending.second.mask != 0xFFFFFFFF) {
+      ++m_nTransactions;
+      const uint32_t current_value = readAddressRetry(address, m_la->response);
       if (current_value == 0xdeaddead) {
-        std::stringstream errmsg;
-        errmsg << "Writing masked register failed due to problem reading: " << regName;
-        la->response->set_string("error", errmsg.str());
-        LOGGER->log_message(LogManager::ERROR, errmsg.str().c_str());
-        return;
+        std::string errmsg = stdsprintf("Writing masked register failed due to problem reading address 0x%08x", address);
+        m_la->response->set_string("error", errmsg);
+        LOGGER->log_message(LogManager::ERROR, errmsg);
+        continue;
       }
-      int shift_amount = 0;
-      uint32_t mask_copy = rmask;
-      for (int i = 0; i < 32; i++) {
-        if (rmask & 1) {
-          break;
-        } else {
-          shift_amount +=1;
-          rmask = rmask >> 1;
-        }
+      value |= current_value & ~pending.second.mask;
+    }
+    ++m_nTransactions;
+    writeRawAddress(address, value, m_la->response);
+  }
+  m_pending.clear();
+  return m_nTransactions;
+}
+
+RegArray::RegArray(LocalArgs * la, const std::string & pattern, const std::vector<uint32_t> & sizes) :
+  m_la(la),
+  m_pattern(pattern),
+  m_sizes(sizes),
+  m_strides(sizes.size(), 0),
+  m_valid(false),
+  m_regular(false)
+{
+  size_t start = 0;
+  for (size_t pos = pattern.find("{}"); pos != std::string::npos; pos = pattern.find("{}", start)) {
+    m_parts.push_back(pattern.substr(start, pos-start));
+    start = pos+2;
+  }
+  m_parts.push_back(pattern.substr(start));
+  if (m_parts.size() != m_sizes.size()+1) {
+    LOGGER->log_message(LogManager::ERROR, stdsprintf("RegArray %s: %zu placeholders but %zu sizes",
+                                                      pattern.c_str(), m_parts.size()-1, m_sizes.size()));
+    return;
+  }
+
+  std::string key = pattern;
+  for (auto const& size : m_sizes)
+    key += "|" + std::to_string(size);
+  auto cached = regArrayLayouts.find(key);
+  if (cached != regArrayLayouts.end()) {
+    m_base    = cached->second.base;
+    m_strides = cached->second.strides;
+    m_regular = cached->second.regular;
+    m_valid   = true;
+    return;
+  }
+
+  std::vector<uint32_t> indices(m_sizes.size(), 0);
+  const RegNode * base = getRegNode(la, format(indices.data(), indices.size()));
+  if (!base) {
+    LOGGER->log_message(LogManager::ERROR, stdsprintf("RegArray %s: %s not found", pattern.c_str(), format(indices.data(), indices.size()).c_str()));
+    return;
+  }
+  m_base  = *base;
+  m_valid = true;
+
+  auto sameKind = [this](const RegNode * node) {
+    return node && node->mask == m_base.mask && node->mode == m_base.mode && node->perm == m_base.perm && node->size == m_base.size;
+  };
+  bool regular = true;
+  for (size_t dim = 0; dim < m_sizes.size() && regular; ++dim) {
+    if (m_sizes[dim] < 2)
+      continue;
+    indices[dim] = 1;
+    const RegNode * next = getRegNode(la, format(indices.data(), indices.size()));
+    regular = sameKind(next);
+    if (regular)
+      m_strides[dim] = next->address - m_base.address;
+    indices[dim] = 0;
+  }
+  m_regular = regular; // allows resolve to compute the expected nodes below
+
+  // Every element is checked once per process, the layout is then reused by all the handles on the family
+  bool empty = false;
+  for (auto const& size : m_sizes)
+    empty |= (size == 0);
+  for (bool more = !empty; more && m_regular; ) {
+    RegNode expected;
+    const RegNode * node = getRegNode(la, format(indices.data(), indices.size()));
+    m_regular = resolve(indices.data(), indices.size(), expected) && sameKind(node) && node->address == expected.address;
+    more = false;
+    for (size_t dim = m_sizes.size(); dim-- > 0; ) {
+      if (++indices[dim] < m_sizes[dim]) {
+        more = true;
+        break;
       }
-      uint32_t val_to_write = value << shift_amount;
-      val_to_write = (val_to_write & mask_copy) | (current_value & ~mask_copy);
-      writeAddress(db_res, val_to_write, la->response);
+      indices[dim] = 0;
     }
-  } else {
+  }
+  if (!m_regular)
+    LOGGER->log_message(LogManager::INFO, stdsprintf("RegArray %s is not regular, its registers are looked up by name", pattern.c_str()));
+  regArrayLayouts[key] = RegArrayLayout{m_base, m_strides, m_regular};
+}
+
+std::string RegArray::format(const uint32_t * indices, size_t nIndices) const
+{
+  std::string name = m_parts[0];
+  for (size_t i = 0; i < nIndices && i+1 < m_parts.size(); ++i)
+    name += std::to_string(indices[i]) + m_parts[i+1];
+  return name;
+}
+
+bool RegArray::resolve(const uint32_t * indices, size_t nIndices, RegNode & node) const
+{
+  if (!m_valid || nIndices != m_sizes.size())
+    return false;
+  for (size_t i = 0; i < nIndices; ++i)
+    if (indices[i] >= m_sizes[i])
+      return false;
+
+  if (!m_regular) {
+    const RegNode * found = getRegNode(m_la, format(indices, nIndices));
+    if (!found)
+      return false;
+    node = *found;
+    return true;
+  }
+  node = m_base;
+  for (size_t i = 0; i < nIndices; ++i)
+    node.address += indices[i]*m_strides[i];
+  return true;
+}
+
+uint32_t RegArray::readAt(const uint32_t * indices, size_t nIndices) const
+{
+  RegNode node;
+  if (!resolve(indices, nIndices, node)) {
+    LOGGER->log_message(LogManager::ERROR, stdsprintf("Key: %s is NOT found", format(indices, nIndices).c_str()));
+    return 0xdeaddead;
+  }
+  return readReg(m_la, node, m_pattern);
+}
+
+void RegArray::writeAt(const uint32_t * indices, size_t nIndices, uint32_t value) const
+{
+  RegNode node;
+  if (!resolve(indices, nIndices, node)) {
     std::stringstream errmsg;
-    errmsg << "Register " << regName << " key not found";
-    la->response->set_string("error", errmsg.str());
+    errmsg << "Register " << format(indices, nIndices) << " key not found";
+    m_la->response->set_string("error", errmsg.str());
     LOGGER->log_message(LogManager::ERROR, errmsg.str().c_str());
+    return;
   }
+  writeReg(m_la, node, value, m_pattern);
 }
 
 void writeBlock(localArgs* la, const std::string& regName, const uint32_t* values, const uint32_t& size, const uint32_t& offset)
 {
-  lmdb::val db_res;
-  if (regExists(la, regName, &db_res)) {
-    std::string t_db_res = std::string(db_res.data());
-    t_db_res = t_db_res.substr(0,db_res.size());
-    std::vector<std::string> tmp = split(t_db_res,'|');
-    uint32_t raddr = stoull(tmp[0], nullptr, 16);
-    uint32_t rmask = stoull(tmp[2], nullptr, 16);
-    uint32_t rsize = stoull(tmp[4], nullptr, 16);
-    std::string rmode = tmp[3];
-    std::string rperm = tmp[1];
+  const RegNode * node = getRegNode(la, regName);
+  if (node) {
+    const uint32_t raddr = node->address;
+    const uint32_t rsize = node->size;
     LOGGER->log_message(LogManager::DEBUG, stdsprintf("node %s properties: 0x%x  0x%x  0x%x  %s  %s",
-                                                      regName.c_str(), raddr, rmask, rsize, rmode.c_str(), rperm.c_str()));
+                                                      regName.c_str(), raddr, node->mask, rsize,
+                                                      regModeName(node->mode), regPermName(node->perm)));
 
-    if (rmask != 0xFFFFFFFF) {
+    if (node->masked()) {
       // deny block write on masked register
       std::stringstream errmsg;
       errmsg << "Block write attempted on masked register";
       la->response->set_string("error", errmsg.str());
       LOGGER->log_message(LogManager::ERROR, stdsprintf("block write error: %s", errmsg.str().c_str()));
-    } else if (rmode.rfind("single") != std::string::npos && size > 1) {
+    } else if (node->mode == REG_MODE_SINGLE && size > 1) {
       // only allow block write of size 1 on single registers
       std::stringstream errmsg;
       errmsg << "Block write attempted on single register with size greater than 1";
@@ -519,6 +1222,266 @@ void writeBlock(const uint32_t& regAddr, const uint32_t* values, const size_t& s
   return;
 }
 
+static uint64_t sleepNs = 0; ///< Time spent in sleepFor, for the RPC statistics
+static std::map<std::string, RPCMethodStats> rpcStats;
+static std::unordered_map<std::string, uint16_t> traceRpcIds; ///< memhub trace ids of the RPC methods
+
+void recordSleepTime(uint64_t ns)
+{
+  sleepNs += ns;
+}
+
+/*! \brief Returns whether value meets the pollUntil condition
+ */
+static bool pollConditionMet(PollCondition condition, uint32_t value, uint32_t target)
+{
+  switch (condition) {
+  case PollCondition::equal:          return value == target;
+  case PollCondition::notEqual:       return value != target;
+  case PollCondition::greaterOrEqual: return value >= target;
+  }
+  return false;
+}
+
+PollResult pollUntil(uint32_t address, uint32_t mask, PollCondition condition, uint32_t target,
+                     std::chrono::microseconds timeout, const PollBackoff & backoff)
+{
+  using std::chrono::microseconds;
+  const auto start = std::chrono::steady_clock::now();
+  auto elapsed = [&start]() { return std::chrono::duration_cast<microseconds>(std::chrono::steady_clock::now() - start); };
+
+  PollResult result = {false, 0xdeaddead, 0, microseconds(0)};
+  if (backoff.predicted.count() > 0)
+    sleepFor(std::min(backoff.predicted, timeout));
+
+  microseconds interval = backoff.initial;
+  uint32_t firstValue = 0;       // first value and time, to predict the progress of the value
+  microseconds firstTime(0);
+  while (true) {
+    uint32_t data;
+    if (memhub_read(memsvc, address, 1, &data) != 0) {
+      LOGGER->log_message(LogManager::ERROR, stdsprintf("pollUntil: read memsvc error at 0x%08x: %s", address, memsvc_get_last_error(memsvc)));
+      result.value = 0xdeaddead;
+      break;
+    }
+    ++result.polls;
+    result.value = applyMask(data, mask);
+    const microseconds now = elapsed();
+    if (pollConditionMet(condition, result.value, target)) {
+      result.success = true;
+      break;
+    }
+    if (timeout != POLL_FOREVER && now >= timeout)
+      break;
+
+    if (condition == PollCondition::greaterOrEqual && result.polls == 1) {
+      firstValue = result.value;
+      firstTime  = now;
+    } else if (condition == PollCondition::greaterOrEqual && result.value > firstValue && now > firstTime) {
+      // Time to reach the target at the rate observed since the first read
+      const double rate = double(result.value - firstValue)/(now - firstTime).count();
+      interval = microseconds(int64_t((target - result.value)/rate));
+      interval = std::max(backoff.initial, std::min(backoff.max, interval));
+    }
+    microseconds wait = interval;
+    if (timeout != POLL_FOREVER)
+      wait = std::min(wait, timeout - now);
+    sleepFor(wait);
+    if (condition != PollCondition::greaterOrEqual || result.value == firstValue)
+      interval = std::min(backoff.max, interval*2);
+  }
+  result.elapsed = elapsed();
+  return result;
+}
+
+PollResult pollUntil(const RegNode & node, PollCondition condition, uint32_t target,
+                     std::chrono::microseconds timeout, const PollBackoff & backoff)
+{
+  return pollUntil(node.address, node.mask, condition, target, timeout, backoff);
+}
+
+RPCStatsScope::RPCStatsScope(const std::string & method) :
+  m_method(method),
+  m_sleepNs(sleepNs),
+  m_lmdbLookups(lmdbLookups),
+  m_lmdbNs(lmdbNs)
+{
+  auto traceRpcId = traceRpcIds.find(method);
+  if (traceRpcId == traceRpcIds.end())
+    traceRpcId = traceRpcIds.emplace(method, memhub_trace_rpc_id(method.c_str())).first;
+  memhub_trace_set_rpc(traceRpcId->second);
+  memhub_get_stats(&m_memhub);
+  m_start = std::chrono::steady_clock::now();
+}
+
+RPCStatsScope::~RPCStatsScope()
+{
+  const uint64_t wallNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count();
+  struct memhub_stats memhub;
+  memhub_get_stats(&memhub);
+  memhub_trace_set_rpc(0);
+
+  RPCMethodStats & stats = rpcStats[m_method]; // value-initialized on the first call
+  ++stats.calls;
+  stats.reads        += memhub.reads         - m_memhub.reads;
+  stats.writes       += memhub.writes        - m_memhub.writes;
+  stats.wordsRead    += memhub.words_read    - m_memhub.words_read;
+  stats.wordsWritten += memhub.words_written - m_memhub.words_written;
+  stats.lockWaitNs   += memhub.lock_wait_ns  - m_memhub.lock_wait_ns;
+  stats.busNs        += memhub.bus_ns        - m_memhub.bus_ns;
+  stats.sleepNs      += sleepNs     - m_sleepNs;
+  stats.lmdbLookups  += lmdbLookups - m_lmdbLookups;
+  stats.lmdbNs       += lmdbNs      - m_lmdbNs;
+  stats.wallNs       += wallNs;
+
+  uint32_t bin = 0;
+  for (uint64_t us = wallNs/1000; us > 0 && bin < RPC_STATS_HIST_BINS-1; us >>= 1)
+    ++bin;
+  ++stats.wallHist[bin];
+}
+
+std::map<std::string, RPCMethodStats> getRPCStatsLocal(bool reset)
+{
+  std::map<std::string, RPCMethodStats> stats = rpcStats;
+  if (reset)
+    rpcStats.clear();
+  return stats;
+}
+
+static uint32_t toWord(uint64_t value)
+{
+  return (value > 0xffffffffULL) ? 0xffffffff : uint32_t(value);
+}
+
+/*! \fn void getRPCStats(const RPCMsg *request, RPCMsg *response)
+ *  \brief Returns the statistics of the RPC methods called by this client connection, see RPCStatsScope
+ *  \details The "methods" string array names the methods, the word arrays calls, reads, writes, words_read, words_written,
+ *            lock_wait_us, bus_us, sleep_us, lmdb_lookups, lmdb_us and wall_us are indexed like it, and "<method>.wall_hist"
+ *            holds the wall time histogram of each method. A nonzero "reset" word clears the statistics.
+ */
+void getRPCStats(const RPCMsg *request, RPCMsg *response)
+{
+  const bool reset = request->get_key_exists("reset") && request->get_word("reset");
+  // getRPCStats itself is not profiled, so that reading the statistics does not change them
+  const std::map<std::string, RPCMethodStats> stats = getRPCStatsLocal(reset);
+
+  std::vector<std::string> methods;
+  std::vector<uint32_t> calls, reads, writes, wordsRead, wordsWritten, lockWaitUs, busUs, sleepUs, lmdbLookups, lmdbUs, wallUs;
+  for (auto const& method : stats) {
+    const RPCMethodStats & s = method.second;
+    methods.push_back(method.first);
+    calls.push_back(toWord(s.calls));
+    reads.push_back(toWord(s.reads));
+    writes.push_back(toWord(s.writes));
+    wordsRead.push_back(toWord(s.wordsRead));
+    wordsWritten.push_back(toWord(s.wordsWritten));
+    lockWaitUs.push_back(toWord(s.lockWaitNs/1000));
+    busUs.push_back(toWord(s.busNs/1000));
+    sleepUs.push_back(toWord(s.sleepNs/1000));
+    lmdbLookups.push_back(toWord(s.lmdbLookups));
+    lmdbUs.push_back(toWord(s.lmdbNs/1000));
+    wallUs.push_back(toWord(s.wallNs/1000));
+    response->set_word_array(method.first+".wall_hist", std::vector<uint32_t>(s.wallHist, s.wallHist+RPC_STATS_HIST_BINS));
+  }
+  response->set_string_array("methods", methods);
+  response->set_word_array("calls",         calls);
+  response->set_word_array("reads",         reads);
+  response->set_word_array("writes",        writes);
+  response->set_word_array("words_read",    wordsRead);
+  response->set_word_array("words_written", wordsWritten);
+  response->set_word_array("lock_wait_us",  lockWaitUs);
+  response->set_word_array("bus_us",        busUs);
+  response->set_word_array("sleep_us",      sleepUs);
+  response->set_word_array("lmdb_lookups",  lmdbLookups);
+  response->set_word_array("lmdb_us",       lmdbUs);
+  response->set_word_array("wall_us",       wallUs);
+  response->set_word("pid", getpid());
+  LOGGER->log_message(LogManager::INFO, stdsprintf("RPC statistics of %zu methods returned%s", stats.size(), reset ? " and reset" : ""));
+}
+
+/*! \fn void getSystemInfo(const RPCMsg *request, RPCMsg *response)
+ *  \brief Returns the cached system information, see utils/system_info.h
+ *  \details A nonzero "reload" word, to be sent after a firmware reload, invalidates the information cached by all
+ *            the processes and reads it again. Returns the words release_major, release_minor, release_build and
+ *            num_of_oh, and the string gem_variant.
+ */
+void getSystemInfo(const RPCMsg *request, RPCMsg *response)
+{
+  GETLOCALARGS(response);
+
+  if (request->get_key_exists("reload") && request->get_word("reload")) {
+    LOGGER->log_message(LogManager::INFO, "Reloading the system information of all the processes");
+    invalidateSystemInfo(true);
+  }
+  const SystemInfo & info = getSystemInfo(&la);
+  response->set_word("release_major", info.releaseMajor);
+  response->set_word("release_minor", info.releaseMinor);
+  response->set_word("release_build", info.releaseBuild);
+  response->set_word("num_of_oh",     info.numOfOH);
+  response->set_string("gem_variant", info.gemVariant);
+  rtxn.abort();
+}
+
+/*! \fn void getMemhubTrace(const RPCMsg *request, RPCMsg *response)
+ *  \brief Returns the register accesses recorded in the memhub trace by all the processes
+ *  \details Returns the most recent "max_entries" entries (default: the whole ring) with a sequence number
+ *            larger than "since" (default 0, all), oldest first, as the word arrays seq, time_s, time_ns, address,
+ *            value, words, flags, pid and rpc_id; see memhub_trace_entry. rpc_id is 0 outside of an RPC method,
+ *            the name of the method is rpc_names[rpc_id-1] otherwise.
+ */
+void getMemhubTrace(const RPCMsg *request, RPCMsg *response)
+{
+  // Sequence numbers are exchanged as their 32 low bits
+  const uint32_t since      = request->get_key_exists("since") ? request->get_word("since") : 0;
+  const uint32_t maxEntries = request->get_key_exists("max_entries") ? std::min(request->get_word("max_entries"), uint32_t(MEMHUB_TRACE_ENTRIES)) : MEMHUB_TRACE_ENTRIES;
+
+  std::vector<memhub_trace_entry> entries(MEMHUB_TRACE_ENTRIES);
+  const int nEntries = memhub_trace_snapshot(0, entries.data(), MEMHUB_TRACE_ENTRIES);
+  if (nEntries < 0) {
+    EMIT_RPC_ERROR(response, std::string("The memhub trace is not available"), (void)"");
+  }
+
+  // The most recent maxEntries entries following since
+  int first = 0;
+  while (since != 0 && first < nEntries && int32_t(uint32_t(entries[first].seq) - since) <= 0)
+    ++first;
+  first = std::max(first, nEntries - int(maxEntries));
+
+  std::vector<uint32_t> seq, timeS, timeNs, address, value, words, flags, pid, rpcId;
+  for (int i = first; i < nEntries; ++i) {
+    const memhub_trace_entry & entry = entries[i];
+    seq.push_back(uint32_t(entry.seq));
+    timeS.push_back(entry.time_ns/1000000000ULL);
+    timeNs.push_back(entry.time_ns%1000000000ULL);
+    address.push_back(entry.addr);
+    value.push_back(entry.value);
+    words.push_back(entry.words);
+    flags.push_back(entry.flags);
+    pid.push_back(entry.pid);
+    rpcId.push_back(entry.rpc_id);
+  }
+
+  // Names of the RPC ids, rpc_names[id-1]
+  std::vector<std::string> rpcNames;
+  for (uint16_t id = 1; id <= MEMHUB_TRACE_RPC_NAMES; ++id) {
+    const char * name = memhub_trace_rpc_name(id);
+    if (!name)
+      break;
+    rpcNames.push_back(name);
+  }
+
+  response->set_word_array("seq",     seq);
+  response->set_word_array("time_s",  timeS);
+  response->set_word_array("time_ns", timeNs);
+  response->set_word_array("address", address);
+  response->set_word_array("value",   value);
+  response->set_word_array("words",   words);
+  response->set_word_array("flags",   flags);
+  response->set_word_array("pid",     pid);
+  response->set_word_array("rpc_id",  rpcId);
+  response->set_string_array("rpc_names", rpcNames);
+}
+
 extern "C" {
   const char *module_version_key = "utils v1.0.1";
   int module_activity_color = 4;
@@ -529,7 +1492,13 @@ extern "C" {
       LOGGER->log_message(LogManager::ERROR, "Unable to load module");
       return; // Do not register our functions, we depend on memsvc.
     }
-    modmgr->register_method("utils", "update_address_table", update_address_table);
-    modmgr->register_method("utils", "readRegFromDB",        readRegFromDB);
+    if (!openAddressTable()) {
+      LOGGER->log_message(LogManager::WARNING, "Address table not available yet, it will be opened on first use");
+    }
+    modmgr->register_method("utils", "update_address_table", profiledMethod<update_address_table>);
+    modmgr->register_method("utils", "readRegFromDB",        profiledMethod<readRegFromDB>);
+    modmgr->register_method("utils", "getRPCStats",          getRPCStats);
+    modmgr->register_method("utils", "getMemhubTrace",       getMemhubTrace);
+    modmgr->register_method("utils", "getSystemInfo",        profiledMethod<getSystemInfo>);
   }
 }
@@ -0,0 +1,114 @@
+/*!
+ * \file utils/bulk.cpp
+ * \brief Scratch buffers and chunked memhub transfers
+ */
+
+#include "utils/bulk.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace {
+  /*! \brief Buffer kept in the pool
+   */
+  struct PoolBlock {
+    std::unique_ptr<uint32_t[]> data;
+    size_t capacity;
+  };
+
+  std::vector<PoolBlock> pool;  ///< Free buffers
+  size_t pooledWords = 0;       ///< Total capacity of the free buffers
+}
+
+ScratchBuffer::ScratchBuffer(size_t words, bool zero) :
+  m_data(nullptr),
+  m_size(words),
+  m_capacity(0)
+{
+  if (words == 0 || words > SCRATCH_MAX_WORDS)
+    return;
+
+  // Smallest free buffer large enough, the others stay available to the nested users
+  auto best = pool.end();
+  for (auto it = pool.begin(); it != pool.end(); ++it) {
+    if (it->capacity >= words && (best == pool.end() || it->capacity < best->capacity))
+      best = it;
+  }
+  if (best != pool.end()) {
+    m_data     = best->data.release();
+    m_capacity = best->capacity;
+    pooledWords -= m_capacity;
+    pool.erase(best);
+  } else {
+    // Round up to limit the reallocations for slowly growing requests
+    m_capacity = std::min<size_t>(SCRATCH_MAX_WORDS, std::max<size_t>(1024, words + words/4));
+    m_data = new (std::nothrow) uint32_t[m_capacity];
+    if (!m_data) {
+      LOGGER->log_message(LogManager::ERROR, stdsprintf("Unable to allocate a scratch buffer of %zu words", m_capacity));
+      m_capacity = 0;
+      return;
+    }
+  }
+  if (zero)
+    std::memset(m_data, 0, words*sizeof(uint32_t));
+}
+
+ScratchBuffer::~ScratchBuffer()
+{
+  if (!m_data)
+    return;
+  // Keep the buffer unless the pool would grow too large; drop the smallest buffers first
+  while (pooledWords + m_capacity > SCRATCH_POOL_WORDS && !pool.empty()) {
+    auto smallest = std::min_element(pool.begin(), pool.end(),
+                                     [](const PoolBlock & a, const PoolBlock & b) { return a.capacity < b.capacity; });
+    if (smallest->capacity > m_capacity)
+      break;
+    pooledWords -= smallest->capacity;
+    pool.erase(smallest);
+  }
+  if (pooledWords + m_capacity > SCRATCH_POOL_WORDS) {
+    delete[] m_data;
+    return;
+  }
+  pool.push_back(PoolBlock{std::unique_ptr<uint32_t[]>(m_data), m_capacity});
+  pooledWords += m_capacity;
+}
+
+bool ScratchBuffer::check(wisc::RPCMsg * response, const char * what) const
+{
+  if (valid())
+    return true;
+  const std::string error = (m_size > SCRATCH_MAX_WORDS)
+    ? stdsprintf("%s of %zu words exceeds the maximum of %u words", what, m_size, SCRATCH_MAX_WORDS)
+    : stdsprintf("Unable to allocate the buffer of %s, %zu words", what, m_size);
+  response->set_string("error", error);
+  LOGGER->log_message(LogManager::ERROR, error);
+  return false;
+}
+
+int readChunked(uint32_t address, uint32_t words, uint32_t * data, bool fifo)
+{
+  for (uint32_t done = 0; done < words; done += TRANSFER_CHUNK_WORDS) {
+    const uint32_t n = std::min(TRANSFER_CHUNK_WORDS, words - done);
+    const int ret = fifo ? memhub_fifo_read(memsvc, address, n, data + done)
+                         : memhub_read(memsvc, address + done*4, n, data + done);
+    if (ret != 0)
+      return ret;
+  }
+  return 0;
+}
+
+int writeChunked(uint32_t address, uint32_t words, const uint32_t * data, bool fifo)
+{
+  for (uint32_t done = 0; done < words; done += TRANSFER_CHUNK_WORDS) {
+    const uint32_t n = std::min(TRANSFER_CHUNK_WORDS, words - done);
+    const int ret = fifo ? memhub_fifo_write(memsvc, address, n, data + done)
+                         : memhub_write(memsvc, address + done*4, n, data + done);
+    if (ret != 0)
+      return ret;
+  }
+  return 0;
+}
@@ -0,0 +1,42 @@
+/*!
+ * \file utils/compiled_regs.cpp
+ * \brief Check of the compiled-in register descriptors against the LMDB address table
+ */
+
+#include "utils/compiled_regs.h"
+#include "utils.h"
+
+/*! \brief Returns whether two nodes describe the same register
+ */
+static bool sameNode(const RegNode & a, const RegNode & b)
+{
+  return a.address == b.address && a.mask == b.mask && a.size == b.size && a.mode == b.mode && a.perm == b.perm;
+}
+
+bool checkCompiledRegs(localArgs * la)
+{
+  if (regs::ADDRESS_TABLE[0] == '\0') {
+    LOGGER->log_message(LogManager::DEBUG, "Modules built without address table, the compiled-in registers are looked up by name");
+    return false;
+  }
+
+  size_t nMismatches = 0;
+  for (const CompiledReg * reg : regs::ALL) {
+    const RegNode * node = getRegNode(la, reg->name);
+    if (node ? (reg->inTable && sameNode(*node, reg->node)) : !reg->inTable)
+      continue;
+    ++nMismatches;
+    if (!node) {
+      LOGGER->log_message(LogManager::INFO, stdsprintf("Compiled-in register %s is not in the address table", reg->name));
+    } else {
+      LOGGER->log_message(LogManager::INFO, stdsprintf("Compiled-in register %s differs from the address table: address 0x%08x mask 0x%08x, expected 0x%08x 0x%08x",
+                                                       reg->name, node->address, node->mask, reg->node.address, reg->node.mask));
+    }
+  }
+  if (nMismatches > 0) {
+    LOGGER->log_message(LogManager::WARNING, stdsprintf("%zu of %zu compiled-in registers (%s, firmware %s) do not match the address table, they are looked up by name",
+                                                        nMismatches, sizeof(regs::ALL)/sizeof(regs::ALL[0]), regs::ADDRESS_TABLE, regs::FW_VERSION));
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,83 @@
+/*!
+ * \file utils/jobs.cpp
+ * \brief Progress and partial results of the routines run as asynchronous jobs
+ */
+
+#include "utils/jobs.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+  JobShared * current = nullptr; ///< Block of the job run by this process, nullptr outside of a worker
+  double   base  = 0.;           ///< Start of the current JobProgressScope, as a fraction of the job
+  double   width = 1.;           ///< Width of the current JobProgressScope
+  unsigned depth = 0;            ///< Number of nested JobProgressScope
+}
+
+void setJobShared(JobShared * job)
+{
+  current = job;
+  base  = 0.;
+  width = 1.;
+  depth = 0;
+}
+
+static void setProgress(double fraction)
+{
+  const uint32_t progress = uint32_t(std::min(1., std::max(0., fraction))*JOB_PROGRESS_SCALE);
+  __atomic_store_n(&current->progress, progress, __ATOMIC_RELEASE);
+}
+
+void jobProgress(uint32_t done, uint32_t total)
+{
+  if (!current || total == 0)
+    return;
+  setProgress(base + width*std::min(done, total)/total);
+}
+
+void jobPartialResult(const uint32_t * data, size_t words)
+{
+  if (!current || depth > 0)
+    return;
+  words = std::min<size_t>(words, JOB_PARTIAL_MAX_WORDS);
+  __atomic_add_fetch(&current->partialSeq, 1, __ATOMIC_SEQ_CST);
+  std::memcpy(current->partial, data, words*sizeof(uint32_t));
+  __atomic_store_n(&current->partialWords, uint32_t(words), __ATOMIC_RELEASE);
+  __atomic_add_fetch(&current->partialSeq, 1, __ATOMIC_SEQ_CST);
+}
+
+uint32_t readJobPartialResult(const JobShared * job, uint32_t offset, uint32_t maxWords, std::vector<uint32_t> & words, bool & consistent)
+{
+  uint32_t total = 0;
+  consistent = false;
+  // A copy overlapping an update is retried, after a few attempts the last copy is returned flagged inconsistent
+  for (int attempt = 0; attempt < 4 && !consistent; ++attempt) {
+    const uint32_t seq = __atomic_load_n(&job->partialSeq, __ATOMIC_ACQUIRE);
+    total = std::min(__atomic_load_n(&job->partialWords, __ATOMIC_ACQUIRE), JOB_PARTIAL_MAX_WORDS);
+    const uint32_t count = (offset < total) ? std::min(maxWords, total - offset) : 0;
+    words.assign(job->partial + offset, job->partial + offset + count);
+    consistent = !(seq & 0x1) && __atomic_load_n(&job->partialSeq, __ATOMIC_ACQUIRE) == seq;
+  }
+  return total;
+}
+
+JobProgressScope::JobProgressScope(uint32_t part, uint32_t parts) :
+  m_base(base),
+  m_width(width)
+{
+  parts = std::max<uint32_t>(parts, 1);
+  base  += width*part/parts;
+  width /= parts;
+  ++depth;
+}
+
+JobProgressScope::~JobProgressScope()
+{
+  const double end = base + width;
+  base  = m_base;
+  width = m_width;
+  --depth;
+  if (current)
+    setProgress(end);
+}
@@ -0,0 +1,300 @@
+/*!
+ * \file utils/regnode_cache.cpp
+ * \brief Shared memory cache of the decoded address table nodes
+ */
+
+#include "utils/regnode_cache.h"
+#include "moduleapi.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace {
+  const char * const CACHE_SHM_NAME      = "/gem_regnode_cache";
+  const char * const CACHE_NEW_SHM_NAME  = "/gem_regnode_cache.new";
+  const char * const GENERATION_SHM_NAME = "/gem_address_table_generation";
+  const std::string  SHM_DIR             = "/dev/shm"; ///< Where the POSIX shared memory objects live, for rename(2)
+
+  constexpr uint32_t CACHE_MAGIC   = 0x434e5247; ///< "GRNC"
+  constexpr uint32_t CACHE_VERSION = 1;          ///< To be increased when the layout changes
+  constexpr uint32_t EMPTY_BUCKET  = 0xffffffff;
+
+  /*! \brief Header of the shared cache, followed by the buckets and the names
+   */
+  struct CacheHeader {
+    uint32_t magic;       ///< CACHE_MAGIC, written last
+    uint32_t version;     ///< CACHE_VERSION
+    uint32_t entrySize;   ///< sizeof(CacheEntry), guards against a layout change without version change
+    uint32_t generation;  ///< Address table generation the cache was built for
+    uint32_t format;      ///< Record format version of the address table
+    uint32_t nBuckets;    ///< Number of buckets, a power of 2
+    uint32_t nNodes;      ///< Number of nodes
+    uint32_t reserved;
+    uint64_t tableDev;    ///< Identity of the data.mdb file the cache was built from
+    uint64_t tableIno;
+    uint64_t tableSize;
+    int64_t  tableMtime;
+    uint64_t size;        ///< Size of the shared memory object
+  };
+
+  /*! \brief Bucket of the open addressing hash table
+   */
+  struct CacheEntry {
+    uint64_t hash;        ///< Hash of the register name
+    uint32_t nameOffset;  ///< Offset of the name from the start of the object, EMPTY_BUCKET if the bucket is free
+    uint32_t nameLength;  ///< Length of the name
+    RegNode  node;        ///< Decoded node
+  };
+
+  const char *        cacheBase  = nullptr; ///< Read-only mapping of the cache
+  size_t              cacheSize  = 0;
+  const CacheHeader * header     = nullptr;
+  const CacheEntry *  entries    = nullptr;
+  const volatile uint32_t * generation = nullptr; ///< Read-only mapping of the address table generation
+
+  /*! \brief FNV-1a hash, stable across processes and builds
+   */
+  uint64_t hashName(const char * name, size_t length)
+  {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < length; ++i) {
+      hash ^= uint8_t(name[i]);
+      hash *= 0x100000001b3ULL;
+    }
+    return hash;
+  }
+
+  bool mapGeneration()
+  {
+    if (generation)
+      return true;
+    int fd = shm_open(GENERATION_SHM_NAME, O_CREAT | O_RDWR, 0664);
+    if (fd < 0)
+      return false;
+    struct stat st;
+    void * addr = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (st.st_size >= off_t(sizeof(uint32_t)) || ftruncate(fd, sizeof(uint32_t)) == 0))
+      addr = mmap(nullptr, sizeof(uint32_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+      return false;
+    generation = static_cast<const volatile uint32_t *>(addr);
+    return true;
+  }
+
+  /*! \brief Maps the current cache object read-only, if it exists and has the expected layout
+   */
+  bool mapCache()
+  {
+    int fd = shm_open(CACHE_SHM_NAME, O_RDONLY, 0);
+    if (fd < 0)
+      return false;
+    struct stat st;
+    void * addr = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= off_t(sizeof(CacheHeader)))
+      addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+      return false;
+
+    cacheBase = static_cast<const char *>(addr);
+    cacheSize = st.st_size;
+    header    = reinterpret_cast<const CacheHeader *>(cacheBase);
+    entries   = reinterpret_cast<const CacheEntry *>(cacheBase + sizeof(CacheHeader));
+    if (header->magic != CACHE_MAGIC || header->version != CACHE_VERSION || header->entrySize != sizeof(CacheEntry)
+        || header->size != cacheSize || sizeof(CacheHeader) + uint64_t(header->nBuckets)*sizeof(CacheEntry) > cacheSize) {
+      detachRegNodeCache();
+      return false;
+    }
+    return true;
+  }
+
+  /*! \brief Returns whether the mapped cache was built for the current generation of the given address table
+   */
+  bool cacheMatches(uint32_t format, const struct stat & tableStat)
+  {
+    return header && header->generation == *generation && header->format == format
+      && header->tableDev == uint64_t(tableStat.st_dev) && header->tableIno == uint64_t(tableStat.st_ino)
+      && header->tableSize == uint64_t(tableStat.st_size) && header->tableMtime == int64_t(tableStat.st_mtime);
+  }
+
+  /*! \brief Decodes all the nodes of the address table into a new cache object and swaps it in
+   */
+  bool buildCache(lmdb::env & env, lmdb::dbi & dbi, uint32_t format, const struct stat & tableStat)
+  {
+    const uint32_t buildGeneration = *generation;
+    std::vector<std::pair<std::string, RegNode> > nodes;
+    size_t namesSize = 0;
+    try {
+      auto txn    = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+      auto cursor = lmdb::cursor::open(txn, dbi);
+      lmdb::val key, value;
+      while (cursor.get(key, value, MDB_NEXT)) {
+        RegNode node;
+        std::string name(key.data(), key.size());
+        if (name == REG_FORMAT_KEY || !decodeRegNode(format, value.data(), value.size(), node))
+          continue;
+        namesSize += name.size();
+        nodes.emplace_back(std::move(name), node);
+      }
+      cursor.close();
+      txn.abort();
+    } catch (const lmdb::error & e) {
+      LOGGER->log_message(LogManager::ERROR, stdsprintf("Unable to read the address table for the shared node cache: %s", e.what()));
+      return false;
+    }
+
+    uint32_t nBuckets = 16;
+    while (nBuckets < 2*nodes.size())
+      nBuckets *= 2;
+    const size_t namesOffset = sizeof(CacheHeader) + size_t(nBuckets)*sizeof(CacheEntry);
+    const size_t size        = namesOffset + namesSize;
+
+    shm_unlink(CACHE_NEW_SHM_NAME);
+    int fd = shm_open(CACHE_NEW_SHM_NAME, O_CREAT | O_EXCL | O_RDWR, 0664);
+    if (fd < 0) {
+      LOGGER->log_message(LogManager::ERROR, stdsprintf("Unable to create the shared node cache: %s", strerror(errno)));
+      return false;
+    }
+    void * addr = MAP_FAILED;
+    if (ftruncate(fd, size) == 0)
+      addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+      LOGGER->log_message(LogManager::ERROR, stdsprintf("Unable to allocate %zu bytes for the shared node cache: %s", size, strerror(errno)));
+      shm_unlink(CACHE_NEW_SHM_NAME);
+      return false;
+    }
+
+    char * base = static_cast<char *>(addr);
+    CacheEntry * buckets = reinterpret_cast<CacheEntry *>(base + sizeof(CacheHeader));
+    for (uint32_t i = 0; i < nBuckets; ++i)
+      buckets[i].nameOffset = EMPTY_BUCKET;
+    size_t nameOffset = namesOffset;
+    for (auto const& node : nodes) {
+      const uint64_t hash = hashName(node.first.data(), node.first.size());
+      uint32_t i = hash & (nBuckets - 1);
+      while (buckets[i].nameOffset != EMPTY_BUCKET)
+        i = (i + 1) & (nBuckets - 1);
+      buckets[i].hash       = hash;
+      buckets[i].nameOffset = nameOffset;
+      buckets[i].nameLength = node.first.size();
+      buckets[i].node       = node.second;
+      std::memcpy(base + nameOffset, node.first.data(), node.first.size());
+      nameOffset += node.first.size();
+    }
+
+    CacheHeader * newHeader = reinterpret_cast<CacheHeader *>(base);
+    newHeader->version    = CACHE_VERSION;
+    newHeader->entrySize  = sizeof(CacheEntry);
+    newHeader->generation = buildGeneration;
+    newHeader->format     = format;
+    newHeader->nBuckets   = nBuckets;
+    newHeader->nNodes     = nodes.size();
+    newHeader->tableDev   = tableStat.st_dev;
+    newHeader->tableIno   = tableStat.st_ino;
+    newHeader->tableSize  = tableStat.st_size;
+    newHeader->tableMtime = tableStat.st_mtime;
+    newHeader->size       = size;
+    newHeader->magic      = CACHE_MAGIC;
+    munmap(addr, size);
+
+    // Processes which mapped the previous cache keep on using it until they notice the new generation
+    if (rename((SHM_DIR + CACHE_NEW_SHM_NAME).c_str(), (SHM_DIR + CACHE_SHM_NAME).c_str()) != 0) {
+      LOGGER->log_message(LogManager::ERROR, stdsprintf("Unable to swap in the shared node cache: %s", strerror(errno)));
+      shm_unlink(CACHE_NEW_SHM_NAME);
+      return false;
+    }
+    LOGGER->log_message(LogManager::INFO, stdsprintf("Shared node cache built: %zu nodes, %zu bytes, generation %u",
+                                                     nodes.size(), size, buildGeneration));
+    return true;
+  }
+}
+
+bool attachRegNodeCache(lmdb::env & env, lmdb::dbi & dbi, uint32_t format, const struct stat & tableStat)
+{
+  detachRegNodeCache();
+  if (!mapGeneration()) {
+    LOGGER->log_message(LogManager::WARNING, stdsprintf("Unable to map the address table generation: %s", strerror(errno)));
+    return false;
+  }
+  if (mapCache() && cacheMatches(format, tableStat))
+    return true;
+  detachRegNodeCache();
+
+  static int cacheLock = namedlock_init("utils", "regnode_cache");
+  if (cacheLock < 0 || namedlock_lock(cacheLock) != 0)
+    return false;
+  // Another process may have built the cache while this one was waiting for the lock
+  bool attached = mapCache() && cacheMatches(format, tableStat);
+  if (!attached) {
+    detachRegNodeCache();
+    attached = buildCache(env, dbi, format, tableStat) && mapCache() && cacheMatches(format, tableStat);
+    if (!attached)
+      detachRegNodeCache();
+  }
+  namedlock_unlock(cacheLock);
+  return attached;
+}
+
+void detachRegNodeCache()
+{
+  if (cacheBase)
+    munmap(const_cast<char *>(cacheBase), cacheSize);
+  cacheBase = nullptr;
+  cacheSize = 0;
+  header    = nullptr;
+  entries   = nullptr;
+}
+
+bool regNodeCacheAttached()
+{
+  return header != nullptr;
+}
+
+bool regNodeCacheStale()
+{
+  return header && header->generation != *generation;
+}
+
+const RegNode * findSharedRegNode(const std::string & regName)
+{
+  if (!header)
+    return nullptr;
+  const uint64_t hash = hashName(regName.data(), regName.size());
+  const uint32_t mask = header->nBuckets - 1;
+  // The table is at most half full, so the probing always ends on a free bucket
+  for (uint32_t i = hash & mask; entries[i].nameOffset != EMPTY_BUCKET; i = (i + 1) & mask) {
+    const CacheEntry & entry = entries[i];
+    if (entry.hash == hash && entry.nameLength == regName.size()
+        && std::memcmp(cacheBase + entry.nameOffset, regName.data(), entry.nameLength) == 0)
+      return &entry.node;
+  }
+  return nullptr;
+}
+
+void bumpAddressTableGeneration()
+{
+  int fd = shm_open(GENERATION_SHM_NAME, O_CREAT | O_RDWR, 0664);
+  if (fd < 0) {
+    LOGGER->log_message(LogManager::ERROR, stdsprintf("Unable to open the address table generation: %s", strerror(errno)));
+    return;
+  }
+  void * addr = MAP_FAILED;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && (st.st_size >= off_t(sizeof(uint32_t)) || ftruncate(fd, sizeof(uint32_t)) == 0))
+    addr = mmap(nullptr, sizeof(uint32_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    LOGGER->log_message(LogManager::ERROR, stdsprintf("Unable to map the address table generation: %s", strerror(errno)));
+    return;
+  }
+  const uint32_t newGeneration = __atomic_add_fetch(static_cast<uint32_t *>(addr), 1, __ATOMIC_SEQ_CST);
+  munmap(addr, sizeof(uint32_t));
+  LOGGER->log_message(LogManager::INFO, stdsprintf("Address table generation is now %u", newGeneration));
+}
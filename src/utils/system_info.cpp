@@ -0,0 +1,95 @@
+/*!
+ * \file utils/system_info.cpp
+ * \brief Cached firmware release and system configuration
+ */
+
+#include "utils/system_info.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SYSTEM_INFO_STR(x) #x
+#define SYSTEM_INFO_XSTR(x) SYSTEM_INFO_STR(x)
+
+namespace {
+  const char * const GENERATION_SHM_NAME = "/gem_system_info_generation";
+
+  SystemInfo info = {0, 0, 0, 0, SYSTEM_INFO_XSTR(GEM_VARIANT)};
+  bool       infoValid      = false;
+  uint32_t   infoGeneration = 0;       ///< Value of the shared generation when info was read
+  volatile uint32_t * generation = nullptr; ///< Mapping of the shared generation, nullptr if unavailable
+
+  void mapGeneration()
+  {
+    static bool tried = false;
+    if (tried)
+      return;
+    tried = true;
+    int fd = shm_open(GENERATION_SHM_NAME, O_CREAT | O_RDWR, 0664);
+    if (fd < 0) {
+      LOGGER->log_message(LogManager::WARNING, stdsprintf("Unable to open the system information generation: %s", strerror(errno)));
+      return;
+    }
+    void * addr = MAP_FAILED;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (st.st_size >= off_t(sizeof(uint32_t)) || ftruncate(fd, sizeof(uint32_t)) == 0))
+      addr = mmap(nullptr, sizeof(uint32_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+      LOGGER->log_message(LogManager::WARNING, stdsprintf("Unable to map the system information generation: %s", strerror(errno)));
+      return;
+    }
+    generation = static_cast<volatile uint32_t *>(addr);
+  }
+
+  uint32_t currentGeneration()
+  {
+    mapGeneration();
+    return generation ? __atomic_load_n(generation, __ATOMIC_ACQUIRE) : 0;
+  }
+}
+
+const SystemInfo & getSystemInfo(localArgs * la)
+{
+  const uint32_t gen = currentGeneration();
+  if (infoValid && gen == infoGeneration)
+    return info;
+
+  const std::vector<const RegNode *> nodes = {
+    getRegNode(la, regs::GEM_AMC_GEM_SYSTEM_RELEASE_MAJOR),
+    getRegNode(la, regs::GEM_AMC_GEM_SYSTEM_RELEASE_MINOR),
+    getRegNode(la, regs::GEM_AMC_GEM_SYSTEM_RELEASE_BUILD),
+    getRegNode(la, regs::GEM_AMC_GEM_SYSTEM_CONFIG_NUM_OF_OH),
+  };
+  std::vector<uint32_t> values;
+  readRegs(nodes, values);
+  info.releaseMajor = values[0];
+  info.releaseMinor = values[1];
+  info.releaseBuild = values[2];
+  info.numOfOH      = values[3];
+
+  infoValid = std::find(values.begin(), values.end(), 0xdeaddead) == values.end();
+  infoGeneration = gen;
+  if (infoValid) {
+    LOGGER->log_message(LogManager::INFO, stdsprintf("System release %u.%u.%u, %u OptoHybrids, %s",
+                                                     info.releaseMajor, info.releaseMinor, info.releaseBuild, info.numOfOH, info.gemVariant));
+  } else {
+    LOGGER->log_message(LogManager::ERROR, "Unable to read the system information, it will be read again on the next call");
+  }
+  return info;
+}
+
+void invalidateSystemInfo(bool allProcesses)
+{
+  infoValid = false;
+  if (allProcesses) {
+    mapGeneration();
+    if (generation)
+      __atomic_add_fetch(generation, 1, __ATOMIC_SEQ_CST);
+  }
+}
@@ -95,7 +95,7 @@ void configureVFAT3DacMonitorMultiLink(const RPCMsg *request, RPCMsg *response){
     uint32_t ohMask = request->get_word("ohMask");
     uint32_t dacSelect = request->get_word("dacSelect");
 
-    unsigned int NOH = readReg(&la, "GEM_AMC.GEM_SYSTEM.CONFIG.NUM_OF_OH");
+    unsigned int NOH = getSystemInfo(&la).numOfOH;
     if (request->get_key_exists("NOH")){
         unsigned int NOH_requested = request->get_word("NOH");
         if (NOH_requested <= NOH)
@@ -134,6 +134,7 @@ void configureVFAT3sLocal(localArgs * la, uint32_t ohN, uint32_t vfatMask) {
     }
 
     LOGGER->log_message(LogManager::INFO, "Load configuration settings");
+    RegShadowScope shadow(la);
     for(uint32_t vfatN = 0; vfatN < oh::VFATS_PER_OH; vfatN++) if((notmask >> vfatN) & 0x1)
     {
         std::string configFileBase = "/mnt/persistent/gemdaq/vfat3/config_OH"+std::to_string(ohN)+"_VFAT"+std::to_string(vfatN)+".txt";
@@ -196,6 +197,7 @@ void getChannelRegistersVFAT3Local(localArgs *la, uint32_t ohN, uint32_t vfatMas
 
     char regBuf[200];
     LOGGER->log_message(LogManager::INFO, "Read channel register settings");
+    const RegArray chanRegs(la, stdsprintf("GEM_AMC.OH.OH%i.GEB.VFAT{}.VFAT_CHANNELS.CHANNEL{}", ohN), {oh::VFATS_PER_OH, 128});
     for(unsigned int vfatN=0; vfatN < oh::VFATS_PER_OH; ++vfatN){
         // Check if vfat is masked
         if(!((notmask >> vfatN) & 0x1)){
@@ -211,19 +213,22 @@ void getChannelRegistersVFAT3Local(localArgs *la, uint32_t ohN, uint32_t vfatMas
         }
 
         //Loop over the channels
-        uint32_t chanAddr;
+        RegNode chanNode;
         for(unsigned int chan=0; chan < 128; ++chan){
             //Deterime the idx
             unsigned int idx = vfatN*128 + chan;
 
             //Get the address
-            sprintf(regBuf,"GEM_AMC.OH.OH%i.GEB.VFAT%i.VFAT_CHANNELS.CHANNEL%i",ohN,vfatN,chan);
-            chanAddr = getAddress(la, regBuf);
+            if (!chanRegs.node(chanNode, vfatN, chan)) {
+                LOGGER->log_message(LogManager::ERROR, stdsprintf("Key: %s is NOT found", chanRegs.name(vfatN, chan).c_str()));
+                la->response->set_string("error", "Register not found");
+                return;
+            }
 
             //Build the channel register
             LOGGER->log_message(LogManager::DEBUG, stdsprintf("Reading channel register for VFAT%i chan %i",vfatN,chan));
-            chanRegData[idx] = readRawAddress(chanAddr, la->response);
-            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            chanRegData[idx] = readRawAddress(chanNode.address, la->response);
+            sleepFor(std::chrono::microseconds(200));
         } //End Loop over channels
     } //End Loop over VFATs
 
@@ -233,12 +238,12 @@ void getChannelRegistersVFAT3Local(localArgs *la, uint32_t ohN, uint32_t vfatMas
 void readVFAT3ADCLocal(localArgs * la, uint32_t * outData, uint32_t ohN, bool useExtRefADC, uint32_t mask){
     if(useExtRefADC){ //Case: Use ADC with external reference
         broadcastReadLocal(la, outData, ohN, "ADC1_UPDATE", mask);
-        std::this_thread::sleep_for(std::chrono::microseconds(20));
+        sleepFor(std::chrono::microseconds(20));
         broadcastReadLocal(la, outData, ohN, "ADC1_CACHED", mask);
     } //End Case: Use ADC with external reference
     else{ //Case: Use ADC with internal reference
         broadcastReadLocal(la, outData, ohN, "ADC0_UPDATE", mask);
-        std::this_thread::sleep_for(std::chrono::microseconds(20));
+        sleepFor(std::chrono::microseconds(20));
         broadcastReadLocal(la, outData, ohN, "ADC0_CACHED", mask);
     } //End Case: Use ADC with internal reference
 
@@ -268,7 +273,7 @@ void readVFAT3ADCMultiLink(const RPCMsg *request, RPCMsg *response){
     uint32_t ohMask = request->get_word("ohMask");
     bool useExtRefADC = request->get_word("useExtRefADC");
 
-    unsigned int NOH = readReg(&la, "GEM_AMC.GEM_SYSTEM.CONFIG.NUM_OF_OH");
+    unsigned int NOH = getSystemInfo(&la).numOfOH;
     if (request->get_key_exists("NOH")){
         unsigned int NOH_requested = request->get_word("NOH");
         if (NOH_requested <= NOH)
@@ -331,7 +336,7 @@ void setChannelRegistersVFAT3SimpleLocal(localArgs * la, uint32_t ohN, uint32_t
             sprintf(regBuf,"GEM_AMC.OH.OH%i.GEB.VFAT%i.VFAT_CHANNELS.CHANNEL%i",ohN,vfatN,chan);
             chanAddr = getAddress(la, regBuf);
             writeRawAddress(chanAddr, chanRegData[idx], la->response);
-            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            sleepFor(std::chrono::microseconds(200));
         } //End Loop over channels
     } //End Loop over VFATs
 
@@ -358,17 +363,12 @@ void setChannelRegistersVFAT3Local(localArgs * la, uint32_t ohN, uint32_t vfatMa
             return;
         }
 
-        //Loop over the channels
-        uint32_t chanAddr;
-        uint32_t chanRegVal;
+        //Check the trim values and build the channel registers before any write
+        uint32_t chanRegVal[128];
         for(unsigned int chan=0; chan < 128; ++chan){
             //Deterime the idx
             unsigned int idx = vfatN*128 + chan;
 
-            //Get the address
-            sprintf(regBuf,"GEM_AMC.OH.OH%i.GEB.VFAT%i.VFAT_CHANNELS.CHANNEL%i",ohN,vfatN,chan);
-            chanAddr = getAddress(la, regBuf);
-
             //Check trim values make sense
             if ( trimARM[idx] > 0x3F || trimARM[idx] < 0x0){
                 sprintf(regBuf,"arming comparator trim value must be positive in range [0x0,0x3F]. Value given for VFAT%i chan %i: %x",vfatN,chan,trimARM[idx]);
@@ -382,12 +382,29 @@ void setChannelRegistersVFAT3Local(localArgs * la, uint32_t ohN, uint32_t vfatMa
             }
 
             //Build the channel register
-            LOGGER->log_message(LogManager::INFO, stdsprintf("Setting channel register for VFAT%i chan %i",vfatN,chan));
-            chanRegVal = (calEnable[idx] << 15) + (masks[idx] << 14) + \
-                         (trimZCCPol[idx] << 13) + (trimZCC[idx] << 7) + \
-                         (trimARMPol[idx] << 6) + (trimARM[idx]);
-            writeRawAddress(chanAddr, chanRegVal, la->response);
-            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            chanRegVal[chan] = (calEnable[idx] << 15) + (masks[idx] << 14) + \
+                               (trimZCCPol[idx] << 13) + (trimZCC[idx] << 7) + \
+                               (trimARMPol[idx] << 6) + (trimARM[idx]);
+        } //End Loop over channels
+
+        //Get the addresses
+        const RegArray chanRegs(la, stdsprintf("GEM_AMC.OH.OH%i.GEB.VFAT%i.VFAT_CHANNELS.CHANNEL{}", ohN, vfatN), {128});
+        uint32_t chanAddr[128];
+        RegNode chanNode;
+        for(unsigned int chan=0; chan < 128; ++chan){
+            if (!chanRegs.node(chanNode, chan)) {
+                LOGGER->log_message(LogManager::ERROR, stdsprintf("Key: %s is NOT found", chanRegs.name(chan).c_str()));
+                la->response->set_string("error", "Register not found");
+                return;
+            }
+            chanAddr[chan] = chanNode.address;
+        } //End Loop over channels
+
+        //Write the channel registers, paced by the VFAT slow control: each write takes the memhub semaphore on its own
+        LOGGER->log_message(LogManager::INFO, stdsprintf("Setting channel registers for VFAT%i",vfatN));
+        for(unsigned int chan=0; chan < 128; ++chan){
+            writeRawAddress(chanAddr[chan], chanRegVal[chan], la->response);
+            sleepFor(std::chrono::microseconds(200));
         } //End Loop over channels
     } //End Loop over VFATs
 
@@ -461,17 +478,23 @@ void statusVFAT3sLocal(localArgs * la, uint32_t ohN)
                            "CFG_BIAS_SD_I_BSF",
                            "CFG_BIAS_SD_I_BFCAS",
                            "CFG_RUN"};
-    std::string regName;
+    std::vector<std::string> regNames;
 
     for(unsigned int vfatN = 0; vfatN < oh::VFATS_PER_OH; vfatN++)
     {
         char regBase [100];
         sprintf(regBase, "GEM_AMC.OH.OH%i.GEB.VFAT%i.",ohN, vfatN);
         for (auto &reg : regs) {
-            regName = std::string(regBase)+reg;
-            la->response->set_word(regName,readReg(la,regName));
+            regNames.push_back(std::string(regBase)+reg);
         }
     }
+
+    std::vector<uint32_t> values;
+    uint32_t nTransactions = readRegs(la, regNames, values);
+    for (size_t i = 0; i < regNames.size(); ++i) {
+        la->response->set_word(regNames[i], values[i]);
+    }
+    LOGGER->log_message(LogManager::DEBUG, stdsprintf("statusVFAT3s: %zu registers read in %u transactions", regNames.size(), nTransactions));
 }
 
 void statusVFAT3s(const RPCMsg *request, RPCMsg *response)
@@ -709,10 +732,11 @@ void readDACValues(const RPCMsg *request, RPCMsg *response)
     }
   }
 
+  size_t dacsRead = 0;
   for (auto const& dac : dacNames) {
     LOGGER->log_message(LogManager::INFO, "Reading back DAC "+dac.second);
     configureVFAT3DacMonitorLocal(&la, ohN, vfatMask, dac.first);
-    std::this_thread::sleep_for(std::chrono::seconds(1));
+    sleepFor(std::chrono::seconds(1));
 
     for (size_t vfatN=0; vfatN < oh::VFATS_PER_OH; ++vfatN) {
       if (!((notmask >> vfatN) & 0x1)) {
@@ -725,7 +749,7 @@ void readDACValues(const RPCMsg *request, RPCMsg *response)
       for (size_t c = 0; c < 100; ++c) {
         if (foundAdcCached) {
           readRawAddress(adcCacheUpdateAddr[vfatN], la.response);
-          std::this_thread::sleep_for(std::chrono::microseconds(30));
+          sleepFor(std::chrono::microseconds(30));
         }
         val += readRawAddress(adcAddr[vfatN], la.response);
       }
@@ -734,6 +758,7 @@ void readDACValues(const RPCMsg *request, RPCMsg *response)
       regName << "OH" << ohN << ".VFAT" << vfatN << "." << dac.second;
       la.response->set_word(regName.str(), val);
     }
+    jobProgress(++dacsRead, dacNames.size());
   }
 
   rtxn.abort();
@@ -748,16 +773,19 @@ extern "C" {
             LOGGER->log_message(LogManager::ERROR, "Unable to load module");
             return; // Do not register our functions, we depend on memsvc.
         }
-        modmgr->register_method("vfat3", "configureVFAT3s", configureVFAT3s);
-        modmgr->register_method("vfat3", "configureVFAT3DacMonitor", configureVFAT3DacMonitor);
-        modmgr->register_method("vfat3", "configureVFAT3DacMonitorMultiLink", configureVFAT3DacMonitorMultiLink);
-        modmgr->register_method("vfat3", "getChannelRegistersVFAT3", getChannelRegistersVFAT3);
-        modmgr->register_method("vfat3", "getVFAT3ChipIDs", getVFAT3ChipIDs);
-        modmgr->register_method("vfat3", "readVFAT3ADC", readVFAT3ADC);
-        modmgr->register_method("vfat3", "readDACValues", readDACValues);
-        modmgr->register_method("vfat3", "readVFAT3ADCMultiLink", readVFAT3ADCMultiLink);
-        modmgr->register_method("vfat3", "setChannelRegistersVFAT3", setChannelRegistersVFAT3);
-        modmgr->register_method("vfat3", "statusVFAT3s", statusVFAT3s);
-        modmgr->register_method("vfat3", "vfatSyncCheck", vfatSyncCheck);
+        if (!openAddressTable()) {
+            LOGGER->log_message(LogManager::WARNING, "Address table not available yet, it will be opened on first use");
+        }
+        modmgr->register_method("vfat3", "configureVFAT3s", profiledMethod<configureVFAT3s>);
+        modmgr->register_method("vfat3", "configureVFAT3DacMonitor", profiledMethod<configureVFAT3DacMonitor>);
+        modmgr->register_method("vfat3", "configureVFAT3DacMonitorMultiLink", profiledMethod<configureVFAT3DacMonitorMultiLink>);
+        modmgr->register_method("vfat3", "getChannelRegistersVFAT3", profiledMethod<getChannelRegistersVFAT3>);
+        modmgr->register_method("vfat3", "getVFAT3ChipIDs", profiledMethod<getVFAT3ChipIDs>);
+        modmgr->register_method("vfat3", "readVFAT3ADC", profiledMethod<readVFAT3ADC>);
+        modmgr->register_method("vfat3", "readDACValues", profiledMethod<readDACValues>);
+        modmgr->register_method("vfat3", "readVFAT3ADCMultiLink", profiledMethod<readVFAT3ADCMultiLink>);
+        modmgr->register_method("vfat3", "setChannelRegistersVFAT3", profiledMethod<setChannelRegistersVFAT3>);
+        modmgr->register_method("vfat3", "statusVFAT3s", profiledMethod<statusVFAT3s>);
+        modmgr->register_method("vfat3", "vfatSyncCheck", profiledMethod<vfatSyncCheck>);
     }
 }
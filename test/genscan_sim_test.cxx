@@ -0,0 +1,107 @@
+/*! \file genscan_sim_test.cxx
+ *  \brief Runs a genScan on backplane triggers against memsvc_sim and checks that it completes
+ *
+ *  The scan waits at each DAC step for GEM_AMC.TTC.CMD_COUNTERS.L1A to reach nevts, which only happens when the
+ *  simulated L1As reach the counters (see src/memsvc_sim.cpp). The test checks that the scan ends without error,
+ *  well before the timeout of the trigger wait, and that every unmasked VFAT counted at least nevts events
+ *  at every step. Only built for the off-card (Arch=x86_64) build: on the card it would drive the hardware.
+ *
+ *  Usage: genscan_sim_test [ohN] [nevts] [dacMax]
+ *  GEM_PATH must point to the directory holding address_table.mdb and memsvc_sim.txt.
+ *  The module libraries are loaded from lib/, e.g. LD_LIBRARY_PATH=lib bin/x86_64/genscan_sim_test
+ *  Returns 0 on success, 1 on failure.
+ */
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "calibration_routines.h"
+#include "hw_constants.h"
+#include "utils.h"
+
+// The logger is normally provided by the RPC service
+LogManager::LogManager(std::string /*logpathf*/, LogLevel output_level) : logfd(stderr), output_level(output_level), ledstate(0) {}
+void LogManager::log_message(LogLevel level, std::string message)
+{
+  if (level <= output_level)
+    fprintf(logfd, "%s\n", message.c_str());
+}
+void LogManager::indicate_activity() {}
+void LogManager::push_active_service(std::string /*service*/, int /*activity_color*/) {}
+void LogManager::pop_active_service(std::string /*service*/) {}
+void * LogManager::shm = nullptr;
+LogManager * LOGGER = new LogManager("stderr", LogManager::WARNING);
+
+std::string stdsprintf(const char *fmt, ...)
+{
+  va_list va;
+  va_start(va, fmt);
+  char buf[1024];
+  vsnprintf(buf, sizeof(buf), fmt, va);
+  va_end(va);
+  return buf;
+}
+
+int main(int argc, char *argv[])
+{
+  const uint32_t ohN    = (argc > 1) ? std::strtoul(argv[1], nullptr, 0) : 0;
+  const uint32_t nevts  = (argc > 2) ? std::strtoul(argv[2], nullptr, 0) : 100;
+  const uint32_t dacMax = (argc > 3) ? std::strtoul(argv[3], nullptr, 0) : 7;
+  const uint32_t dacMin = 0, dacStep = 1;
+  if (!std::getenv("GEM_PATH") || nevts == 0) {
+    std::cerr << "Usage: " << argv[0] << " [ohN] [nevts] [dacMax], with GEM_PATH set and nevts positive" << std::endl;
+    return 1;
+  }
+
+  if (memhub_open(&memsvc) != 0) {
+    std::cerr << "Unable to connect to memory service: " << memsvc_get_last_error(memsvc) << std::endl;
+    return 1;
+  }
+  if (!openAddressTable()) {
+    std::cerr << "Unable to open the address table" << std::endl;
+    return 1;
+  }
+
+  RPCMsg response;
+  LocalTxn rtxn;
+  LocalArgs la = {.rtxn = rtxn, .dbi = getAddressTableDbi(), .response = &response};
+  const RegNode * goodEvents = getRegNode(&la, "GEM_AMC.GEM_TESTS.VFAT_DAQ_MONITOR.VFAT0.GOOD_EVENTS_COUNT");
+  if (!goodEvents) {
+    std::cerr << "Register GEM_AMC.GEM_TESTS.VFAT_DAQ_MONITOR.VFAT0.GOOD_EVENTS_COUNT not found" << std::endl;
+    return 1;
+  }
+
+  // The backplane triggers only reach the counters while the TTC generator is disabled
+  writeReg(&la, "GEM_AMC.TTC.GENERATOR.ENABLE", 0x0);
+
+  const uint32_t nDac = (dacMax-dacMin)/dacStep+1;
+  std::vector<uint32_t> outData(oh::VFATS_PER_OH*nDac, 0);
+  const auto start = std::chrono::steady_clock::now();
+  genScanLocal(&la, outData.data(), ohN, 0x0, 0, false, false, 0, nevts, dacMin, dacMax, dacStep, "THR_ARM_DAC", false, true);
+  const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+  if (response.get_key_exists("error")) {
+    std::cerr << "FAIL: genScan error after " << elapsed.count() << " ms: " << response.get_string("error") << std::endl;
+    return 1;
+  }
+  unsigned failed = 0;
+  for (uint32_t vfatN = 0; vfatN < oh::VFATS_PER_OH; ++vfatN) {
+    for (uint32_t point = 0; point < nDac; ++point) {
+      const uint32_t events = applyMask(outData[vfatN*nDac+point], goodEvents->mask);
+      if (events < nevts) {
+        std::cerr << "FAIL: VFAT" << vfatN << " counted " << events << " events for " << nevts
+                  << " at THR_ARM_DAC " << dacMin+point*dacStep << std::endl;
+        ++failed;
+      }
+    }
+  }
+  if (failed)
+    return 1;
+  std::cout << "PASS: " << nDac << " steps of " << nevts << " backplane triggers on OH" << ohN
+            << " in " << elapsed.count() << " ms" << std::endl;
+  return 0;
+}
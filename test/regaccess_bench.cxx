@@ -0,0 +1,296 @@
+/*! \file regaccess_bench.cxx
+ *  \brief Microbenchmarks of the register access primitives of utils and memhub
+ *
+ *  Runs the module code directly, without the RPC service, against the memory service memhub was
+ *  linked with: the CTP7 libmemsvc on the card, memsvc_sim in an off-card (Arch=x86_64) build.
+ *  Each primitive is timed sample by sample and reported with its median, 99th percentile and mean.
+ *
+ *  The address table accesses are measured with four cache states:
+ *   * shm:  the node is looked up in the cache shared by all the processes
+ *   * hot:  the shared cache is not used, the decoded node is in the per-process node cache
+ *   * lmdb: the node caches are cleared before each sample, the node is looked up and decoded from LMDB
+ *   * cold: the address table is also reopened and its pages dropped from the page cache before each sample
+ *
+ *  The FIFO transfers of 1k to 64k words to a single address compare one memhub_read/memhub_write per word,
+ *  as extras.fiforead/fifowrite used to issue, with the memhub_fifo_read/memhub_fifo_write bursts. Their
+ *  number of samples is scaled down with the transfer size.
+ *
+ *  Usage: regaccess_bench [options]
+ *    --samples N   number of samples per measurement (default 1000)
+ *    --reg NAME    read-write single register (default GEM_AMC.TTC.GENERATOR.CYCLIC_L1A_GAP)
+ *    --block NAME  read-write block register (default GEM_AMC.CONFIG_BLASTER.RAM.VFAT)
+ *    --fifo NAME   port register of the FIFO transfers (default: the --reg register)
+ *    --write       also measure writeReg, writeBlock and the FIFO writes, which overwrite the registers above
+ *    --json        JSON output instead of CSV
+ *  GEM_PATH must point to the directory holding address_table.mdb.
+ *  The module libraries are loaded from lib/, e.g. LD_LIBRARY_PATH=lib bin/x86_64/regaccess_bench
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "utils.h"
+#include "utils/regnode_cache.h"
+
+// The logger is normally provided by the RPC service
+LogManager::LogManager(std::string /*logpathf*/, LogLevel output_level) : logfd(stderr), output_level(output_level), ledstate(0) {}
+void LogManager::log_message(LogLevel level, std::string message)
+{
+  if (level <= output_level)
+    fprintf(logfd, "%s\n", message.c_str());
+}
+void LogManager::indicate_activity() {}
+void LogManager::push_active_service(std::string /*service*/, int /*activity_color*/) {}
+void LogManager::pop_active_service(std::string /*service*/) {}
+void * LogManager::shm = nullptr;
+LogManager * LOGGER = new LogManager("stderr", LogManager::WARNING);
+
+std::string stdsprintf(const char *fmt, ...)
+{
+  va_list va;
+  va_start(va, fmt);
+  char buf[1024];
+  vsnprintf(buf, sizeof(buf), fmt, va);
+  va_end(va);
+  return buf;
+}
+
+#ifdef __arm__
+static const char * const BACKEND = "memsvc";
+#else
+static const char * const BACKEND = "memsvc_sim";
+#endif
+
+enum class CacheState { shm, hot, lmdb, cold };
+
+static const char * cacheName(CacheState cache)
+{
+  switch (cache) {
+  case CacheState::shm:  return "shm";
+  case CacheState::hot:  return "hot";
+  case CacheState::lmdb: return "lmdb";
+  case CacheState::cold: return "cold";
+  }
+  return "";
+}
+
+/*! \brief Drops the address table from the node cache and, for the cold state, from memory
+ */
+static void prepareCache(CacheState cache)
+{
+  if (cache == CacheState::shm) {
+    if (!regNodeCacheAttached()) {
+      closeAddressTable(); // attached again when reopened
+      openAddressTable();
+    }
+    return;
+  }
+  if (cache == CacheState::cold) {
+    closeAddressTable();
+    const std::string dataFile = std::string(std::getenv("GEM_PATH"))+"/address_table.mdb/data.mdb";
+    int fd = open(dataFile.c_str(), O_RDONLY);
+    if (fd >= 0) {
+      posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+      close(fd);
+    }
+    openAddressTable();
+  }
+  detachRegNodeCache();
+  if (cache != CacheState::hot)
+    clearRegNodeCache();
+}
+
+struct Result {
+  std::string name;
+  std::string cache;
+  uint32_t batch;
+  std::vector<double> samples;
+};
+
+static std::vector<Result> results;
+static unsigned nSamples = 1000;
+static volatile uint32_t sink;
+
+/*! \brief Times samples calls of op, nSamples by default, after preparing the cache state before each of them
+ */
+template<typename F>
+static void measure(const std::string & name, CacheState cache, uint32_t batch, F op, unsigned samples = 0)
+{
+  if (samples == 0)
+    samples = nSamples;
+  Result result = {name, cacheName(cache), batch, {}};
+  result.samples.reserve(samples);
+  RPCMsg response;
+  for (unsigned i = 0; i < samples + 1; ++i) {
+    prepareCache(cache);
+    LocalTxn rtxn;
+    LocalArgs la = {.rtxn = rtxn, .dbi = getAddressTableDbi(), .response = &response};
+    if (i == 0 && (cache == CacheState::hot || cache == CacheState::shm))
+      op(&la); // warm up the node cache
+    auto start = std::chrono::steady_clock::now();
+    op(&la);
+    auto stop = std::chrono::steady_clock::now();
+    if (i > 0)
+      result.samples.push_back(std::chrono::duration<double, std::nano>(stop-start).count());
+  }
+  if (response.get_key_exists("error"))
+    std::cerr << name << ": " << response.get_string("error") << std::endl;
+  results.push_back(result);
+}
+
+static double percentile(const std::vector<double> & sorted, double p)
+{
+  return sorted[std::min(sorted.size()-1, size_t(p*sorted.size()))];
+}
+
+static void report(bool json)
+{
+  if (json)
+    std::cout << "[" << std::endl;
+  else
+    std::cout << "backend,benchmark,cache,batch,samples,p50_ns,p99_ns,mean_ns" << std::endl;
+  for (size_t i = 0; i < results.size(); ++i) {
+    std::vector<double> sorted = results[i].samples;
+    std::sort(sorted.begin(), sorted.end());
+    double mean = 0;
+    for (auto const& s : sorted)
+      mean += s/sorted.size();
+    const double p50 = percentile(sorted, 0.5);
+    const double p99 = percentile(sorted, 0.99);
+    if (json) {
+      fprintf(stdout, "  {\"backend\": \"%s\", \"benchmark\": \"%s\", \"cache\": \"%s\", \"batch\": %u, \"samples\": %zu, "
+              "\"p50_ns\": %.0f, \"p99_ns\": %.0f, \"mean_ns\": %.0f}%s\n",
+              BACKEND, results[i].name.c_str(), results[i].cache.c_str(), results[i].batch, sorted.size(),
+              p50, p99, mean, (i+1 < results.size()) ? "," : "");
+    } else {
+      fprintf(stdout, "%s,%s,%s,%u,%zu,%.0f,%.0f,%.0f\n",
+              BACKEND, results[i].name.c_str(), results[i].cache.c_str(), results[i].batch, sorted.size(), p50, p99, mean);
+    }
+  }
+  if (json)
+    std::cout << "]" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+  std::string regName   = "GEM_AMC.TTC.GENERATOR.CYCLIC_L1A_GAP";
+  std::string blockName = "GEM_AMC.CONFIG_BLASTER.RAM.VFAT";
+  std::string fifoName;
+  bool write = false;
+  bool json  = false;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--samples" && i+1 < argc)
+      nSamples = std::strtoul(argv[++i], nullptr, 10);
+    else if (arg == "--reg" && i+1 < argc)
+      regName = argv[++i];
+    else if (arg == "--block" && i+1 < argc)
+      blockName = argv[++i];
+    else if (arg == "--fifo" && i+1 < argc)
+      fifoName = argv[++i];
+    else if (arg == "--write")
+      write = true;
+    else if (arg == "--json")
+      json = true;
+    else {
+      std::cerr << "Usage: " << argv[0] << " [--samples N] [--reg NAME] [--block NAME] [--fifo NAME] [--write] [--json]" << std::endl;
+      return 1;
+    }
+  }
+  if (nSamples == 0 || !std::getenv("GEM_PATH")) {
+    std::cerr << "GEM_PATH must be set and the number of samples must be positive" << std::endl;
+    return 1;
+  }
+
+  if (memhub_open(&memsvc) != 0) {
+    std::cerr << "Unable to connect to memory service: " << memsvc_get_last_error(memsvc) << std::endl;
+    return 1;
+  }
+  if (!openAddressTable()) {
+    std::cerr << "Unable to open the address table" << std::endl;
+    return 1;
+  }
+
+  uint32_t blockSize = 0;
+  uint32_t regMask   = 0xFFFFFFFF;
+  {
+    RPCMsg response;
+    LocalTxn rtxn;
+    LocalArgs la = {.rtxn = rtxn, .dbi = getAddressTableDbi(), .response = &response};
+    const RegNode * reg   = getRegNode(&la, regName);
+    const RegNode * block = getRegNode(&la, blockName);
+    if (!reg || !block) {
+      std::cerr << "Register " << (reg ? blockName : regName) << " not found" << std::endl;
+      return 1;
+    }
+    regMask   = reg->mask;
+    blockSize = block->size;
+  }
+
+  // Address table lookups
+  for (auto cache : {CacheState::shm, CacheState::hot, CacheState::lmdb, CacheState::cold}) {
+    measure("regExists", cache, 1, [&](LocalArgs * la) { sink = regExists(la, regName); });
+    measure("getAddress", cache, 1, [&](LocalArgs * la) { sink = getAddress(la, regName); });
+    measure("readReg", cache, 1, [&](LocalArgs * la) { sink = readReg(la, regName); });
+    if (write)
+      measure("writeReg", cache, 1, [&](LocalArgs * la) { writeReg(la, regName, 0x1); });
+  }
+
+  // Pure computation
+  measure("applyMask", CacheState::hot, 1, [&](LocalArgs * /*la*/) { sink = applyMask(0xdeadbeef, regMask); });
+
+  // memhub lock and the memory service underneath
+  uint32_t address;
+  uint32_t fifoAddress;
+  {
+    RPCMsg response;
+    LocalTxn rtxn;
+    LocalArgs la = {.rtxn = rtxn, .dbi = getAddressTableDbi(), .response = &response};
+    address     = getAddress(&la, regName);
+    fifoAddress = getAddress(&la, fifoName.empty() ? regName : fifoName);
+    if (fifoAddress == 0xdeaddead) {
+      std::cerr << "Register " << fifoName << " not found" << std::endl;
+      return 1;
+    }
+  }
+  measure("memhub_lock", CacheState::hot, 1, [&](LocalArgs * /*la*/) { memhub_session_begin(0); memhub_session_end(); });
+  measure("memsvc_read", CacheState::hot, 1, [&](LocalArgs * /*la*/) { uint32_t data; memsvc_read(memsvc, address, 1, &data); sink = data; });
+  measure("memhub_read", CacheState::hot, 1, [&](LocalArgs * /*la*/) { uint32_t data; memhub_read(memsvc, address, 1, &data); sink = data; });
+
+  // Block transfers of increasing size
+  std::vector<uint32_t> buffer(blockSize, 0);
+  for (uint32_t batch = 1; batch <= blockSize; batch *= 4) {
+    measure("readBlock", CacheState::hot, batch, [&](LocalArgs * la) { sink = readBlock(la, blockName, buffer.data(), batch); });
+    if (write)
+      measure("writeBlock", CacheState::hot, batch, [&](LocalArgs * la) { writeBlock(la, blockName, buffer.data(), batch); });
+  }
+
+  // FIFO transfers, word by word and in bursts
+  std::vector<uint32_t> fifo(65536, 0);
+  for (uint32_t batch = 1024; batch <= fifo.size(); batch *= 4) {
+    const unsigned samples = std::max(10u, unsigned(uint64_t(nSamples)*64/batch));
+    measure("fifo_read_words", CacheState::hot, batch, [&](LocalArgs * /*la*/) {
+        for (uint32_t i = 0; i < batch; ++i)
+          memhub_read(memsvc, fifoAddress, 1, &fifo[i]);
+      }, samples);
+    measure("memhub_fifo_read", CacheState::hot, batch, [&](LocalArgs * /*la*/) { memhub_fifo_read(memsvc, fifoAddress, batch, fifo.data()); }, samples);
+    if (write) {
+      measure("fifo_write_words", CacheState::hot, batch, [&](LocalArgs * /*la*/) {
+          for (uint32_t i = 0; i < batch; ++i)
+            memhub_write(memsvc, fifoAddress, 1, &fifo[i]);
+        }, samples);
+      measure("memhub_fifo_write", CacheState::hot, batch, [&](LocalArgs * /*la*/) { memhub_fifo_write(memsvc, fifoAddress, batch, fifo.data()); }, samples);
+    }
+  }
+
+  report(json);
+  return 0;
+}
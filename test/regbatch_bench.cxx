@@ -0,0 +1,165 @@
+/*! \file regbatch_bench.cxx
+ *  \brief Bus transaction count of the batched register reads
+ *
+ *  For the register lists read by statusVFAT3s, statusOH, getmonOHmain and
+ *  getmonCTP7dump, compares the number of memhub_read transactions issued
+ *  with one readReg per register against the number issued by readRegs,
+ *  which reads each word once and merges adjacent words into block reads.
+ *
+ *  Usage: regbatch_bench [address_table.mdb directory] [mon_registers.txt]
+ *  The directory defaults to $GEM_PATH/address_table.mdb
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "lmdb_cpp_wrapper.h"
+#include "reg_node.h"
+
+static const uint32_t VFATS_PER_OH    = 24;
+static const uint32_t OH_PER_AMC      = 12;
+
+static std::string format(const char * fmt, uint32_t n)
+{
+  char buf[256];
+  snprintf(buf, sizeof(buf), fmt, n);
+  return buf;
+}
+
+static void report(lmdb::txn& rtxn, lmdb::dbi& dbi, uint32_t fmt, const std::string& name, const std::vector<std::string>& regNames)
+{
+  std::vector<uint32_t> addresses;
+  uint32_t nFound = 0;
+  for (auto const& regName : regNames) {
+    lmdb::val key, db_res;
+    key.assign(regName.c_str());
+    RegNode node;
+    if (dbi.get(rtxn, key, db_res) && decodeRegNode(fmt, db_res.data(), db_res.size(), node) && node.readable()) {
+      ++nFound;
+      addresses.push_back(node.address);
+    }
+  }
+  std::sort(addresses.begin(), addresses.end());
+  addresses.erase(std::unique(addresses.begin(), addresses.end()), addresses.end());
+  const size_t nRuns = coalesceAddresses(addresses, BATCH_MAX_WORDS).size();
+
+  std::cout << std::left << std::setw(16) << name << std::right
+            << std::setw(10) << regNames.size()
+            << std::setw(10) << nFound
+            << std::setw(10) << addresses.size()
+            << std::setw(10) << nRuns
+            << std::setw(10) << std::fixed << std::setprecision(1) << (nRuns ? double(nFound)/nRuns : 0.)
+            << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+  std::string db_path;
+  if (argc > 1) {
+    db_path = argv[1];
+  } else if (std::getenv("GEM_PATH")) {
+    db_path = std::string(std::getenv("GEM_PATH"))+"/address_table.mdb";
+  } else {
+    std::cerr << "Usage: " << argv[0] << " [address_table.mdb directory] [mon_registers.txt]" << std::endl;
+    return 1;
+  }
+  const std::string mon_file = (argc > 2) ? argv[2] : "/mnt/persistent/gemdaq/mon_registers.txt";
+
+  auto env = lmdb::env::create();
+  env.set_mapsize(1UL * 1024UL * 1024UL * 50UL);
+  env.open(db_path.c_str(), MDB_RDONLY | MDB_NOLOCK, 0664);
+  auto rtxn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+  auto dbi  = lmdb::dbi::open(rtxn, nullptr);
+
+  uint32_t fmt = REG_FORMAT_TEXT;
+  {
+    lmdb::val key, value;
+    key.assign(REG_FORMAT_KEY);
+    if (dbi.get(rtxn, key, value) && value.size() == sizeof(uint32_t))
+      fmt = loadLE32(reinterpret_cast<const uint8_t*>(value.data()));
+  }
+
+  std::cout << std::left << std::setw(16) << "list" << std::right
+            << std::setw(10) << "regs" << std::setw(10) << "readReg"
+            << std::setw(10) << "words" << std::setw(10) << "readRegs"
+            << std::setw(10) << "gain" << std::endl;
+
+  // statusVFAT3s, on OH0
+  {
+    static const char * const regs[] = {"CFG_PULSE_STRETCH", "CFG_SYNC_LEVEL_MODE", "CFG_FP_FE", "CFG_RES_PRE", "CFG_CAP_PRE",
+                                        "CFG_PT", "CFG_SEL_POL", "CFG_FORCE_EN_ZCC", "CFG_SEL_COMP_MODE", "CFG_VREF_ADC",
+                                        "CFG_IREF", "CFG_THR_ARM_DAC", "CFG_LATENCY", "CFG_CAL_SEL_POL", "CFG_CAL_DAC",
+                                        "CFG_CAL_MODE", "CFG_BIAS_CFD_DAC_2", "CFG_BIAS_CFD_DAC_1", "CFG_BIAS_PRE_I_BSF",
+                                        "CFG_BIAS_PRE_I_BIT", "CFG_BIAS_PRE_I_BLCC", "CFG_BIAS_PRE_VREF", "CFG_BIAS_SH_I_BFCAS",
+                                        "CFG_BIAS_SH_I_BDIFF", "CFG_BIAS_SH_I_BFAMP", "CFG_BIAS_SD_I_BDIFF", "CFG_BIAS_SD_I_BSF",
+                                        "CFG_BIAS_SD_I_BFCAS", "CFG_RUN"};
+    std::vector<std::string> regNames;
+    for (uint32_t vfatN = 0; vfatN < VFATS_PER_OH; ++vfatN)
+      for (auto const& reg : regs)
+        regNames.push_back(format("GEM_AMC.OH.OH0.GEB.VFAT%u.", vfatN)+reg);
+    report(rtxn, dbi, fmt, "statusVFAT3s", regNames);
+  }
+
+  // statusOH, on all the OptoHybrids
+  {
+    static const char * const regs[] = {"TRIG.CTRL.SBIT_SOT_READY", "TRIG.CTRL.SBIT_SOT_UNSTABLE", "GBT.TX.TX_READY",
+                                        "GBT.RX.RX_READY", "GBT.RX.RX_VALID", "GBT.RX.CNT_LINK_ERR", "ADC.CTRL.CNT_OVERTEMP",
+                                        "ADC.CTRL.CNT_VCCAUX_ALARM", "ADC.CTRL.CNT_VCCINT_ALARM", "CONTROL.RELEASE.DATE",
+                                        "CONTROL.RELEASE.VERSION.MAJOR", "CONTROL.RELEASE.VERSION.MINOR",
+                                        "CONTROL.RELEASE.VERSION.BUILD", "CONTROL.RELEASE.VERSION.GENERATION",
+                                        "CONTROL.SEM.CNT_SEM_CRITICAL", "CONTROL.SEM.CNT_SEM_CORRECTION", "TRIG.CTRL.SOT_INVERT",
+                                        "GBT.TX.CNT_RESPONSE_SENT", "GBT.RX.CNT_REQUEST_RECEIVED",
+                                        "CLOCKING.CLOCKING.GBT_MMCM_LOCKED", "CLOCKING.CLOCKING.LOGIC_MMCM_LOCKED",
+                                        "CLOCKING.CLOCKING.GBT_MMCM_UNLOCKED_CNT", "CLOCKING.CLOCKING.LOGIC_MMCM_UNLOCKED_CNT"};
+    std::vector<std::string> regNames;
+    for (uint32_t ohN = 0; ohN < OH_PER_AMC; ++ohN)
+      for (auto const& reg : regs)
+        regNames.push_back(format("GEM_AMC.OH.OH%u.", ohN)+reg);
+    report(rtxn, dbi, fmt, "statusOH", regNames);
+  }
+
+  // getmonOHmain, on all the OptoHybrids
+  {
+    static const char * const regs[] = {"GEM_AMC.OH.OH%u.FPGA.CONTROL.RELEASE.VERSION.MAJOR",
+                                        "GEM_AMC.OH.OH%u.FPGA.CONTROL.RELEASE.VERSION.MINOR",
+                                        "GEM_AMC.OH.OH%u.FPGA.CONTROL.RELEASE.VERSION.BUILD",
+                                        "GEM_AMC.OH.OH%u.FPGA.CONTROL.RELEASE.VERSION.GENERATION",
+                                        "GEM_AMC.DAQ.OH%u.COUNTERS.EVN", "GEM_AMC.DAQ.OH%u.COUNTERS.EVT_RATE",
+                                        "GEM_AMC.OH.OH%u.COUNTERS.GTX_LINK.TRK_ERR", "GEM_AMC.OH.OH%u.COUNTERS.GTX_LINK.TRG_ERR",
+                                        "GEM_AMC.OH.OH%u.COUNTERS.GBT_LINK.TRK_ERR", "GEM_AMC.DAQ.OH%u.COUNTERS.CORRUPT_VFAT_BLK_CNT",
+                                        "GEM_AMC.OH.OH%u.COUNTERS.SEU", "GEM_AMC.OH.OH%u.STATUS.SEU"};
+    std::vector<std::string> regNames;
+    for (uint32_t ohN = 0; ohN < OH_PER_AMC; ++ohN)
+      for (auto const& reg : regs)
+        regNames.push_back(format(reg, ohN));
+    report(rtxn, dbi, fmt, "getmonOHmain", regNames);
+  }
+
+  // getmonCTP7dump, from the same register file
+  std::ifstream ifs(mon_file);
+  if (ifs) {
+    std::vector<std::string> regNames;
+    std::string line;
+    while (std::getline(ifs, line)) {
+      // format0x658030f8 r    GEM_AMC.OH_LINKS.OH11.VFAT23.DAQ_CRC_ERROR_CNT          0x00000000
+      std::replace(line.begin(), line.end(), '\t', ' ');
+      std::stringstream ss(line);
+      std::string address, perm, regName;
+      if (ss >> address >> perm >> regName)
+        regNames.push_back(regName);
+    }
+    report(rtxn, dbi, fmt, "getmonCTP7dump", regNames);
+  } else {
+    std::cout << "getmonCTP7dump: " << mon_file << " not found, skipped" << std::endl;
+  }
+
+  rtxn.abort();
+  return 0;
+}
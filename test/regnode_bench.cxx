@@ -0,0 +1,132 @@
+/*! \file regnode_bench.cxx
+ *  \brief Microbenchmark of the address table node decoding
+ *
+ *  Measures the per-access overhead of resolving a register name into its
+ *  address/mask/size, comparing:
+ *   * the legacy path: LMDB lookup, copy into a std::string, split on '|' and stoull (text tables only)
+ *   * the in-place path: LMDB lookup and decodeRegNode on the LMDB value (text or binary records)
+ *   * the cached path: lookup in the per-process map of decoded nodes (as done by getRegNode)
+ *
+ *  Usage: regnode_bench [address_table.mdb directory] [iterations]
+ *  The directory defaults to $GEM_PATH/address_table.mdb
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "lmdb_cpp_wrapper.h"
+#include "reg_node.h"
+
+static std::vector<std::string> split(const std::string &s, char delim)
+{
+  std::vector<std::string> elems;
+  std::stringstream ss(s);
+  std::string item;
+  while (std::getline(ss, item, delim))
+    elems.push_back(item);
+  return elems;
+}
+
+static volatile uint32_t sink;
+
+template<typename F>
+static double timeLoop(const std::vector<std::string>& names, unsigned iterations, F f)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < iterations; ++i)
+    for (auto const& name : names)
+      f(name);
+  auto stop = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(stop-start).count()/(double(iterations)*names.size());
+}
+
+int main(int argc, char *argv[])
+{
+  std::string db_path;
+  if (argc > 1) {
+    db_path = argv[1];
+  } else if (std::getenv("GEM_PATH")) {
+    db_path = std::string(std::getenv("GEM_PATH"))+"/address_table.mdb";
+  } else {
+    std::cerr << "Usage: " << argv[0] << " [address_table.mdb directory] [iterations]" << std::endl;
+    return 1;
+  }
+  const unsigned iterations = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 10;
+
+  auto env = lmdb::env::create();
+  env.set_mapsize(1UL * 1024UL * 1024UL * 50UL);
+  env.open(db_path.c_str(), MDB_RDONLY, 0664);
+  auto rtxn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+  auto dbi  = lmdb::dbi::open(rtxn, nullptr);
+
+  uint32_t format = REG_FORMAT_TEXT;
+  {
+    lmdb::val key, value;
+    key.assign(REG_FORMAT_KEY);
+    if (dbi.get(rtxn, key, value) && value.size() == sizeof(uint32_t))
+      format = loadLE32(reinterpret_cast<const uint8_t*>(value.data()));
+  }
+
+  std::vector<std::string> names;
+  {
+    auto cursor = lmdb::cursor::open(rtxn, dbi);
+    std::string key, value;
+    while (cursor.get(key, value, MDB_NEXT))
+      if (key != REG_FORMAT_KEY)
+        names.push_back(key);
+  }
+  if (names.empty()) {
+    std::cerr << "No registers found in " << db_path << std::endl;
+    return 1;
+  }
+
+  double legacy = -1;
+  if (format == REG_FORMAT_TEXT)
+    legacy = timeLoop(names, iterations, [&](const std::string& name) {
+      lmdb::val key, db_res;
+      key.assign(name.c_str());
+      dbi.get(rtxn, key, db_res);
+      std::string t_db_res = std::string(db_res.data());
+      t_db_res = t_db_res.substr(0,db_res.size());
+      std::vector<std::string> tmp = split(t_db_res,'|');
+      sink = stoull(tmp[0], nullptr, 16) ^ stoull(tmp[2], nullptr, 16) ^ stoull(tmp[4], nullptr, 16);
+    });
+
+  double inplace = timeLoop(names, iterations, [&](const std::string& name) {
+      lmdb::val key, db_res;
+      key.assign(name.c_str());
+      dbi.get(rtxn, key, db_res);
+      RegNode node;
+      decodeRegNode(format, db_res.data(), db_res.size(), node);
+      sink = node.address ^ node.mask ^ node.size;
+    });
+
+  std::unordered_map<std::string, RegNode> cache;
+  for (auto const& name : names) {
+    lmdb::val key, db_res;
+    key.assign(name.c_str());
+    dbi.get(rtxn, key, db_res);
+    decodeRegNode(format, db_res.data(), db_res.size(), cache[name]);
+  }
+  double cached = timeLoop(names, iterations, [&](const std::string& name) {
+      const RegNode& node = cache.find(name)->second;
+      sink = node.address ^ node.mask ^ node.size;
+    });
+
+  rtxn.abort();
+
+  std::cout << "Registers:  " << names.size() << ", iterations: " << iterations
+            << ", format version: " << format << std::endl
+            << std::fixed << std::setprecision(1);
+  if (legacy >= 0)
+    std::cout << "legacy   (split + stoull):   " << std::setw(8) << legacy  << " ns/access" << std::endl;
+  std::cout << "in-place (decodeRegNode):    " << std::setw(8) << inplace << " ns/access" << std::endl
+            << "cached   (decoded RegNode):  " << std::setw(8) << cached  << " ns/access" << std::endl;
+  return 0;
+}
@@ -0,0 +1,161 @@
+/*! \file scurve_fit_bench.cxx
+ *  \brief Accuracy and throughput of the S-curve fits of scurve_fit.h
+ *
+ *  Generates S-curves of known mean and sigma, sampling binomially the hits of each point, as genChannelScan
+ *  measures them for the 3072 channels of an OptoHybrid. They are fitted with fitSCurves and with a scalar
+ *  double precision reference using std::erfc, and the time per curve and the residuals to the true mean and
+ *  sigma of both are reported, along with the fraction of fits flagged bad.
+ *
+ *  Usage: scurve_fit_bench [curves] [points] [events] [iterations]
+ *  The defaults are 3072 curves of 256 points of 100 events, fitted 10 times.
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "scurve_fit.h"
+
+/*! \brief Same fit as fitSCurves, one curve at a time in double precision with the standard library functions
+ */
+static SCurveFit referenceFit(const std::vector<float>& x, const uint32_t* k, const uint32_t* n)
+{
+  const size_t np = x.size();
+  const double range = x[np-1] - x[0];
+  const double sMin = 0.5*range/std::max<size_t>(1, np-1), sMax = std::max(range, sMin);
+  double sumD = 0, sumXD = 0, sumVar = 0;
+  unsigned valid = 0;
+  for (size_t p = 0; p < np; ++p)
+    valid += n[p] > 0;
+  auto diff = [&](size_t p) { return (n[p] && n[p+1]) ? double(k[p+1])/n[p+1] - double(k[p])/n[p] : 0.; };
+  for (size_t p = 0; p+1 < np; ++p) {
+    sumD  += diff(p);
+    sumXD += 0.5*(x[p]+x[p+1])*diff(p);
+  }
+  double mu = (std::fabs(sumD) >= SCURVE_FIT_MIN_RISE) ? sumXD/sumD : x[0] + 0.5*range;
+  mu = std::min<double>(std::max<double>(mu, x[0]), x[np-1]);
+  for (size_t p = 0; p+1 < np; ++p) {
+    const double xm = 0.5*(x[p]+x[p+1]);
+    sumVar += (xm-mu)*(xm-mu)*diff(p);
+  }
+  const double sign = (sumD < 0) ? -1 : 1;
+  double s = sign*std::min(std::max(std::sqrt(std::max(sumD != 0 ? sumVar/sumD : 0., 0.)), sMin), sMax);
+  auto cdf = [](double z) { return 0.5*std::erfc(-z/std::sqrt(2.)); };
+
+  for (unsigned it = 0; it < SCURVE_FIT_ITERATIONS; ++it) {
+    double a00 = 0, a01 = 0, a11 = 0, g0 = 0, g1 = 0;
+    for (size_t p = 0; p < np; ++p) {
+      if (!n[p])
+        continue;
+      const double z = (x[p]-mu)/s, c = cdf(z), pdf = std::exp(-0.5*z*z)/std::sqrt(2*M_PI);
+      const double w = n[p]/(c*(1-c) + 1./n[p]), r = double(k[p])/n[p] - c;
+      const double jm = -pdf/s, js = jm*z;
+      a00 += w*jm*jm; a01 += w*jm*js; a11 += w*js*js; g0 += w*jm*r; g1 += w*js*r;
+    }
+    const double d00 = a00*1.001 + 1e-12, d11 = a11*1.001 + 1e-12, det = d00*d11 - a01*a01;
+    const double dm = (d11*g0 - a01*g1)/det, ds = (d00*g1 - a01*g0)/det;
+    mu = std::min(std::max(mu + std::min(std::max(dm, -0.5*range), 0.5*range), x[0] - range), x[np-1] + range);
+    s  = sign*std::min(std::max(sign*(s + ds), sMin), sMax);
+  }
+
+  double chi2 = 0;
+  for (size_t p = 0; p < np; ++p) {
+    if (!n[p])
+      continue;
+    const double c = cdf((x[p]-mu)/s), r = k[p] - n[p]*c;
+    chi2 += r*r/std::max(n[p]*c*(1-c), 1.);
+  }
+  uint32_t flags = 0;
+  if (s < 0) flags |= SCURVE_FIT_FALLING;
+  if (valid < 3) flags |= SCURVE_FIT_FEW_POINTS;
+  if (std::fabs(sumD) < SCURVE_FIT_MIN_RISE) flags |= SCURVE_FIT_NO_TRANSITION;
+  if (!(mu >= x[0] && mu <= x[np-1])) flags |= SCURVE_FIT_OUT_OF_RANGE;
+  if (!(std::fabs(s) > sMin && std::fabs(s) < sMax)) flags |= SCURVE_FIT_BAD_SIGMA;
+  if (valid > 2 && chi2 > SCURVE_FIT_MAX_CHI2*(valid-2)) flags |= SCURVE_FIT_HIGH_CHI2;
+  return SCurveFit{float(mu), float(std::fabs(s)), float(chi2), valid > 2 ? valid-2 : 0, flags};
+}
+
+struct Residuals {
+  double mean = 0, sigma = 0;
+  unsigned bad = 0;
+};
+
+static Residuals residuals(const std::vector<SCurveFit>& fits, const std::vector<double>& mu, const std::vector<double>& sigma)
+{
+  Residuals res;
+  unsigned good = 0;
+  for (size_t c = 0; c < fits.size(); ++c) {
+    if (fits[c].flags & SCURVE_FIT_BAD) {
+      ++res.bad;
+      continue;
+    }
+    res.mean  += std::fabs(fits[c].mean - mu[c]);
+    res.sigma += std::fabs(fits[c].sigma - sigma[c]);
+    ++good;
+  }
+  if (good) {
+    res.mean  /= good;
+    res.sigma /= good;
+  }
+  return res;
+}
+
+int main(int argc, char *argv[])
+{
+  const unsigned curves     = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 3072;
+  const unsigned points     = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 256;
+  const unsigned events     = (argc > 3) ? std::strtoul(argv[3], nullptr, 10) : 100;
+  const unsigned iterations = (argc > 4) ? std::strtoul(argv[4], nullptr, 10) : 10;
+  if (curves == 0 || points < 3 || events == 0 || iterations == 0) {
+    std::cerr << "Usage: " << argv[0] << " [curves] [points] [events] [iterations]" << std::endl;
+    return 1;
+  }
+
+  // Means spread over the middle of the scan, sigmas of one to a few DAC units, one curve in four falling
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<double> meanDist(0.25*points, 0.75*points), sigmaDist(1., 0.02*points + 2.);
+  std::vector<float> x(points);
+  for (unsigned p = 0; p < points; ++p)
+    x[p] = p;
+  std::vector<double> mu(curves), sigma(curves);
+  std::vector<uint32_t> hits(curves*points), nevts(curves*points, events);
+  for (unsigned c = 0; c < curves; ++c) {
+    mu[c] = meanDist(gen);
+    sigma[c] = sigmaDist(gen);
+    const double dir = (c % 4 == 3) ? -1 : 1;
+    for (unsigned p = 0; p < points; ++p) {
+      std::binomial_distribution<uint32_t> hitDist(events, 0.5*std::erfc(-dir*(p - mu[c])/(sigma[c]*std::sqrt(2.))));
+      hits[c*points+p] = hitDist(gen);
+    }
+  }
+
+  std::vector<SCurveFit> fits(curves), refFits(curves);
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < iterations; ++i)
+    fitSCurves(x.data(), points, hits.data(), nevts.data(), curves, fits.data());
+  const double kernel = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count()/(double(iterations)*curves);
+
+  start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < iterations; ++i)
+    for (unsigned c = 0; c < curves; ++c)
+      refFits[c] = referenceFit(x, &hits[c*points], &nevts[c*points]);
+  const double reference = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count()/(double(iterations)*curves);
+
+  const Residuals kernelRes = residuals(fits, mu, sigma), refRes = residuals(refFits, mu, sigma);
+  double agreement = 0;
+  for (unsigned c = 0; c < curves; ++c)
+    agreement = std::max<double>(agreement, std::fabs(fits[c].mean - refFits[c].mean));
+
+  std::cout << "Curves: " << curves << ", points: " << points << ", events: " << events << ", iterations: " << iterations << std::endl
+            << std::fixed << std::setprecision(3)
+            << "fitSCurves: " << std::setw(9) << kernel    << " us/curve, |mean error| " << kernelRes.mean
+            << ", |sigma error| " << kernelRes.sigma << ", bad " << kernelRes.bad << std::endl
+            << "reference:  " << std::setw(9) << reference << " us/curve, |mean error| " << refRes.mean
+            << ", |sigma error| " << refRes.sigma << ", bad " << refRes.bad << std::endl
+            << "largest mean difference: " << agreement << std::endl;
+  return 0;
+}